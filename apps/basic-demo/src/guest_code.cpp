@@ -0,0 +1,364 @@
+/*
+Defines the function that writes the basic demo's guest code to ROM and RAM.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "guest_code.hpp"
+
+#include <cstring>
+
+void writeGuestCode(uint8_t *rom, uint8_t *ram, const GuestCodeOptions& options) noexcept {
+    // Fill ROM with HLT instructions
+    memset(rom, 0xf4, 0x10000);
+
+    // Write initialization code to ROM and a simple program to RAM
+    uint32_t addr;
+#define emit(buf, code) {memcpy(&buf[addr], code, sizeof(code) - 1); addr += sizeof(code) - 1;}
+
+    // --- Start of ROM code ----------------------------------------------------------------------------------------------
+
+    // --- GDT and IDT tables ---------------------------------------------------------------------------------------------
+
+    // GDT table
+    addr = 0x0000;
+    emit(rom, "\x00\x00\x00\x00\x00\x00\x00\x00"); // [0x0000] GDT entry 0: null
+    emit(rom, "\xff\xff\x00\x00\x00\x9b\xcf\x00"); // [0x0008] GDT entry 1: code (full access to 4 GB linear space)
+    emit(rom, "\xff\xff\x00\x00\x00\x93\xcf\x00"); // [0x0010] GDT entry 2: data (full access to 4 GB linear space)
+
+    // IDT table (system)
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x0018] Vector 0x00: Divide by zero
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x0020] Vector 0x01: Reserved
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x0028] Vector 0x02: Non-maskable interrupt
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x0030] Vector 0x03: Breakpoint (INT3)
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x0038] Vector 0x04: Overflow (INTO)
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x0040] Vector 0x05: Bounds range exceeded (BOUND)
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x0048] Vector 0x06: Invalid opcode (UD2)
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x0050] Vector 0x07: Device not available (WAIT/FWAIT)
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x0058] Vector 0x08: Double fault
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x0060] Vector 0x09: Coprocessor segment overrun
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x0068] Vector 0x0A: Invalid TSS
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x0070] Vector 0x0B: Segment not present
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x0078] Vector 0x0C: Stack-segment fault
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x0080] Vector 0x0D: General protection fault
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x0088] Vector 0x0E: Page fault
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x0090] Vector 0x0F: Reserved
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x0098] Vector 0x10: x87 FPU error
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x00a0] Vector 0x11: Alignment check
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x00a8] Vector 0x12: Machine check
+    emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x00b0] Vector 0x13: SIMD Floating-Point Exception
+    for (uint8_t i = 0x14; i <= 0x1f; i++) {
+        emit(rom, "\x05\x10\x08\x00\x00\x8f\x00\x10"); // [0x00b8..0x0110] Vector 0x14..0x1F: Reserved
+    }
+
+    // IDT table (user defined)
+    emit(rom, "\x00\x10\x08\x00\x00\x8f\x00\x10"); // [0x0118] Vector 0x20: Just IRET
+    emit(rom, "\x02\x10\x08\x00\x00\x8f\x00\x10"); // [0x0120] Vector 0x21: HLT, then IRET
+    emit(rom, "\x0a\x10\x08\x00\x00\x8e\x00\x10"); // [0x0128] Vector 0x22: Timer tick acknowledge, then IRET
+
+    // --- 32-bit protected mode ------------------------------------------------------------------------------------------
+
+    // Prepare memory for paging
+    // (based on https://github.com/unicorn-engine/unicorn/blob/master/tests/unit/test_x86_soft_paging.c)
+    // 0x1000 = Page directory
+    // 0x2000 = Page table (identity map RAM: 0x000xxxxx)
+    // 0x3000 = Page table (identity map ROM: 0xffffxxxx)
+    // 0x4000 = Page table (0x10000xxx .. 0x10001xxx -> 0x00005xxx .. 0x00006xxx)
+    // 0x5000 = Data area (first dword reads 0xdeadbeef)
+    // 0x6000 = Interrupt handler code area
+    // 0xe000 = Page table (identity map first page of MMIO: 0xe00000xxx)
+
+    // Load segment registers
+    addr = 0xff00;
+    if (options.manualPaging) {
+        emit(rom, "\xf4");                         // [0xff00] hlt
+        emit(rom, "\x90");                         // [0xff01] nop
+    }
+    else {
+        emit(rom, "\x33\xc0");                     // [0xff00] xor    eax, eax
+    }
+    emit(rom, "\xb0\x10");                         // [0xff02] mov     al, 0x10
+    emit(rom, "\x8e\xd8");                         // [0xff04] mov     ds, eax
+    emit(rom, "\x8e\xc0");                         // [0xff06] mov     es, eax
+    emit(rom, "\x8e\xd0");                         // [0xff08] mov     ss, eax
+
+    // Clear page directory
+    emit(rom, "\xbf\x00\x10\x00\x00");             // [0xff0a] mov    edi, 0x1000
+    emit(rom, "\xb9\x00\x10\x00\x00");             // [0xff0f] mov    ecx, 0x1000
+    emit(rom, "\x31\xc0");                         // [0xff14] xor    eax, eax
+    emit(rom, "\xf3\xab");                         // [0xff16] rep    stosd
+
+    // Write 0xdeadbeef at physical memory address 0x5000
+    emit(rom, "\xbf\x00\x50\x00\x00");             // [0xff18] mov    edi, 0x5000
+    emit(rom, "\xb8\xef\xbe\xad\xde");             // [0xff1d] mov    eax, 0xdeadbeef
+    emit(rom, "\x89\x07");                         // [0xff22] mov    [edi], eax
+
+    // Identity map the RAM to 0x00000000
+    emit(rom, "\xb9\x00\x01\x00\x00");             // [0xff24] mov    ecx, 0x100
+    emit(rom, "\xbf\x00\x20\x00\x00");             // [0xff29] mov    edi, 0x2000
+    emit(rom, "\xb8\x03\x00\x00\x00");             // [0xff2e] mov    eax, 0x0003
+    //                                             // aLoop:
+    emit(rom, "\xab");                             // [0xff33] stosd
+    emit(rom, "\x05\x00\x10\x00\x00");             // [0xff34] add    eax, 0x1000
+    emit(rom, "\xe2\xf8");                         // [0xff39] loop   aLoop
+
+    // Identity map the ROM
+    emit(rom, "\xb9\x10\x00\x00\x00");             // [0xff3b] mov    ecx, 0x10
+    emit(rom, "\xbf\xc0\x3f\x00\x00");             // [0xff40] mov    edi, 0x3fc0
+    emit(rom, "\xb8\x03\x00\xff\xff");             // [0xff45] mov    eax, 0xffff0003
+    //                                             // bLoop:
+    emit(rom, "\xab");                             // [0xff4a] stosd
+    emit(rom, "\x05\x00\x10\x00\x00");             // [0xff4b] add    eax, 0x1000
+    emit(rom, "\xe2\xf8");                         // [0xff50] loop   bLoop
+
+    // Map physical address 0x5000 to virtual address 0x10000000
+    emit(rom, "\xbf\x00\x40\x00\x00");             // [0xff52] mov    edi, 0x4000
+    emit(rom, "\xb8\x03\x50\x00\x00");             // [0xff57] mov    eax, 0x5003
+    emit(rom, "\x89\x07");                         // [0xff5c] mov    [edi], eax
+
+    // Map physical address 0x6000 to virtual address 0x10001000
+    emit(rom, "\xbf\x04\x40\x00\x00");             // [0xff5e] mov    edi, 0x4004
+    emit(rom, "\xb8\x03\x60\x00\x00");             // [0xff63] mov    eax, 0x6003
+    emit(rom, "\x89\x07");                         // [0xff68] mov    [edi], eax
+
+    // Map physical address 0xe0000000 to virtual address 0xe0000000 (for MMIO)
+    emit(rom, "\xbf\x00\xe0\x00\x00");             // [0xff6a] mov    edi, 0xe000
+    emit(rom, "\xb8\x03\x00\x00\xe0");             // [0xff6f] mov    eax, 0xe0000003
+    emit(rom, "\x89\x07");                         // [0xff74] mov    [edi], eax
+
+    // Add page tables into page directory
+    emit(rom, "\xbf\x00\x10\x00\x00");             // [0xff76] mov    edi, 0x1000
+    emit(rom, "\xb8\x03\x20\x00\x00");             // [0xff7b] mov    eax, 0x2003
+    emit(rom, "\x89\x07");                         // [0xff80] mov    [edi], eax
+    emit(rom, "\xbf\xfc\x1f\x00\x00");             // [0xff82] mov    edi, 0x1ffc
+    emit(rom, "\xb8\x03\x30\x00\x00");             // [0xff87] mov    eax, 0x3003
+    emit(rom, "\x89\x07");                         // [0xff8c] mov    [edi], eax
+    emit(rom, "\xbf\x00\x11\x00\x00");             // [0xff8e] mov    edi, 0x1100
+    emit(rom, "\xb8\x03\x40\x00\x00");             // [0xff93] mov    eax, 0x4003
+    emit(rom, "\x89\x07");                         // [0xff98] mov    [edi], eax
+    emit(rom, "\xbf\x00\x1e\x00\x00");             // [0xff9a] mov    edi, 0x1e00
+    emit(rom, "\xb8\x03\xe0\x00\x00");             // [0xff9f] mov    eax, 0xe003
+    emit(rom, "\x89\x07");                         // [0xffa4] mov    [edi], eax
+
+    // Load the page directory register
+    emit(rom, "\xb8\x00\x10\x00\x00");             // [0xffa6] mov    eax, 0x1000
+    emit(rom, "\x0f\x22\xd8");                     // [0xffab] mov    cr3, eax
+
+    // Enable paging
+    emit(rom, "\x0f\x20\xc0");                     // [0xffae] mov    eax, cr0
+    emit(rom, "\x0d\x00\x00\x00\x80");             // [0xffb1] or     eax, 0x80000000
+    emit(rom, "\x0f\x22\xc0");                     // [0xffb6] mov    cr0, eax
+
+    // Clear EAX
+    emit(rom, "\x31\xc0");                         // [0xffb9] xor    eax, eax
+
+    // Load using virtual memory address; EAX = 0xdeadbeef
+    emit(rom, "\xbe\x00\x00\x00\x10");             // [0xffbb] mov    esi, 0x10000000
+    emit(rom, "\x8b\x06");                         // [0xffc0] mov    eax, [esi]
+
+    // First stop
+    emit(rom, "\xf4");                             // [0xffc2] hlt
+
+    // Jump to RAM
+    emit(rom, "\xe9\x3c\x00\x00\x10");             // [0xffc3] jmp    0x10000004
+    // .. ends at 0xffc7
+
+    // --- 16-bit real mode transition to 32-bit protected mode -----------------------------------------------------------
+
+    // Load GDT and IDT tables
+    addr = 0xffd0;
+    emit(rom, "\x66\x2e\x0f\x01\x16\xf2\xff");     // [0xffd0] lgdt   [cs:0xfff2]
+    emit(rom, "\x66\x2e\x0f\x01\x1e\xf8\xff");     // [0xffd7] lidt   [cs:0xfff8]
+
+    // Enter protected mode
+    emit(rom, "\x0f\x20\xc0");                     // [0xffde] mov    eax, cr0
+    emit(rom, "\x0c\x01");                         // [0xffe1] or      al, 1
+    emit(rom, "\x0f\x22\xc0");                     // [0xffe3] mov    cr0, eax
+    if (options.manualJmp) {
+        emit(rom, "\xf4");                         // [0xffe6] hlt
+        // Fill the rest with HLTs
+        while (addr < 0xfff0) {
+            emit(rom, "\xf4");                     // [0xffe7..0xffef] hlt
+        }
+    }
+    else {
+        emit(rom, "\x66\xea\x00\xff\xff\xff\x08\x00"); // [0xffe6] jmp    dword 0x8:0xffffff00
+        emit(rom, "\xf4");                         // [0xffef] hlt
+    }
+
+    // --- 16-bit real mode start -----------------------------------------------------------------------------------------
+
+    // Jump to initialization code and define GDT/IDT table pointer
+    addr = 0xfff0;
+    if (options.manualInit) {
+        emit(rom, "\xf4");                         // [0xfff0] hlt
+        emit(rom, "\x90");                         // [0xfff1] nop
+    }
+    else {
+        emit(rom, "\xeb\xde");                     // [0xfff0] jmp    short 0x1d0
+    }
+    emit(rom, "\x18\x00\x00\x00\xff\xff");         // [0xfff2] GDT pointer: 0xffff0000:0x0018
+    emit(rom, "\x18\x01\x18\x00\xff\xff");         // [0xfff8] IDT pointer: 0xffff0018:0x0118
+    
+    // There's room for two bytes at the end, so let's fill it up with HLTs
+    emit(rom, "\xf4");                             // [0xfffe] hlt
+    emit(rom, "\xf4");                             // [0xffff] hlt
+
+    // --- End of ROM code ------------------------------------------------------------------------------------------------
+
+    // --- Start of RAM code ----------------------------------------------------------------------------------------------
+    addr = 0x5004; // Addresses 0x5000..0x5003 are reserved for 0xdeadbeef
+    // Note that these addresses are mapped to virtual addresses 0x10000000 through 0x10000fff
+
+    // Do some basic stuff
+    emit(ram, "\xba\x78\x56\x34\x12");             // [0x5004] mov    edx, 0x12345678
+    emit(ram, "\xbf\x00\x00\x00\x10");             // [0x5009] mov    edi, 0x10000000
+    emit(ram, "\x31\xd0");                         // [0x500e] xor    eax, edx
+    emit(ram, "\x89\x07");                         // [0x5010] mov    [edi], eax
+    emit(ram, "\xf4");                             // [0x5012] hlt
+
+    // Setup a proper stack
+    emit(ram, "\x31\xed");                         // [0x5013] xor    ebp, ebp
+    emit(ram, "\xbc\x00\x00\x10\x00");             // [0x5015] mov    esp, 0x100000
+
+    // Test the stack
+    emit(ram, "\x68\xfe\xca\x0d\xf0");             // [0x501a] push   0xf00dcafe
+    emit(ram, "\x5a");                             // [0x501f] pop    edx
+    emit(ram, "\xf4");                             // [0x5020] hlt
+
+    // -------------------------------
+
+    // Call interrupts
+    emit(ram, "\xcd\x20");                         // [0x5021] int    0x20
+    emit(ram, "\xcd\x21");                         // [0x5023] int    0x21
+    emit(ram, "\xf4");                             // [0x5025] hlt
+
+    // -------------------------------
+
+    // Basic PMIO
+    emit(ram, "\x66\xba\x00\x10");                 // [0x5026] mov     dx, 0x1000
+    emit(ram, "\xec");                             // [0x502a] in      al, dx
+    emit(ram, "\x66\x42");                         // [0x502b] inc     dx
+    emit(ram, "\x34\xff");                         // [0x502d] xor     al, 0xff
+    emit(ram, "\xee");                             // [0x502f] out     dx, al
+    emit(ram, "\x66\x42");                         // [0x5030] inc     dx
+    emit(ram, "\x66\xed");                         // [0x5032] in      ax, dx
+    emit(ram, "\x66\x42");                         // [0x5034] inc     dx
+    emit(ram, "\x66\x83\xf0\xff");                 // [0x5036] xor     ax, 0xffff
+    emit(ram, "\x66\xef");                         // [0x503a] out     dx, ax
+    emit(ram, "\x66\x42");                         // [0x503c] inc     dx
+    emit(ram, "\xed");                             // [0x503e] in     eax, dx
+    emit(ram, "\x66\x42");                         // [0x503f] inc     dx
+    emit(ram, "\x83\xf0\xff");                     // [0x5041] xor    eax, 0xffffffff
+    emit(ram, "\xef");                             // [0x5044] out     dx, eax
+
+    // -------------------------------
+
+    // Basic MMIO
+    emit(ram, "\xbf\x00\x00\x00\xe0");             // [0x5045] mov    edi, 0xe0000000
+    emit(ram, "\x8b\x1f");                         // [0x504a] mov    ebx, [edi]
+    emit(ram, "\x83\xc7\x04");                     // [0x504c] add    edi, 4
+    emit(ram, "\x89\x1f");                         // [0x504f] mov    [edi], ebx
+
+    // Advanced MMIO
+    emit(ram, "\xb9\x00\x00\x00\x10");             // [0x5051] mov    ecx, 0x10000000
+    emit(ram, "\x85\x0f");                         // [0x5056] test   [edi], ecx
+
+    // -------------------------------
+
+    // Test single stepping
+    emit(ram, "\xb9\x11\x00\x00\x00");             // [0x5058] mov    ecx, 0x11
+    emit(ram, "\xb9\x00\x22\x00\x00");             // [0x505d] mov    ecx, 0x2200
+    emit(ram, "\xb9\x00\x00\x33\x00");             // [0x5062] mov    ecx, 0x330000
+    emit(ram, "\xb9\x00\x00\x00\x44");             // [0x5067] mov    ecx, 0x44000000
+
+    // -------------------------------
+
+    // Test software and hardware breakpoints
+    emit(ram, "\xb9\xff\x00\x00\x00");             // [0x506c] mov    ecx, 0xff
+    emit(ram, "\xb9\x00\xee\x00\x00");             // [0x5071] mov    ecx, 0xee00
+    emit(ram, "\xb9\x00\x00\xdd\x00");             // [0x5076] mov    ecx, 0xdd0000
+    emit(ram, "\xb9\x00\x00\x00\xcc");             // [0x507b] mov    ecx, 0xcc000000
+    emit(ram, "\xb9\xff\xee\xdd\xcc");             // [0x5080] mov    ecx, 0xccddeeff
+
+    // -------------------------------
+
+    // Test CPUID exit
+    emit(ram, "\x33\xc0");                         // [0x5085] xor    eax, eax
+    emit(ram, "\x0f\xa2");                         // [0x5087] cpuid
+
+    // Test custom CPUID
+    emit(ram, "\xb8\x02\x00\x00\x80");             // [0x5089] xor    eax, eax
+    emit(ram, "\x0f\xa2");                         // [0x508e] cpuid
+    emit(ram, "\xf4");                             // [0x5090] hlt
+
+    // -------------------------------
+
+    // End
+    emit(ram, "\xf4");                             // [0x5091] hlt
+
+    // -------------------------------
+
+    // Idle loop for timer interrupts
+    emit(ram, "\xfb");                             // [0x5092] sti
+    emit(ram, "\xf4");                             // [0x5093] hlt
+    emit(ram, "\xeb\xfc");                         // [0x5094] jmp    short 0x5092
+
+    // -------------------------------
+
+    // MSR loop: reads the MSR in ECX and writes the value back, ESI times
+    emit(ram, "\x0f\x32");                         // [0x5096] rdmsr
+    emit(ram, "\x0f\x30");                         // [0x5098] wrmsr
+    emit(ram, "\x4e");                             // [0x509a] dec    esi
+    emit(ram, "\x75\xf9");                         // [0x509b] jnz    short 0x5096
+    emit(ram, "\xf4");                             // [0x509d] hlt
+
+    // -------------------------------
+
+    addr = 0x6000; // Interrupt handlers
+    // Note that these addresses are mapped to virtual addresses 0x10001000 through 0x10001fff
+    // 0x20: Just IRET
+    emit(ram, "\xfb");                             // [0x6000] sti
+    emit(ram, "\xcf");                             // [0x6001] iretd
+
+    // 0x21: HLT, then IRET
+    emit(ram, "\xf4");                             // [0x6002] hlt
+    emit(ram, "\xfb");                             // [0x6003] sti
+    emit(ram, "\xcf");                             // [0x6004] iretd
+
+    // 0x00 .. 0x1F: Clear stack then IRET
+    emit(ram, "\x83\xc4\x04");                     // [0x6005] add    esp, 4
+    emit(ram, "\xfb");                             // [0x6008] sti
+    emit(ram, "\xcf");                             // [0x6009] iretd
+
+    // 0x22: Acknowledge timer tick, then IRET
+    emit(ram, "\x50");                             // [0x600a] push   eax
+    emit(ram, "\x52");                             // [0x600b] push   edx
+    emit(ram, "\x66\xba\x00\x11");                 // [0x600c] mov    dx, 0x1100
+    emit(ram, "\xb0\x22");                         // [0x6010] mov    al, 0x22
+    emit(ram, "\xee");                             // [0x6012] out    dx, al
+    emit(ram, "\x5a");                             // [0x6013] pop    edx
+    emit(ram, "\x58");                             // [0x6014] pop    eax
+    emit(ram, "\xcf");                             // [0x6015] iretd
+
+#undef emit
+}
@@ -0,0 +1,53 @@
+/*
+Declares the function that writes the basic demo's guest code to ROM and RAM.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <cstdint>
+
+// Options that cause some portions of guest code to be skipped and executed
+// on the host by manipulating the virtual processor's registers and the
+// guest's physical memory through the hypervisor.
+struct GuestCodeOptions {
+    // The GDTR and IDTR are set and the virtual processor is initialized to
+    // 32-bit protected mode
+    bool manualInit = false;
+
+    // Performs the jump into 32-bit protected mode
+    bool manualJmp = false;
+
+    // Sets up the PTEs and the CR3 register for paging
+    bool manualPaging = false;
+};
+
+// Vector of the timer interrupt handler, which acknowledges each interrupt by
+// writing the vector number to timerAckPort
+const uint8_t timerVector = 0x22;
+const uint16_t timerAckPort = 0x1100;
+
+// Fills ROM with HLT instructions and writes the initialization code to it,
+// then writes the test program to RAM.
+// ROM must be 64 KiB long and RAM must be at least 1 MiB long.
+void writeGuestCode(uint8_t *rom, uint8_t *ram, const GuestCodeOptions& options) noexcept;
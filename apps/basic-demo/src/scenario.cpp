@@ -0,0 +1,214 @@
+/*
+Defines the context shared by all scenarios.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "scenario.hpp"
+
+#include "print_helpers.hpp"
+#include "utils.hpp"
+
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <cinttypes>
+
+using namespace virt86;
+
+ScenarioContext::ScenarioContext(Platform& platform, VirtualMachine& vm, VirtualProcessor& vp, uint8_t *rom, uint8_t *ram, VCPUExitStats& stats, bool verbose) noexcept
+    : platform(platform)
+    , vm(vm)
+    , vp(vp)
+    , rom(rom)
+    , ram(ram)
+    , stats(stats)
+    , verbose(verbose)
+{
+}
+
+void ScenarioContext::RegisterIOHandlers() noexcept {
+    vm.RegisterIOReadCallback(IORead);
+    vm.RegisterIOWriteCallback(IOWrite);
+    vm.RegisterMMIOReadCallback(MMIORead);
+    vm.RegisterMMIOWriteCallback(MMIOWrite);
+    vm.RegisterIOContext(this);
+}
+
+void ScenarioContext::Enter(uint32_t eip) noexcept {
+    m_failures = 0;
+    m_logIO = true;
+    ClearIO();
+
+    Reg regs[] = { Reg::EIP, Reg::ESP };
+    RegValue values[] = { eip, 0x100000 };
+    vp.RegWrite(regs, values, array_size(regs));
+}
+
+bool ScenarioContext::Run() noexcept {
+    auto execStatus = stats.Run(vp);
+    if (execStatus != VPExecutionStatus::OK) {
+        printf("VCPU failed to run\n");
+        return false;
+    }
+    return true;
+}
+
+bool ScenarioContext::Step() noexcept {
+    auto execStatus = stats.Step(vp);
+    if (execStatus != VPExecutionStatus::OK) {
+        printf("VCPU failed to step\n");
+        return false;
+    }
+    return true;
+}
+
+bool ScenarioContext::ExpectExit(VMExitReason reason, const char *description) noexcept {
+    auto& exitInfo = vp.GetVMExitInfo();
+    if (exitInfo.reason == reason) {
+        Log("Emulation exited due to %s as expected!\n", description);
+        return true;
+    }
+    printf("Emulation exited for another reason: %s\n", reason_str(exitInfo.reason));
+    m_failures++;
+    return false;
+}
+
+void ScenarioContext::Check(bool condition, const char *message) noexcept {
+    if (condition) {
+        Log("%s\n", message);
+    }
+    else {
+        printf("** Check failed: %s\n", message);
+        m_failures++;
+    }
+}
+
+void ScenarioContext::ExpectIO(IOKind kind, uint64_t address, size_t size, uint64_t value) noexcept {
+    m_expected[0] = { kind, address, size, value };
+    m_numExpected = 1;
+}
+
+void ScenarioContext::ExpectIO(IOKind kind, uint64_t address, size_t size, uint64_t value, IOKind kind2, uint64_t address2, size_t size2, uint64_t value2) noexcept {
+    m_expected[0] = { kind, address, size, value };
+    m_expected[1] = { kind2, address2, size2, value2 };
+    m_numExpected = 2;
+}
+
+void ScenarioContext::ClearIO() noexcept {
+    m_numExpected = 0;
+}
+
+void ScenarioContext::Log(const char *format, ...) noexcept {
+    if (!verbose) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+void ScenarioContext::PrintRegs() noexcept {
+    if (!verbose) {
+        return;
+    }
+    printf("\nCPU register state:\n");
+    printRegs(vp);
+    printf("\n");
+}
+
+const IOExpectation *ScenarioContext::FindExpectation(IOKind kind, uint64_t address, size_t size) const noexcept {
+    for (size_t i = 0; i < m_numExpected; i++) {
+        auto& expected = m_expected[i];
+        if (expected.kind == kind && expected.address == address && expected.size == size) {
+            return &expected;
+        }
+    }
+    return nullptr;
+}
+
+uint32_t ScenarioContext::IORead(void *context, uint16_t port, size_t size) noexcept {
+    IOCallbackTimer timer(IOCallbackKind::PIORead);
+    auto& ctx = *reinterpret_cast<ScenarioContext *>(context);
+    auto expected = ctx.FindExpectation(IOKind::PIORead, port, size);
+    if (expected == nullptr) {
+        printf("** Unexpected I/O read from port 0x%x (%zd bytes)\n", port, size);
+        ctx.m_failures++;
+        return 0;
+    }
+    if (ctx.m_logIO) {
+        ctx.Log("I/O read callback reached!\nAnd we got the right port and size!\n");
+    }
+    return static_cast<uint32_t>(expected->value);
+}
+
+void ScenarioContext::IOWrite(void *context, uint16_t port, size_t size, uint32_t value) noexcept {
+    IOCallbackTimer timer(IOCallbackKind::PIOWrite);
+    auto& ctx = *reinterpret_cast<ScenarioContext *>(context);
+    auto expected = ctx.FindExpectation(IOKind::PIOWrite, port, size);
+    if (expected == nullptr) {
+        printf("** Unexpected I/O write to port 0x%x (%zd bytes) = 0x%x\n", port, size, value);
+        ctx.m_failures++;
+        return;
+    }
+    if (ctx.m_logIO) {
+        ctx.Log("I/O write callback reached!\nAnd we got the right port and size!\n");
+        ctx.Check(value == expected->value, "And the right result too!");
+    }
+    else if (value != expected->value) {
+        ctx.Check(false, "And the right result too!");
+    }
+}
+
+uint64_t ScenarioContext::MMIORead(void *context, uint64_t address, size_t size) noexcept {
+    IOCallbackTimer timer(IOCallbackKind::MMIORead);
+    auto& ctx = *reinterpret_cast<ScenarioContext *>(context);
+    auto expected = ctx.FindExpectation(IOKind::MMIORead, address, size);
+    if (expected == nullptr) {
+        printf("** Unexpected MMIO read from address 0x%" PRIx64 " (%zd bytes)\n", address, size);
+        ctx.m_failures++;
+        return 0;
+    }
+    if (ctx.m_logIO) {
+        ctx.Log("MMIO read callback reached!\nAnd we got the right address and size!\n");
+    }
+    return expected->value;
+}
+
+void ScenarioContext::MMIOWrite(void *context, uint64_t address, size_t size, uint64_t value) noexcept {
+    IOCallbackTimer timer(IOCallbackKind::MMIOWrite);
+    auto& ctx = *reinterpret_cast<ScenarioContext *>(context);
+    auto expected = ctx.FindExpectation(IOKind::MMIOWrite, address, size);
+    if (expected == nullptr) {
+        printf("** Unexpected MMIO write to address 0x%" PRIx64 " (%zd bytes) = 0x%" PRIx64 "\n", address, size, value);
+        ctx.m_failures++;
+        return;
+    }
+    if (ctx.m_logIO) {
+        ctx.Log("MMIO write callback reached!\nAnd we got the right address and size!\n");
+        ctx.Check(value == expected->value, "And the right value too!");
+    }
+    else if (value != expected->value) {
+        ctx.Check(false, "And the right value too!");
+    }
+}
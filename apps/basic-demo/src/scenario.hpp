@@ -0,0 +1,139 @@
+/*
+Declares the scenario registry and the context shared by all scenarios.
+
+Each scenario exercises one feature of the virtualization platform by running
+a section of the guest program. Scenarios can be selected, repeated and timed
+individually from the command line.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "virt86/virt86.hpp"
+
+#include "guest_code.hpp"
+#include "exit_stats.hpp"
+
+#include <cstdint>
+#include <cstddef>
+
+enum class ScenarioResult {
+    Passed,
+    Failed,
+    Skipped,
+    Aborted,  // The virtual processor failed; no further scenarios can run
+};
+
+// I/O operations that a scenario expects the guest to perform
+enum class IOKind {
+    PIORead,
+    PIOWrite,
+    MMIORead,
+    MMIOWrite,
+};
+
+struct IOExpectation {
+    IOKind kind;
+    uint64_t address;
+    size_t size;
+    uint64_t value;  // Value returned to the guest on reads, or expected from the guest on writes
+};
+
+class ScenarioContext {
+public:
+    ScenarioContext(virt86::Platform& platform, virt86::VirtualMachine& vm, virt86::VirtualProcessor& vp, uint8_t *rom, uint8_t *ram, VCPUExitStats& stats, bool verbose) noexcept;
+
+    // Registers I/O and MMIO callbacks that validate guest accesses against
+    // the current expectations. Must be called once before running scenarios.
+    void RegisterIOHandlers() noexcept;
+
+    // Prepares the virtual processor to run a scenario starting at the given
+    // linear address. Resets the stack pointer and the failure counter.
+    void Enter(uint32_t eip) noexcept;
+
+    // Runs or steps the virtual processor, recording exit statistics.
+    // Returns false if the virtual processor failed to execute.
+    bool Run() noexcept;
+    bool Step() noexcept;
+
+    // Checks that the last VM exit happened for the expected reason.
+    bool ExpectExit(virt86::VMExitReason reason, const char *description) noexcept;
+
+    // Records a failure if the condition is false; otherwise prints the
+    // message in verbose mode.
+    void Check(bool condition, const char *message) noexcept;
+
+    // Replaces the I/O operations expected on the next run.
+    void ExpectIO(IOKind kind, uint64_t address, size_t size, uint64_t value) noexcept;
+    void ExpectIO(IOKind kind, uint64_t address, size_t size, uint64_t value, IOKind kind2, uint64_t address2, size_t size2, uint64_t value2) noexcept;
+    void ClearIO() noexcept;
+
+    // Enables or disables the messages printed by I/O callbacks in verbose
+    // mode. Scenarios that perform thousands of I/O operations turn them off.
+    void SetIOLogging(bool enabled) noexcept { m_logIO = enabled; }
+
+    // Prints a message or the CPU register state in verbose mode.
+    void Log(const char *format, ...) noexcept;
+    void PrintRegs() noexcept;
+
+    // Passed if no checks failed since the scenario was entered
+    ScenarioResult Result() const noexcept { return (m_failures == 0) ? ScenarioResult::Passed : ScenarioResult::Failed; }
+
+    virt86::Platform& platform;
+    virt86::VirtualMachine& vm;
+    virt86::VirtualProcessor& vp;
+    uint8_t *rom;
+    uint8_t *ram;
+    VCPUExitStats& stats;
+    const bool verbose;
+
+private:
+    static uint32_t IORead(void *context, uint16_t port, size_t size) noexcept;
+    static void IOWrite(void *context, uint16_t port, size_t size, uint32_t value) noexcept;
+    static uint64_t MMIORead(void *context, uint64_t address, size_t size) noexcept;
+    static void MMIOWrite(void *context, uint64_t address, size_t size, uint64_t value) noexcept;
+
+    const IOExpectation *FindExpectation(IOKind kind, uint64_t address, size_t size) const noexcept;
+
+    IOExpectation m_expected[2];
+    size_t m_numExpected = 0;
+    size_t m_failures = 0;
+    bool m_logIO = true;
+};
+
+struct Scenario {
+    const char *name;
+    const char *description;
+    ScenarioResult (*run)(ScenarioContext& ctx);
+};
+
+// All registered scenarios, in the order they appear in the guest program
+extern const Scenario scenarios[];
+extern const size_t numScenarios;
+
+const Scenario *findScenario(const char *name) noexcept;
+
+// Runs the guest initialization code from the reset vector up to the first
+// stop in 32-bit protected mode with paging enabled. Must be done once before
+// running any scenarios.
+bool bootGuest(ScenarioContext& ctx, const GuestCodeOptions& options) noexcept;
@@ -0,0 +1,1056 @@
+/*
+Defines the guest initialization sequence and the scenarios of the basic demo.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "scenario.hpp"
+
+#include "interrupt_controller.hpp"
+#include "msr_table.hpp"
+#include "coverage.hpp"
+#include "step_tracer.hpp"
+#include "print_helpers.hpp"
+#include "utils.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <filesystem>
+#include <string>
+
+using namespace virt86;
+
+// ----- Initialization ---------------------------------------------------------------------------------------------------
+
+bool bootGuest(ScenarioContext& ctx, const GuestCodeOptions& options) noexcept {
+    auto& vp = ctx.vp;
+    auto& ram = ctx.ram;
+    VPOperationStatus opStatus;
+
+    if (options.manualInit) {
+        RegValue cr0, eip;
+
+        vp.RegRead(Reg::CR0, cr0);
+        vp.RegRead(Reg::EIP, eip);
+
+        // Load GDT table
+        RegValue gdtr;
+        gdtr.table.base = 0xFFFF0000;
+        gdtr.table.limit = 0x0018;
+
+        // Load IDT table
+        RegValue idtr;
+        idtr.table.base = 0xFFFF0000 + 0x18;
+        idtr.table.limit = 0x0118;
+
+        // Enter protected mode
+        cr0.u32 |= CR0_PE;
+
+        // Skip initialization code
+        eip.u32 = 0xffe6;
+
+        vp.RegWrite(Reg::GDTR, gdtr);
+        vp.RegWrite(Reg::IDTR, idtr);
+
+        vp.RegWrite(Reg::CR0, cr0);
+        vp.RegWrite(Reg::EIP, eip);
+    }
+
+    // The CPU starts in 16-bit real mode.
+    // Memory addressing is based on segments and offsets, where a segment is basically a 16-byte offset.
+
+    // On a real application, you should be checking the outcome of register reads and writes.
+    // We're not going to bother since we know they cannot fail, except for segment registers.
+
+    // Run the CPU! Will stop at the first HLT at ROM address 0xffc2
+    if (!ctx.Run()) {
+        return false;
+    }
+
+    ctx.Log("\nCPU register state after 16-bit initialization code:\n");
+    ctx.PrintRegs();
+
+    if (options.manualJmp) {
+        // Do the jmp dword 0x8:0xffffff00 manually
+        RegValue cs;
+        if (vp.ReadSegment(0x0008, cs) != VPOperationStatus::OK) {
+            printf("Failed to load segment data for selector 0x0008\n");
+            return false;
+        }
+        opStatus = vp.RegWrite(Reg::CS, cs);
+        if (opStatus != VPOperationStatus::OK) {
+            printf("Failed to set CS register\n");
+            return false;
+        }
+        vp.RegWrite(Reg::EIP, 0xffffff00);
+
+        // Run the CPU again!
+        if (!ctx.Run()) {
+            return false;
+        }
+
+        ctx.Log("\nCPU register state after manual jump:\n");
+        ctx.PrintRegs();
+    }
+
+    if (options.manualPaging) {
+        // Prepare the registers
+        Reg regs[] = {
+            Reg::EAX, Reg::ESI, Reg::EIP, Reg::CR0, Reg::CR3,
+            Reg::SS, Reg::DS, Reg::ES,
+        };
+        RegValue values[] = {
+            0, 0x10000000, 0xffffffc0, 0xe0000011, 0x1000,
+            0x0010, 0x0010, 0x0010,
+        };
+
+        for (int i = 5; i < 8; i++) {
+            if (vp.ReadSegment(0x0010, values[i]) != VPOperationStatus::OK) {
+                printf("Failed to load segment data for selector 0x0010\n");
+                return false;
+            }
+        }
+
+        opStatus = vp.RegWrite(regs, values, array_size(regs));
+        if (opStatus != VPOperationStatus::OK) {
+            printf("Failed to set VCPU registers\n");
+            return false;
+        }
+
+        // Clear page directory
+        memset(&ram[0x1000], 0, 0x1000 * sizeof(uint16_t));
+
+        // Write 0xdeadbeef at physical memory address 0x5000
+        *(uint32_t *)&ram[0x5000] = 0xdeadbeef;
+
+        // Identity map the RAM to 0x00000000
+        for (uint32_t i = 0; i < 0x100; i++) {
+            *(uint32_t *)&ram[0x2000 + i * 4] = 0x0003 + i * 0x1000;
+        }
+
+        // Identity map the ROM
+        for (uint32_t i = 0; i < 0x10; i++) {
+            *(uint32_t *)&ram[0x3fc0 + i * 4] = 0xffff0003 + i * 0x1000;
+        }
+
+        // Map physical address 0x5000 to virtual address 0x10000000
+        *(uint32_t *)&ram[0x4000] = 0x5003;
+
+        // Map physical address 0x6000 to virtual address 0x10001000
+        *(uint32_t *)&ram[0x4004] = 0x6003;
+
+        // Map physical address 0xe0000000 to virtual address 0xe0000000
+        *(uint32_t *)&ram[0xe000] = 0xe0000003;
+
+        // Add page tables into page directory
+        *(uint32_t *)&ram[0x1000] = 0x2003;
+        *(uint32_t *)&ram[0x1ffc] = 0x3003;
+        *(uint32_t *)&ram[0x1100] = 0x4003;
+        *(uint32_t *)&ram[0x1e00] = 0xe003;
+
+        // Run the CPU again!
+        if (!ctx.Run()) {
+            return false;
+        }
+
+        ctx.Log("\nCPU register state after manual paging setup:\n");
+        ctx.PrintRegs();
+    }
+
+    // Validate output at the first stop
+    ctx.Log("Testing data in virtual memory\n\n");
+    {
+        // Get CPU registers
+        RegValue cs, eip, eax;
+
+        opStatus = vp.RegRead(Reg::CS, cs);
+        if (opStatus != VPOperationStatus::OK) {
+            printf("Failed to read CS register\n");
+            return false;
+        }
+        vp.RegRead(Reg::EIP, eip);
+        vp.RegRead(Reg::EAX, eax);
+
+        // Validate
+        ctx.Check(eip.u32 == 0xffffffc3 && cs.u16 == 0x0008, "Emulation stopped at the right place!");
+        ctx.Check(eax.u32 == 0xdeadbeef, "And we got the right result!");
+    }
+    ctx.Log("\n");
+
+    return ctx.Result() == ScenarioResult::Passed;
+}
+
+// ----- Dirty page tracking ----------------------------------------------------------------------------------------------
+
+static ScenarioResult dirtyPages(ScenarioContext& ctx) {
+    auto& features = ctx.platform.GetFeatures();
+    if (!features.dirtyPageTracking) {
+        ctx.Log("Dirty page tracking not supported by the hypervisor, skipping test\n\n");
+        return ScenarioResult::Skipped;
+    }
+
+    // Query the pages touched by the guest so far. The page tables and data
+    // area written by the initialization code live in the first 16 pages.
+    const uint64_t numPages = features.partialDirtyBitmap ? 0x10 : 0x100;
+    uint64_t bitmap[0x100 / 64] = { 0 };
+    const auto dptStatus = ctx.vm.QueryDirtyPages(0x0, numPages * PAGE_SIZE, bitmap, sizeof(bitmap));
+    ctx.Check(dptStatus == DirtyPageTrackingStatus::OK, "Dirty bitmap retrieved successfully!");
+    if (dptStatus == DirtyPageTrackingStatus::OK && ctx.verbose) {
+        if (!features.partialDirtyBitmap) {
+            printf("Hypervisor does not support reading partial dirty bitmaps\n\n");
+        }
+        printf("Dirty pages:\n");
+        for (uint64_t page = 0; page < numPages; page++) {
+            if (bitmap[page / 64] & (1ull << (page & 63))) {
+                printf("  0x%" PRIx64 "\n", page * PAGE_SIZE);
+            }
+        }
+        printf("\n");
+    }
+
+    return ctx.Result();
+}
+
+// ----- Execute code in virtual memory -----------------------------------------------------------------------------------
+
+static ScenarioResult virtualMemory(ScenarioContext& ctx) {
+    auto& vp = ctx.vp;
+    ctx.Log("Testing code in virtual memory\n\n");
+
+    // The program XORs EAX with EDX; start from the value loaded by the initialization code
+    ctx.Enter(0x10000004);
+    vp.RegWrite(Reg::EAX, 0xdeadbeef);
+
+    // Run CPU
+    if (!ctx.Run()) return ScenarioResult::Aborted;
+    ctx.ExpectExit(VMExitReason::HLT, "HLT instruction");
+
+    // Validate output
+    {
+        // Get CPU registers
+        RegValue eip, eax, edx;
+
+        vp.RegRead(Reg::EIP, eip);
+        vp.RegRead(Reg::EAX, eax);
+        vp.RegRead(Reg::EDX, edx);
+
+        ctx.Check(eip.u32 == 0x10000013, "Emulation stopped at the right place!");
+        const uint32_t memValue = *(uint32_t *)&ctx.ram[0x5000];
+        ctx.Check(eax.u32 == 0xcc99e897 && edx.u32 == 0x12345678 && memValue == 0xcc99e897, "And we got the right result!");
+    }
+
+    ctx.PrintRegs();
+    return ctx.Result();
+}
+
+// ----- Stack ------------------------------------------------------------------------------------------------------------
+
+static ScenarioResult stack(ScenarioContext& ctx) {
+    auto& vp = ctx.vp;
+    ctx.Log("Testing the stack\n\n");
+
+    ctx.Enter(0x10000013);
+
+    // Run CPU
+    if (!ctx.Run()) return ScenarioResult::Aborted;
+    ctx.ExpectExit(VMExitReason::HLT, "HLT instruction");
+
+    // Validate stack results
+    {
+        RegValue eip, edx, esp;
+        vp.RegRead(Reg::EIP, eip);
+        vp.RegRead(Reg::EDX, edx);
+        vp.RegRead(Reg::ESP, esp);
+
+        ctx.Check(eip.u32 == 0x10000021, "Emulation stopped at the right place!");
+        const uint32_t memValue = *(uint32_t *)&ctx.ram[0xffffc];
+        ctx.Check(edx.u32 == 0xf00dcafe && esp.u32 == 0x00100000 && memValue == 0xf00dcafe, "And we got the right result!");
+    }
+
+    ctx.PrintRegs();
+    return ctx.Result();
+}
+
+// ----- Interrupts -------------------------------------------------------------------------------------------------------
+
+static ScenarioResult interrupts(ScenarioContext& ctx) {
+    auto& vp = ctx.vp;
+    auto& exitInfo = vp.GetVMExitInfo();
+    ctx.Log("Testing interrupts\n\n");
+
+    ctx.Enter(0x10000021);
+
+    // Run until the HLT inside INT 0x21
+    if (!ctx.Run()) return ScenarioResult::Aborted;
+    ctx.ExpectExit(VMExitReason::HLT, "HLT instruction");
+
+    // Validate registers
+    {
+        RegValue eip;
+        vp.RegRead(Reg::EIP, eip);
+        ctx.Check(eip.u32 == 0x10001003, "Emulation stopped at the right place!");
+    }
+
+    ctx.PrintRegs();
+
+    // Now we should leave the interrupt handler and hit the HLT right after INT 0x21
+    if (!ctx.Run()) return ScenarioResult::Aborted;
+    ctx.ExpectExit(VMExitReason::HLT, "HLT instruction");
+
+    // Validate registers
+    {
+        RegValue eip;
+        vp.RegRead(Reg::EIP, eip);
+        ctx.Check(eip.u32 == 0x10000026, "Emulation stopped at the right place!");
+    }
+
+    ctx.PrintRegs();
+
+    // Enable interrupts
+    {
+        RegValue eflags;
+        vp.RegRead(Reg::EFLAGS, eflags);
+        eflags.u32 |= RFLAGS_IF;
+        vp.RegWrite(Reg::EFLAGS, eflags);
+    }
+
+    // Inject an INT 0x21
+    vp.EnqueueInterrupt(0x21);
+
+    // Should hit the HLT in the INT 0x21 handler again
+    if (!ctx.Run()) return ScenarioResult::Aborted;
+
+    // Some hypervisors cause a VM exit due to either having to cancel
+    // execution of the virtual processor to open a window for interrupt
+    // injection, or because of the act of requesting an injection window.
+    if (exitInfo.reason == VMExitReason::Cancelled || exitInfo.reason == VMExitReason::Interrupt) {
+        ctx.Log("Emulation exited to inject an interrupt, continuing execution...\n");
+        if (!ctx.Run()) return ScenarioResult::Aborted;
+    }
+
+    ctx.ExpectExit(VMExitReason::HLT, "HLT instruction");
+
+    // Validate registers
+    {
+        RegValue eip;
+        vp.RegRead(Reg::EIP, eip);
+        ctx.Check(eip.u32 == 0x10001003, "Emulation stopped at the right place!");
+    }
+
+    ctx.PrintRegs();
+    return ctx.Result();
+}
+
+// ----- PIO --------------------------------------------------------------------------------------------------------------
+
+static ScenarioResult pio(ScenarioContext& ctx) {
+    ctx.Log("Testing PIO\n\n");
+
+    ctx.Enter(0x10000026);
+
+    // Each step sets up the I/O operation the guest is expected to perform
+    // before running the CPU until the next I/O instruction
+    const IOExpectation steps[] = {
+        { IOKind::PIORead, 0x1000, 1, 0xac },         // 8-bit IN
+        { IOKind::PIOWrite, 0x1001, 1, 0x53 },        // 8-bit OUT
+        { IOKind::PIORead, 0x1002, 2, 0xfade },       // 16-bit IN
+        { IOKind::PIOWrite, 0x1003, 2, 0x0521 },      // 16-bit OUT
+        { IOKind::PIORead, 0x1004, 4, 0xfeedbabe },   // 32-bit IN
+        { IOKind::PIOWrite, 0x1005, 4, 0x01124541 },  // 32-bit OUT
+    };
+
+    for (auto& step : steps) {
+        ctx.ExpectIO(step.kind, step.address, step.size, step.value);
+        if (!ctx.Run()) return ScenarioResult::Aborted;
+        ctx.ExpectExit(VMExitReason::PIO, "I/O");
+        ctx.PrintRegs();
+    }
+
+    ctx.ClearIO();
+    return ctx.Result();
+}
+
+// ----- MMIO -------------------------------------------------------------------------------------------------------------
+
+static ScenarioResult mmio(ScenarioContext& ctx) {
+    ctx.Log("Testing MMIO\n\n");
+
+    ctx.Enter(0x10000045);
+
+    // Run CPU until the first MMIO
+    ctx.ExpectIO(IOKind::MMIORead, 0xe0000000, 4, 0xbaadc0de);
+    if (!ctx.Run()) return ScenarioResult::Aborted;
+    ctx.ExpectExit(VMExitReason::MMIO, "MMIO");
+    ctx.PrintRegs();
+
+    // Will now hit the MMIO write
+    ctx.ExpectIO(IOKind::MMIOWrite, 0xe0000004, 4, 0xbaadc0de);
+    if (!ctx.Run()) return ScenarioResult::Aborted;
+    ctx.ExpectExit(VMExitReason::MMIO, "MMIO");
+    ctx.PrintRegs();
+
+    // Will now hit the first part of TEST instruction with MMIO address
+    ctx.ExpectIO(IOKind::MMIORead, 0xe0000004, 4, 0xdeadc0de,
+                 IOKind::MMIOWrite, 0xe0000004, 4, 0xdeadc0de);
+    if (!ctx.Run()) return ScenarioResult::Aborted;
+    ctx.ExpectExit(VMExitReason::MMIO, "MMIO");
+    ctx.PrintRegs();
+
+    // Some platforms require multiple executions to complete an emulated MMIO instruction
+    if (ctx.platform.GetFeatures().partialMMIOInstructions) {
+        ctx.Log("Hypervisor instruction emulator executes MMIO instructions partially, continuing execution...\n\n");
+
+        if (!ctx.Run()) return ScenarioResult::Aborted;
+        ctx.ExpectExit(VMExitReason::MMIO, "MMIO");
+        ctx.PrintRegs();
+    }
+
+    ctx.ClearIO();
+    return ctx.Result();
+}
+
+// ----- Single stepping --------------------------------------------------------------------------------------------------
+
+static ScenarioResult singleStep(ScenarioContext& ctx) {
+    auto& vp = ctx.vp;
+    if (!ctx.platform.GetFeatures().guestDebugging) {
+        ctx.Log("Guest debugging not supported by the platform, skipping test\n\n");
+        return ScenarioResult::Skipped;
+    }
+
+    ctx.Log("Testing single stepping\n\n");
+
+    ctx.Enter(0x10000058);
+
+    // Expected EIP and ECX after each step
+    const struct { uint32_t eip, ecx; } steps[] = {
+        { 0x1000005d, 0x11 },
+        { 0x10000062, 0x2200 },
+        { 0x10000067, 0x330000 },
+        { 0x1000006c, 0x44000000 },
+    };
+
+    bool first = true;
+    for (auto& step : steps) {
+        // Step CPU
+        if (!ctx.Step()) return ScenarioResult::Aborted;
+
+        // Some hypervisors may not step forward after completing the complex
+        // MMIO instruction from the previous test. Check if that's the case by
+        // looking at EIP
+        if (first) {
+            first = false;
+            RegValue eip;
+            vp.RegRead(Reg::EIP, eip);
+            if (eip.u32 == 0x10000058) {
+                ctx.Log("Hypervisor does not complete complex MMIO instruction on execution, stepping again\n");
+                if (!ctx.Step()) return ScenarioResult::Aborted;
+            }
+        }
+
+        if (ctx.ExpectExit(VMExitReason::Step, "single stepping")) {
+            RegValue eip, ecx;
+            vp.RegRead(Reg::EIP, eip);
+            vp.RegRead(Reg::ECX, ecx);
+
+            ctx.Check(eip.u32 == step.eip, "And stopped at the right place!");
+            ctx.Check(ecx.u32 == step.ecx, "And got the right result!");
+        }
+
+        ctx.PrintRegs();
+    }
+
+    return ctx.Result();
+}
+
+// ----- Instruction tracing ----------------------------------------------------------------------------------------------
+
+static ScenarioResult instructionTrace(ScenarioContext& ctx) {
+    auto& vp = ctx.vp;
+    if (!ctx.platform.GetFeatures().guestDebugging) {
+        ctx.Log("Guest debugging not supported by the platform, skipping test\n\n");
+        return ScenarioResult::Skipped;
+    }
+
+    ctx.Log("Testing the instruction tracer\n\n");
+
+    std::error_code ec;
+    const std::string path = (std::filesystem::temp_directory_path(ec) / "virt86-basic-demo.trace").string();
+
+    // Trace the virtual memory program with the same input as its scenario.
+    // Its result is cleared so that the write shows up in the trace.
+    ctx.Enter(0x10000004);
+    RegValue eax;
+    eax.u32 = 0xdeadbeef;
+    vp.RegWrite(Reg::EAX, eax);
+    memset(&ctx.ram[0x5000], 0, sizeof(uint32_t));
+
+    StepTracer tracer;
+    if (!tracer.Start(vp, path.c_str())) {
+        printf("Failed to start the trace: %s\n", tracer.Error().c_str());
+        return ScenarioResult::Failed;
+    }
+    const uint64_t ramSize = PAGE_SIZE * 256;  // As mapped by the demo
+    const bool traceMemory = tracer.EnableMemoryWrites(ctx.vm, 0x0, ctx.ram, ramSize);
+    if (!traceMemory) {
+        ctx.Log("Dirty page tracking not supported by the hypervisor, memory writes will not be traced\n");
+    }
+
+    // Step until the HLT at the end of the program
+    const size_t maxSteps = 16;
+    for (size_t i = 0; i < maxSteps; i++) {
+        if (tracer.Step(vp) != VPExecutionStatus::OK) {
+            printf("VCPU failed to step\n");
+            tracer.Finish();
+            remove(path.c_str());
+            return ScenarioResult::Aborted;
+        }
+        if (vp.GetVMExitInfo().reason != VMExitReason::Step) {
+            break;
+        }
+    }
+    ctx.ExpectExit(VMExitReason::HLT, "HLT instruction");
+    ctx.Check(tracer.Finish(), "Trace recorded successfully!");
+
+    // Decode the trace and compare the final state with the processor
+    StepTraceReader reader;
+    uint64_t numSteps = 0;
+    bool wroteResult = false;
+    if (reader.Open(path.c_str())) {
+        StepTraceReader::Step step;
+        while (reader.Next(step)) {
+            numSteps++;
+            for (auto& write : step.writes) {
+                wroteResult |= write.address == 0x5000 && write.data.size() == 4 && memcmp(write.data.data(), "\x97\xe8\x99\xcc", 4) == 0;
+            }
+        }
+    }
+    ctx.Check(reader.Error().empty() && numSteps == tracer.NumSteps(), "Trace decoded successfully!");
+
+    uint64_t tracedEAX = 0, tracedEDX = 0, tracedEIP = 0;
+    for (size_t i = 0; i < reader.NumRegs(); i++) {
+        if (reader.RegName(i) == "RAX") tracedEAX = reader.Value(i) & 0xffffffff;
+        if (reader.RegName(i) == "RDX") tracedEDX = reader.Value(i) & 0xffffffff;
+        if (reader.RegName(i) == "RIP") tracedEIP = reader.Value(i) & 0xffffffff;
+    }
+    RegValue eip;
+    vp.RegRead(Reg::EIP, eip);
+    ctx.Check(tracedEAX == 0xcc99e897 && tracedEDX == 0x12345678 && tracedEIP == eip.u32, "Trace has the right register values!");
+    if (traceMemory) {
+        ctx.Check(wroteResult, "Trace has the memory write!");
+    }
+    ctx.Log("Traced %" PRIu64 " instructions in %" PRIu64 " bytes with %" PRIu64 " memory writes\n",
+        tracer.NumSteps(), tracer.BytesWritten(), tracer.NumMemoryWrites());
+    remove(path.c_str());
+
+    ctx.PrintRegs();
+    return ctx.Result();
+}
+
+// ----- Software breakpoints ---------------------------------------------------------------------------------------------
+
+static ScenarioResult softwareBreakpoint(ScenarioContext& ctx) {
+    auto& vp = ctx.vp;
+    auto& ram = ctx.ram;
+    if (!ctx.platform.GetFeatures().guestDebugging) {
+        ctx.Log("Guest debugging not supported by the platform, skipping test\n\n");
+        return ScenarioResult::Skipped;
+    }
+
+    ctx.Log("Testing software breakpoints\n\n");
+
+    ctx.Enter(0x1000006c);
+
+    // Enable software breakpoints and place a breakpoint
+    if (vp.EnableSoftwareBreakpoints(true) != VPOperationStatus::OK) {
+        printf("Failed to enable software breakpoints\n");
+        return ScenarioResult::Aborted;
+    }
+    const uint8_t swBpBackup = ram[0x5071];
+    ram[0x5071] = 0xCC;
+
+    // Run CPU. Should hit the breakpoint
+    if (!ctx.Run()) return ScenarioResult::Aborted;
+
+    if (ctx.ExpectExit(VMExitReason::SoftwareBreakpoint, "software breakpoint")) {
+        RegValue eip, ecx;
+        uint64_t bpAddr;
+
+        vp.RegRead(Reg::EIP, eip);
+        vp.RegRead(Reg::ECX, ecx);
+
+        vp.GetBreakpointAddress(&bpAddr);
+
+        ctx.Check(bpAddr == 0x10000071, "And triggered the correct breakpoint!");
+        ctx.Check(eip.u32 == 0x10000071, "And stopped at the right place!");
+        ctx.Check(ecx.u32 == 0x000000ff, "And got the right result!");
+    }
+
+    ctx.PrintRegs();
+
+    // Disable software breakpoints and revert instruction
+    if (vp.EnableSoftwareBreakpoints(false) != VPOperationStatus::OK) {
+        printf("Failed to disable software breakpoints\n");
+        return ScenarioResult::Aborted;
+    }
+    ram[0x5071] = swBpBackup;
+
+    return ctx.Result();
+}
+
+// ----- Hardware breakpoints ---------------------------------------------------------------------------------------------
+
+static ScenarioResult hardwareBreakpoint(ScenarioContext& ctx) {
+    auto& vp = ctx.vp;
+    if (!ctx.platform.GetFeatures().guestDebugging) {
+        ctx.Log("Guest debugging not supported by the platform, skipping test\n\n");
+        return ScenarioResult::Skipped;
+    }
+
+    ctx.Log("Testing hardware breakpoints\n\n");
+
+    ctx.Enter(0x10000071);
+
+    // Place hardware breakpoint
+    HardwareBreakpoints bps = { 0 };
+    bps.bp[0].address = 0x1000007b;
+    bps.bp[0].localEnable = true;
+    bps.bp[0].globalEnable = false;
+    bps.bp[0].trigger = HardwareBreakpointTrigger::Execution;
+    bps.bp[0].length = HardwareBreakpointLength::Byte;
+    if (vp.SetHardwareBreakpoints(bps) != VPOperationStatus::OK) {
+        printf("Failed to set hardware breakpoint\n");
+        return ScenarioResult::Aborted;
+    }
+
+    // Run CPU. Should hit the breakpoint
+    if (!ctx.Run()) return ScenarioResult::Aborted;
+
+    if (ctx.ExpectExit(VMExitReason::HardwareBreakpoint, "hardware breakpoint")) {
+        RegValue eip, ecx, dr6;
+
+        vp.RegRead(Reg::EIP, eip);
+        vp.RegRead(Reg::ECX, ecx);
+        vp.RegRead(Reg::DR6, dr6);
+
+        ctx.Check(dr6.u32 == 1, "And triggered the correct breakpoint!");
+        ctx.Check(eip.u32 == 0x1000007b, "And stopped at the right place!");
+        ctx.Check(ecx.u32 == 0x00dd0000, "And got the right result!");
+    }
+
+    // Clear hardware breakpoints
+    if (vp.ClearHardwareBreakpoints() != VPOperationStatus::OK) {
+        printf("Could not clear hardware breakpoints\n");
+    }
+    ctx.Log("\nHardware breakpoints cleared\n");
+
+    ctx.PrintRegs();
+    return ctx.Result();
+}
+
+// ----- Extended VM exit: CPUID ------------------------------------------------------------------------------------------
+
+static ScenarioResult cpuidExit(ScenarioContext& ctx) {
+    auto& vp = ctx.vp;
+    auto& features = ctx.platform.GetFeatures();
+    if (BitmaskEnum(features.extendedVMExits).NoneOf(ExtendedVMExit::CPUID)) {
+        ctx.Log("Extended VM exit on CPUID instruction not supported by the platform, skipping test\n\n");
+        return ScenarioResult::Skipped;
+    }
+
+    ctx.Log("Testing extended VM exit: CPUID instruction\n\n");
+
+    ctx.Enter(0x10000085);
+
+    // Run CPU. Should hit the CPUID and exit with the correct result
+    if (!ctx.Run()) return ScenarioResult::Aborted;
+
+    if (ctx.ExpectExit(VMExitReason::CPUID, "CPUID instruction")) {
+        RegValue eax;
+        vp.RegRead(Reg::EAX, eax);
+        ctx.Check(eax.u32 == 0, "And we got the correct function!");
+
+        vp.RegWrite(Reg::EAX, 0x80000008);
+        vp.RegWrite(Reg::EBX, 'vuoc');
+        vp.RegWrite(Reg::ECX, 'Rtri');
+        vp.RegWrite(Reg::EDX, 'SKCO');
+    }
+
+    ctx.PrintRegs();
+
+    // Should hit the next CPUID with function 0x800000002 then stop at the
+    // following HLT
+    if (!ctx.Run()) return ScenarioResult::Aborted;
+
+    if (ctx.ExpectExit(VMExitReason::HLT, "HLT instruction")) {
+        RegValue eax, ebx, ecx, edx;
+        vp.RegRead(Reg::EAX, eax);
+        vp.RegRead(Reg::EBX, ebx);
+        vp.RegRead(Reg::ECX, ecx);
+        vp.RegRead(Reg::EDX, edx);
+        if (eax.u32 == 'vupc' && ebx.u32 == ' tri' && ecx.u32 == 'UPCV' && edx.u32 == '    ') {
+            ctx.Log("And we got the correct results!\n");
+        }
+        else if (features.customCPUIDs) {
+            ctx.Log("Custom CPUID results unsupported by the hypervisor\n");
+        }
+    }
+
+    ctx.PrintRegs();
+    return ctx.Result();
+}
+
+// ----- Timer interrupts -------------------------------------------------------------------------------------------------
+
+// Runs the guest idle loop while a periodic timer injects interrupts at the
+// given frequency for 100 ms. The guest acknowledges each tick with an OUT to
+// timerAckPort; the time between the timer deadline and the acknowledgement is
+// the interrupt delivery latency.
+static ScenarioResult timerTicks(ScenarioContext& ctx, uint64_t frequency) {
+    auto& vp = ctx.vp;
+    auto& exitInfo = vp.GetVMExitInfo();
+    ctx.Log("Testing timer interrupts at %" PRIu64 " Hz\n\n", frequency);
+
+    const uint64_t period = 1000000000ull / frequency;
+    const uint64_t numTicks = frequency / 10;
+    const uint64_t haltTimeout = 100000000ull;  // 100 ms
+
+    ctx.Enter(0x10000092);
+    ctx.ExpectIO(IOKind::PIOWrite, timerAckPort, 1, timerVector);
+    ctx.SetIOLogging(false);
+
+    InterruptController intc;
+    intc.Start();
+    const uint64_t start = intc.Now();
+    const uint64_t timerID = intc.ScheduleInterrupt(start + period, timerVector, period);
+
+    LatencyHistogram latency;
+    double mean = 0.0;
+    double m2 = 0.0;
+    uint64_t ticks = 0;
+    ScenarioResult result = ScenarioResult::Passed;
+    while (ticks < numTicks) {
+        intc.Deliver(vp);
+        if (!ctx.Run()) {
+            result = ScenarioResult::Aborted;
+            break;
+        }
+
+        if (exitInfo.reason == VMExitReason::PIO) {
+            // Welford's online algorithm for the latency variance
+            const uint64_t sample = intc.Now() - intc.LastRaiseTime(timerVector);
+            latency.Record(sample);
+            ticks++;
+            const double delta = (double)sample - mean;
+            mean += delta / ticks;
+            m2 += delta * ((double)sample - mean);
+        }
+        else if (exitInfo.reason == VMExitReason::HLT) {
+            if (!intc.WaitForInterrupt(haltTimeout)) {
+                ctx.Check(false, "Timer interrupt arrived while halted");
+                break;
+            }
+        }
+        else if (exitInfo.reason != VMExitReason::Cancelled && exitInfo.reason != VMExitReason::Interrupt) {
+            ctx.ExpectExit(VMExitReason::HLT, "HLT instruction");
+            break;
+        }
+    }
+    const uint64_t elapsed = intc.Now() - start;
+
+    intc.CancelTimer(timerID);
+    intc.Stop();
+    ctx.ClearIO();
+
+    printf("  %" PRIu64 " Hz: %" PRIu64 " ticks in %.1f ms, %" PRIu64 " raised, %" PRIu64 " coalesced\n",
+        frequency, ticks, (double)elapsed / 1000000.0, intc.NumRaised(), intc.NumCoalesced());
+    if (ticks > 0) {
+        printf("  latency: avg %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us, jitter %.1f us\n",
+            mean / 1000.0,
+            (double)latency.Percentile(50.0) / 1000.0,
+            (double)latency.Percentile(99.0) / 1000.0,
+            (double)latency.Max() / 1000.0,
+            std::sqrt(m2 / ticks) / 1000.0);
+    }
+
+    ctx.PrintRegs();
+    if (result == ScenarioResult::Aborted) {
+        return result;
+    }
+    ctx.Check(ticks == numTicks, "All timer ticks were acknowledged");
+    return ctx.Result();
+}
+
+static ScenarioResult timer1k(ScenarioContext& ctx) {
+    return timerTicks(ctx, 1000);
+}
+
+static ScenarioResult timer10k(ScenarioContext& ctx) {
+    return timerTicks(ctx, 10000);
+}
+
+static ScenarioResult timer100k(ScenarioContext& ctx) {
+    return timerTicks(ctx, 100000);
+}
+
+static void countExpiry(void *context, uint64_t timerID, uint64_t deadline) {
+    (*(uint64_t *)context)++;
+}
+
+// Drives a timer wheel without the guest. A timer scheduled past the span of
+// the wheel sits in the overflow list until the wheel reaches the span
+// boundary; the next event must never be reported after its deadline, even
+// when the wheel stops exactly on that boundary.
+static ScenarioResult timerWheel(ScenarioContext& ctx) {
+    ctx.Log("Testing timer wheel expiry past the wheel span\n\n");
+
+    const uint64_t resolution = 1000;
+    const uint64_t span = 1ull << 24;   // Four levels of 64 slots, in ticks
+    const uint64_t deadline = (span + 10) * resolution;
+
+    TimerWheel wheel(resolution);
+    uint64_t expired = 0;
+    wheel.Schedule(deadline, countExpiry, &expired);
+
+    // Leaves the first unprocessed tick on the span boundary
+    wheel.Advance((span - 1) * resolution);
+    const uint64_t next = wheel.NextEvent();
+    printf("  next event at tick %" PRIu64 ", timer due at tick %" PRIu64 "\n", next / resolution, deadline / resolution);
+    ctx.Check(next <= deadline, "Next event is not after the overflow timer deadline");
+
+    uint64_t now = next;
+    while (expired == 0 && now <= deadline) {
+        wheel.Advance(now);
+        now = wheel.NextEvent();
+    }
+    ctx.Check(expired == 1, "Overflow timer expired by its deadline");
+    ctx.Check(wheel.Count() == 0, "Timer wheel is empty");
+    return ctx.Result();
+}
+
+// ----- Extended VM exit: MSR access -------------------------------------------------------------------------------------
+
+// Runs the guest MSR loop on the given MSR, emulating every access that
+// exits through the MSR table. Returns false if the loop did not reach the
+// final HLT.
+static bool msrLoop(ScenarioContext& ctx, MSRTable& table, uint32_t msr, uint32_t iterations, uint64_t& exits, uint64_t& elapsedNs) {
+    auto& vp = ctx.vp;
+    auto& exitInfo = vp.GetVMExitInfo();
+
+    ctx.Enter(0x10000096);
+    Reg regs[] = { Reg::ECX, Reg::ESI };
+    RegValue values[] = { msr, iterations };
+    vp.RegWrite(regs, values, array_size(regs));
+
+    exits = 0;
+    auto start = std::chrono::steady_clock::now();
+    bool completed = false;
+    for (;;) {
+        if (!ctx.Run()) {
+            break;
+        }
+        if (exitInfo.reason == VMExitReason::MSRAccess) {
+            exits++;
+            if (!table.HandleExit(vp)) {
+                ctx.Check(false, "MSR access instruction was decoded");
+                break;
+            }
+        }
+        else if (exitInfo.reason == VMExitReason::HLT) {
+            completed = true;
+            break;
+        }
+        else if (exitInfo.reason != VMExitReason::Cancelled && exitInfo.reason != VMExitReason::Interrupt) {
+            ctx.ExpectExit(VMExitReason::HLT, "HLT instruction");
+            break;
+        }
+    }
+    elapsedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return completed;
+}
+
+static void printMSRResults(const char *label, uint32_t msr, uint32_t iterations, uint64_t exits, uint64_t elapsedNs) {
+    const double seconds = (double)elapsedNs / 1000000000.0;
+    printf("  %s MSR 0x%x: %u iterations in %.1f ms, %.2f M accesses/s, %" PRIu64 " exits (%.0f exits/s)\n",
+        label, msr, iterations, seconds * 1000.0, 2.0 * iterations / seconds / 1000000.0, exits, exits / seconds);
+}
+
+static ScenarioResult msrAccess(ScenarioContext& ctx) {
+    auto& features = ctx.platform.GetFeatures();
+    if (BitmaskEnum(features.extendedVMExits).NoneOf(ExtendedVMExit::MSRAccess)) {
+        ctx.Log("Extended VM exit on MSR access not supported by the platform, skipping test\n\n");
+        return ScenarioResult::Skipped;
+    }
+
+    ctx.Log("Testing extended VM exit: MSR access\n\n");
+
+    // IA32_SYSENTER_CS is part of the guest state and is normally handled by
+    // the hypervisor without exiting
+    const uint32_t passthroughMSR = 0x174;
+    const uint32_t passthroughIterations = 100000;
+
+    // An MSR unknown to the hypervisor, emulated by the host on every access
+    const uint32_t emulatedMSR = 0x56543836;
+    const uint32_t emulatedIterations = 10000;
+    const uint64_t emulatedValue = 0x0123456789abcdefull;
+
+    MSRTable table;
+    table.RegisterValue(emulatedMSR, emulatedValue);
+
+    uint64_t exits, elapsedNs;
+    if (!msrLoop(ctx, table, passthroughMSR, passthroughIterations, exits, elapsedNs)) {
+        ctx.PrintRegs();
+        return ScenarioResult::Failed;
+    }
+    printMSRResults("passthrough", passthroughMSR, passthroughIterations, exits, elapsedNs);
+
+    const uint64_t passthroughReads = table.NumReads();
+    const uint64_t passthroughWrites = table.NumWrites();
+    if (!msrLoop(ctx, table, emulatedMSR, emulatedIterations, exits, elapsedNs)) {
+        ctx.PrintRegs();
+        return ScenarioResult::Failed;
+    }
+    printMSRResults("emulated", emulatedMSR, emulatedIterations, exits, elapsedNs);
+
+    uint64_t value;
+    table.Read(emulatedMSR, value);
+    ctx.Check(exits == 2 * emulatedIterations, "Every emulated MSR access exited");
+    ctx.Check(table.NumReads() - passthroughReads == emulatedIterations + 1 && table.NumWrites() - passthroughWrites == emulatedIterations,
+        "The MSR table handled every read and write");
+    ctx.Check(value == emulatedValue, "The emulated MSR kept its value");
+
+    ctx.PrintRegs();
+    return ctx.Result();
+}
+
+// ----- Coverage ---------------------------------------------------------------------------------------------------------
+
+// Runs the guest from the given address to the next HLT, letting the coverage
+// tracker handle breakpoints. Returns the number of breakpoint exits, or -1
+// if the guest stopped for another reason.
+static int64_t runWithCoverage(ScenarioContext& ctx, CoverageTracker& coverage, uint32_t eip) {
+    auto& vp = ctx.vp;
+    auto& exitInfo = vp.GetVMExitInfo();
+
+    ctx.Enter(eip);
+    int64_t breakpoints = 0;
+    for (;;) {
+        if (!ctx.Run()) {
+            return -1;
+        }
+        if (exitInfo.reason == VMExitReason::SoftwareBreakpoint || exitInfo.reason == VMExitReason::HardwareBreakpoint) {
+            if (!coverage.HandleExit(vp)) {
+                ctx.Check(false, "Breakpoint belongs to a block");
+                return -1;
+            }
+            breakpoints++;
+        }
+        else if (exitInfo.reason == VMExitReason::HLT) {
+            return breakpoints;
+        }
+        else {
+            ctx.ExpectExit(VMExitReason::HLT, "HLT instruction");
+            return -1;
+        }
+    }
+}
+
+static ScenarioResult coverage(ScenarioContext& ctx) {
+    auto& vp = ctx.vp;
+    if (!ctx.platform.GetFeatures().guestDebugging) {
+        ctx.Log("Guest debugging not supported by the platform, skipping test\n\n");
+        return ScenarioResult::Skipped;
+    }
+
+    ctx.Log("Testing basic block coverage\n\n");
+
+    // Blocks in the first two programs of the guest, plus one that is never
+    // reached (the CPUID test)
+    const uint64_t blocks[] = { 0x10000004, 0x10000009, 0x10000013, 0x1000001a, 0x10000085 };
+    uint8_t original[array_size(blocks)];
+    for (size_t i = 0; i < array_size(blocks); i++) {
+        vp.LMemRead(blocks[i], 1, &original[i]);
+    }
+
+    CoverageTracker coverage;
+    coverage.SetBlocks(std::vector<uint64_t>(blocks, blocks + array_size(blocks)));
+    if (!coverage.Arm(vp)) {
+        printf("Failed to arm coverage tracker: %s\n", coverage.Error().c_str());
+        return ScenarioResult::Aborted;
+    }
+
+    // Each block exits once on the first run and never again
+    const int64_t firstRun = runWithCoverage(ctx, coverage, 0x10000004) + runWithCoverage(ctx, coverage, 0x10000013);
+    const int64_t secondRun = runWithCoverage(ctx, coverage, 0x10000004) + runWithCoverage(ctx, coverage, 0x10000013);
+    ctx.Check(firstRun == 4, "Every reached block exited once");
+    ctx.Check(secondRun == 0, "Blocks did not exit again");
+    ctx.Check(coverage.NumHit() == 4 && !coverage.Hit(4), "Coverage bitmap is correct");
+
+    if (!coverage.Disarm(vp)) {
+        printf("Failed to disarm coverage tracker\n");
+        return ScenarioResult::Aborted;
+    }
+    bool restored = true;
+    for (size_t i = 0; i < array_size(blocks); i++) {
+        uint8_t byte;
+        restored &= vp.LMemRead(blocks[i], 1, &byte) && byte == original[i];
+    }
+    ctx.Check(restored, "Original code was restored");
+
+    ctx.PrintRegs();
+    return ctx.Result();
+}
+
+// ----- Registry ---------------------------------------------------------------------------------------------------------
+
+const Scenario scenarios[] = {
+    { "dirty", "Dirty page tracking after initialization", dirtyPages },
+    { "vmem", "Code and data in virtual memory", virtualMemory },
+    { "stack", "Stack push and pop", stack },
+    { "int", "Software interrupts and interrupt injection", interrupts },
+    { "pio", "8, 16 and 32-bit port I/O", pio },
+    { "mmio", "Memory-mapped I/O, including complex instructions", mmio },
+    { "step", "Single stepping", singleStep },
+    { "trace", "Instruction tracing with register deltas", instructionTrace },
+    { "swbp", "Software breakpoints", softwareBreakpoint },
+    { "hwbp", "Hardware breakpoints", hardwareBreakpoint },
+    { "cpuid", "Extended VM exit on CPUID and custom CPUID results", cpuidExit },
+    { "timer-1k", "Periodic timer interrupts at 1 kHz", timer1k },
+    { "timer-10k", "Periodic timer interrupts at 10 kHz", timer10k },
+    { "timer-100k", "Periodic timer interrupts at 100 kHz", timer100k },
+    { "timer-wheel", "Timer wheel expiry past the wheel span", timerWheel },
+    { "msr", "Extended VM exit on MSR access and MSR emulation", msrAccess },
+    { "coverage", "Basic block coverage with one-shot breakpoints", coverage },
+};
+const size_t numScenarios = array_size(scenarios);
+
+const Scenario *findScenario(const char *name) noexcept {
+    for (size_t i = 0; i < numScenarios; i++) {
+        if (strcmp(scenarios[i].name, name) == 0) {
+            return &scenarios[i];
+        }
+    }
+    return nullptr;
+}
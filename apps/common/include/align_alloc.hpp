@@ -29,5 +29,20 @@ SOFTWARE.
 #include <stddef.h>
 
 
-uint8_t *alignedAlloc(const size_t size) noexcept;
+// Allocates a page-aligned block of memory. Mergeable blocks are marked as
+// candidates for kernel same-page merging (KSM) on Linux, which shares
+// identical pages across processes and copies them again when written; the
+// flag is ignored on other platforms and when KSM is unavailable.
+uint8_t *alignedAlloc(const size_t size, const bool mergeable = false) noexcept;
 bool alignedFree(void *memory) noexcept;
+
+// Tells the OS that the contents of a page-aligned range of a block returned
+// by alignedAlloc are no longer needed, so the physical memory backing it can
+// be reclaimed. The range remains allocated and accessible; its contents are
+// undefined until written again.
+bool alignedDiscard(void *memory, const size_t size) noexcept;
+
+// Fills a page-aligned range of a block returned by alignedAlloc with zeros.
+// On Linux and Windows the pages are released and zero-filled when first
+// touched, so clearing costs nothing up front; elsewhere they are written.
+bool alignedClear(void *memory, const size_t size) noexcept;
@@ -0,0 +1,140 @@
+/*
+Declares the timer of a local APIC, including TSC-deadline mode.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "interrupt_controller.hpp"
+#include "io_bus.hpp"
+#include "msr_table.hpp"
+#include "tsc_clock.hpp"
+
+#include <cinttypes>
+#include <stddef.h>
+
+// Local APIC registers emulated by LocalAPICTimer, relative to the xAPIC base
+// address. All accesses are 32 bits wide.
+//
+//   Offset  Access  Description
+//   0x020   R/W     APIC ID
+//   0x030   R       Version: 0x14, with six LVT entries
+//   0x080   R/W     Task priority register; stored but not enforced
+//   0x0B0   W       End of interrupt; counted
+//   0x0F0   R/W     Spurious interrupt vector register: bit 8 enables the
+//                   APIC, and with it the timer
+//   0x320   R/W     LVT timer: vector in bits 7:0, mask in bit 16, mode in
+//                   bits 18:17 (0 = one-shot, 1 = periodic, 2 = TSC-deadline)
+//   0x380   R/W     Initial count; writing it starts the timer in one-shot
+//                   and periodic modes, writing 0 stops it
+//   0x390   R       Current count
+//   0x3E0   R/W     Divide configuration
+//
+// Other registers read as zero and ignore writes. In TSC-deadline mode the
+// timer is armed by writing a guest TSC value to IA32_TSC_DEADLINE, which
+// needs a platform with MSR access exits; writing 0 disarms it, and the MSR
+// reads as 0 once the deadline has passed.
+//
+// Keep in sync with apps/time-bench/src/timebench.asm.
+
+const uint64_t lapicBaseAddress = 0xFEE00000;
+const uint64_t lapicSize = 0x1000;
+const uint32_t IA32_TSC_DEADLINE = 0x6E0;
+
+// The counter runs at 1 GHz before the divider, like KVM's, so one count is
+// one nanosecond at a divisor of 1
+const uint64_t lapicTimerFrequency = 1000000000;
+
+const uint32_t LAPIC_LVT_MASKED = 1u << 16;
+const uint32_t LAPIC_TIMER_ONESHOT = 0u << 17;
+const uint32_t LAPIC_TIMER_PERIODIC = 1u << 17;
+const uint32_t LAPIC_TIMER_TSC_DEADLINE = 2u << 17;
+const uint32_t LAPIC_SVR_ENABLE = 1u << 8;
+
+// Emulates the timer of a single local APIC. Expirations are scheduled on the
+// interrupt controller, which raises the LVT timer vector from its timer
+// thread. The rest of the APIC is reduced to what a guest needs to program
+// and acknowledge the timer: there is no in-service or priority tracking, so
+// the guest must not rely on the APIC to hold back nested timer interrupts.
+class LocalAPICTimer {
+public:
+    LocalAPICTimer(InterruptController& controller, const TSCClock& clock) noexcept;
+    ~LocalAPICTimer() noexcept;
+
+    // Claims the APIC register page on the I/O bus.
+    bool Attach(IOBus& bus, uint64_t baseAddress = lapicBaseAddress) noexcept;
+
+    // Registers IA32_TSC_DEADLINE for TSC-deadline mode.
+    bool Attach(MSRTable& msrs) noexcept;
+
+    uint64_t NumArmed() const noexcept { return m_numArmed; }
+    uint64_t NumEOIs() const noexcept { return m_numEOIs; }
+
+private:
+    static uint64_t MMIORead(void *context, uint64_t address, size_t size) noexcept;
+    static void MMIOWrite(void *context, uint64_t address, size_t size, uint64_t value) noexcept;
+    static bool DeadlineRead(void *context, uint32_t msr, uint64_t& value);
+    static bool DeadlineWrite(void *context, uint32_t msr, uint64_t value);
+
+    uint32_t Mode() const noexcept { return m_lvtTimer & (3u << 17); }
+    uint32_t CurrentCount() const noexcept;
+
+    void WriteSVR(uint32_t value) noexcept;
+    void WriteLVT(uint32_t value) noexcept;
+    void WriteInitialCount(uint32_t value) noexcept;
+    void WriteDivide(uint32_t value) noexcept;
+    void WriteDeadline(uint64_t value) noexcept;
+
+    // Schedules the next expiration of the running count or deadline if the
+    // timer can deliver interrupts, cancelling any scheduled one. A one-shot
+    // expiration in the past fires at once if the count or deadline was just
+    // written (started), and is dropped otherwise.
+    void Schedule(bool started) noexcept;
+    void Cancel() noexcept;
+
+    InterruptController& m_controller;
+    const TSCClock& m_clock;
+    uint64_t m_baseAddress = lapicBaseAddress;
+
+    // Registers
+    uint32_t m_id = 0;
+    uint32_t m_tpr = 0;
+    uint32_t m_svr = 0xFF;
+    uint32_t m_lvtTimer = LAPIC_LVT_MASKED;
+    uint32_t m_initialCount = 0;
+    uint32_t m_divideConfig = 0;
+    uint32_t m_divisor = 2;
+    uint64_t m_tscDeadline = 0;
+
+    // Timer state, in controller time. The count keeps running while the
+    // timer is masked; only the interrupt is held back.
+    bool m_running = false;
+    uint64_t m_start = 0;       // When the initial count was written
+    uint64_t m_duration = 0;    // Of one count down
+    uint64_t m_deadline = 0;    // Next expiration
+    uint64_t m_period = 0;      // Zero for one-shot and TSC-deadline modes
+    uint64_t m_timerID = TimerWheel::invalidTimer;
+
+    uint64_t m_numArmed = 0;
+    uint64_t m_numEOIs = 0;
+};
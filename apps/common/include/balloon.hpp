@@ -0,0 +1,109 @@
+/*
+Declares a memory balloon device that returns free guest pages to the host.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "guest_memory.hpp"
+#include "io_bus.hpp"
+
+#include <cinttypes>
+#include <stddef.h>
+#include <vector>
+
+// Balloon device ABI
+// ------------------
+// The guest gives free pages to the host (inflating the balloon) and takes
+// them back (deflating it) by reporting ranges of page frames. All accesses
+// are 32 bits wide.
+//
+//   Port            Access  Description
+//   balloonPort+0   W       Page frame number of the first page of a range
+//   balloonPort+4   W       Number of pages in the range; the write applies
+//                           the current command to the range
+//   balloonPort+8   W       Command applied to the following ranges
+//   balloonPort+0   R       Balloon size in pages requested by the host
+//   balloonPort+4   R       Current balloon size in pages
+//   balloonPort+8   R       Status of the last range: 0 on success, or
+//                           BALLOON_EINVAL if it was not backed by guest RAM
+//
+// The contents of inflated pages are discarded. Deflated pages read as zeros
+// on Linux and are undefined on other hosts until written by the guest.
+//
+// Keep in sync with apps/x64-guest/src/ram.asm.
+
+const uint16_t balloonPort = 0x0610;
+
+enum BalloonCommand : uint32_t {
+    BALLOON_INFLATE = 1,
+    BALLOON_DEFLATE = 2,
+};
+
+const uint32_t BALLOON_EINVAL = 1;
+
+class BalloonDevice {
+public:
+    // Pages can be ballooned anywhere in guest memory below maxAddress.
+    BalloonDevice(const GuestMemory& memory, uint64_t maxAddress) noexcept;
+
+    // Claims the balloon ports on the I/O bus.
+    bool Attach(IOBus& bus, uint16_t port = balloonPort) noexcept;
+
+    // Sets the balloon size the guest should reach.
+    void SetTarget(uint32_t pages) noexcept { m_target = pages; }
+    uint32_t Target() const noexcept { return m_target; }
+
+    // Adds pages to or removes pages from the balloon. Pages already in the
+    // requested state are ignored. Returns false if the range is not backed
+    // by guest memory.
+    bool Inflate(uint64_t pfn, uint64_t count) noexcept;
+    bool Deflate(uint64_t pfn, uint64_t count) noexcept;
+
+    bool Contains(uint64_t pfn) const noexcept;
+
+    uint64_t NumPages() const noexcept { return m_numPages; }
+    uint64_t PeakPages() const noexcept { return m_peakPages; }
+    uint64_t NumInflated() const noexcept { return m_numInflated; }
+    uint64_t NumDeflated() const noexcept { return m_numDeflated; }
+
+private:
+    static uint32_t PortRead(void *context, uint16_t port, size_t size) noexcept;
+    static void PortWrite(void *context, uint16_t port, size_t size, uint32_t value) noexcept;
+
+    uint8_t *TranslateRange(uint64_t pfn, uint64_t count) const noexcept;
+
+    const GuestMemory& m_memory;
+    uint16_t m_port = balloonPort;
+    std::vector<uint64_t> m_bitmap;  // One bit per page frame below maxAddress
+
+    uint32_t m_target = 0;
+    uint32_t m_command = BALLOON_INFLATE;
+    uint32_t m_rangePFN = 0;
+    uint32_t m_status = 0;
+
+    uint64_t m_numPages = 0;
+    uint64_t m_peakPages = 0;
+    uint64_t m_numInflated = 0;     // Pages added to the balloon over time
+    uint64_t m_numDeflated = 0;     // Pages removed from the balloon over time
+};
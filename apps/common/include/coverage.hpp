@@ -0,0 +1,100 @@
+/*
+Declares a basic block coverage tracker based on one-shot guest breakpoints.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "virt86/virt86.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Records which basic blocks of the guest have executed, given the linear
+// addresses of the block starts.
+//
+// Arm writes an INT3 over the first byte of every block. When a block is
+// reached, HandleExit marks it in a bitmap and restores the original byte,
+// so each block causes at most one VM exit and the guest then runs at full
+// speed. Blocks whose memory cannot be accessed when armed, such as code
+// that is not mapped yet, are covered by one-shot hardware breakpoints
+// instead, up to four at a time.
+//
+// Guests that read their own code will see the INT3 bytes of blocks that
+// have not run yet. Code must not move while the tracker is armed.
+class CoverageTracker {
+public:
+    // Replaces the block list with the contents of a file containing one
+    // hexadecimal linear address per line. Text after a # is ignored.
+    bool Load(const char *path);
+    void SetBlocks(std::vector<uint64_t> blocks);
+
+    // Patches every block that has not been hit and enables software
+    // breakpoints. Call again after Reset to collect coverage for another run.
+    bool Arm(virt86::VirtualProcessor& vp);
+
+    // Restores the original bytes of every armed block and clears the
+    // hardware breakpoints.
+    bool Disarm(virt86::VirtualProcessor& vp);
+
+    // Clears the hit bitmap. Blocks are patched again on the next Arm.
+    void Reset() noexcept;
+
+    // Handles a software or hardware breakpoint exit. Returns true if the
+    // breakpoint belongs to a block; the guest can then resume at the block.
+    bool HandleExit(virt86::VirtualProcessor& vp) noexcept;
+
+    size_t NumBlocks() const noexcept { return m_blocks.size(); }
+    size_t NumHit() const noexcept { return m_numHit; }
+    bool Hit(size_t block) const noexcept { return (m_hitBitmap[block / 64] >> (block & 63)) & 1; }
+    uint64_t BlockAddress(size_t block) const noexcept { return m_blocks[block]; }
+    const std::string& Error() const noexcept { return m_error; }
+
+    // Writes the addresses of the blocks that were hit, in the format read
+    // by Load.
+    bool Save(const char *path) const noexcept;
+
+private:
+    enum class State : uint8_t {
+        Idle,       // Not armed, or hit
+        Patched,    // INT3 written over the first byte
+        Hardware,   // Waiting for a hardware breakpoint slot or in one
+    };
+
+    size_t Find(uint64_t address) const noexcept;
+    void MarkHit(size_t block) noexcept;
+    bool UpdateHardwareBreakpoints(virt86::VirtualProcessor& vp, bool force) noexcept;
+
+    std::vector<uint64_t> m_blocks;         // Sorted linear addresses
+    std::vector<uint8_t> m_original;        // Original first byte of each block
+    std::vector<State> m_state;
+    std::vector<uint64_t> m_hitBitmap;
+    size_t m_numHit = 0;
+
+    static const size_t numHardwareBreakpoints = 4;
+    size_t m_hwSlots[numHardwareBreakpoints] = { SIZE_MAX, SIZE_MAX, SIZE_MAX, SIZE_MAX };  // Block in each slot, or SIZE_MAX
+    std::string m_error;
+};
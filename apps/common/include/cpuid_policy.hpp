@@ -0,0 +1,116 @@
+/*
+Declares a table of CPUID results presented to the guest, loaded from a file
+or derived from the host processor.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "virt86/virt86.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// The complete set of CPUID results seen by the guest.
+//
+// Install moves as many leaves as the hypervisor allows into the VM's
+// CPUIDResults, so the guest reads them without exiting. The remaining
+// leaves, including every leaf whose results depend on the subleaf in ECX,
+// are configured to exit and are answered by HandleExit from a flat table
+// indexed by function number. Functions missing from the table return zeros.
+//
+// Table files contain one leaf per line with hexadecimal values:
+//
+//   # function subleaf  eax      ebx      ecx      edx
+//   00000000   *        0000000d 756e6547 6c65746e 49656e69
+//   00000007   0        00000000 009c6fbb 00000000 bc000400
+//
+// A subleaf of * marks a leaf that ignores ECX. Empty lines and text after
+// a # are ignored.
+class CPUIDPolicy {
+public:
+    static const uint32_t anySubleaf = UINT32_MAX;
+
+    struct Leaf {
+        uint32_t function;
+        uint32_t subleaf;   // anySubleaf if the leaf ignores ECX
+        uint32_t eax, ebx, ecx, edx;
+    };
+
+    struct InstallStats {
+        size_t installed = 0;   // Leaves answered by the hypervisor
+        size_t trapped = 0;     // Functions answered by HandleExit
+        size_t unhandled = 0;   // Functions answered by the hypervisor's defaults
+    };
+
+    // Replaces the table with the contents of a file. On failure, the table
+    // is left unchanged and Error describes the problem.
+    bool Load(const char *path);
+    bool Save(const char *path) const noexcept;
+
+    // Replaces the table with the host processor's CPUID results, with
+    // virtualization extensions hidden and the hypervisor bit set.
+    void LoadHost();
+
+    // Adds or replaces a leaf. Use anySubleaf for leaves that ignore ECX.
+    void Set(uint32_t function, uint32_t subleaf, uint32_t eax, uint32_t ebx, uint32_t ecx, uint32_t edx);
+
+    // Clears and then sets bits of one register of a leaf, if it exists.
+    // The register is 0 for EAX, 1 for EBX, 2 for ECX and 3 for EDX.
+    void Mask(uint32_t function, uint32_t subleaf, size_t reg, uint32_t clearBits, uint32_t setBits) noexcept;
+
+    const Leaf *Find(uint32_t function, uint32_t subleaf) const noexcept;
+    const std::vector<Leaf>& Leaves() const noexcept { return m_leaves; }
+    const std::string& Error() const noexcept { return m_error; }
+
+    // Adds the leaves to the VM specifications: as CPUID results where the
+    // platform supports them and as CPUID exits otherwise.
+    InstallStats Install(virt86::VMSpecifications& specs, const virt86::PlatformFeatures& features) const;
+
+    // Answers a CPUID exit with the results for the function and subleaf in
+    // EAX and ECX. Returns false if the registers could not be accessed.
+    bool HandleExit(virt86::VirtualProcessor& vp) noexcept;
+
+    uint64_t NumExits() const noexcept { return m_numExits; }
+
+private:
+    // Leaves of a range of functions starting at base. index[n] is the
+    // position in m_leaves of the first leaf of function base + n, and
+    // index[n + 1] the end of its leaves.
+    struct Range {
+        uint32_t base = 0;
+        std::vector<uint32_t> index;
+    };
+
+    void Rebuild();
+    static uint64_t Key(const Leaf& leaf) noexcept { return ((uint64_t)leaf.function << 32) | leaf.subleaf; }
+
+    std::vector<Leaf> m_leaves;     // Sorted by function, then subleaf
+    Range m_basic;                  // Functions 0x00000000 and up
+    Range m_extended;               // Functions 0x80000000 and up
+    std::string m_error;
+    uint64_t m_numExits = 0;
+};
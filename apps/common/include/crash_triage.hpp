@@ -0,0 +1,88 @@
+/*
+Declares compact crash records captured from exception VM exits.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "virt86/virt86.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <stddef.h>
+
+// Turns guest faults into crash records instead of hangs or triple faults.
+//
+// Enable adds exception exits to the VM specifications. The run loop calls
+// Capture only when an exit reports VMExitReason::Exception, so there is no
+// cost on other exits. Capture reads the registers in one batched read, the
+// faulting address from CR2 and a few bytes of code at the instruction
+// pointer.
+//
+// virt86 does not report which exception caused the exit. If a single
+// exception is enabled it is known; otherwise it is inferred from the
+// captured state: an undefined opcode at RIP means #UD, code or a CR2
+// address that cannot be translated means #PF, and anything else #GP.
+class CrashTriage {
+public:
+    static const size_t maxCodeBytes = 16;
+
+    struct Record {
+        uint64_t timestamp;             // Seconds since the epoch
+        virt86::ExceptionCode exception;
+        bool exceptionInferred;
+
+        uint64_t gpr[16];               // RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8..R15
+        uint64_t rip, rflags;
+        uint16_t cs, ss;
+        uint64_t csBase;
+        uint64_t cr0, cr2, cr3, cr4, efer;
+
+        uint64_t faultLinear;           // CR2 for page faults, the code address otherwise
+        uint64_t faultPhysical;
+        bool faultPhysicalValid;
+
+        uint8_t code[maxCodeBytes];
+        size_t codeLength;              // Bytes readable at the instruction pointer
+    };
+
+    // #PF, #GP, #UD and #DF
+    static const virt86::ExceptionCode defaultExceptions;
+
+    // Enables exits on the given exceptions that the platform supports.
+    // Returns the exceptions that will exit.
+    virt86::ExceptionCode Enable(virt86::VMSpecifications& specs, const virt86::PlatformFeatures& features,
+        virt86::ExceptionCode exceptions = defaultExceptions) noexcept;
+
+    // Captures the state of a virtual processor that exited on an exception.
+    bool Capture(virt86::VirtualProcessor& vp, Record& record) const noexcept;
+
+    // Prints a record, or appends it to a triage file.
+    static void Print(FILE *out, const Record& record) noexcept;
+    static bool Append(const char *path, const Record& record) noexcept;
+
+    static const char *ExceptionName(virt86::ExceptionCode exception) noexcept;
+
+private:
+    virt86::ExceptionCode m_enabled = virt86::ExceptionCode::None;
+};
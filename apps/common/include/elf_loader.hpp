@@ -0,0 +1,108 @@
+/*
+Declares a loader that places the segments of an ELF64 executable in guest RAM.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "page_table_builder.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Loads a statically linked x86-64 ELF executable into guest RAM.
+//
+// Each PT_LOAD segment is placed at its physical address. BSS is zero-filled
+// lazily with alignedClear where whole pages allow it. On request, on Linux,
+// the pages of a segment whose file offset and address agree modulo the page
+// size are mapped straight from the file, copy-on-write, so only the pages
+// the guest touches are ever read; everything else is copied. Loading then
+// costs time in proportion to the segments, not to guest RAM.
+//
+// File-backed pages stay mapped in the RAM block until it is freed.
+// Discarding them with alignedDiscard or alignedClear brings back the file
+// contents instead of zeros, even after the guest wrote them, and KSM never
+// merges them. Only map from the file when nothing will discard or merge
+// guest RAM: no balloon, no page deduplication and no shrinking.
+class ElfLoader {
+public:
+    // Segment permission flags
+    static const uint32_t PF_X = (1u << 0);
+    static const uint32_t PF_W = (1u << 1);
+    static const uint32_t PF_R = (1u << 2);
+
+    struct Segment {
+        uint64_t virtualAddress;
+        uint64_t physicalAddress;
+        uint64_t fileOffset;
+        uint64_t fileSize;
+        uint64_t memorySize;
+        uint32_t flags;
+    };
+
+    ~ElfLoader() noexcept;
+
+    // Returns true if the file starts with the ELF magic number
+    static bool IsELF(const char *path) noexcept;
+
+    // Reads and validates the ELF header and the program headers
+    bool Open(const char *path);
+
+    // Places every segment in the guest RAM block at ram, which holds the
+    // guest physical range [ramBase, ramBase + ramSize). Both ram and ramBase
+    // must be page-aligned. Fails if a segment falls outside the range.
+    // mapFromFile enables mapping pages from the file on Linux; see above for
+    // when that is safe.
+    bool Load(uint8_t *ram, uint64_t ramBase, uint64_t ramSize, bool mapFromFile = false);
+
+    // Maps the virtual range of every segment to its physical range, writable
+    // if the segment is. Virtual and physical addresses must agree modulo the
+    // page size.
+    bool MapSegments(PageTableBuilder& pageTables);
+
+    uint64_t Entry() const noexcept { return m_entry; }
+    const std::vector<Segment>& Segments() const noexcept { return m_segments; }
+
+    // What Load did with the segments' bytes
+    uint64_t BytesMapped() const noexcept { return m_bytesMapped; }
+    uint64_t BytesCopied() const noexcept { return m_bytesCopied; }
+    uint64_t BytesZeroed() const noexcept { return m_bytesZeroed; }
+
+    const std::string& Error() const noexcept { return m_error; }
+
+private:
+    bool Copy(uint8_t *dest, uint64_t fileOffset, uint64_t size);
+    void Zero(uint8_t *dest, uint64_t size) noexcept;
+
+    FILE *m_file = nullptr;
+    uint64_t m_entry = 0;
+    std::vector<Segment> m_segments;
+
+    uint64_t m_bytesMapped = 0;
+    uint64_t m_bytesCopied = 0;
+    uint64_t m_bytesZeroed = 0;
+    std::string m_error;
+};
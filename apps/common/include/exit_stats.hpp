@@ -0,0 +1,191 @@
+/*
+Declares per-VCPU VM exit and I/O callback statistics with Prometheus export.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "virt86/virt86.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+// Log-linear latency histogram in the style of HdrHistogram: each power of
+// two is split into 8 sub-buckets, giving ~12.5% relative precision over the
+// whole 64-bit range in a fixed 4 KiB table.
+//
+// Values are recorded by a single writer thread without locked instructions;
+// readers may observe a snapshot that is slightly behind but never torn.
+class LatencyHistogram {
+public:
+    static const size_t subBucketBits = 3;
+    static const size_t subBuckets = 1 << subBucketBits;
+    static const size_t numBuckets = (64 - subBucketBits + 1) * subBuckets;
+
+    void Record(uint64_t value) noexcept {
+        Increment(m_buckets[BucketIndex(value)]);
+        Increment(m_count);
+        m_sum.store(m_sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        if (value > m_max.load(std::memory_order_relaxed)) {
+            m_max.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t Count() const noexcept { return m_count.load(std::memory_order_relaxed); }
+    uint64_t Sum() const noexcept { return m_sum.load(std::memory_order_relaxed); }
+    uint64_t Max() const noexcept { return m_max.load(std::memory_order_relaxed); }
+    uint64_t BucketCount(size_t index) const noexcept { return m_buckets[index].load(std::memory_order_relaxed); }
+
+    // Returns the upper bound of the bucket containing the given percentile (0 to 100).
+    uint64_t Percentile(double percentile) const noexcept;
+
+    // Returns the number of recorded values strictly below the given power of two.
+    uint64_t CountBelowPow2(size_t exponent) const noexcept;
+
+    static size_t BucketIndex(uint64_t value) noexcept;
+    static uint64_t BucketLowerBound(size_t index) noexcept;
+    static uint64_t BucketUpperBound(size_t index) noexcept;
+
+private:
+    static void Increment(std::atomic<uint64_t>& counter) noexcept {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> m_buckets[numBuckets] = {};
+    std::atomic<uint64_t> m_count{ 0 };
+    std::atomic<uint64_t> m_sum{ 0 };
+    std::atomic<uint64_t> m_max{ 0 };
+};
+
+// Callbacks timed by IOCallbackTimer
+enum class IOCallbackKind {
+    PIORead,
+    PIOWrite,
+    MMIORead,
+    MMIOWrite,
+};
+
+const size_t numIOCallbackKinds = 4;
+const char *iocallback_kind_str(IOCallbackKind kind) noexcept;
+
+// Exit statistics of a single virtual processor. All Record* methods must be
+// called from the thread that runs the virtual processor.
+class VCPUExitStats {
+public:
+    // One slot per VMExitReason, plus one for unknown reasons
+    static const size_t numReasons = static_cast<size_t>(virt86::VMExitReason::Unhandled) + 2;
+
+    // Runs or steps the virtual processor, timing the call and recording the
+    // exit reason. I/O callbacks invoked during the call are attributed to
+    // this virtual processor.
+    virt86::VPExecutionStatus Run(virt86::VirtualProcessor& vp) noexcept;
+    virt86::VPExecutionStatus Step(virt86::VirtualProcessor& vp) noexcept;
+
+    void RecordExit(virt86::VMExitReason reason, uint64_t nanoseconds) noexcept {
+        size_t index = static_cast<size_t>(reason);
+        if (index >= numReasons) {
+            index = numReasons - 1;
+        }
+        m_exits[index].Record(nanoseconds);
+    }
+
+    void RecordIO(IOCallbackKind kind, uint64_t nanoseconds) noexcept {
+        m_io[static_cast<size_t>(kind)].Record(nanoseconds);
+    }
+
+    void RecordFailure() noexcept {
+        m_failures.store(m_failures.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    const LatencyHistogram& Exits(size_t reasonIndex) const noexcept { return m_exits[reasonIndex]; }
+    const LatencyHistogram& IO(IOCallbackKind kind) const noexcept { return m_io[static_cast<size_t>(kind)]; }
+    uint64_t Failures() const noexcept { return m_failures.load(std::memory_order_relaxed); }
+
+    // Exits recorded for all reasons
+    uint64_t TotalExits() const noexcept {
+        uint64_t total = 0;
+        for (auto& exits : m_exits) {
+            total += exits.Count();
+        }
+        return total;
+    }
+
+    // The statistics of the virtual processor being run by the calling
+    // thread, or nullptr if none is running.
+    static VCPUExitStats *Current() noexcept;
+
+private:
+    LatencyHistogram m_exits[numReasons];
+    LatencyHistogram m_io[numIOCallbackKinds];
+    std::atomic<uint64_t> m_failures{ 0 };
+};
+
+// Times the enclosing scope as an I/O callback of the virtual processor
+// currently running on this thread. Does nothing outside VCPUExitStats::Run.
+class IOCallbackTimer {
+public:
+    explicit IOCallbackTimer(IOCallbackKind kind) noexcept
+        : m_stats(VCPUExitStats::Current())
+        , m_kind(kind)
+    {
+        if (m_stats != nullptr) {
+            m_start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~IOCallbackTimer() noexcept {
+        if (m_stats != nullptr) {
+            auto elapsed = std::chrono::steady_clock::now() - m_start;
+            m_stats->RecordIO(m_kind, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+    }
+
+private:
+    VCPUExitStats *m_stats;
+    IOCallbackKind m_kind;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// Exit statistics of all virtual processors in a virtual machine.
+class ExitStats {
+public:
+    explicit ExitStats(size_t numVCPUs) noexcept;
+
+    size_t NumVCPUs() const noexcept { return m_numVCPUs; }
+    VCPUExitStats& VCPU(size_t index) noexcept { return m_vcpus[index]; }
+    const VCPUExitStats& VCPU(size_t index) const noexcept { return m_vcpus[index]; }
+
+    // Appends all metrics in the Prometheus text exposition format (0.0.4).
+    void WritePrometheus(std::string& out) const;
+
+    // Prints a table with counts and latency percentiles per exit reason and
+    // I/O callback kind.
+    void PrintSummary(FILE *fp) const noexcept;
+
+private:
+    size_t m_numVCPUs;
+    std::unique_ptr<VCPUExitStats[]> m_vcpus;
+};
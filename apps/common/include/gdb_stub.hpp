@@ -0,0 +1,144 @@
+/*
+Declares a GDB remote serial protocol stub for debugging a virtual processor.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "virt86/virt86.hpp"
+
+#include "guest_memory.hpp"
+#include "socket.hpp"
+
+#include <cinttypes>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Lets GDB debug a virtual processor over a local TCP or UNIX domain socket
+// using the remote serial protocol. Supported packets:
+//   ?, g, G, p, P   stop reason and registers
+//   m, M            memory at linear addresses
+//   Z0/z0, Z1/z1    software and hardware execution breakpoints
+//   s, c            step and continue, optionally from a new address
+//   D, k            detach; the guest keeps running without the debugger
+//   qSupported, qXfer:features:read, QStartNoAckMode and a few queries
+//
+// Registers are presented in GDB's x86-64 layout up to the segment
+// selectors and read in one batched call. Segment selectors cannot be
+// changed from GDB. Memory is translated to physical addresses a page at a
+// time and read straight from host RAM when GuestMemory knows the page,
+// falling back to VirtualProcessor::LMemRead otherwise.
+//
+// The stub owns the run loop while a debugger is attached. Exits other than
+// its own breakpoints and steps go to the exit handler, which returns true
+// to keep the guest running or false to return from Run. virt86 cannot stop
+// a running virtual processor from another thread, so a Ctrl-C from GDB
+// takes effect at the next VM exit.
+class GDBStub {
+public:
+    // Handles a VM exit that does not belong to the debugger
+    typedef bool (*ExitHandler)(void *context, virt86::VirtualProcessor& vp);
+
+    explicit GDBStub(const GuestMemory& memory) noexcept;
+    ~GDBStub() noexcept;
+
+    // Starts listening on the endpoint, in the format accepted by socketListen.
+    bool Listen(const char *endpoint) noexcept;
+
+    // Waits up to timeoutMs milliseconds for GDB to connect. The guest is
+    // stopped until GDB resumes it.
+    bool Accept(int timeoutMs) noexcept;
+
+    // Runs the guest until the exit handler returns false, serving the
+    // debugger while it is attached. Returns false if the virtual processor
+    // failed to run.
+    bool Run(virt86::VirtualProcessor& vp, ExitHandler handler, void *context) noexcept;
+
+    // Removes the breakpoints and closes the connection.
+    void Detach(virt86::VirtualProcessor& vp) noexcept;
+
+    bool Attached() const noexcept { return m_client != invalidSocket; }
+
+    uint64_t NumPackets() const noexcept { return m_numPackets; }
+
+private:
+    enum class State {
+        Stopped,
+        Continue,
+        Step,
+    };
+
+    struct SoftwareBreakpoint {
+        uint64_t address;
+        uint8_t original;
+    };
+
+    // Serves packets until the debugger resumes the guest or detaches
+    void Serve(virt86::VirtualProcessor& vp) noexcept;
+    void HandlePacket(virt86::VirtualProcessor& vp, const std::string& packet) noexcept;
+
+    bool ReceivePacket(std::string& packet) noexcept;
+    bool SendPacket(const std::string& data) noexcept;
+    bool InterruptRequested() noexcept;
+
+    void ReadRegisters(virt86::VirtualProcessor& vp) noexcept;
+    void WriteRegisters(virt86::VirtualProcessor& vp, const char *hex) noexcept;
+    void ReadRegister(virt86::VirtualProcessor& vp, const char *args) noexcept;
+    void WriteRegister(virt86::VirtualProcessor& vp, const char *args) noexcept;
+    void ReadMemory(virt86::VirtualProcessor& vp, const char *args) noexcept;
+    void WriteMemory(virt86::VirtualProcessor& vp, const char *args) noexcept;
+    void Resume(virt86::VirtualProcessor& vp, const char *args, State state) noexcept;
+    void Query(const std::string& packet) noexcept;
+
+    // Copies between linear guest memory and a host buffer, reading and
+    // writing host RAM directly where possible. Returns the number of bytes
+    // copied before the first inaccessible page.
+    size_t AccessMemory(virt86::VirtualProcessor& vp, uint64_t address, uint8_t *buffer, size_t size, bool write) noexcept;
+
+    bool InsertBreakpoint(virt86::VirtualProcessor& vp, char type, uint64_t address) noexcept;
+    bool RemoveBreakpoint(virt86::VirtualProcessor& vp, char type, uint64_t address) noexcept;
+    bool UpdateHardwareBreakpoints(virt86::VirtualProcessor& vp) noexcept;
+
+    // Returns the stop reply for a breakpoint exit, or nullptr if the
+    // breakpoint was not set by the debugger
+    const char *BreakpointStop(virt86::VirtualProcessor& vp) const noexcept;
+
+    const GuestMemory& m_memory;
+
+    socket_t m_listener = invalidSocket;
+    socket_t m_client = invalidSocket;
+    State m_state = State::Stopped;
+    bool m_noAck = false;
+
+    std::string m_input;          // Received bytes not yet parsed
+    std::string m_reply;          // Reply being built
+    std::vector<uint8_t> m_data;  // Scratch buffer for memory transfers
+
+    std::vector<SoftwareBreakpoint> m_swBreakpoints;
+    uint64_t m_hwBreakpoints[4];
+    bool m_hwUsed[4] = { false, false, false, false };
+
+    uint64_t m_numExits = 0;
+    uint64_t m_numPackets = 0;
+};
@@ -0,0 +1,121 @@
+/*
+Declares a manager for the guest physical address space of a virtual machine.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "virt86/virt86.hpp"
+
+#include "guest_memory.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Keeps track of the host memory blocks mapped into a virtual machine's guest
+// physical address space. All mappings of the VM should go through this class
+// so that overlaps are rejected and device models see the same map through
+// the optional GuestMemory.
+//
+// RAM regions can be grown and shrunk at runtime up to a maximum size
+// reserved when they are added. Shrinking returns the host memory of the
+// removed pages to the OS. Unmapping and shrinking depend on the hypervisor's
+// memoryUnmapping and partialUnmapping features.
+//
+// Not thread-safe. Mappings must not be changed while virtual processors run.
+class GuestAddressSpace {
+public:
+    struct Region {
+        std::string name;
+        uint64_t baseAddress;
+        uint64_t size;          // Currently mapped size
+        uint64_t maxSize;       // Size of the host memory block
+        uint8_t *memory;
+        virt86::MemoryFlags flags;
+        bool owned;             // Host memory was allocated by AddRAM
+
+        // Hypervisor mappings backing the region, as offsets from the base
+        // address. Growing a region adds mappings instead of replacing them.
+        std::vector<std::pair<uint64_t, uint64_t>> mappings;
+    };
+
+    GuestAddressSpace(virt86::VirtualMachine& vm, const virt86::PlatformFeatures& features, GuestMemory *guestMemory = nullptr) noexcept;
+    ~GuestAddressSpace() noexcept;
+
+    // Maps a host memory block owned by the caller. Returns
+    // MemoryMappingStatus::AlreadyAllocated if the range overlaps an existing
+    // region and OutOfBounds if it exceeds the guest physical address range.
+    virt86::MemoryMappingStatus Map(const char *name, uint64_t baseAddress, uint64_t size, virt86::MemoryFlags flags, uint8_t *memory) noexcept;
+
+    // Allocates zeroed host memory for maxSize bytes of RAM and maps the first
+    // size bytes. The rest of the range is reserved for growing the region and
+    // may not be used by other regions.
+    virt86::MemoryMappingStatus AddRAM(const char *name, uint64_t baseAddress, uint64_t size, uint64_t maxSize, virt86::MemoryFlags flags) noexcept;
+
+    // Marks host memory allocated by subsequent AddRAM calls as mergeable by
+    // kernel same-page merging (see alignedAlloc).
+    void SetMergeable(bool mergeable) noexcept { m_mergeable = mergeable; }
+
+    // Changes the mapped size of the region at the given base address.
+    // Shrinking unmaps the tail of the region and discards its host memory;
+    // without partialUnmapping, the mapping that contains the new end is
+    // removed and the part below it is remapped.
+    virt86::MemoryMappingStatus Resize(uint64_t baseAddress, uint64_t newSize) noexcept;
+
+    // Unmaps the region at the given base address and frees its host memory
+    // if it was allocated by AddRAM.
+    virt86::MemoryMappingStatus Unmap(uint64_t baseAddress) noexcept;
+
+    // Unmaps every region, newest first, and stops at the first failure. Must
+    // be called before the VM is freed; the destructor calls it otherwise,
+    // which is only safe while the VM still exists.
+    virt86::MemoryMappingStatus UnmapAll() noexcept;
+
+    // Returns the region containing the guest physical address, or nullptr.
+    // Addresses in the reserved part of a RAM region return the region.
+    const Region *Find(uint64_t address) const noexcept;
+
+    const std::vector<Region>& Regions() const noexcept { return m_regions; }
+    uint64_t TotalMapped() const noexcept;
+    uint64_t TotalDiscarded() const noexcept { return m_discarded; }
+
+    void Print(FILE *out) const noexcept;
+
+private:
+    Region *FindByBase(uint64_t baseAddress) noexcept;
+    bool Overlaps(uint64_t baseAddress, uint64_t size) const noexcept;
+    virt86::MemoryMappingStatus Insert(Region&& region) noexcept;
+    virt86::MemoryMappingStatus Shrink(Region& region, uint64_t newSize) noexcept;
+    void SyncGuestMemory(const Region& region) noexcept;
+
+    virt86::VirtualMachine& m_vm;
+    const virt86::PlatformFeatures& m_features;
+    GuestMemory *m_guestMemory;
+
+    std::vector<Region> m_regions;  // Sorted by base address
+    uint64_t m_discarded = 0;
+    bool m_mergeable = false;
+};
@@ -0,0 +1,62 @@
+/*
+Declares a registry of host memory blocks mapped into the guest physical
+address space, used to access guest memory directly from device code.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <cinttypes>
+#include <stddef.h>
+#include <vector>
+
+// Translates guest physical addresses into pointers to the host memory blocks
+// that back them. Device models use this to read and write guest buffers in
+// place instead of going through VirtualProcessor::MemRead/MemWrite.
+class GuestMemory {
+public:
+    // Registers a host memory block mapped at the given guest physical address.
+    // Regions must not overlap.
+    bool AddRegion(uint64_t baseAddress, uint64_t size, uint8_t *memory) noexcept;
+    bool RemoveRegion(uint64_t baseAddress) noexcept;
+
+    // Returns a pointer to the host memory backing the guest physical range
+    // [address, address + size), or nullptr if the range is not fully
+    // contained in a single region.
+    uint8_t *Translate(uint64_t address, uint64_t size) const noexcept;
+
+    template<typename T>
+    T *Get(uint64_t address) const noexcept {
+        return reinterpret_cast<T *>(Translate(address, sizeof(T)));
+    }
+
+private:
+    struct Region {
+        uint64_t baseAddress;
+        uint64_t size;
+        uint8_t *memory;
+    };
+
+    // Sorted by base address
+    std::vector<Region> m_regions;
+};
@@ -0,0 +1,115 @@
+/*
+Declares the paravirtual hypercall ABI and its host-side dispatcher.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "guest_memory.hpp"
+#include "io_bus.hpp"
+
+#include <cinttypes>
+#include <stddef.h>
+
+// Hypercall ABI
+// -------------
+// The guest fills a page-aligned batch page in guest physical memory with a
+// HypercallBatch header followed by up to hypercallMaxRequests requests, then
+// submits the whole batch with a single 32-bit OUT of the page frame number
+// (guest physical address >> 12) to hypercallPort. The host processes the
+// requests in order before the OUT instruction completes, writes each result
+// into its request and stores the number of processed requests in the
+// header. Bulk payloads are passed by guest physical address and length and
+// are accessed by the host in place.
+//
+// Keep in sync with apps/x64-guest/src/ram.asm.
+
+const uint16_t hypercallPort = 0x0600;
+
+enum HypercallNumber : uint32_t {
+    HC_NOP = 0,             // No operation; returns 0
+    HC_CONSOLE_WRITE = 1,   // args: gpa, length. Writes a string to the host console; returns bytes written
+    HC_CHECKSUM = 2,        // args: gpa, length. Returns the 64-bit sum of the buffer's bytes
+    HC_USER_BASE = 0x100,   // First number available for application-defined hypercalls
+};
+
+// Results are non-negative on success
+const int64_t HC_ENOSYS = -1;   // Unknown hypercall number
+const int64_t HC_EFAULT = -2;   // Invalid guest physical address or length
+const int64_t HC_EINVAL = -3;   // Invalid argument
+
+#pragma pack(push, 1)
+struct HypercallRequest {
+    uint32_t number;
+    uint32_t flags;     // Reserved; must be zero
+    int64_t result;     // Written by the host
+    uint64_t args[3];
+};
+
+struct HypercallBatch {
+    uint32_t count;     // Number of requests in the batch
+    uint32_t processed; // Written by the host
+    uint64_t reserved;
+    HypercallRequest requests[1];
+};
+#pragma pack(pop)
+
+const size_t hypercallBatchHeaderSize = offsetof(HypercallBatch, requests);
+const size_t hypercallMaxRequests = (0x1000 - hypercallBatchHeaderSize) / sizeof(HypercallRequest);
+
+typedef int64_t (*HypercallHandler)(void *context, const GuestMemory& memory, const uint64_t args[3]);
+
+// Processes hypercall batches submitted by the guest.
+class HypercallDispatcher {
+public:
+    explicit HypercallDispatcher(const GuestMemory& memory) noexcept;
+
+    // Registers a handler for a hypercall number, replacing the built-in one
+    // if any.
+    bool Register(uint32_t number, HypercallHandler handler, void *context) noexcept;
+
+    // Claims the hypercall doorbell port on the I/O bus.
+    bool Attach(IOBus& bus, uint16_t port = hypercallPort) noexcept;
+
+    // Processes the batch at the given guest physical address. Returns the
+    // number of processed requests.
+    uint32_t ProcessBatch(uint64_t address) noexcept;
+
+    uint64_t NumBatches() const noexcept { return m_numBatches; }
+    uint64_t NumRequests() const noexcept { return m_numRequests; }
+
+private:
+    static void DoorbellWrite(void *context, uint16_t port, size_t size, uint32_t value) noexcept;
+
+    static const size_t maxHandlers = 0x200;
+
+    struct Handler {
+        HypercallHandler fn;
+        void *context;
+    };
+
+    const GuestMemory& m_memory;
+    Handler m_handlers[maxHandlers];
+    uint64_t m_numBatches = 0;
+    uint64_t m_numRequests = 0;
+};
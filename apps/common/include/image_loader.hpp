@@ -0,0 +1,87 @@
+/*
+Declares a loader that reads guest images into memory on a background thread.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <stddef.h>
+#include <string>
+#include <thread>
+
+// Reads a file into a host memory block on a background thread, so that the
+// host can initialize the hypervisor, create the VM and map the block while
+// the image is still loading.
+//
+// Start opens the file and checks its size right away, asks the OS to read
+// ahead the whole file, then reads it in large chunks on its own thread. The
+// rest of the block is zeroed on the same thread. The block can be mapped into
+// a VM at any time, but must not be accessed until Wait returns.
+class ImageLoader {
+public:
+    ~ImageLoader() noexcept;
+
+    // Starts loading the file at path into [memory + offset, memory + size)
+    // and zeroing the rest of [memory, memory + size). Fails if the file
+    // cannot be opened or does not fit; with exactSize, the file must fill the
+    // range exactly.
+    bool Start(const char *path, uint8_t *memory, uint64_t size, uint64_t offset, bool exactSize = false);
+
+    // Waits for the load to finish. Returns false if the file could not be
+    // fully read.
+    bool Wait() noexcept;
+
+    uint64_t FileSize() const noexcept { return m_fileSize; }
+
+    // Bytes read so far, which can be polled while loading
+    uint64_t BytesLoaded() const noexcept { return m_bytesLoaded.load(); }
+
+    // Time from Start until the image was read and the block cleared. Valid
+    // after Wait.
+    double ElapsedMs() const noexcept { return m_elapsedMs; }
+
+    const std::string& Error() const noexcept { return m_error; }
+
+private:
+    void Load(std::chrono::steady_clock::time_point start) noexcept;
+    void Close() noexcept;
+
+#if defined(_WIN32)
+    void *m_handle = nullptr;
+#else
+    int m_fd = -1;
+#endif
+
+    uint8_t *m_memory = nullptr;
+    uint64_t m_size = 0;
+    uint64_t m_offset = 0;
+    uint64_t m_fileSize = 0;
+    std::atomic<uint64_t> m_bytesLoaded{ 0 };
+    double m_elapsedMs = 0.0;
+    bool m_ok = false;
+    std::string m_error;
+    std::thread m_thread;
+};
@@ -0,0 +1,145 @@
+/*
+Declares a host-side interrupt controller that injects device and timer
+interrupts into a virtual processor.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "virt86/virt86.hpp"
+
+#include "timer_wheel.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Collects interrupt requests from devices and timers and injects them into
+// a virtual processor. Interrupts raised while the virtual processor is
+// running are injected by the run loop at the next VM exit; a halted guest is
+// woken up as soon as an interrupt is raised, without polling.
+//
+// Timer interrupts are scheduled on a timer wheel serviced by a background
+// thread that sleeps until the next deadline. Guest time is measured in
+// nanoseconds since the controller was created. On Linux the thread sleeps
+// on a timerfd armed with the absolute deadline, which unlike a timed wait on
+// a condition variable is not subject to the thread's timer slack. Other
+// threads wake it through an eventfd, and only when a new timer expires
+// before the one it is sleeping for.
+//
+// virt86 has no way to force a running virtual processor to exit from another
+// thread. Platforms that do can install a kick handler, which is invoked from
+// the raising thread or the timer thread whenever a new interrupt becomes pending.
+class InterruptController {
+public:
+    typedef void (*KickHandler)(void *context);
+    typedef void (*DeliverHandler)(void *context, uint8_t vector);
+
+    explicit InterruptController(uint64_t timerResolution = 1000) noexcept;
+    ~InterruptController() noexcept;
+
+    // Starts and stops the timer thread.
+    void Start();
+    void Stop() noexcept;
+
+    uint64_t Now() const noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_epoch).count();
+    }
+
+    // Marks the vector as pending. Requests for a vector that is already
+    // pending are coalesced, like edge-triggered lines on a real controller.
+    void Raise(uint8_t vector) noexcept;
+
+    // Schedules an interrupt at the given guest time, optionally repeating
+    // every period nanoseconds. Returns a timer ID for CancelTimer.
+    uint64_t ScheduleInterrupt(uint64_t deadline, uint8_t vector, uint64_t period = 0);
+    bool CancelTimer(uint64_t timerID) noexcept;
+
+    void SetKickHandler(KickHandler handler, void *context) noexcept;
+
+    // Installs a handler called from Deliver for every interrupt enqueued into
+    // the virtual processor, such as a recorder for replay.
+    void SetDeliverHandler(DeliverHandler handler, void *context) noexcept;
+
+    // Enqueues all pending interrupts into the virtual processor. Vectors it
+    // does not accept stay pending. Returns the number of injected interrupts.
+    size_t Deliver(virt86::VirtualProcessor& vp) noexcept;
+
+    // Blocks until an interrupt is pending or the timeout expires. Returns
+    // true if an interrupt is pending.
+    bool WaitForInterrupt(uint64_t timeout) noexcept;
+
+    // Guest time at which the vector last became pending (the timer deadline
+    // for timer interrupts). Requests coalesced into a pending one do not
+    // change it.
+    uint64_t LastRaiseTime(uint8_t vector) const noexcept { return m_raiseTime[vector].load(std::memory_order_relaxed); }
+
+    uint64_t NumRaised() const noexcept { return m_numRaised.load(std::memory_order_relaxed); }
+    uint64_t NumCoalesced() const noexcept { return m_numCoalesced.load(std::memory_order_relaxed); }
+    uint64_t NumDelivered() const noexcept { return m_numDelivered.load(std::memory_order_relaxed); }
+    uint64_t NumTimerWakeups() const noexcept { return m_numTimerWakeups.load(std::memory_order_relaxed); }
+
+private:
+    struct TimerContext {
+        InterruptController *controller;
+        uint8_t vector;
+    };
+
+    static void TimerExpired(void *context, uint64_t timerID, uint64_t deadline);
+    bool RaiseLocked(uint8_t vector, uint64_t time) noexcept;
+    void TimerThread() noexcept;
+    void WaitForTimers(std::unique_lock<std::mutex>& lock, uint64_t deadline) noexcept;
+    void WakeTimerThread() noexcept;
+
+    const std::chrono::steady_clock::time_point m_epoch;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_timerCond;    // Wakes the timer thread when timers change
+    std::condition_variable m_pendingCond;  // Wakes the run loop when interrupts become pending
+    TimerWheel m_wheel;
+    TimerContext m_timerContexts[256];
+    uint64_t m_pending[4] = {};             // Bitmap of pending vectors
+    bool m_running = false;
+    bool m_newlyPending = false;            // Set by timer callbacks during Advance
+    uint64_t m_sleepDeadline = 0;           // Deadline the timer thread is sleeping for
+    std::thread m_thread;
+
+#if defined(__linux__)
+    int m_timerFd = -1;
+    int m_wakeFd = -1;
+#endif
+
+    KickHandler m_kickHandler = nullptr;
+    void *m_kickContext = nullptr;
+
+    DeliverHandler m_deliverHandler = nullptr;
+    void *m_deliverContext = nullptr;
+
+    std::atomic<uint64_t> m_raiseTime[256];
+    std::atomic<uint64_t> m_numRaised{ 0 };
+    std::atomic<uint64_t> m_numCoalesced{ 0 };
+    std::atomic<uint64_t> m_numDelivered{ 0 };
+    std::atomic<uint64_t> m_numTimerWakeups{ 0 };
+};
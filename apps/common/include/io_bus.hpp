@@ -0,0 +1,92 @@
+/*
+Declares an I/O bus that routes port and memory-mapped I/O to device models.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "virt86/virt86.hpp"
+
+#include <cinttypes>
+#include <stddef.h>
+#include <vector>
+
+typedef uint32_t (*PIOReadHandler)(void *context, uint16_t port, size_t size);
+typedef void (*PIOWriteHandler)(void *context, uint16_t port, size_t size, uint32_t value);
+typedef uint64_t (*MMIOReadHandler)(void *context, uint64_t address, size_t size);
+typedef void (*MMIOWriteHandler)(void *context, uint64_t address, size_t size, uint64_t value);
+
+// Routes the I/O and MMIO callbacks of a virtual machine to the devices
+// registered on port and address ranges. Handlers receive absolute ports and
+// addresses. Reads from unclaimed ranges return all ones and writes to them
+// are dropped, as on real hardware.
+class IOBus {
+public:
+    IOBus() noexcept;
+
+    // Registers handlers for ports [basePort, basePort + count). Either handler
+    // may be null. Fails if the range overlaps a registered range.
+    bool RegisterPIO(uint16_t basePort, uint32_t count, PIOReadHandler read, PIOWriteHandler write, void *context) noexcept;
+
+    // Registers handlers for the guest physical range [baseAddress, baseAddress + size).
+    bool RegisterMMIO(uint64_t baseAddress, uint64_t size, MMIOReadHandler read, MMIOWriteHandler write, void *context) noexcept;
+
+    // Installs this bus as the I/O callback handler of the virtual machine.
+    // Replaces any previously registered callbacks and I/O context.
+    void Attach(virt86::VirtualMachine& vm) noexcept;
+
+    uint32_t ReadPIO(uint16_t port, size_t size) const noexcept;
+    void WritePIO(uint16_t port, size_t size, uint32_t value) const noexcept;
+    uint64_t ReadMMIO(uint64_t address, size_t size) const noexcept;
+    void WriteMMIO(uint64_t address, size_t size, uint64_t value) const noexcept;
+
+private:
+    static uint32_t IOReadCallback(void *context, uint16_t port, size_t size) noexcept;
+    static void IOWriteCallback(void *context, uint16_t port, size_t size, uint32_t value) noexcept;
+    static uint64_t MMIOReadCallback(void *context, uint64_t address, size_t size) noexcept;
+    static void MMIOWriteCallback(void *context, uint64_t address, size_t size, uint64_t value) noexcept;
+
+    struct PIORange {
+        PIOReadHandler read;
+        PIOWriteHandler write;
+        void *context;
+    };
+
+    struct MMIORange {
+        uint64_t baseAddress;
+        uint64_t size;
+        MMIOReadHandler read;
+        MMIOWriteHandler write;
+        void *context;
+    };
+
+    const MMIORange *FindMMIO(uint64_t address) const noexcept;
+
+    // Port lookups go through a direct map of port number to range index
+    // (0 = unclaimed) so that dispatch cost doesn't grow with device count.
+    std::vector<PIORange> m_pioRanges;
+    std::vector<uint8_t> m_portMap;
+
+    // Sorted by base address
+    std::vector<MMIORange> m_mmioRanges;
+};
@@ -0,0 +1,42 @@
+/*
+Declares a helper that boots a virtual processor directly into 64-bit long mode.
+-------------------------------------------------------------------------------
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "virt86/virt86.hpp"
+
+#include "page_table_builder.hpp"
+
+#include <cinttypes>
+
+// Performs the work of x64-guest's rom.asm from the host: puts the virtual
+// processor directly into 64-bit long mode at entryPoint with a single
+// register write. Writes a GDT with a 64-bit code and a data descriptor at
+// gdtAddress in guest RAM and points CR3 at the tables built by pageTables,
+// which must already map the code, the stack and the GDT. The IDT is empty,
+// so any interrupt causes a triple fault until the guest loads its own.
+bool bootLongMode(virt86::VirtualProcessor& vp, const PageTableBuilder& pageTables, uint8_t *ram, uint64_t gdtAddress,
+    uint64_t entryPoint, uint64_t stackTop) noexcept;
@@ -0,0 +1,55 @@
+/*
+Declares a minimal HTTP server that exposes exit statistics to Prometheus.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "exit_stats.hpp"
+#include "socket.hpp"
+
+#include <atomic>
+#include <thread>
+
+// Serves ExitStats in the Prometheus text format to any HTTP request received
+// on a local TCP or UNIX domain socket. Requests are handled one at a time on
+// a background thread; the statistics are only formatted when scraped, so the
+// virtual processors pay nothing beyond recording.
+class MetricsServer {
+public:
+    explicit MetricsServer(const ExitStats& stats) noexcept;
+    ~MetricsServer() noexcept;
+
+    // Starts listening on the endpoint, in the format accepted by socketListen.
+    bool Start(const char *endpoint) noexcept;
+    void Stop() noexcept;
+
+private:
+    void Serve() noexcept;
+    void HandleClient(socket_t client) noexcept;
+
+    const ExitStats& m_stats;
+    socket_t m_listener = invalidSocket;
+    std::atomic<bool> m_running{ false };
+    std::thread m_thread;
+};
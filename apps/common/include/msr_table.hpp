@@ -0,0 +1,100 @@
+/*
+Declares a registry of model-specific registers emulated by the host.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "virt86/virt86.hpp"
+
+#include <cinttypes>
+#include <stddef.h>
+#include <vector>
+
+// Emulates model-specific registers for VMs created with the MSRAccess
+// extended VM exit. Each MSR has read and write handlers, or is a plain
+// register with a mask of writable bits. MSR numbers are kept in a sorted
+// array searched separately from the handlers, so a lookup touches only a
+// few cache lines.
+//
+// Accesses to unknown MSRs are counted and otherwise ignored: HandleExit
+// leaves EDX:EAX unchanged on reads and drops writes. virt86 cannot inject a
+// #GP with an error code, so the guest is not told about them.
+class MSRTable {
+public:
+    typedef bool (*ReadHandler)(void *context, uint32_t msr, uint64_t& value);
+    typedef bool (*WriteHandler)(void *context, uint32_t msr, uint64_t value);
+
+    // Registers handlers for an MSR. Either handler may be null, in which
+    // case reads return zero or writes are ignored. Fails if the MSR is
+    // already registered.
+    bool Register(uint32_t msr, ReadHandler read, WriteHandler write, void *context);
+
+    // Registers a plain register. Writes only change the bits set in
+    // writableMask.
+    bool RegisterValue(uint32_t msr, uint64_t initialValue, uint64_t writableMask = ~0ull);
+
+    bool Read(uint32_t msr, uint64_t& value) noexcept;
+    bool Write(uint32_t msr, uint64_t value) noexcept;
+
+    // Emulates the RDMSR or WRMSR instruction that caused an MSRAccess exit.
+    // virt86 moves RIP past the instruction like it does for CPUID exits, so
+    // by default the instruction is decoded from the two bytes before RIP.
+    // For platforms that leave RIP at the instruction, call
+    // SetRIPAdvanced(false); the instruction is then decoded at RIP and RIP
+    // is moved past it. Only that one location is decoded, since the bytes
+    // on the other side may be another MSR instruction. Returns false if the
+    // instruction could not be decoded or the registers could not be
+    // accessed.
+    bool HandleExit(virt86::VirtualProcessor& vp) noexcept;
+
+    void SetRIPAdvanced(bool advanced) noexcept { m_ripAdvanced = advanced; }
+
+    uint64_t NumReads() const noexcept { return m_numReads; }
+    uint64_t NumWrites() const noexcept { return m_numWrites; }
+    uint64_t NumUnknown() const noexcept { return m_numUnknown; }
+
+private:
+    struct Entry {
+        ReadHandler read;
+        WriteHandler write;
+        void *context;
+        uint64_t value;         // Used by plain registers
+        uint64_t writableMask;
+    };
+
+    static bool ValueRead(void *context, uint32_t msr, uint64_t& value);
+    static bool ValueWrite(void *context, uint32_t msr, uint64_t value);
+
+    Entry *Find(uint32_t msr) noexcept;
+    bool Insert(uint32_t msr, const Entry& entry);
+
+    std::vector<uint32_t> m_msrs;       // Sorted
+    std::vector<Entry> m_entries;       // Same order as m_msrs
+
+    bool m_ripAdvanced = true;
+
+    uint64_t m_numReads = 0;
+    uint64_t m_numWrites = 0;
+    uint64_t m_numUnknown = 0;
+};
@@ -0,0 +1,68 @@
+/*
+Declares a scanner that finds zero and duplicate pages in guest RAM.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "guest_address_space.hpp"
+
+#include <cinttypes>
+#include <stddef.h>
+#include <unordered_map>
+
+// Scans the RAM mapped through a GuestAddressSpace for pages with identical
+// contents. Pages are hashed and candidates are confirmed with a full
+// comparison.
+//
+// virt86 cannot remap a single guest page onto another host page or make it
+// copy-on-write, so non-zero duplicates are only counted; on Linux, mapping
+// RAM with GuestAddressSpace::SetMergeable lets KSM share them. Pages that
+// only contain zeros can be reclaimed on every host: once discarded, they
+// read back as either their old contents or zeros, which are the same.
+//
+// Must not run while virtual processors run.
+class PageDedupScanner {
+public:
+    struct Stats {
+        uint64_t pagesScanned = 0;
+        uint64_t zeroPages = 0;
+        uint64_t duplicatePages = 0;    // Non-zero pages identical to an earlier page
+        uint64_t hashCollisions = 0;    // Same hash, different contents
+        uint64_t pagesReclaimed = 0;    // Zero pages discarded by this scan
+        uint64_t scanTimeNs = 0;
+
+        // Bytes that could be shared by merging every zero and duplicate page
+        uint64_t BytesSaved() const noexcept { return (zeroPages + duplicatePages) * PAGE_SIZE; }
+    };
+
+    // Scans the mapped part of every region. With reclaimZeroPages, the host
+    // memory behind zero pages is discarded.
+    Stats Scan(const GuestAddressSpace& addressSpace, bool reclaimZeroPages) noexcept;
+
+    void PrintStats(FILE *out, const Stats& stats) const noexcept;
+
+private:
+    // Page hash -> first page seen with that hash
+    std::unordered_map<uint64_t, const uint8_t *> m_pages;
+};
@@ -0,0 +1,113 @@
+/*
+Declares a host-side builder for x86-64 guest page tables.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "guest_memory.hpp"
+
+#include <cinttypes>
+#include <stddef.h>
+
+// Builds 4-level x86-64 page tables in guest memory from the host. Ranges are
+// mapped with the largest pages their alignment allows: 1 GiB pages (when
+// enabled), then 2 MiB pages (unless disabled), with 4 KiB pages only at
+// unaligned edges.
+//
+// Page tables are allocated from a dedicated range of guest RAM and are never
+// freed. Tables that are replaced by a larger page are leaked, and large pages
+// are split into tables when a smaller mapping is made inside them.
+class PageTableBuilder {
+public:
+    static const uint64_t PTE_PRESENT = (1ull << 0);
+    static const uint64_t PTE_WRITE = (1ull << 1);
+    static const uint64_t PTE_USER = (1ull << 2);
+    static const uint64_t PTE_PWT = (1ull << 3);
+    static const uint64_t PTE_PCD = (1ull << 4);
+    static const uint64_t PTE_LARGE = (1ull << 7);
+    static const uint64_t PTE_GLOBAL = (1ull << 8);
+    static const uint64_t PTE_NX = (1ull << 63);
+
+    // Tables are allocated from the page-aligned guest physical range
+    // [tableBase, tableBase + tableSize), which must be backed by memory.
+    PageTableBuilder(GuestMemory& memory, uint64_t tableBase, uint64_t tableSize) noexcept;
+
+    // Allocates an empty PML4. Either this or Attach must be called before
+    // mapping memory. Returns false if out of table space.
+    bool Create() noexcept;
+
+    // Uses existing page tables rooted at the given PML4 address, such as the
+    // ones built by guest code.
+    void Attach(uint64_t root) noexcept { m_root = root; }
+
+    // Physical address of the PML4, to be loaded into CR3
+    uint64_t Root() const noexcept { return m_root; }
+
+    // Enables 1 GiB pages. The guest CPU must support them (CPUID
+    // 0x80000001, EDX bit 26).
+    void UseHugePages(bool enable) noexcept { m_hugePages = enable; }
+
+    // Enables 2 MiB pages, which are on by default. When disabled, every
+    // range is mapped with 4 KiB pages, regardless of UseHugePages.
+    void UseLargePages(bool enable) noexcept { m_largePages = enable; }
+
+    // Maps the linear range [linear, linear + size) to the physical range
+    // starting at physical. All addresses and the size must be 4 KiB aligned.
+    // flags are applied to every page; PTE_PRESENT is implied. Returns false
+    // if the arguments are invalid or the table space is exhausted, in which
+    // case part of the range may have been mapped.
+    bool Map(uint64_t linear, uint64_t physical, uint64_t size, uint64_t flags) noexcept;
+
+    // Returns the guest physical address of the page table entry that maps the
+    // 4 KiB page at the linear address, or 0 if the address is not covered by
+    // a page table (no table exists, or it is mapped by a large page).
+    uint64_t EntryAddress(uint64_t linear) const noexcept;
+
+    size_t NumTables() const noexcept { return m_numTables; }
+    uint64_t TableSpaceUsed() const noexcept { return m_nextTable - m_tableBase; }
+
+    // Number of pages of each size written by Map
+    uint64_t NumPages4K() const noexcept { return m_numPages[0]; }
+    uint64_t NumPages2M() const noexcept { return m_numPages[1]; }
+    uint64_t NumPages1G() const noexcept { return m_numPages[2]; }
+
+private:
+    uint64_t AllocTable() noexcept;
+    uint64_t *Table(uint64_t address) const noexcept;
+
+    // Returns the table at the given level (0 = PT, 1 = PD, 2 = PDPT) that
+    // covers the linear address, creating or splitting entries as needed
+    uint64_t *WalkCreate(uint64_t linear, size_t level) noexcept;
+
+    GuestMemory& m_memory;
+    const uint64_t m_tableBase;
+    const uint64_t m_tableEnd;
+    uint64_t m_nextTable;
+    uint64_t m_root = 0;
+    bool m_hugePages = false;
+    bool m_largePages = true;
+
+    size_t m_numTables = 0;
+    uint64_t m_numPages[3] = { 0, 0, 0 };
+};
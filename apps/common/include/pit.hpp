@@ -0,0 +1,104 @@
+/*
+Declares an 8254 programmable interval timer.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "interrupt_controller.hpp"
+#include "io_bus.hpp"
+
+#include <cinttypes>
+#include <stddef.h>
+
+// PIT registers. All accesses are 8 bits wide.
+//
+//   Port     Access  Description
+//   base+0   R/W     Channel 0 counter; its output is wired to IRQ 0
+//   base+1   R/W     Channel 1 counter
+//   base+2   R/W     Channel 2 counter
+//   base+3   W       Mode/command register: channel in bits 7:6, access
+//                    mode in bits 5:4 (0 latches the count), operating
+//                    mode in bits 3:1, BCD in bit 0
+//
+// Counters tick at pitFrequency. Modes 0 and 4 count down once, modes 2 and 3
+// reload the counter and repeat. Modes 1 and 5 wait for a rising edge on the
+// gate input, which never comes; the channel 2 gate on port 0x61 is not
+// emulated. BCD counting and the read-back command are not supported.
+//
+// Keep in sync with apps/time-bench/src/timebench.asm.
+
+const uint16_t pitPort = 0x0040;
+const uint64_t pitFrequency = 1193182;
+
+// Emulates an 8254 PIT. Counters are not stepped: the current count is
+// computed from the time the counter was loaded, and expirations of
+// channel 0 are scheduled on the interrupt controller, which raises the
+// IRQ 0 vector from its timer thread. There is no 8259 PIC, so the vector is
+// fixed when the PIT is created instead of being programmed by the guest.
+class PIT8254 {
+public:
+    PIT8254(InterruptController& controller, uint8_t vector = 0x20) noexcept;
+    ~PIT8254() noexcept;
+
+    // Claims the four PIT ports on the I/O bus.
+    bool Attach(IOBus& bus, uint16_t port = pitPort) noexcept;
+
+    // Current count of a channel, as the guest would read it after a latch
+    uint16_t Count(size_t channel) const noexcept;
+
+    // Number of times channel 0 was started by loading its counter
+    uint64_t NumStarts() const noexcept { return m_numStarts; }
+
+private:
+    struct Channel {
+        uint8_t accessMode = 3;     // 1 = low byte, 2 = high byte, 3 = low then high
+        uint8_t mode = 0;
+        uint32_t reload = 0x10000;  // A count of 0 means 65536
+        uint8_t writeLow = 0;       // Low byte written while waiting for the high byte
+        bool writeHigh = false;     // Next write is the high byte
+        bool readHigh = false;      // Next read is the high byte
+        bool latched = false;
+        uint16_t latch = 0;
+        bool counting = false;
+        uint64_t start = 0;         // Controller time at which the counter was loaded
+    };
+
+    static uint32_t PortRead(void *context, uint16_t port, size_t size) noexcept;
+    static void PortWrite(void *context, uint16_t port, size_t size, uint32_t value) noexcept;
+
+    void Command(uint8_t value) noexcept;
+    void Load(size_t index, uint16_t count) noexcept;
+    uint8_t ReadCounter(size_t index) noexcept;
+    void WriteCounter(size_t index, uint8_t value) noexcept;
+    void StopTimer() noexcept;
+
+    InterruptController& m_controller;
+    const uint8_t m_vector;
+    uint16_t m_port = pitPort;
+
+    Channel m_channels[3];
+    uint64_t m_timerID = TimerWheel::invalidTimer;   // Channel 0 expiration
+
+    uint64_t m_numStarts = 0;
+};
@@ -0,0 +1,122 @@
+/*
+Declares a paravirtual clock that lets the guest read time without exiting.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "guest_memory.hpp"
+#include "io_bus.hpp"
+#include "tsc_clock.hpp"
+
+#include <cinttypes>
+#include <stddef.h>
+
+// Paravirtual clock ABI
+// ---------------------
+// The guest reserves a 32-byte aligned PVClockInfo structure in its memory
+// and tells the host where it is. The host fills it in with the scale that
+// converts the guest TSC to nanoseconds, so the guest reads the time with
+// RDTSC and a few instructions instead of a VM exit. All accesses are 32 bits
+// wide.
+//
+//   Port            Access  Description
+//   pvclockPort+0   W       Bits 31:1 of the guest physical address of the
+//                           structure. Bit 0 set enables the clock, clear
+//                           disables it. The host fills in the structure
+//                           before the write completes.
+//   pvclockPort+4   W       Bits 63:32 of the address; written before +0
+//   pvclockPort+0   R       Low 32 bits of the current time in nanoseconds,
+//                           for guests that want to compare with the clock
+//                           page. Costs a VM exit.
+//   pvclockPort+4   R       PVCLOCK_MAGIC if the device is present
+//
+// The structure has the layout of KVM's pvclock_vcpu_time_info, so guest
+// code written for KVM's clock works unchanged:
+//
+//   time = systemTime + (((rdtsc - tscTimestamp) << tscShift) * tscToSystemMul) >> 32
+//
+// where a negative tscShift shifts right and the product is 96 bits wide. The
+// host bumps version to an odd number before changing the other fields and
+// to an even number after, so the guest retries while version is odd or has
+// changed during the read.
+//
+// The guest registers the page through a port rather than KVM's MSR because
+// KVM handles that MSR itself, and the clock must also work on platforms
+// without MSR access exits.
+//
+// Keep in sync with apps/time-bench/src/timebench.asm.
+
+const uint16_t pvclockPort = 0x0620;
+const uint32_t PVCLOCK_MAGIC = 0x4B4C4350;  // 'PCLK'
+
+// Set in flags: the TSC runs at a constant rate, so time read on different
+// processors never goes backwards
+const uint8_t PVCLOCK_TSC_STABLE_BIT = 1;
+
+struct PVClockInfo {
+    uint32_t version;
+    uint32_t pad0;
+    uint64_t tscTimestamp;
+    uint64_t systemTime;        // Nanoseconds at tscTimestamp
+    uint32_t tscToSystemMul;
+    int8_t tscShift;
+    uint8_t flags;
+    uint8_t pad[2];
+};
+
+static_assert(sizeof(PVClockInfo) == 32, "PVClockInfo must match the guest ABI");
+
+class PVClock {
+public:
+    PVClock(const GuestMemory& memory, const InterruptController& controller, const TSCClock& clock) noexcept;
+
+    // Claims the clock ports on the I/O bus.
+    bool Attach(IOBus& bus, uint16_t port = pvclockPort) noexcept;
+
+    // Publishes the current calibration of the TSC clock to the guest. Call
+    // after recalibrating; the guest picks up the new scale on its next read.
+    void Update() noexcept;
+
+    bool Enabled() const noexcept { return m_info != nullptr; }
+    uint64_t Address() const noexcept { return m_address; }
+
+    uint64_t NumUpdates() const noexcept { return m_numUpdates; }
+    uint64_t NumTimeReads() const noexcept { return m_numTimeReads; }
+
+private:
+    static uint32_t PortRead(void *context, uint16_t port, size_t size) noexcept;
+    static void PortWrite(void *context, uint16_t port, size_t size, uint32_t value) noexcept;
+
+    const GuestMemory& m_memory;
+    const InterruptController& m_controller;
+    const TSCClock& m_clock;
+    uint16_t m_port = pvclockPort;
+
+    uint32_t m_addressHigh = 0;
+    uint64_t m_address = 0;
+    PVClockInfo *m_info = nullptr;
+
+    uint64_t m_numUpdates = 0;
+    uint64_t m_numTimeReads = 0;
+};
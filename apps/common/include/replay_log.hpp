@@ -0,0 +1,173 @@
+/*
+Declares a log of the non-deterministic inputs the host gives a guest,
+recorded during one run and fed back to replay it.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "virt86/virt86.hpp"
+
+#include "io_bus.hpp"
+#include "interrupt_controller.hpp"
+#include "cpuid_policy.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Records everything the host feeds into a guest that is not determined by
+// the guest's own execution, so that the run can be repeated exactly:
+//   - values returned by port I/O and MMIO reads
+//   - CPUID results computed by the host
+//   - injected interrupts, with the index of the run they were injected before
+//   - optionally, the guest TSC before each run
+//
+// The log sits between the virtual machine and an IOBus. When recording,
+// reads go to the bus and their results are logged. When replaying, reads
+// return the logged values without touching the devices. Writes go to the
+// bus in both modes and are logged too, so that a replay that takes a
+// different path is detected at the first differing write rather than much
+// later. Checkpoint adds a hash of the registers for the same purpose.
+//
+// virt86 has no VM exit on RDTSC, so individual TSC reads cannot be logged.
+// With TSC sync, the TSC is read before each run when recording and set to
+// the same value when replaying, so the guest sees the same time at every
+// exit but not between exits.
+//
+// Devices that write guest memory on their own, such as block devices, must
+// be given the same backing data on replay.
+//
+// The log is a byte stream of events, each a tag byte followed by LEB128
+// varints:
+//   header:      "V86R" version flags
+//   PIO read:    tag|size<<4 port value
+//   PIO write:   tag|size<<4 port value
+//   MMIO read:   tag|size<<4 address value
+//   MMIO write:  tag|size<<4 address value
+//   CPUID:       tag leaf subleaf eax ebx ecx edx
+//   interrupt:   tag runDelta vector       (runs since the previous interrupt)
+//   TSC:         tag zigzag(tsc - previous)
+//   checkpoint:  tag hash
+class ReplayLog {
+public:
+    enum class Mode {
+        Off,
+        Record,
+        Replay,
+    };
+
+    static const uint32_t version = 1;
+    static const uint64_t flagSyncTSC = 1 << 0;
+
+    ~ReplayLog() noexcept;
+
+    // Starts recording to a file. Must be called before the guest runs.
+    bool StartRecording(const char *path, bool syncTSC);
+
+    // Loads a log to replay. Returns false if the file is not a valid log.
+    bool StartReplay(const char *path);
+
+    // Flushes the recording, or checks that the replay consumed every event.
+    bool Finish() noexcept;
+
+    // Installs the log as the I/O callback handler of the virtual machine,
+    // forwarding accesses to the bus. Replaces IOBus::Attach.
+    void Attach(virt86::VirtualMachine& vm, IOBus& bus) noexcept;
+
+    // Records the interrupts delivered by the controller.
+    void Attach(InterruptController& interrupts) noexcept;
+
+    // Call before every Run of the virtual processor. Delivers interrupts
+    // from the controller (or from the log when replaying) and syncs the TSC.
+    // The controller may be null.
+    size_t BeforeRun(virt86::VirtualProcessor& vp, InterruptController *interrupts) noexcept;
+
+    // Handles a CPUID exit. When recording, the policy computes the result,
+    // or the registers are left as they are if it is null.
+    bool HandleCPUID(virt86::VirtualProcessor& vp, CPUIDPolicy *policy) noexcept;
+
+    // Logs or checks a hash of the general purpose registers and RIP.
+    bool Checkpoint(virt86::VirtualProcessor& vp) noexcept;
+
+    Mode GetMode() const noexcept { return m_mode; }
+    bool Recording() const noexcept { return m_mode == Mode::Record; }
+    bool Replaying() const noexcept { return m_mode == Mode::Replay; }
+
+    // Set when the replay took a different path than the recording. The log
+    // stops feeding values at that point and the guest runs live.
+    bool Diverged() const noexcept { return m_diverged; }
+    const std::string& Error() const noexcept { return m_error; }
+
+    uint64_t NumEvents() const noexcept { return m_numEvents; }
+    uint64_t NumBytes() const noexcept { return m_bytes + m_buffer.size(); }
+
+private:
+    enum class Event : uint8_t {
+        PIORead = 1,
+        PIOWrite,
+        MMIORead,
+        MMIOWrite,
+        CPUID,
+        Interrupt,
+        TSC,
+        Checkpoint,
+    };
+
+    static uint32_t IOReadCallback(void *context, uint16_t port, size_t size) noexcept;
+    static void IOWriteCallback(void *context, uint16_t port, size_t size, uint32_t value) noexcept;
+    static uint64_t MMIOReadCallback(void *context, uint64_t address, size_t size) noexcept;
+    static void MMIOWriteCallback(void *context, uint64_t address, size_t size, uint64_t value) noexcept;
+    static void InterruptDelivered(void *context, uint8_t vector) noexcept;
+
+    // Recording
+    void Put(uint8_t tag) { m_buffer.push_back(tag); }
+    void PutVarint(uint64_t value);
+    void EndEvent() noexcept;
+
+    // Replaying. Expect consumes the next event if it has the given tag, or
+    // marks the replay as diverged.
+    bool Expect(uint8_t tag, const char *what) noexcept;
+    bool GetVarint(uint64_t& value) noexcept;
+    bool PeekTag(uint8_t& tag) const noexcept;
+    void Diverge(const char *what) noexcept;
+
+    Mode m_mode = Mode::Off;
+    bool m_syncTSC = false;
+    IOBus *m_bus = nullptr;
+
+    FILE *m_file = nullptr;
+    std::vector<uint8_t> m_buffer;  // Pending output when recording, the whole log when replaying
+    size_t m_pos = 0;               // Read position when replaying
+    uint64_t m_bytes = 0;
+
+    uint64_t m_runs = 0;
+    uint64_t m_lastInterruptRun = 0;
+    uint64_t m_lastTSC = 0;
+    uint64_t m_numEvents = 0;
+
+    bool m_diverged = false;
+    std::string m_error;
+};
@@ -0,0 +1,68 @@
+/*
+Declares a machine-readable report of test results and timings.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <cinttypes>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+enum class TestStatus {
+    Passed,
+    Failed,
+    Skipped,
+};
+
+struct TestResult {
+    std::string name;
+    TestStatus status;
+    uint64_t runs;
+    uint64_t exits;     // VM exits over all runs
+    uint64_t totalNs;
+    uint64_t minNs;
+    uint64_t maxNs;
+};
+
+// Results of a set of tests, written by the demos with --report so that runs
+// on different platforms can be compared by another program. The file has
+// one line per test with tab-separated fields:
+//   <test> <passed|failed|skipped> <runs> <exits> <total ns> <min ns> <max ns>
+// Lines starting with # are comments.
+class ResultReport {
+public:
+    void Add(const TestResult& result) { m_results.push_back(result); }
+    void Add(const char *name, TestStatus status, uint64_t exits, uint64_t ns);
+
+    bool Save(const char *path) const noexcept;
+    bool Load(const char *path);
+
+    const std::vector<TestResult>& Results() const noexcept { return m_results; }
+
+    static const char *StatusName(TestStatus status) noexcept;
+
+private:
+    std::vector<TestResult> m_results;
+};
@@ -0,0 +1,76 @@
+/*
+Declares minimal cross-platform helpers for local stream sockets.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <cinttypes>
+#include <stddef.h>
+
+#if defined(_WIN32)
+typedef uintptr_t socket_t;
+#else
+typedef int socket_t;
+#endif
+
+const socket_t invalidSocket = (socket_t)-1;
+
+// Creates a listening TCP socket bound to the given IPv4 address and port.
+socket_t socketListenTCP(const char *address, uint16_t port) noexcept;
+
+// Creates a listening UNIX domain socket at the given path, replacing any
+// existing socket file. Fails if the path exists and is not a socket. Not
+// supported on Windows.
+socket_t socketListenUnix(const char *path) noexcept;
+
+// Creates a listening socket from an endpoint specification:
+//   <port>            TCP on 127.0.0.1:<port>
+//   <address>:<port>  TCP on the given IPv4 address
+//   unix:<path>       UNIX domain socket
+socket_t socketListen(const char *endpoint) noexcept;
+
+// Waits up to timeoutMs milliseconds for a connection on the listening socket.
+// Returns invalidSocket if the timeout expired or the wait failed.
+socket_t socketAccept(socket_t listener, int timeoutMs) noexcept;
+
+// Waits up to timeoutMs milliseconds for data to arrive on the socket, or for
+// the peer to close it. Returns immediately when timeoutMs is 0.
+bool socketWaitReadable(socket_t sock, int timeoutMs) noexcept;
+
+// Makes receives and sends on the socket fail once they have blocked for
+// timeoutMs milliseconds. Returns false on errors.
+bool socketSetTimeout(socket_t sock, int timeoutMs) noexcept;
+
+// Receives up to len bytes. Returns the number of bytes received, 0 if the
+// peer closed the connection or -1 on errors.
+ptrdiff_t socketRecv(socket_t sock, void *buffer, size_t len) noexcept;
+
+// Sends the whole buffer. Returns false on errors.
+bool socketSendAll(socket_t sock, const void *data, size_t len) noexcept;
+
+void socketClose(socket_t sock) noexcept;
+
+// Closes a listening socket. For UNIX domain sockets, also removes the socket
+// file.
+void socketCloseListener(socket_t listener) noexcept;
@@ -0,0 +1,151 @@
+/*
+Declares an instruction tracer that single-steps a virtual processor and
+records register changes and memory writes in a compact trace file, and a
+reader for those files.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "virt86/virt86.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Trace file format. All integers are LEB128 varints.
+//
+//   header:  "V86T" version numRegs { nameLength name }* { initialValue }*
+//   step:    flags { zigzag(value - previous) }* [exitReason] [writes]
+//   writes:  count { address length bytes }*
+//
+// The low two bits of flags tell whether an exit reason (the step ended with
+// an exit other than VMExitReason::Step) and memory writes follow. The
+// remaining bits are a mask of the registers that changed, in header order.
+// Memory writes are byte ranges of guest physical memory that changed during
+// the step. Segment registers are recorded by selector.
+
+// Single-steps a virtual processor and writes a trace of what changed.
+//
+// Each step reads the traced registers in one batched read and writes only
+// the ones that differ from the previous step, so a typical step costs one
+// Step, one register read and a few bytes of buffered output. Memory writes
+// are found by querying dirty pages after each step and comparing them with
+// a shadow copy of RAM, which costs two more hypervisor calls per step.
+class StepTracer {
+public:
+    static const uint32_t version = 1;
+    static const uint64_t flagExit = 1 << 0;
+    static const uint64_t flagWrites = 1 << 1;
+    static const size_t flagBits = 2;
+
+    ~StepTracer() noexcept;
+
+    // Creates the trace file and records the initial register state.
+    bool Start(virt86::VirtualProcessor& vp, const char *path);
+
+    // Records memory writes to the RAM block mapped at ramBase. The RAM must
+    // have been mapped with MemoryFlags::DirtyPageTracking. Returns false if
+    // the platform does not track dirty pages.
+    bool EnableMemoryWrites(virt86::VirtualMachine& vm, uint64_t ramBase, uint8_t *ram, uint64_t ramSize);
+
+    // Executes one instruction and records it.
+    virt86::VPExecutionStatus Step(virt86::VirtualProcessor& vp) noexcept;
+
+    // Flushes and closes the trace file.
+    bool Finish() noexcept;
+
+    uint64_t NumSteps() const noexcept { return m_steps; }
+    uint64_t NumMemoryWrites() const noexcept { return m_memoryWrites; }
+    uint64_t BytesWritten() const noexcept { return m_bytesWritten + m_buffer.size(); }
+    const std::string& Error() const noexcept { return m_error; }
+
+private:
+    void RecordMemoryWrites() noexcept;
+    void Flush() noexcept;
+
+    FILE *m_file = nullptr;
+    std::vector<uint8_t> m_buffer;
+    std::vector<virt86::RegValue> m_values;
+    std::vector<uint64_t> m_previous;
+
+    virt86::VirtualMachine *m_vm = nullptr;
+    uint64_t m_ramBase = 0;
+    uint8_t *m_ram = nullptr;
+    uint64_t m_ramSize = 0;
+    std::vector<uint8_t> m_shadow;
+    std::vector<uint64_t> m_dirtyBitmap;
+    std::vector<uint8_t> m_writes;
+    uint64_t m_numWrites = 0;
+
+    uint64_t m_steps = 0;
+    uint64_t m_memoryWrites = 0;
+    uint64_t m_bytesWritten = 0;
+    bool m_failed = false;
+    std::string m_error;
+};
+
+// Reads trace files written by StepTracer and reconstructs the register
+// state after every step.
+class StepTraceReader {
+public:
+    struct MemoryWrite {
+        uint64_t address;
+        std::vector<uint8_t> data;
+    };
+
+    struct Step {
+        uint64_t index;
+        uint64_t changed;               // Mask of the registers that changed
+        bool exited;
+        virt86::VMExitReason reason;    // Valid if exited
+        std::vector<MemoryWrite> writes;
+    };
+
+    ~StepTraceReader() noexcept;
+
+    bool Open(const char *path);
+
+    // Reads the next step. Returns false at the end of the trace or on error.
+    bool Next(Step& step);
+
+    size_t NumRegs() const noexcept { return m_names.size(); }
+    const std::string& RegName(size_t reg) const noexcept { return m_names[reg]; }
+
+    // Value of a register after the last step read, or the initial value
+    uint64_t Value(size_t reg) const noexcept { return m_values[reg]; }
+
+    const std::string& Error() const noexcept { return m_error; }
+
+private:
+    bool ReadVarint(uint64_t& value) noexcept;
+    bool ReadBytes(void *data, size_t size) noexcept;
+
+    FILE *m_file = nullptr;
+    std::vector<std::string> m_names;
+    std::vector<uint64_t> m_values;
+    uint64_t m_steps = 0;
+    std::string m_error;
+};
@@ -0,0 +1,107 @@
+/*
+Declares a hierarchical timer wheel for scheduling device events.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <cinttypes>
+#include <stddef.h>
+#include <vector>
+
+// Hierarchical timer wheel (Varghese & Lauck) with four levels of 64 slots.
+// Scheduling and cancelling are O(1); expiring timers costs O(1) per timer
+// plus one cascade per level boundary crossed. Time is expressed in
+// nanoseconds and rounded up to the wheel resolution; with the default 1 us
+// resolution the wheel spans ~16.7 seconds before timers are parked in an
+// overflow list.
+//
+// Not thread-safe; callers must serialize access.
+class TimerWheel {
+public:
+    typedef void (*Callback)(void *context, uint64_t timerID, uint64_t deadline);
+
+    static const uint64_t invalidTimer = 0;
+    static const uint64_t never = UINT64_MAX;
+
+    explicit TimerWheel(uint64_t resolution = 1000) noexcept;
+
+    // Schedules a timer that expires at the given deadline. Periodic timers
+    // are rescheduled at deadline + period after each expiration, without
+    // accumulating drift. Returns a timer ID, or invalidTimer on failure.
+    uint64_t Schedule(uint64_t deadline, Callback callback, void *context, uint64_t period = 0);
+
+    // Cancels a pending timer. Returns false if the timer already expired or
+    // was cancelled.
+    bool Cancel(uint64_t timerID) noexcept;
+
+    // Expires all timers with deadlines up to the given time, invoking their
+    // callbacks in deadline order (timers within the same resolution tick may
+    // expire in any order). Callbacks may schedule and cancel timers.
+    // Returns the number of expired timers.
+    size_t Advance(uint64_t now);
+
+    // Returns the earliest time at which Advance might expire a timer or
+    // cascade a slot, or never if no timers are pending. Never later than the
+    // earliest pending deadline.
+    uint64_t NextEvent() const noexcept;
+
+    size_t Count() const noexcept { return m_count; }
+    uint64_t Resolution() const noexcept { return m_resolution; }
+
+private:
+    static const size_t levelBits = 6;
+    static const size_t slotsPerLevel = 1 << levelBits;
+    static const size_t numLevels = 4;
+    static const uint32_t nil = UINT32_MAX;
+
+    struct Timer {
+        uint64_t expires;       // In ticks
+        uint64_t deadline;      // In nanoseconds, as requested
+        uint64_t period;
+        Callback callback;
+        void *context;
+        uint32_t generation;
+        uint32_t prev;
+        uint32_t next;
+        uint32_t *list;         // Head of the list containing this timer, or null if free
+    };
+
+    void Insert(uint32_t index) noexcept;
+    void Link(uint32_t *list, uint32_t index) noexcept;
+    void Unlink(uint32_t index) noexcept;
+    void Free(uint32_t index) noexcept;
+    void ProcessTick(uint64_t tick, size_t& expired);
+    uint64_t NextEventTick() const noexcept;
+
+    uint64_t m_resolution;
+    uint64_t m_currentTick = 0; // Next tick to be processed
+    size_t m_count = 0;
+
+    std::vector<Timer> m_timers;
+    uint32_t m_freeList = nil;
+
+    uint32_t m_slots[numLevels][slotsPerLevel];
+    uint64_t m_occupied[numLevels] = {};  // Bitmap of non-empty slots per level
+    uint32_t m_overflow = nil;
+};
@@ -0,0 +1,80 @@
+/*
+Declares a clock that relates the guest TSC to host time.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "virt86/virt86.hpp"
+
+#include "interrupt_controller.hpp"
+
+#include <cinttypes>
+
+// Reads the host time stamp counter.
+uint64_t hostTSC() noexcept;
+
+// Converts between guest TSC values and InterruptController time, so that
+// devices can turn TSC deadlines into timer interrupts and publish the
+// conversion to the guest through the paravirtual clock.
+//
+// The conversion uses the same 32.32 fixed point scale that the guest reads
+// from the paravirtual clock page:
+//
+//   time = baseTime + (((tsc - baseTSC) << shift) * mul) >> 32
+//
+// where a negative shift shifts right. Host and guest therefore agree on the
+// time of every TSC value to the nanosecond.
+//
+// The TSC frequency is measured on the host, assuming the hypervisor runs
+// the guest TSC at the host rate with a constant offset, as all supported
+// platforms do on processors with an invariant TSC.
+class TSCClock {
+public:
+    // Measures the TSC frequency against the steady clock for the given
+    // number of nanoseconds and reads the guest TSC through the virtual
+    // processor to find its offset from the host TSC. Returns false if the
+    // guest TSC could not be read.
+    bool Calibrate(const InterruptController& controller, virt86::VirtualProcessor& vp, uint64_t interval = 20000000) noexcept;
+
+    uint64_t Frequency() const noexcept { return m_frequency; }
+
+    // Guest TSC value and time of the calibration point
+    uint64_t BaseTSC() const noexcept { return m_baseTSC; }
+    uint64_t BaseTime() const noexcept { return m_baseTime; }
+
+    uint32_t Mul() const noexcept { return m_mul; }
+    int8_t Shift() const noexcept { return m_shift; }
+
+    // TSC values before the calibration point map to the base time, and
+    // times before it map to the base TSC value.
+    uint64_t ToTime(uint64_t tsc) const noexcept;
+    uint64_t ToTSC(uint64_t time) const noexcept;
+
+private:
+    uint64_t m_frequency = 0;
+    uint64_t m_baseTSC = 0;
+    uint64_t m_baseTime = 0;
+    uint32_t m_mul = 0;
+    int8_t m_shift = 0;
+};
@@ -0,0 +1,127 @@
+/*
+Declares a 16550-style UART that gives the guest a console.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "io_bus.hpp"
+
+#include <atomic>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <stddef.h>
+#include <thread>
+#include <vector>
+
+// UART registers, relative to the base port. With the divisor latch access
+// bit (LCR bit 7) set, ports 0 and 1 access the baud rate divisor instead.
+//
+//   Port     Access  Description
+//   base+0   W       Transmitter holding register: the byte to send
+//   base+0   R       Receiver buffer register: always 0, there is no input
+//   base+1   R/W     Interrupt enable register
+//   base+2   R       Interrupt identification register: no interrupt pending
+//   base+2   W       FIFO control register
+//   base+3   R/W     Line control register
+//   base+4   R/W     Modem control register
+//   base+5   R       Line status register: THRE and TEMT while there is room
+//                    in the output buffer
+//   base+6   R       Modem status register: CTS, DSR and DCD set
+//   base+7   R/W     Scratch register
+//
+// Keep in sync with apps/x64-guest/src/ram.asm.
+
+const uint16_t uartCOM1Port = 0x03F8;
+
+// A transmit-only 16550-style UART. Bytes sent by the guest go into a ring
+// buffer, and a background thread drains the buffer to a file in large
+// writes, so guest output costs no host system call per character.
+//
+// The device only sees single port accesses. Platforms that complete a
+// whole REP OUTSB in one VM exit and call the I/O handler for each byte, as
+// KVM does for up to a page at a time, move a string with one exit. The
+// handler just stores the byte in the ring.
+//
+// The ring has one producer: the thread running the virtual processor. When
+// the ring is full, LSR reports the transmitter as busy, and a write made
+// anyway waits for the drain thread. No interrupts are raised.
+class UART16550 {
+public:
+    // bufferSize is rounded up to a power of two
+    UART16550(size_t bufferSize = 64 * 1024) noexcept;
+
+    // Drains all pending output and stops the drain thread
+    ~UART16550() noexcept;
+
+    // Starts draining output to the given file, which must stay open while
+    // the UART exists. Output written before this is kept.
+    void Start(FILE *output) noexcept;
+
+    // Claims the eight UART ports on the I/O bus.
+    bool Attach(IOBus& bus, uint16_t port = uartCOM1Port) noexcept;
+
+    // Waits until all output sent so far has been written to the file
+    void Flush() noexcept;
+
+    // Bytes sent by the guest and writes made to the file
+    uint64_t BytesSent() const noexcept { return m_head.load(std::memory_order_relaxed); }
+    uint64_t NumHostWrites() const noexcept { return m_numHostWrites.load(std::memory_order_relaxed); }
+
+private:
+    static uint32_t PortRead(void *context, uint16_t port, size_t size) noexcept;
+    static void PortWrite(void *context, uint16_t port, size_t size, uint32_t value) noexcept;
+
+    void Transmit(uint8_t byte) noexcept;
+    bool Full() const noexcept;
+    void DrainLoop() noexcept;
+    bool Drain() noexcept;
+
+    uint16_t m_port = uartCOM1Port;
+
+    // Registers
+    uint8_t m_ier = 0;
+    uint8_t m_fcr = 0;
+    uint8_t m_lcr = 0;
+    uint8_t m_mcr = 0;
+    uint8_t m_scr = 0;
+    uint16_t m_divisor = 12;  // 9600 baud
+
+    // Single-producer, single-consumer ring. The positions count bytes
+    // since the start and are reduced modulo the capacity on access.
+    std::vector<uint8_t> m_ring;
+    size_t m_mask;
+    std::atomic<uint64_t> m_head{ 0 };
+    std::atomic<uint64_t> m_tail{ 0 };
+
+    FILE *m_output = nullptr;
+    std::atomic<uint64_t> m_numHostWrites{ 0 };
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;     // Wakes the drain thread
+    std::condition_variable m_drained;  // Signaled after each drain
+    bool m_stop = false;
+    std::thread m_thread;
+};
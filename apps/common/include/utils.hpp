@@ -27,9 +27,24 @@ SOFTWARE.
 
 #include "virt86/virt86.hpp"
 
+#include <vector>
+
 template<class T, size_t N>
 constexpr size_t array_size(T(&)[N]) {
     return N;
 }
 
 const char *reason_str(virt86::VMExitReason reason) noexcept;
+
+// Returns the index in PlatformFactories of the first platform that
+// initialized successfully and whose name contains the selector, ignoring
+// case, or SIZE_MAX if there is none. A null selector matches any platform.
+size_t selectPlatform(const char *selector) noexcept;
+
+// Returns the resident set size of the current process in bytes, or 0 if it
+// cannot be determined.
+uint64_t residentSetSize() noexcept;
+
+// Reads a whole file into a buffer. Returns false if the file cannot be read
+// or is larger than maxSize.
+bool loadFile(const char *path, std::vector<uint8_t>& data, uint64_t maxSize);
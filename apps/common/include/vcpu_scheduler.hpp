@@ -0,0 +1,163 @@
+/*
+Declares a scheduler that multiplexes virtual processors over a pool of host
+threads in fixed time slices with fair-share accounting.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "virt86/virt86.hpp"
+
+#include "exit_stats.hpp"
+
+#include <atomic>
+#include <cinttypes>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs many virtual processors on fewer host threads. Each worker thread
+// picks the runnable guest with the least weighted run time, runs it for at
+// most one quantum and puts it back in the run queue, so every guest gets a
+// share of the CPU proportional to its weight and waits at most a bounded
+// time for its next slice.
+//
+// A watchdog thread tracks the slice of every worker. A slice that overruns
+// its quantum ends at the next VM exit. virt86 has no way to force a running
+// virtual processor to exit from another thread, so a guest that runs for a
+// long time without exiting keeps its worker until it does. Platforms that
+// can interrupt a running virtual processor install a preempt handler, which
+// the watchdog invokes for the worker's host thread until the slice ends.
+// The run is then reported as a VMExitReason::Cancelled exit, which the
+// scheduler consumes; runs that fail after a preemption request are treated
+// as preempted as well, since some platforms report interrupted runs as
+// failures.
+class VCPUScheduler {
+public:
+    enum class ExitAction {
+        Continue,   // Keep running the guest until its slice ends
+        Yield,      // End the slice and put the guest back in the run queue
+        Stop,       // Remove the guest from the run queue
+    };
+
+    // Invoked on the worker thread after every VM exit.
+    typedef ExitAction (*ExitHandler)(void *context, virt86::VirtualProcessor& vp, const virt86::VMExitInfo& exitInfo);
+
+    // Invoked on the watchdog thread to force the virtual processor running
+    // on the given host thread to exit.
+    typedef void (*PreemptHandler)(void *context, std::thread::native_handle_type thread);
+
+    static const uint32_t defaultWeight = 1024;
+
+    struct GuestStats {
+        std::string name;
+        uint32_t weight = defaultWeight;
+        uint64_t runTimeNs = 0;
+        uint64_t slices = 0;
+        uint64_t exits = 0;
+        uint64_t preemptions = 0;   // Slices ended by the quantum
+        uint64_t kicks = 0;         // Preempt handler invocations
+        bool stopped = false;
+        bool failed = false;        // The virtual processor failed to run
+
+        // Time spent in the run queue before each slice
+        LatencyHistogram waitLatency;
+    };
+
+    VCPUScheduler(size_t numThreads, uint64_t quantumNs) noexcept;
+    ~VCPUScheduler() noexcept;
+
+    // Adds a guest to the run queue. Must be called before Run. The weight
+    // sets the guest's share of CPU time relative to the other guests.
+    size_t AddGuest(const char *name, virt86::VirtualProcessor& vp, uint32_t weight, ExitHandler handler, void *context);
+
+    void SetPreemptHandler(PreemptHandler handler, void *context) noexcept;
+
+    // Installs a preempt handler that interrupts the worker thread with a
+    // signal, which makes KVM return from a run. Returns false on platforms
+    // without this mechanism.
+    bool EnableSignalPreemption() noexcept;
+
+    // Runs the guests until all of them stop or the duration elapses.
+    void Run(uint64_t durationNs);
+
+    uint64_t Now() const noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_epoch).count();
+    }
+
+    size_t NumGuests() const noexcept { return m_guests.size(); }
+    const GuestStats& Stats(size_t guest) const noexcept { return m_guests[guest]->stats; }
+    uint64_t ElapsedNs() const noexcept { return m_elapsed; }
+
+    // Prints the CPU share and scheduling latency of every guest.
+    void PrintStats(FILE *out) const noexcept;
+
+private:
+    struct Guest {
+        virt86::VirtualProcessor *vp;
+        ExitHandler handler;
+        void *context;
+        uint64_t vruntime = 0;      // Run time scaled by defaultWeight / weight
+        uint64_t readyTime = 0;
+        bool running = false;
+        GuestStats stats;
+    };
+
+    struct Worker {
+        std::thread thread;
+        // End of the current slice, 0 while idle, or preemptedDeadline once
+        // the watchdog asked the slice to end
+        std::atomic<uint64_t> deadline{ 0 };
+        std::atomic<Guest *> guest{ nullptr };
+    };
+
+    static const uint64_t preemptedDeadline = UINT64_MAX;
+
+    void WorkerThread(Worker& worker);
+    void WatchdogThread();
+    Guest *Pick(uint64_t now) noexcept;
+    void RunSlice(Worker& worker, Guest& guest) noexcept;
+
+    const size_t m_numThreads;
+    const uint64_t m_quantum;
+    const std::chrono::steady_clock::time_point m_epoch;
+
+    std::vector<std::unique_ptr<Guest>> m_guests;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;             // Signaled when a guest becomes runnable or on stop
+    std::condition_variable m_watchdogCond;     // Signaled when the workers have finished
+    size_t m_numActive = 0;                     // Guests that have not stopped
+    std::atomic<bool> m_stopping{ false };
+    bool m_workersDone = false;
+    uint64_t m_elapsed = 0;
+
+    PreemptHandler m_preemptHandler = nullptr;
+    void *m_preemptContext = nullptr;
+};
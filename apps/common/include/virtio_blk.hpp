@@ -0,0 +1,98 @@
+/*
+Declares a virtio block device backed by a host file.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "virtio_mmio.hpp"
+
+#include <cinttypes>
+
+const uint32_t VIRTIO_ID_BLOCK = 2;
+
+const uint64_t VIRTIO_BLK_F_RO = 1ull << 5;
+const uint64_t VIRTIO_BLK_F_FLUSH = 1ull << 9;
+
+// Request types
+const uint32_t VIRTIO_BLK_T_IN = 0;
+const uint32_t VIRTIO_BLK_T_OUT = 1;
+const uint32_t VIRTIO_BLK_T_FLUSH = 4;
+const uint32_t VIRTIO_BLK_T_GET_ID = 8;
+
+// Request status
+const uint8_t VIRTIO_BLK_S_OK = 0;
+const uint8_t VIRTIO_BLK_S_IOERR = 1;
+const uint8_t VIRTIO_BLK_S_UNSUPP = 2;
+
+const uint32_t VIRTIO_BLK_SECTOR_SIZE = 512;
+
+#pragma pack(push, 1)
+struct VirtioBlkRequestHeader {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+};
+#pragma pack(pop)
+
+// A virtio block device with a single request queue, backed by a host file.
+// Data is transferred directly between the file and the guest buffers.
+class VirtioBlk : public VirtioMMIODevice {
+public:
+    static const uint16_t queueSize = 256;
+
+    explicit VirtioBlk(const GuestMemory& memory) noexcept;
+    ~VirtioBlk() noexcept override;
+
+    // Opens the backing file. The capacity is the file size rounded down to
+    // a whole sector.
+    bool Open(const char *path, bool readOnly) noexcept;
+    void Close() noexcept;
+
+    uint64_t Capacity() const noexcept { return m_capacity; }  // In sectors
+    uint64_t NumRequests() const noexcept { return m_numRequests; }
+    uint64_t BytesRead() const noexcept { return m_bytesRead; }
+    uint64_t BytesWritten() const noexcept { return m_bytesWritten; }
+
+protected:
+    uint64_t DeviceFeatures() const noexcept override;
+    uint32_t ReadConfig(uint32_t offset, size_t size) noexcept override;
+    void ProcessQueue(uint32_t index, Virtqueue& queue) noexcept override;
+
+private:
+    uint8_t HandleRequest(const VirtqBuffer *buffers, size_t numBuffers, uint32_t& written) noexcept;
+    bool ReadAt(uint64_t offset, uint8_t *data, uint32_t len) noexcept;
+    bool WriteAt(uint64_t offset, const uint8_t *data, uint32_t len) noexcept;
+    bool Flush() noexcept;
+
+#if defined(_WIN32)
+    void *m_file = nullptr;
+#else
+    int m_file = -1;
+#endif
+    bool m_readOnly = false;
+    uint64_t m_capacity = 0;
+    uint64_t m_numRequests = 0;
+    uint64_t m_bytesRead = 0;
+    uint64_t m_bytesWritten = 0;
+};
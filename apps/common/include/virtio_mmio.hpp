@@ -0,0 +1,131 @@
+/*
+Declares the virtio MMIO transport shared by the virtio device models.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "guest_memory.hpp"
+#include "io_bus.hpp"
+#include "virtqueue.hpp"
+
+#include <cinttypes>
+#include <stddef.h>
+
+// Register layout of the virtio MMIO transport (version 2), as defined by the
+// virtio 1.1 specification, section 4.2.2
+enum VirtioMMIORegister : uint32_t {
+    VIRTIO_MMIO_MAGIC_VALUE = 0x000,
+    VIRTIO_MMIO_VERSION = 0x004,
+    VIRTIO_MMIO_DEVICE_ID = 0x008,
+    VIRTIO_MMIO_VENDOR_ID = 0x00c,
+    VIRTIO_MMIO_DEVICE_FEATURES = 0x010,
+    VIRTIO_MMIO_DEVICE_FEATURES_SEL = 0x014,
+    VIRTIO_MMIO_DRIVER_FEATURES = 0x020,
+    VIRTIO_MMIO_DRIVER_FEATURES_SEL = 0x024,
+    VIRTIO_MMIO_QUEUE_SEL = 0x030,
+    VIRTIO_MMIO_QUEUE_NUM_MAX = 0x034,
+    VIRTIO_MMIO_QUEUE_NUM = 0x038,
+    VIRTIO_MMIO_QUEUE_READY = 0x044,
+    VIRTIO_MMIO_QUEUE_NOTIFY = 0x050,
+    VIRTIO_MMIO_INTERRUPT_STATUS = 0x060,
+    VIRTIO_MMIO_INTERRUPT_ACK = 0x064,
+    VIRTIO_MMIO_STATUS = 0x070,
+    VIRTIO_MMIO_QUEUE_DESC_LOW = 0x080,
+    VIRTIO_MMIO_QUEUE_DESC_HIGH = 0x084,
+    VIRTIO_MMIO_QUEUE_DRIVER_LOW = 0x090,
+    VIRTIO_MMIO_QUEUE_DRIVER_HIGH = 0x094,
+    VIRTIO_MMIO_QUEUE_DEVICE_LOW = 0x0a0,
+    VIRTIO_MMIO_QUEUE_DEVICE_HIGH = 0x0a4,
+    VIRTIO_MMIO_CONFIG_GENERATION = 0x0fc,
+    VIRTIO_MMIO_CONFIG = 0x100,
+};
+
+const uint32_t VIRTIO_MMIO_MAGIC = 0x74726976;  // "virt"
+const uint64_t VIRTIO_MMIO_SIZE = 0x200;
+
+// Device status bits
+const uint32_t VIRTIO_STATUS_ACKNOWLEDGE = 1;
+const uint32_t VIRTIO_STATUS_DRIVER = 2;
+const uint32_t VIRTIO_STATUS_DRIVER_OK = 4;
+const uint32_t VIRTIO_STATUS_FEATURES_OK = 8;
+const uint32_t VIRTIO_STATUS_FAILED = 128;
+
+const uint64_t VIRTIO_F_VERSION_1 = 1ull << 32;
+
+// Base class of virtio devices using the MMIO transport. Queue notifications
+// are processed synchronously in the MMIO write callback, so a single guest
+// exit can complete any number of requests. Completions are signaled through
+// the interrupt status register; the guest is expected to poll the used ring.
+class VirtioMMIODevice {
+public:
+    static const uint32_t maxQueues = 4;
+
+    VirtioMMIODevice(const GuestMemory& memory, uint32_t deviceID, uint32_t numQueues, uint16_t queueSizeMax) noexcept;
+    virtual ~VirtioMMIODevice() noexcept = default;
+
+    // Claims the register window at the given guest physical address.
+    bool Attach(IOBus& bus, uint64_t baseAddress) noexcept;
+
+    uint64_t NumNotifications() const noexcept { return m_numNotifications; }
+
+protected:
+    // Features offered by the device. VIRTIO_F_VERSION_1 is always offered.
+    virtual uint64_t DeviceFeatures() const noexcept { return 0; }
+
+    // Reads from the device-specific configuration space.
+    virtual uint32_t ReadConfig(uint32_t offset, size_t size) noexcept { return 0; }
+    virtual void WriteConfig(uint32_t offset, size_t size, uint32_t value) noexcept {}
+
+    // Processes all chains available in the queue.
+    virtual void ProcessQueue(uint32_t index, Virtqueue& queue) noexcept = 0;
+
+    // Signals a used buffer notification to the driver.
+    void NotifyUsed() noexcept { m_interruptStatus |= 1; }
+
+    uint64_t DriverFeatures() const noexcept { return m_driverFeatures; }
+
+    const GuestMemory& m_memory;
+
+private:
+    static uint64_t MMIORead(void *context, uint64_t address, size_t size) noexcept;
+    static void MMIOWrite(void *context, uint64_t address, size_t size, uint64_t value) noexcept;
+
+    uint32_t ReadRegister(uint32_t offset, size_t size) noexcept;
+    void WriteRegister(uint32_t offset, size_t size, uint32_t value) noexcept;
+    void Reset() noexcept;
+
+    const uint32_t m_deviceID;
+    const uint32_t m_numQueues;
+    const uint16_t m_queueSizeMax;
+
+    uint64_t m_baseAddress = 0;
+    uint32_t m_status = 0;
+    uint32_t m_deviceFeaturesSel = 0;
+    uint32_t m_driverFeaturesSel = 0;
+    uint64_t m_driverFeatures = 0;
+    uint32_t m_queueSel = 0;
+    uint32_t m_interruptStatus = 0;
+    uint64_t m_numNotifications = 0;
+    Virtqueue m_queues[maxQueues];
+};
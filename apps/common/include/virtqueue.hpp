@@ -0,0 +1,110 @@
+/*
+Declares the host side of a virtio split virtqueue living in guest memory.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "guest_memory.hpp"
+
+#include <cinttypes>
+#include <stddef.h>
+
+// Split virtqueue layout as defined by the virtio 1.1 specification, section 2.6.
+// All structures live in guest memory and are little-endian.
+
+const uint16_t VIRTQ_DESC_F_NEXT = 1;
+const uint16_t VIRTQ_DESC_F_WRITE = 2;
+const uint16_t VIRTQ_DESC_F_INDIRECT = 4;
+
+#pragma pack(push, 1)
+struct VirtqDesc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+};
+
+struct VirtqAvail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[1];   // queue size entries, followed by used_event
+};
+
+struct VirtqUsedElem {
+    uint32_t id;
+    uint32_t len;
+};
+
+struct VirtqUsed {
+    uint16_t flags;
+    uint16_t idx;
+    VirtqUsedElem ring[1];  // queue size entries, followed by avail_event
+};
+#pragma pack(pop)
+
+// A buffer of a descriptor chain, translated to host memory
+struct VirtqBuffer {
+    uint8_t *data;
+    uint32_t len;
+    bool writable;  // Device-writable
+};
+
+// Host side of a split virtqueue. Descriptors are translated into pointers to
+// the host memory backing guest RAM, so device models read and write guest
+// buffers in place without copying.
+class Virtqueue {
+public:
+    static const uint16_t maxSize = 1024;
+
+    // Resets the queue to its initial, disabled state.
+    void Reset() noexcept;
+
+    // Validates the ring size and addresses set by the driver and enables the
+    // queue. The size must be a power of two no larger than maxSize.
+    bool Enable(const GuestMemory& memory) noexcept;
+    bool IsReady() const noexcept { return m_ready; }
+
+    // Retrieves the next descriptor chain made available by the driver.
+    // Returns false if no chains are pending. On malformed chains, numBuffers
+    // is set to zero; the chain must still be returned with PushUsed.
+    bool PopChain(uint16_t& head, VirtqBuffer *buffers, size_t maxBuffers, size_t& numBuffers) noexcept;
+
+    // Returns a chain to the driver, with the number of bytes written to its
+    // device-writable buffers.
+    void PushUsed(uint16_t head, uint32_t len) noexcept;
+
+    // Ring configuration, written by the transport
+    uint16_t size = 0;
+    uint64_t descAddr = 0;
+    uint64_t availAddr = 0;
+    uint64_t usedAddr = 0;
+
+private:
+    const GuestMemory *m_memory = nullptr;
+    VirtqDesc *m_desc = nullptr;
+    VirtqAvail *m_avail = nullptr;
+    VirtqUsed *m_used = nullptr;
+    uint16_t m_lastAvailIdx = 0;
+    bool m_ready = false;
+};
@@ -0,0 +1,100 @@
+/*
+Declares a snapshot of a virtual machine's RAM and processor state that is
+restored by copying back only the dirty pages.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "virt86/virt86.hpp"
+
+#include <cinttypes>
+#include <stddef.h>
+#include <vector>
+
+// Captures the RAM and the processor registers of a virtual machine at one
+// point and returns it to that point as often as needed. Restoring asks the
+// hypervisor for the pages the guest wrote since the last restore and copies
+// back only those, so the cost depends on how much memory the guest touched
+// rather than on the size of RAM.
+//
+// The hypervisor only tracks writes made by the guest. Host writes to guest
+// RAM, such as device emulation or inputs placed by the host, must be
+// reported with MarkDirty. Without dirty page tracking, every restore copies
+// all of RAM.
+//
+// The x87 and SSE state is captured along with the other registers when the
+// platform exposes it; the upper halves of the AVX registers are not.
+class VMSnapshot {
+public:
+    struct Stats {
+        uint64_t restores = 0;
+        uint64_t pagesRestored = 0;
+        uint64_t fullRestores = 0;      // Restores that copied all of RAM
+    };
+
+    VMSnapshot() noexcept = default;
+    ~VMSnapshot() noexcept;
+    VMSnapshot(const VMSnapshot&) = delete;
+    VMSnapshot& operator=(const VMSnapshot&) = delete;
+
+    // Copies the RAM mapped at the given guest physical address and reads the
+    // processor state. The RAM must have been mapped with
+    // MemoryFlags::DirtyPageTracking for incremental restores.
+    bool Take(virt86::VirtualMachine& vm, virt86::VirtualProcessor& vp, uint64_t ramBase, uint8_t *ram, uint64_t ramSize) noexcept;
+
+    // Returns the RAM and the processor to the state captured by Take.
+    bool Restore(virt86::VirtualProcessor& vp) noexcept;
+
+    // Records a host write to guest RAM so that the next restore reverts it.
+    void MarkDirty(uint64_t address, uint64_t size) noexcept;
+
+    bool Valid() const noexcept { return m_snapshot != nullptr; }
+    const Stats& GetStats() const noexcept { return m_stats; }
+
+private:
+    // Copies pages [firstPage, endPage) from the snapshot back to RAM
+    void CopyPages(uint64_t firstPage, uint64_t endPage) noexcept;
+
+    static const virt86::Reg regs[];
+    static const size_t numRegs;
+    static const virt86::Reg fpRegs[];
+    static const size_t numFPRegs;
+
+    virt86::VirtualMachine *m_vm = nullptr;
+    uint64_t m_ramBase = 0;
+    uint8_t *m_ram = nullptr;
+    uint64_t m_ramSize = 0;
+    uint8_t *m_snapshot = nullptr;
+    bool m_dirtyTracking = false;
+
+    std::vector<virt86::RegValue> m_regValues;
+    std::vector<virt86::RegValue> m_fpRegValues;
+    virt86::FPUControl m_fpuControl;
+    virt86::MXCSR m_mxcsr;
+    bool m_fpState = false;     // Whether the floating point state was captured
+    std::vector<uint64_t> m_dirtyBitmap;    // Pages written by the guest
+    std::vector<uint64_t> m_hostDirty;      // Pages written by the host
+
+    Stats m_stats;
+};
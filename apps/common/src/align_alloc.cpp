@@ -31,13 +31,16 @@ SOFTWARE.
 #  include <Windows.h>
 #elif defined(__linux__)
 #  include <stdlib.h>
+#  include <sys/mman.h>
 #elif defined(__APPLE__)
 #  include <stdlib.h>
+#  include <string.h>
+#  include <sys/mman.h>
 #else
 #  error Unsupported platform
 #endif
 
-uint8_t *alignedAlloc(const size_t size) noexcept {
+uint8_t *alignedAlloc(const size_t size, const bool mergeable) noexcept {
 #if defined(_WIN32)
     LPVOID mem = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_READWRITE);
     if (mem == NULL) {
@@ -45,7 +48,14 @@ uint8_t *alignedAlloc(const size_t size) noexcept {
     }
     return (uint8_t *)VirtualAlloc(mem, size, MEM_COMMIT, PAGE_READWRITE);
 #elif defined(__linux__)
-    return (uint8_t *)aligned_alloc(PAGE_SIZE, size);
+    uint8_t *mem = (uint8_t *)aligned_alloc(PAGE_SIZE, size);
+#  if defined(MADV_MERGEABLE)
+    if (mem != NULL && mergeable) {
+        // Failure only means the pages won't be merged
+        madvise(mem, (size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1), MADV_MERGEABLE);
+    }
+#  endif
+    return mem;
 #elif defined(__APPLE__)
     // Allocate memory with room to keep track of the original pointer
     void *mem = malloc(size + (PAGE_SIZE - 1) + sizeof(void*));
@@ -72,3 +82,26 @@ bool alignedFree(void *memory) noexcept {
     return true;
 #endif
 }
+
+bool alignedDiscard(void *memory, const size_t size) noexcept {
+#if defined(_WIN32)
+    return VirtualAlloc(memory, size, MEM_RESET, PAGE_READWRITE) != NULL;
+#elif defined(__linux__)
+    return madvise(memory, size, MADV_DONTNEED) == 0;
+#elif defined(__APPLE__)
+    return madvise(memory, size, MADV_FREE) == 0;
+#endif
+}
+
+bool alignedClear(void *memory, const size_t size) noexcept {
+#if defined(_WIN32)
+    return VirtualFree(memory, size, MEM_DECOMMIT) == TRUE
+        && VirtualAlloc(memory, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#elif defined(__linux__)
+    // Private anonymous pages read as zeros after MADV_DONTNEED
+    return madvise(memory, size, MADV_DONTNEED) == 0;
+#elif defined(__APPLE__)
+    memset(memory, 0, size);
+    return true;
+#endif
+}
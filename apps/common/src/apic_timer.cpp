@@ -0,0 +1,200 @@
+/*
+Defines the timer of a local APIC, including TSC-deadline mode.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "apic_timer.hpp"
+
+#include <algorithm>
+
+static const uint64_t nsPerCount = 1000000000ull / lapicTimerFrequency;
+
+// Shortest period accepted in periodic mode. Like KVM, longer than the
+// hardware allows, so that a guest can't keep the timer thread busy.
+static const uint64_t minPeriod = 10000;
+
+LocalAPICTimer::LocalAPICTimer(InterruptController& controller, const TSCClock& clock) noexcept
+    : m_controller(controller)
+    , m_clock(clock)
+{
+}
+
+LocalAPICTimer::~LocalAPICTimer() noexcept {
+    Cancel();
+}
+
+bool LocalAPICTimer::Attach(IOBus& bus, uint64_t baseAddress) noexcept {
+    m_baseAddress = baseAddress;
+    return bus.RegisterMMIO(baseAddress, lapicSize, MMIORead, MMIOWrite, this);
+}
+
+bool LocalAPICTimer::Attach(MSRTable& msrs) noexcept {
+    return msrs.Register(IA32_TSC_DEADLINE, DeadlineRead, DeadlineWrite, this);
+}
+
+void LocalAPICTimer::Cancel() noexcept {
+    if (m_timerID != TimerWheel::invalidTimer) {
+        m_controller.CancelTimer(m_timerID);
+        m_timerID = TimerWheel::invalidTimer;
+    }
+}
+
+void LocalAPICTimer::Schedule(bool started) noexcept {
+    Cancel();
+    if (!m_running || !(m_svr & LAPIC_SVR_ENABLE) || (m_lvtTimer & LAPIC_LVT_MASKED)) {
+        return;
+    }
+
+    const uint64_t now = m_controller.Now();
+    if (m_period != 0 && now > m_deadline) {
+        // Skip the expirations that passed while the timer was masked
+        m_deadline += ((now - m_deadline) / m_period + 1) * m_period;
+    }
+    else if (m_period == 0 && now > m_deadline && !started) {
+        // A one-shot count or deadline that ran out earlier has already
+        // fired, or was masked and lost its interrupt
+        return;
+    }
+    m_timerID = m_controller.ScheduleInterrupt(m_deadline, static_cast<uint8_t>(m_lvtTimer), m_period);
+    m_numArmed++;
+}
+
+uint32_t LocalAPICTimer::CurrentCount() const noexcept {
+    if (!m_running || Mode() == LAPIC_TIMER_TSC_DEADLINE || m_duration == 0) {
+        return 0;
+    }
+    uint64_t elapsed = m_controller.Now() - m_start;
+    if (m_period == 0) {
+        if (elapsed >= m_duration) {
+            return 0;
+        }
+    }
+    else {
+        elapsed %= m_duration;
+    }
+    return static_cast<uint32_t>((m_duration - elapsed) / (m_divisor * nsPerCount));
+}
+
+void LocalAPICTimer::WriteSVR(uint32_t value) noexcept {
+    m_svr = value & 0x1FF;
+    if (!(m_svr & LAPIC_SVR_ENABLE)) {
+        // A software-disabled APIC masks all LVT entries
+        m_lvtTimer |= LAPIC_LVT_MASKED;
+    }
+    Schedule(false);
+}
+
+void LocalAPICTimer::WriteLVT(uint32_t value) noexcept {
+    const uint32_t oldMode = Mode();
+    m_lvtTimer = value & (0xFF | LAPIC_LVT_MASKED | (3u << 17));
+    if (!(m_svr & LAPIC_SVR_ENABLE)) {
+        m_lvtTimer |= LAPIC_LVT_MASKED;
+    }
+    if (Mode() != oldMode) {
+        // Switching modes disarms the timer
+        m_running = false;
+        m_initialCount = 0;
+        m_tscDeadline = 0;
+    }
+    // Picks up a new vector or mask
+    Schedule(false);
+}
+
+void LocalAPICTimer::WriteInitialCount(uint32_t value) noexcept {
+    if (Mode() == LAPIC_TIMER_TSC_DEADLINE) {
+        return;
+    }
+    m_initialCount = value;
+    m_running = value != 0;
+    m_start = m_controller.Now();
+    m_duration = static_cast<uint64_t>(value) * m_divisor * nsPerCount;
+    m_period = (Mode() == LAPIC_TIMER_PERIODIC) ? std::max(m_duration, minPeriod) : 0;
+    m_deadline = m_start + std::max(m_duration, m_period);
+    Schedule(true);
+}
+
+void LocalAPICTimer::WriteDivide(uint32_t value) noexcept {
+    // Bits 3, 1 and 0 select a divisor of 2 to 128, or 1 for 0b111. Takes
+    // effect at the next initial count.
+    m_divideConfig = value & 0xB;
+    const uint32_t shift = (m_divideConfig & 3) | ((m_divideConfig & 8) >> 1);
+    m_divisor = (shift == 7) ? 1 : (2u << shift);
+}
+
+void LocalAPICTimer::WriteDeadline(uint64_t value) noexcept {
+    // Ignored outside TSC-deadline mode
+    if (Mode() != LAPIC_TIMER_TSC_DEADLINE) {
+        return;
+    }
+    m_tscDeadline = value;
+    m_running = value != 0;
+    m_period = 0;
+    m_deadline = m_clock.ToTime(value);
+    Schedule(true);
+}
+
+uint64_t LocalAPICTimer::MMIORead(void *context, uint64_t address, size_t size) noexcept {
+    auto& apic = *reinterpret_cast<LocalAPICTimer *>(context);
+    switch (address - apic.m_baseAddress) {
+    case 0x020: return apic.m_id;
+    case 0x030: return 0x00050014;
+    case 0x080: return apic.m_tpr;
+    case 0x0F0: return apic.m_svr;
+    case 0x320: return apic.m_lvtTimer;
+    case 0x380: return apic.m_initialCount;
+    case 0x390: return apic.CurrentCount();
+    case 0x3E0: return apic.m_divideConfig;
+    default: return 0;
+    }
+}
+
+void LocalAPICTimer::MMIOWrite(void *context, uint64_t address, size_t size, uint64_t value) noexcept {
+    auto& apic = *reinterpret_cast<LocalAPICTimer *>(context);
+    const uint32_t value32 = static_cast<uint32_t>(value);
+    switch (address - apic.m_baseAddress) {
+    case 0x020: apic.m_id = value32 & 0xFF000000; break;
+    case 0x080: apic.m_tpr = value32 & 0xFF; break;
+    case 0x0B0: apic.m_numEOIs++; break;
+    case 0x0F0: apic.WriteSVR(value32); break;
+    case 0x320: apic.WriteLVT(value32); break;
+    case 0x380: apic.WriteInitialCount(value32); break;
+    case 0x3E0: apic.WriteDivide(value32); break;
+    }
+}
+
+bool LocalAPICTimer::DeadlineRead(void *context, uint32_t msr, uint64_t& value) {
+    auto& apic = *reinterpret_cast<LocalAPICTimer *>(context);
+    if (apic.Mode() != LAPIC_TIMER_TSC_DEADLINE || !apic.m_running || apic.m_controller.Now() >= apic.m_deadline) {
+        value = 0;
+    }
+    else {
+        value = apic.m_tscDeadline;
+    }
+    return true;
+}
+
+bool LocalAPICTimer::DeadlineWrite(void *context, uint32_t msr, uint64_t value) {
+    auto& apic = *reinterpret_cast<LocalAPICTimer *>(context);
+    apic.WriteDeadline(value);
+    return true;
+}
@@ -0,0 +1,134 @@
+/*
+Defines a memory balloon device that returns free guest pages to the host.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "balloon.hpp"
+
+#include "align_alloc.hpp"
+
+static const uint64_t pageShift = 12;
+
+BalloonDevice::BalloonDevice(const GuestMemory& memory, uint64_t maxAddress) noexcept
+    : m_memory(memory)
+    , m_bitmap(((maxAddress >> pageShift) + 63) / 64, 0)
+{
+}
+
+bool BalloonDevice::Attach(IOBus& bus, uint16_t port) noexcept {
+    m_port = port;
+    return bus.RegisterPIO(port, 12, PortRead, PortWrite, this);
+}
+
+uint8_t *BalloonDevice::TranslateRange(uint64_t pfn, uint64_t count) const noexcept {
+    if (count == 0 || pfn + count > m_bitmap.size() * 64 || pfn + count < pfn) {
+        return nullptr;
+    }
+    return m_memory.Translate(pfn << pageShift, count << pageShift);
+}
+
+bool BalloonDevice::Contains(uint64_t pfn) const noexcept {
+    if (pfn >= m_bitmap.size() * 64) {
+        return false;
+    }
+    return (m_bitmap[pfn / 64] >> (pfn & 63)) & 1;
+}
+
+bool BalloonDevice::Inflate(uint64_t pfn, uint64_t count) noexcept {
+    uint8_t *memory = TranslateRange(pfn, count);
+    if (memory == nullptr) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < count; i++) {
+        const uint64_t page = pfn + i;
+        const uint64_t bit = 1ull << (page & 63);
+        if (!(m_bitmap[page / 64] & bit)) {
+            m_bitmap[page / 64] |= bit;
+            m_numPages++;
+            m_numInflated++;
+        }
+    }
+    if (m_numPages > m_peakPages) {
+        m_peakPages = m_numPages;
+    }
+
+    // Discarding pages that were already in the balloon is harmless, so the
+    // whole range is released with a single call
+    alignedDiscard(memory, count << pageShift);
+    return true;
+}
+
+bool BalloonDevice::Deflate(uint64_t pfn, uint64_t count) noexcept {
+    if (TranslateRange(pfn, count) == nullptr) {
+        return false;
+    }
+
+    // The host memory is faulted back in when the guest touches the pages
+    for (uint64_t i = 0; i < count; i++) {
+        const uint64_t page = pfn + i;
+        const uint64_t bit = 1ull << (page & 63);
+        if (m_bitmap[page / 64] & bit) {
+            m_bitmap[page / 64] &= ~bit;
+            m_numPages--;
+            m_numDeflated++;
+        }
+    }
+    return true;
+}
+
+uint32_t BalloonDevice::PortRead(void *context, uint16_t port, size_t size) noexcept {
+    auto& balloon = *reinterpret_cast<BalloonDevice *>(context);
+    switch (port - balloon.m_port) {
+    case 0: return balloon.m_target;
+    case 4: return static_cast<uint32_t>(balloon.m_numPages);
+    case 8: return balloon.m_status;
+    default: return 0xFFFFFFFF;
+    }
+}
+
+void BalloonDevice::PortWrite(void *context, uint16_t port, size_t size, uint32_t value) noexcept {
+    if (size != 4) {
+        return;
+    }
+    auto& balloon = *reinterpret_cast<BalloonDevice *>(context);
+    switch (port - balloon.m_port) {
+    case 0:
+        balloon.m_rangePFN = value;
+        break;
+    case 4: {
+        bool ok = false;
+        if (balloon.m_command == BALLOON_INFLATE) {
+            ok = balloon.Inflate(balloon.m_rangePFN, value);
+        }
+        else if (balloon.m_command == BALLOON_DEFLATE) {
+            ok = balloon.Deflate(balloon.m_rangePFN, value);
+        }
+        balloon.m_status = ok ? 0 : BALLOON_EINVAL;
+        break;
+    }
+    case 8:
+        balloon.m_command = value;
+        break;
+    }
+}
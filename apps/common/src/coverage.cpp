@@ -0,0 +1,227 @@
+/*
+Defines a basic block coverage tracker based on one-shot guest breakpoints.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "coverage.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+using namespace virt86;
+
+static const uint8_t int3 = 0xCC;
+
+bool CoverageTracker::Load(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        m_error = std::string("could not open ") + path;
+        return false;
+    }
+
+    std::vector<uint64_t> blocks;
+    char line[256];
+    size_t lineNumber = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineNumber++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        char *start = line + strspn(line, " \t\r\n");
+        if (*start == '\0') {
+            continue;
+        }
+        char *end;
+        uint64_t address = strtoull(start, &end, 16);
+        if (end == start || end[strspn(end, " \t\r\n")] != '\0') {
+            m_error = std::string(path) + ":" + std::to_string(lineNumber) + ": expected a hexadecimal address";
+            ok = false;
+            break;
+        }
+        blocks.push_back(address);
+    }
+    fclose(fp);
+    if (ok) {
+        SetBlocks(std::move(blocks));
+    }
+    return ok;
+}
+
+void CoverageTracker::SetBlocks(std::vector<uint64_t> blocks) {
+    std::sort(blocks.begin(), blocks.end());
+    blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+    m_blocks = std::move(blocks);
+    m_original.assign(m_blocks.size(), 0);
+    m_state.assign(m_blocks.size(), State::Idle);
+    m_hitBitmap.assign((m_blocks.size() + 63) / 64, 0);
+    m_numHit = 0;
+    for (auto& slot : m_hwSlots) {
+        slot = SIZE_MAX;
+    }
+}
+
+size_t CoverageTracker::Find(uint64_t address) const noexcept {
+    auto it = std::lower_bound(m_blocks.begin(), m_blocks.end(), address);
+    if (it == m_blocks.end() || *it != address) {
+        return SIZE_MAX;
+    }
+    return it - m_blocks.begin();
+}
+
+bool CoverageTracker::Arm(VirtualProcessor& vp) {
+    if (vp.EnableSoftwareBreakpoints(true) != VPOperationStatus::OK) {
+        m_error = "failed to enable software breakpoints";
+        return false;
+    }
+    for (size_t i = 0; i < m_blocks.size(); i++) {
+        if (Hit(i) || m_state[i] != State::Idle) {
+            continue;
+        }
+        if (vp.LMemRead(m_blocks[i], 1, &m_original[i]) && vp.LMemWrite(m_blocks[i], 1, &int3)) {
+            m_state[i] = State::Patched;
+        }
+        else {
+            m_state[i] = State::Hardware;
+        }
+    }
+    return UpdateHardwareBreakpoints(vp, false);
+}
+
+bool CoverageTracker::Disarm(VirtualProcessor& vp) {
+    bool ok = true;
+    for (size_t i = 0; i < m_blocks.size(); i++) {
+        if (m_state[i] == State::Patched) {
+            ok &= vp.LMemWrite(m_blocks[i], 1, &m_original[i]);
+        }
+        m_state[i] = State::Idle;
+    }
+    for (auto& slot : m_hwSlots) {
+        slot = SIZE_MAX;
+    }
+    ok &= vp.ClearHardwareBreakpoints() == VPOperationStatus::OK;
+    ok &= vp.EnableSoftwareBreakpoints(false) == VPOperationStatus::OK;
+    return ok;
+}
+
+void CoverageTracker::Reset() noexcept {
+    std::fill(m_hitBitmap.begin(), m_hitBitmap.end(), 0);
+    m_numHit = 0;
+}
+
+void CoverageTracker::MarkHit(size_t block) noexcept {
+    m_hitBitmap[block / 64] |= 1ull << (block & 63);
+    m_numHit++;
+    m_state[block] = State::Idle;
+}
+
+bool CoverageTracker::UpdateHardwareBreakpoints(VirtualProcessor& vp, bool force) noexcept {
+    // Fill free slots with blocks waiting for a hardware breakpoint
+    bool changed = force;
+    size_t next = 0;
+    for (auto& slot : m_hwSlots) {
+        if (slot != SIZE_MAX) {
+            continue;
+        }
+        for (; next < m_blocks.size(); next++) {
+            if (m_state[next] == State::Hardware && std::find(std::begin(m_hwSlots), std::end(m_hwSlots), next) == std::end(m_hwSlots)) {
+                break;
+            }
+        }
+        if (next == m_blocks.size()) {
+            break;
+        }
+        slot = next++;
+        changed = true;
+    }
+    if (!changed) {
+        return true;
+    }
+
+    HardwareBreakpoints bps = {};
+    bool inUse = false;
+    for (size_t i = 0; i < numHardwareBreakpoints; i++) {
+        if (m_hwSlots[i] == SIZE_MAX) {
+            continue;
+        }
+        bps.bp[i].address = m_blocks[m_hwSlots[i]];
+        bps.bp[i].localEnable = true;
+        bps.bp[i].globalEnable = false;
+        bps.bp[i].trigger = HardwareBreakpointTrigger::Execution;
+        bps.bp[i].length = HardwareBreakpointLength::Byte;
+        inUse = true;
+    }
+    auto status = inUse ? vp.SetHardwareBreakpoints(bps) : vp.ClearHardwareBreakpoints();
+    if (status != VPOperationStatus::OK) {
+        m_error = "failed to set hardware breakpoints";
+        return false;
+    }
+    return true;
+}
+
+bool CoverageTracker::HandleExit(VirtualProcessor& vp) noexcept {
+    uint64_t address;
+    if (vp.GetBreakpointAddress(&address) != VPOperationStatus::OK) {
+        return false;
+    }
+    size_t block = Find(address);
+    if (block == SIZE_MAX) {
+        return false;
+    }
+
+    switch (m_state[block]) {
+    case State::Patched:
+        vp.LMemWrite(address, 1, &m_original[block]);
+        MarkHit(block);
+        return true;
+    case State::Hardware:
+        // Free the slot and hand it to the next waiting block, if any
+        for (auto& slot : m_hwSlots) {
+            if (slot == block) {
+                slot = SIZE_MAX;
+            }
+        }
+        MarkHit(block);
+        UpdateHardwareBreakpoints(vp, true);
+        return true;
+    default:
+        // Already hit; the breakpoint belongs to someone else
+        return false;
+    }
+}
+
+bool CoverageTracker::Save(const char *path) const noexcept {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        return false;
+    }
+    fprintf(fp, "# %zu of %zu blocks hit\n", m_numHit, m_blocks.size());
+    for (size_t i = 0; i < m_blocks.size(); i++) {
+        if (Hit(i)) {
+            fprintf(fp, "%" PRIx64 "\n", m_blocks[i]);
+        }
+    }
+    return fclose(fp) == 0;
+}
@@ -0,0 +1,323 @@
+/*
+Defines a table of CPUID results presented to the guest, loaded from a file
+or derived from the host processor.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "cpuid_policy.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_WIN32)
+#  include <intrin.h>
+#else
+#  include <cpuid.h>
+#endif
+
+using namespace virt86;
+
+// Flat lookup tables are limited to this many functions per range; leaves
+// beyond it are found by binary search
+static const uint32_t maxRangeSize = 256;
+
+// Leaves whose results depend on the subleaf in ECX
+static bool isIndexedLeaf(uint32_t function) noexcept {
+    switch (function) {
+    case 0x04: case 0x07: case 0x0B: case 0x0D: case 0x0F: case 0x10:
+    case 0x12: case 0x14: case 0x17: case 0x18: case 0x1D: case 0x1F:
+    case 0x8000001D: case 0x80000020:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void hostCPUID(uint32_t function, uint32_t subleaf, uint32_t regs[4]) noexcept {
+#if defined(_WIN32)
+    int info[4];
+    __cpuidex(info, (int)function, (int)subleaf);
+    memcpy(regs, info, sizeof(info));
+#else
+    __cpuid_count(function, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static bool parseHex(const char *token, uint32_t& value) noexcept {
+    char *end;
+    unsigned long parsed = strtoul(token, &end, 16);
+    if (*token == '\0' || *end != '\0' || parsed > UINT32_MAX) {
+        return false;
+    }
+    value = (uint32_t)parsed;
+    return true;
+}
+
+bool CPUIDPolicy::Load(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        m_error = std::string("could not open ") + path;
+        return false;
+    }
+
+    std::vector<Leaf> leaves;
+    char line[256];
+    size_t lineNumber = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineNumber++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        const char *tokens[6];
+        size_t numTokens = 0;
+        for (char *token = strtok(line, " \t\r\n"); token != NULL; token = strtok(NULL, " \t\r\n")) {
+            if (numTokens == 6) {
+                numTokens++;
+                break;
+            }
+            tokens[numTokens++] = token;
+        }
+        if (numTokens == 0) {
+            continue;
+        }
+
+        Leaf leaf;
+        bool valid = (numTokens == 6)
+            && parseHex(tokens[0], leaf.function)
+            && (strcmp(tokens[1], "*") == 0 || parseHex(tokens[1], leaf.subleaf))
+            && parseHex(tokens[2], leaf.eax)
+            && parseHex(tokens[3], leaf.ebx)
+            && parseHex(tokens[4], leaf.ecx)
+            && parseHex(tokens[5], leaf.edx);
+        if (!valid) {
+            m_error = std::string(path) + ":" + std::to_string(lineNumber) + ": expected function, subleaf and four registers";
+            ok = false;
+            break;
+        }
+        if (strcmp(tokens[1], "*") == 0) {
+            leaf.subleaf = anySubleaf;
+        }
+        leaves.push_back(leaf);
+    }
+    fclose(fp);
+    if (!ok) {
+        return false;
+    }
+
+    m_leaves.clear();
+    for (auto& leaf : leaves) {
+        Set(leaf.function, leaf.subleaf, leaf.eax, leaf.ebx, leaf.ecx, leaf.edx);
+    }
+    return true;
+}
+
+bool CPUIDPolicy::Save(const char *path) const noexcept {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        return false;
+    }
+    fprintf(fp, "# function subleaf  eax      ebx      ecx      edx\n");
+    for (auto& leaf : m_leaves) {
+        if (leaf.subleaf == anySubleaf) {
+            fprintf(fp, "%08x   *        ", leaf.function);
+        }
+        else {
+            fprintf(fp, "%08x   %-8x ", leaf.function, leaf.subleaf);
+        }
+        fprintf(fp, "%08x %08x %08x %08x\n", leaf.eax, leaf.ebx, leaf.ecx, leaf.edx);
+    }
+    return fclose(fp) == 0;
+}
+
+void CPUIDPolicy::LoadHost() {
+    m_leaves.clear();
+
+    for (uint32_t base : { 0x00000000u, 0x80000000u }) {
+        uint32_t regs[4];
+        hostCPUID(base, 0, regs);
+        uint32_t maxFunction = regs[0];
+        if (maxFunction < base || maxFunction - base >= maxRangeSize) {
+            continue;
+        }
+
+        for (uint32_t function = base; function <= maxFunction; function++) {
+            if (!isIndexedLeaf(function)) {
+                hostCPUID(function, 0, regs);
+                Set(function, anySubleaf, regs[0], regs[1], regs[2], regs[3]);
+                continue;
+            }
+            // Subleaves can be sparse (e.g. leaf 0xD); keep every one that
+            // returns something
+            for (uint32_t subleaf = 0; subleaf < 64; subleaf++) {
+                hostCPUID(function, subleaf, regs);
+                if ((regs[0] | regs[1] | regs[2] | regs[3]) != 0) {
+                    Set(function, subleaf, regs[0], regs[1], regs[2], regs[3]);
+                }
+            }
+        }
+    }
+
+    // Hide VMX and SMX and report that the processor is virtualized
+    Mask(0x1, anySubleaf, 2, (1u << 5) | (1u << 6), 1u << 31);
+    // Hide SVM
+    Mask(0x80000001, anySubleaf, 2, 1u << 2, 0);
+}
+
+void CPUIDPolicy::Set(uint32_t function, uint32_t subleaf, uint32_t eax, uint32_t ebx, uint32_t ecx, uint32_t edx) {
+    Leaf leaf = { function, subleaf, eax, ebx, ecx, edx };
+    auto it = std::lower_bound(m_leaves.begin(), m_leaves.end(), Key(leaf),
+        [](const Leaf& lhs, uint64_t key) { return Key(lhs) < key; });
+    if (it != m_leaves.end() && Key(*it) == Key(leaf)) {
+        *it = leaf;
+    }
+    else {
+        m_leaves.insert(it, leaf);
+    }
+    Rebuild();
+}
+
+void CPUIDPolicy::Mask(uint32_t function, uint32_t subleaf, size_t reg, uint32_t clearBits, uint32_t setBits) noexcept {
+    for (auto& leaf : m_leaves) {
+        if (leaf.function != function || leaf.subleaf != subleaf) {
+            continue;
+        }
+        uint32_t *regs[] = { &leaf.eax, &leaf.ebx, &leaf.ecx, &leaf.edx };
+        if (reg < 4) {
+            *regs[reg] = (*regs[reg] & ~clearBits) | setBits;
+        }
+    }
+}
+
+void CPUIDPolicy::Rebuild() {
+    for (Range *range : { &m_basic, &m_extended }) {
+        const uint32_t base = (range == &m_basic) ? 0x00000000 : 0x80000000;
+        range->base = base;
+        range->index.clear();
+
+        auto begin = std::lower_bound(m_leaves.begin(), m_leaves.end(), (uint64_t)base << 32,
+            [](const Leaf& lhs, uint64_t key) { return Key(lhs) < key; });
+        auto end = std::lower_bound(begin, m_leaves.end(), (uint64_t)(base + maxRangeSize) << 32,
+            [](const Leaf& lhs, uint64_t key) { return Key(lhs) < key; });
+        if (begin == end) {
+            continue;
+        }
+
+        const uint32_t numFunctions = (end - 1)->function - base + 1;
+        range->index.resize(numFunctions + 1);
+        auto it = begin;
+        for (uint32_t n = 0; n <= numFunctions; n++) {
+            while (it != end && it->function < base + n) {
+                ++it;
+            }
+            range->index[n] = (uint32_t)(it - m_leaves.begin());
+        }
+    }
+}
+
+const CPUIDPolicy::Leaf *CPUIDPolicy::Find(uint32_t function, uint32_t subleaf) const noexcept {
+    size_t first, last;
+    const Range& range = (function >= 0x80000000) ? m_extended : m_basic;
+    const uint32_t offset = function - range.base;
+    if (function >= range.base && offset + 1 < range.index.size()) {
+        first = range.index[offset];
+        last = range.index[offset + 1];
+    }
+    else {
+        auto begin = std::lower_bound(m_leaves.begin(), m_leaves.end(), (uint64_t)function << 32,
+            [](const Leaf& lhs, uint64_t key) { return Key(lhs) < key; });
+        first = begin - m_leaves.begin();
+        last = first;
+        while (last < m_leaves.size() && m_leaves[last].function == function) {
+            last++;
+        }
+    }
+
+    for (size_t i = first; i < last; i++) {
+        const Leaf& leaf = m_leaves[i];
+        if (leaf.subleaf == anySubleaf || leaf.subleaf == subleaf) {
+            return &leaf;
+        }
+    }
+    return nullptr;
+}
+
+CPUIDPolicy::InstallStats CPUIDPolicy::Install(VMSpecifications& specs, const PlatformFeatures& features) const {
+    InstallStats stats;
+    const bool canExit = BitmaskEnum(features.extendedVMExits).AnyOf(ExtendedVMExit::CPUID);
+
+    for (size_t i = 0; i < m_leaves.size(); ) {
+        const Leaf& leaf = m_leaves[i];
+        size_t next = i + 1;
+        while (next < m_leaves.size() && m_leaves[next].function == leaf.function) {
+            next++;
+        }
+
+        // CPUIDResults cannot express subleaves
+        bool installable = features.customCPUIDs && leaf.subleaf == anySubleaf;
+        if (installable && !features.supportedCustomCPUIDs.empty()) {
+            installable = std::any_of(features.supportedCustomCPUIDs.begin(), features.supportedCustomCPUIDs.end(),
+                [&](const CPUIDResult& result) { return result.function == leaf.function; });
+        }
+
+        if (installable) {
+            specs.CPUIDResults.emplace_back(leaf.function, leaf.eax, leaf.ebx, leaf.ecx, leaf.edx);
+            stats.installed++;
+        }
+        else if (canExit) {
+            specs.vmExitCPUIDFunctions.push_back(leaf.function);
+            stats.trapped++;
+        }
+        else {
+            stats.unhandled++;
+        }
+        i = next;
+    }
+
+    if (stats.trapped > 0) {
+        specs.extendedVMExits = specs.extendedVMExits | ExtendedVMExit::CPUID;
+    }
+    return stats;
+}
+
+bool CPUIDPolicy::HandleExit(VirtualProcessor& vp) noexcept {
+    m_numExits++;
+
+    static const Reg inputRegs[] = { Reg::EAX, Reg::ECX };
+    RegValue inputs[2];
+    if (vp.RegRead(inputRegs, inputs, 2) != VPOperationStatus::OK) {
+        return false;
+    }
+
+    static const Reg outputRegs[] = { Reg::EAX, Reg::EBX, Reg::ECX, Reg::EDX };
+    RegValue outputs[4];
+    const Leaf *leaf = Find(inputs[0].u32, inputs[1].u32);
+    outputs[0].u64 = (leaf != nullptr) ? leaf->eax : 0;
+    outputs[1].u64 = (leaf != nullptr) ? leaf->ebx : 0;
+    outputs[2].u64 = (leaf != nullptr) ? leaf->ecx : 0;
+    outputs[3].u64 = (leaf != nullptr) ? leaf->edx : 0;
+    return vp.RegWrite(outputRegs, outputs, 4) == VPOperationStatus::OK;
+}
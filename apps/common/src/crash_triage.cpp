@@ -0,0 +1,190 @@
+/*
+Defines compact crash records captured from exception VM exits.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "crash_triage.hpp"
+
+#include <cstring>
+#include <ctime>
+
+using namespace virt86;
+
+const ExceptionCode CrashTriage::defaultExceptions =
+    ExceptionCode::PageFault | ExceptionCode::GeneralProtectionFault | ExceptionCode::InvalidOpcodeFault | ExceptionCode::DoubleFaultAbort;
+
+ExceptionCode CrashTriage::Enable(VMSpecifications& specs, const PlatformFeatures& features, ExceptionCode exceptions) noexcept {
+    if (BitmaskEnum(features.extendedVMExits).NoneOf(ExtendedVMExit::Exception)) {
+        m_enabled = ExceptionCode::None;
+        return m_enabled;
+    }
+    m_enabled = exceptions & features.exceptionExits;
+    if (BitmaskEnum(m_enabled)) {
+        specs.extendedVMExits = specs.extendedVMExits | ExtendedVMExit::Exception;
+        specs.exceptionExits = specs.exceptionExits | m_enabled;
+    }
+    return m_enabled;
+}
+
+// Returns true if the code starts with an opcode that always raises #UD
+static bool isUndefinedOpcode(const uint8_t *code, size_t length) noexcept {
+    if (length < 2 || code[0] != 0x0f) {
+        return false;
+    }
+    // UD2, UD1 and UD0
+    return code[1] == 0x0b || code[1] == 0xb9 || code[1] == 0xff;
+}
+
+bool CrashTriage::Capture(VirtualProcessor& vp, Record& record) const noexcept {
+    static const Reg regs[] = {
+        Reg::RAX, Reg::RCX, Reg::RDX, Reg::RBX, Reg::RSP, Reg::RBP, Reg::RSI, Reg::RDI,
+        Reg::R8, Reg::R9, Reg::R10, Reg::R11, Reg::R12, Reg::R13, Reg::R14, Reg::R15,
+        Reg::RIP, Reg::RFLAGS, Reg::CS, Reg::SS, Reg::CR0, Reg::CR2, Reg::CR3, Reg::CR4, Reg::EFER,
+    };
+    const size_t numRegs = sizeof(regs) / sizeof(regs[0]);
+    RegValue values[numRegs];
+
+    memset(&record, 0, sizeof(record));
+    record.timestamp = (uint64_t)time(nullptr);
+    if (vp.RegRead(regs, values, numRegs) != VPOperationStatus::OK) {
+        return false;
+    }
+
+    for (size_t i = 0; i < 16; i++) {
+        record.gpr[i] = values[i].u64;
+    }
+    record.rip = values[16].u64;
+    record.rflags = values[17].u64;
+    record.cs = values[18].segment.selector;
+    record.csBase = values[18].segment.base;
+    record.ss = values[19].segment.selector;
+    record.cr0 = values[20].u64;
+    record.cr2 = values[21].u64;
+    record.cr3 = values[22].u64;
+    record.cr4 = values[23].u64;
+    record.efer = values[24].u64;
+
+    // Read as much code as possible, stopping at the first unmapped page
+    const uint64_t codeAddress = record.csBase + record.rip;
+    for (size_t length = maxCodeBytes; length > 0; length--) {
+        if (vp.LMemRead(codeAddress, length, record.code)) {
+            record.codeLength = length;
+            break;
+        }
+    }
+
+    uint64_t cr2Physical;
+    const bool cr2Mapped = vp.LinearToPhysical(record.cr2, &cr2Physical);
+
+    // The exception is known if only one can exit
+    const uint64_t enabled = (uint64_t)m_enabled;
+    if (enabled != 0 && (enabled & (enabled - 1)) == 0) {
+        record.exception = m_enabled;
+    }
+    else {
+        record.exceptionInferred = true;
+        if (record.codeLength == 0 || !cr2Mapped) {
+            record.exception = ExceptionCode::PageFault;
+        }
+        else if (isUndefinedOpcode(record.code, record.codeLength)) {
+            record.exception = ExceptionCode::InvalidOpcodeFault;
+        }
+        else {
+            record.exception = ExceptionCode::GeneralProtectionFault;
+        }
+    }
+
+    if (record.exception == ExceptionCode::PageFault) {
+        record.faultLinear = (record.codeLength == 0) ? codeAddress : record.cr2;
+    }
+    else {
+        record.faultLinear = codeAddress;
+    }
+    record.faultPhysicalValid = vp.LinearToPhysical(record.faultLinear, &record.faultPhysical);
+    return true;
+}
+
+const char *CrashTriage::ExceptionName(ExceptionCode exception) noexcept {
+    switch (exception) {
+    case ExceptionCode::DivideErrorFault: return "#DE";
+    case ExceptionCode::DebugTrapOrFault: return "#DB";
+    case ExceptionCode::BreakpointTrap: return "#BP";
+    case ExceptionCode::OverflowTrap: return "#OF";
+    case ExceptionCode::BoundRangeFault: return "#BR";
+    case ExceptionCode::InvalidOpcodeFault: return "#UD";
+    case ExceptionCode::DeviceNotAvailableFault: return "#NM";
+    case ExceptionCode::DoubleFaultAbort: return "#DF";
+    case ExceptionCode::InvalidTaskStateSegmentFault: return "#TS";
+    case ExceptionCode::SegmentNotPresentFault: return "#NP";
+    case ExceptionCode::StackFault: return "#SS";
+    case ExceptionCode::GeneralProtectionFault: return "#GP";
+    case ExceptionCode::PageFault: return "#PF";
+    case ExceptionCode::FloatingPointErrorFault: return "#MF";
+    case ExceptionCode::AlignmentCheckFault: return "#AC";
+    case ExceptionCode::MachineCheckAbort: return "#MC";
+    case ExceptionCode::SimdFloatingPointFault: return "#XM";
+    default: return "unknown";
+    }
+}
+
+void CrashTriage::Print(FILE *out, const Record& record) noexcept {
+    static const char *names[] = {
+        "RAX", "RCX", "RDX", "RBX", "RSP", "RBP", "RSI", "RDI",
+        "R8 ", "R9 ", "R10", "R11", "R12", "R13", "R14", "R15",
+    };
+
+    fprintf(out, "crash %" PRIu64 ": %s%s at %04x:%016" PRIx64 "\n", record.timestamp,
+        ExceptionName(record.exception), record.exceptionInferred ? " (inferred)" : "", record.cs, record.rip);
+    fprintf(out, "  fault address: linear 0x%016" PRIx64, record.faultLinear);
+    if (record.faultPhysicalValid) {
+        fprintf(out, ", physical 0x%016" PRIx64 "\n", record.faultPhysical);
+    }
+    else {
+        fprintf(out, ", not mapped\n");
+    }
+    for (size_t i = 0; i < 16; i += 4) {
+        fprintf(out, "  %s=%016" PRIx64 " %s=%016" PRIx64 " %s=%016" PRIx64 " %s=%016" PRIx64 "\n",
+            names[i], record.gpr[i], names[i + 1], record.gpr[i + 1], names[i + 2], record.gpr[i + 2], names[i + 3], record.gpr[i + 3]);
+    }
+    fprintf(out, "  RFLAGS=%016" PRIx64 " SS=%04x CS base=%016" PRIx64 "\n", record.rflags, record.ss, record.csBase);
+    fprintf(out, "  CR0=%016" PRIx64 " CR2=%016" PRIx64 " CR3=%016" PRIx64 " CR4=%016" PRIx64 " EFER=%016" PRIx64 "\n",
+        record.cr0, record.cr2, record.cr3, record.cr4, record.efer);
+    fprintf(out, "  code:");
+    if (record.codeLength == 0) {
+        fprintf(out, " not readable");
+    }
+    for (size_t i = 0; i < record.codeLength; i++) {
+        fprintf(out, " %02x", record.code[i]);
+    }
+    fprintf(out, "\n");
+}
+
+bool CrashTriage::Append(const char *path, const Record& record) noexcept {
+    FILE *fp = fopen(path, "a");
+    if (fp == NULL) {
+        return false;
+    }
+    Print(fp, record);
+    fprintf(fp, "\n");
+    return fclose(fp) == 0;
+}
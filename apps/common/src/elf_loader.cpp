@@ -0,0 +1,273 @@
+/*
+Defines a loader that places the segments of an ELF64 executable in guest RAM.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "elf_loader.hpp"
+
+#include "align_alloc.hpp"
+
+#include "virt86/vp/vp.hpp"
+
+#include <cstring>
+
+#if defined(__linux__)
+#  include <sys/mman.h>
+#endif
+
+// ELF64 structures and constants, from the System V ABI
+struct Elf64Header {
+    uint8_t ident[16];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+};
+
+struct Elf64ProgramHeader {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t paddr;
+    uint64_t filesz;
+    uint64_t memsz;
+    uint64_t align;
+};
+
+static const uint8_t elfMagic[4] = { 0x7F, 'E', 'L', 'F' };
+static const uint8_t ELFCLASS64 = 2;
+static const uint8_t ELFDATA2LSB = 1;
+static const uint16_t ET_EXEC = 2;
+static const uint16_t EM_X86_64 = 62;
+static const uint32_t PT_LOAD = 1;
+static const uint16_t maxProgramHeaders = 256;
+
+static uint64_t pageDown(uint64_t value) noexcept {
+    return value & ~(uint64_t)(PAGE_SIZE - 1);
+}
+
+static uint64_t pageUp(uint64_t value) noexcept {
+    return (value + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+}
+
+ElfLoader::~ElfLoader() noexcept {
+    if (m_file != nullptr) {
+        fclose(m_file);
+    }
+}
+
+bool ElfLoader::IsELF(const char *path) noexcept {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+    uint8_t magic[4];
+    const bool isELF = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && memcmp(magic, elfMagic, sizeof(magic)) == 0;
+    fclose(fp);
+    return isELF;
+}
+
+bool ElfLoader::Open(const char *path) {
+    if (m_file != nullptr) {
+        fclose(m_file);
+    }
+    m_segments.clear();
+    m_file = fopen(path, "rb");
+    if (m_file == NULL) {
+        m_error = std::string("could not open ") + path;
+        return false;
+    }
+
+    Elf64Header header;
+    if (fread(&header, sizeof(header), 1, m_file) != 1 || memcmp(header.ident, elfMagic, sizeof(elfMagic)) != 0) {
+        m_error = std::string(path) + " is not an ELF file";
+        return false;
+    }
+    if (header.ident[4] != ELFCLASS64 || header.ident[5] != ELFDATA2LSB || header.machine != EM_X86_64) {
+        m_error = std::string(path) + " is not a little-endian x86-64 ELF64 file";
+        return false;
+    }
+    if (header.type != ET_EXEC) {
+        m_error = std::string(path) + " is not a statically linked executable";
+        return false;
+    }
+    if (header.phentsize != sizeof(Elf64ProgramHeader) || header.phnum == 0 || header.phnum > maxProgramHeaders) {
+        m_error = std::string(path) + " has invalid program headers";
+        return false;
+    }
+
+    if (fseek(m_file, 0, SEEK_END) != 0) {
+        m_error = std::string("could not determine the size of ") + path;
+        return false;
+    }
+    const long fileLength = ftell(m_file);
+    if (fileLength < 0) {
+        m_error = std::string("could not determine the size of ") + path;
+        return false;
+    }
+    const uint64_t fileSize = (uint64_t)fileLength;
+
+    std::vector<Elf64ProgramHeader> programHeaders(header.phnum);
+    if (fseek(m_file, (long)header.phoff, SEEK_SET) != 0
+        || fread(programHeaders.data(), sizeof(Elf64ProgramHeader), header.phnum, m_file) != header.phnum) {
+        m_error = std::string("could not read the program headers of ") + path;
+        return false;
+    }
+    for (auto& ph : programHeaders) {
+        if (ph.type != PT_LOAD) {
+            continue;
+        }
+        // Contents past the end of the file would be a short read when
+        // copied and a SIGBUS when the guest touches them if mapped
+        if (ph.filesz > ph.memsz || ph.paddr + ph.memsz < ph.paddr || ph.vaddr + ph.memsz < ph.vaddr
+            || ph.offset > fileSize || ph.filesz > fileSize - ph.offset) {
+            m_error = std::string(path) + " has an invalid segment";
+            return false;
+        }
+        m_segments.push_back({ ph.vaddr, ph.paddr, ph.offset, ph.filesz, ph.memsz, ph.flags });
+    }
+    if (m_segments.empty()) {
+        m_error = std::string(path) + " has no loadable segments";
+        return false;
+    }
+    m_entry = header.entry;
+    return true;
+}
+
+bool ElfLoader::Load(uint8_t *ram, uint64_t ramBase, uint64_t ramSize, bool mapFromFile) {
+    if (m_file == nullptr) {
+        m_error = "no file open";
+        return false;
+    }
+    if (((uintptr_t)ram | ramBase) & (PAGE_SIZE - 1)) {
+        m_error = "guest RAM must be page-aligned";
+        return false;
+    }
+    m_bytesMapped = m_bytesCopied = m_bytesZeroed = 0;
+
+    for (auto& segment : m_segments) {
+        if (segment.memorySize == 0) {
+            continue;
+        }
+        if (segment.physicalAddress < ramBase || segment.memorySize > ramSize
+            || segment.physicalAddress - ramBase > ramSize - segment.memorySize) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "segment at 0x%" PRIx64 " (%" PRIu64 " bytes) does not fit in guest RAM", segment.physicalAddress, segment.memorySize);
+            m_error = msg;
+            return false;
+        }
+        uint8_t *dest = ram + (segment.physicalAddress - ramBase);
+        const uint64_t start = segment.physicalAddress;
+        const uint64_t fileEnd = start + segment.fileSize;
+
+        // Whole pages of the file contents can be mapped if the file offset
+        // lines up with the address. Partial pages at either end are copied.
+        uint64_t mapStart = fileEnd;
+        uint64_t mapEnd = fileEnd;
+#if defined(__linux__)
+        if (mapFromFile && ((start - segment.fileOffset) & (PAGE_SIZE - 1)) == 0 && pageUp(start) < pageDown(fileEnd)) {
+            mapStart = pageUp(start);
+            mapEnd = pageDown(fileEnd);
+            void *target = dest + (mapStart - start);
+            const off_t offset = (off_t)(segment.fileOffset + (mapStart - start));
+            if (mmap(target, mapEnd - mapStart, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(m_file), offset) == MAP_FAILED) {
+                // Fall back to copying the whole segment
+                mapStart = mapEnd = fileEnd;
+            }
+            else {
+                m_bytesMapped += mapEnd - mapStart;
+            }
+        }
+#endif
+        if (!Copy(dest, segment.fileOffset, mapStart - start)
+            || !Copy(dest + (mapEnd - start), segment.fileOffset + (mapEnd - start), fileEnd - mapEnd)) {
+            return false;
+        }
+
+        Zero(dest + segment.fileSize, segment.memorySize - segment.fileSize);
+    }
+    return true;
+}
+
+bool ElfLoader::MapSegments(PageTableBuilder& pageTables) {
+    for (auto& segment : m_segments) {
+        if (segment.memorySize == 0) {
+            continue;
+        }
+        if ((segment.virtualAddress ^ segment.physicalAddress) & (PAGE_SIZE - 1)) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "segment at 0x%" PRIx64 " is not page-aligned with its physical address", segment.virtualAddress);
+            m_error = msg;
+            return false;
+        }
+        const uint64_t linear = pageDown(segment.virtualAddress);
+        const uint64_t physical = pageDown(segment.physicalAddress);
+        const uint64_t size = pageUp(segment.virtualAddress + segment.memorySize) - linear;
+        const uint64_t flags = (segment.flags & PF_W) ? PageTableBuilder::PTE_WRITE : 0;
+        if (!pageTables.Map(linear, physical, size, flags)) {
+            m_error = "out of page table space";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ElfLoader::Copy(uint8_t *dest, uint64_t fileOffset, uint64_t size) {
+    if (size == 0) {
+        return true;
+    }
+    if (fseek(m_file, (long)fileOffset, SEEK_SET) != 0 || fread(dest, 1, (size_t)size, m_file) != size) {
+        m_error = "could not read segment contents";
+        return false;
+    }
+    m_bytesCopied += size;
+    return true;
+}
+
+void ElfLoader::Zero(uint8_t *dest, uint64_t size) noexcept {
+    if (size == 0) {
+        return;
+    }
+    m_bytesZeroed += size;
+
+    // Clear whole pages lazily and write only the partial pages at the ends
+    uint8_t *pagesStart = (uint8_t *)pageUp((uintptr_t)dest);
+    uint8_t *pagesEnd = (uint8_t *)pageDown((uintptr_t)(dest + size));
+    if (pagesStart < pagesEnd && alignedClear(pagesStart, pagesEnd - pagesStart)) {
+        memset(dest, 0, pagesStart - dest);
+        memset(pagesEnd, 0, (dest + size) - pagesEnd);
+    }
+    else {
+        memset(dest, 0, (size_t)size);
+    }
+}
@@ -0,0 +1,259 @@
+/*
+Defines per-VCPU VM exit and I/O callback statistics with Prometheus export.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "exit_stats.hpp"
+
+#include "utils.hpp"
+
+#if defined(_WIN32)
+#  include <intrin.h>
+#endif
+
+#include <cinttypes>
+#include <cstdarg>
+
+using namespace virt86;
+
+static thread_local VCPUExitStats *t_currentVCPU = nullptr;
+
+static size_t highestBit(uint64_t value) noexcept {
+#if defined(_WIN32)
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+// ----- LatencyHistogram -----------------------------------------------------
+
+size_t LatencyHistogram::BucketIndex(uint64_t value) noexcept {
+    if (value < subBuckets) {
+        return (size_t)value;
+    }
+    size_t exponent = highestBit(value);
+    size_t shift = exponent - subBucketBits;
+    return (shift + 1) * subBuckets + ((value >> shift) & (subBuckets - 1));
+}
+
+uint64_t LatencyHistogram::BucketLowerBound(size_t index) noexcept {
+    if (index < subBuckets) {
+        return index;
+    }
+    size_t shift = index / subBuckets - 1;
+    return (uint64_t)(subBuckets + index % subBuckets) << shift;
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(size_t index) noexcept {
+    if (index < subBuckets) {
+        return index + 1;
+    }
+    size_t shift = index / subBuckets - 1;
+    return BucketLowerBound(index) + ((uint64_t)1 << shift);
+}
+
+uint64_t LatencyHistogram::Percentile(double percentile) const noexcept {
+    uint64_t count = Count();
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(count * percentile / 100.0);
+    if (target >= count) {
+        target = count - 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < numBuckets; i++) {
+        seen += BucketCount(i);
+        if (seen > target) {
+            uint64_t upper = BucketUpperBound(i);
+            uint64_t max = Max();
+            return (upper != 0 && upper < max) ? upper : max;
+        }
+    }
+    return Max();
+}
+
+uint64_t LatencyHistogram::CountBelowPow2(size_t exponent) const noexcept {
+    // Powers of two always fall on a bucket boundary
+    size_t end = BucketIndex((uint64_t)1 << exponent);
+    uint64_t count = 0;
+    for (size_t i = 0; i < end; i++) {
+        count += BucketCount(i);
+    }
+    return count;
+}
+
+// ----- VCPUExitStats --------------------------------------------------------
+
+const char *iocallback_kind_str(IOCallbackKind kind) noexcept {
+    switch (kind) {
+    case IOCallbackKind::PIORead: return "pio_read";
+    case IOCallbackKind::PIOWrite: return "pio_write";
+    case IOCallbackKind::MMIORead: return "mmio_read";
+    case IOCallbackKind::MMIOWrite: return "mmio_write";
+    default: return "unknown";
+    }
+}
+
+VCPUExitStats *VCPUExitStats::Current() noexcept {
+    return t_currentVCPU;
+}
+
+VPExecutionStatus VCPUExitStats::Run(VirtualProcessor& vp) noexcept {
+    t_currentVCPU = this;
+    auto start = std::chrono::steady_clock::now();
+    auto status = vp.Run();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    t_currentVCPU = nullptr;
+
+    if (status != VPExecutionStatus::OK) {
+        RecordFailure();
+    }
+    else {
+        RecordExit(vp.GetVMExitInfo().reason, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+    return status;
+}
+
+VPExecutionStatus VCPUExitStats::Step(VirtualProcessor& vp) noexcept {
+    t_currentVCPU = this;
+    auto start = std::chrono::steady_clock::now();
+    auto status = vp.Step();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    t_currentVCPU = nullptr;
+
+    if (status != VPExecutionStatus::OK) {
+        RecordFailure();
+    }
+    else {
+        RecordExit(vp.GetVMExitInfo().reason, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+    return status;
+}
+
+// ----- ExitStats ------------------------------------------------------------
+
+// Prometheus bucket boundaries are powers of two from 128 ns to ~17 s
+static const size_t minExportExponent = 7;
+static const size_t maxExportExponent = 34;
+
+ExitStats::ExitStats(size_t numVCPUs) noexcept
+    : m_numVCPUs(numVCPUs)
+    , m_vcpus(new VCPUExitStats[numVCPUs])
+{
+}
+
+static void appendf(std::string& out, const char *format, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len > 0) {
+        out.append(buf, ((size_t)len < sizeof(buf)) ? len : sizeof(buf) - 1);
+    }
+}
+
+static void writeHistogram(std::string& out, const char *name, const char *labels, const LatencyHistogram& hist) {
+    for (size_t exp = minExportExponent; exp <= maxExportExponent; exp++) {
+        appendf(out, "%s_bucket{%s,le=\"%.9g\"} %" PRIu64 "\n", name, labels, (double)((uint64_t)1 << exp) / 1e9, hist.CountBelowPow2(exp));
+    }
+    appendf(out, "%s_bucket{%s,le=\"+Inf\"} %" PRIu64 "\n", name, labels, hist.Count());
+    appendf(out, "%s_sum{%s} %.9f\n", name, labels, (double)hist.Sum() / 1e9);
+    appendf(out, "%s_count{%s} %" PRIu64 "\n", name, labels, hist.Count());
+}
+
+void ExitStats::WritePrometheus(std::string& out) const {
+    char labels[128];
+
+    out += "# HELP virt86_vm_exits_total Number of VM exits by reason.\n";
+    out += "# TYPE virt86_vm_exits_total counter\n";
+    for (size_t vcpu = 0; vcpu < m_numVCPUs; vcpu++) {
+        for (size_t reason = 0; reason < VCPUExitStats::numReasons; reason++) {
+            auto& hist = m_vcpus[vcpu].Exits(reason);
+            if (hist.Count() == 0) continue;
+            appendf(out, "virt86_vm_exits_total{vcpu=\"%zu\",reason=\"%s\"} %" PRIu64 "\n", vcpu, reason_str(static_cast<VMExitReason>(reason)), hist.Count());
+        }
+    }
+
+    out += "# HELP virt86_vm_run_failures_total Number of failed attempts to run the virtual processor.\n";
+    out += "# TYPE virt86_vm_run_failures_total counter\n";
+    for (size_t vcpu = 0; vcpu < m_numVCPUs; vcpu++) {
+        appendf(out, "virt86_vm_run_failures_total{vcpu=\"%zu\"} %" PRIu64 "\n", vcpu, m_vcpus[vcpu].Failures());
+    }
+
+    out += "# HELP virt86_vm_exit_duration_seconds Time spent in each call to run the virtual processor, by exit reason.\n";
+    out += "# TYPE virt86_vm_exit_duration_seconds histogram\n";
+    for (size_t vcpu = 0; vcpu < m_numVCPUs; vcpu++) {
+        for (size_t reason = 0; reason < VCPUExitStats::numReasons; reason++) {
+            auto& hist = m_vcpus[vcpu].Exits(reason);
+            if (hist.Count() == 0) continue;
+            snprintf(labels, sizeof(labels), "vcpu=\"%zu\",reason=\"%s\"", vcpu, reason_str(static_cast<VMExitReason>(reason)));
+            writeHistogram(out, "virt86_vm_exit_duration_seconds", labels, hist);
+        }
+    }
+
+    out += "# HELP virt86_io_callback_duration_seconds Time spent in I/O and MMIO callbacks.\n";
+    out += "# TYPE virt86_io_callback_duration_seconds histogram\n";
+    for (size_t vcpu = 0; vcpu < m_numVCPUs; vcpu++) {
+        for (size_t kind = 0; kind < numIOCallbackKinds; kind++) {
+            auto& hist = m_vcpus[vcpu].IO(static_cast<IOCallbackKind>(kind));
+            if (hist.Count() == 0) continue;
+            snprintf(labels, sizeof(labels), "vcpu=\"%zu\",kind=\"%s\"", vcpu, iocallback_kind_str(static_cast<IOCallbackKind>(kind)));
+            writeHistogram(out, "virt86_io_callback_duration_seconds", labels, hist);
+        }
+    }
+}
+
+static void printHistogramRow(FILE *fp, size_t vcpu, const char *name, const LatencyHistogram& hist) noexcept {
+    uint64_t count = hist.Count();
+    fprintf(fp, "%4zu  %-26s %10" PRIu64 " %10.3f %10.3f %10.3f %10.3f\n",
+        vcpu, name, count,
+        (double)hist.Sum() / count / 1000.0,
+        (double)hist.Percentile(50.0) / 1000.0,
+        (double)hist.Percentile(99.0) / 1000.0,
+        (double)hist.Max() / 1000.0);
+}
+
+void ExitStats::PrintSummary(FILE *fp) const noexcept {
+    fprintf(fp, "VCPU  Exit reason / callback         Count    Avg us     P50 us     P99 us     Max us\n");
+    for (size_t vcpu = 0; vcpu < m_numVCPUs; vcpu++) {
+        for (size_t reason = 0; reason < VCPUExitStats::numReasons; reason++) {
+            auto& hist = m_vcpus[vcpu].Exits(reason);
+            if (hist.Count() == 0) continue;
+            printHistogramRow(fp, vcpu, reason_str(static_cast<VMExitReason>(reason)), hist);
+        }
+        for (size_t kind = 0; kind < numIOCallbackKinds; kind++) {
+            auto& hist = m_vcpus[vcpu].IO(static_cast<IOCallbackKind>(kind));
+            if (hist.Count() == 0) continue;
+            printHistogramRow(fp, vcpu, iocallback_kind_str(static_cast<IOCallbackKind>(kind)), hist);
+        }
+        if (m_vcpus[vcpu].Failures() > 0) {
+            fprintf(fp, "%4zu  %-26s %10" PRIu64 "\n", vcpu, "Run failures", m_vcpus[vcpu].Failures());
+        }
+    }
+    fprintf(fp, "\n");
+}
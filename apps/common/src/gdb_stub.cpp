@@ -0,0 +1,593 @@
+/*
+Defines a GDB remote serial protocol stub for debugging a virtual processor.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "gdb_stub.hpp"
+
+#include "utils.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace virt86;
+
+static const uint64_t pageSize = 0x1000;
+
+// Largest packet accepted from GDB; memory transfers are limited to fit
+static const size_t maxPacketSize = 0x4000;
+
+static const uint8_t int3 = 0xCC;
+
+// GDB's x86-64 register layout, up to the segment selectors
+static const Reg gdbRegs[] = {
+    Reg::RAX, Reg::RBX, Reg::RCX, Reg::RDX, Reg::RSI, Reg::RDI, Reg::RBP, Reg::RSP,
+    Reg::R8, Reg::R9, Reg::R10, Reg::R11, Reg::R12, Reg::R13, Reg::R14, Reg::R15,
+    Reg::RIP, Reg::RFLAGS,
+    Reg::CS, Reg::SS, Reg::DS, Reg::ES, Reg::FS, Reg::GS,
+};
+static const size_t numGDBRegs = array_size(gdbRegs);
+static const size_t gdbRegFLAGS = 17;
+static const size_t gdbRegCS = 18;
+
+static inline size_t gdbRegSize(size_t reg) noexcept {
+    return (reg < gdbRegFLAGS) ? 8 : 4;
+}
+
+static inline uint64_t gdbRegValue(size_t reg, const RegValue& value) noexcept {
+    return (reg < gdbRegCS) ? value.u64 : value.segment.selector;
+}
+
+static const char hexDigits[] = "0123456789abcdef";
+
+static inline int hexValue(char c) noexcept {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Appends a little-endian value as hex
+static void appendHexLE(std::string& out, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        const uint8_t byte = (uint8_t)(value >> (i * 8));
+        out.push_back(hexDigits[byte >> 4]);
+        out.push_back(hexDigits[byte & 15]);
+    }
+}
+
+// Parses a little-endian value of the given size; returns nullptr on malformed input
+static const char *parseHexLE(const char *hex, size_t size, uint64_t& value) noexcept {
+    value = 0;
+    for (size_t i = 0; i < size; i++) {
+        const int hi = hexValue(hex[0]);
+        const int lo = (hi >= 0) ? hexValue(hex[1]) : -1;
+        if (lo < 0) {
+            return nullptr;
+        }
+        value |= (uint64_t)(hi << 4 | lo) << (i * 8);
+        hex += 2;
+    }
+    return hex;
+}
+
+GDBStub::GDBStub(const GuestMemory& memory) noexcept
+    : m_memory(memory)
+{
+}
+
+GDBStub::~GDBStub() noexcept {
+    if (m_client != invalidSocket) {
+        socketClose(m_client);
+    }
+    if (m_listener != invalidSocket) {
+        socketCloseListener(m_listener);
+    }
+}
+
+bool GDBStub::Listen(const char *endpoint) noexcept {
+    m_listener = socketListen(endpoint);
+    return m_listener != invalidSocket;
+}
+
+bool GDBStub::Accept(int timeoutMs) noexcept {
+    if (m_listener == invalidSocket || m_client != invalidSocket) {
+        return false;
+    }
+    m_client = socketAccept(m_listener, timeoutMs);
+    if (m_client == invalidSocket) {
+        return false;
+    }
+    m_state = State::Stopped;
+    m_noAck = false;
+    m_input.clear();
+    return true;
+}
+
+void GDBStub::Detach(VirtualProcessor& vp) noexcept {
+    for (auto& bp : m_swBreakpoints) {
+        AccessMemory(vp, bp.address, &bp.original, 1, true);
+    }
+    m_swBreakpoints.clear();
+    bool hwInUse = false;
+    for (size_t i = 0; i < array_size(m_hwUsed); i++) {
+        hwInUse |= m_hwUsed[i];
+        m_hwUsed[i] = false;
+    }
+    if (hwInUse) {
+        vp.ClearHardwareBreakpoints();
+    }
+
+    if (m_client != invalidSocket) {
+        socketClose(m_client);
+        m_client = invalidSocket;
+    }
+    m_state = State::Continue;
+}
+
+// ----- Run loop ---------------------------------------------------------------------------------------------------------
+
+bool GDBStub::Run(VirtualProcessor& vp, ExitHandler handler, void *context) noexcept {
+    for (;;) {
+        if (m_client != invalidSocket && m_state == State::Stopped) {
+            Serve(vp);
+        }
+
+        const bool stepping = (m_client != invalidSocket && m_state == State::Step);
+        const auto status = stepping ? vp.Step() : vp.Run();
+        if (status != VPExecutionStatus::OK) {
+            if (m_client != invalidSocket) {
+                SendPacket("S05");
+                m_state = State::Stopped;
+            }
+            return false;
+        }
+        m_numExits++;
+
+        const char *stop = nullptr;
+        const auto reason = vp.GetVMExitInfo().reason;
+        if (m_client != invalidSocket && (reason == VMExitReason::SoftwareBreakpoint || reason == VMExitReason::HardwareBreakpoint)) {
+            stop = BreakpointStop(vp);
+        }
+        if (stop == nullptr) {
+            const bool resume = (reason == VMExitReason::Step && stepping) || handler(context, vp);
+            if (stepping) {
+                stop = "S05";
+            }
+            else if (resume && m_client != invalidSocket && (m_numExits & 63) == 0 && InterruptRequested()) {
+                stop = "S02";
+            }
+            if (!resume) {
+                // Unless stepping, the debugger still sees the guest running and Run picks up where it left off
+                if (stop != nullptr) {
+                    SendPacket(stop);
+                    m_state = State::Stopped;
+                }
+                return true;
+            }
+        }
+        if (stop != nullptr && m_client != invalidSocket) {
+            SendPacket(stop);
+            m_state = State::Stopped;
+        }
+    }
+}
+
+const char *GDBStub::BreakpointStop(VirtualProcessor& vp) const noexcept {
+    uint64_t address;
+    if (vp.GetBreakpointAddress(&address) != VPOperationStatus::OK) {
+        return nullptr;
+    }
+    if (vp.GetVMExitInfo().reason == VMExitReason::SoftwareBreakpoint) {
+        for (auto& bp : m_swBreakpoints) {
+            if (bp.address == address) {
+                return "T05swbreak:;";
+            }
+        }
+        return nullptr;
+    }
+    for (size_t i = 0; i < array_size(m_hwUsed); i++) {
+        if (m_hwUsed[i] && m_hwBreakpoints[i] == address) {
+            return "T05hwbreak:;";
+        }
+    }
+    return nullptr;
+}
+
+bool GDBStub::InterruptRequested() noexcept {
+    if (!socketWaitReadable(m_client, 0)) {
+        return false;
+    }
+    char buf[256];
+    const auto len = socketRecv(m_client, buf, sizeof(buf));
+    if (len <= 0) {
+        return false;
+    }
+    m_input.append(buf, len);
+    return memchr(buf, 0x03, len) != nullptr;
+}
+
+// ----- Packets ----------------------------------------------------------------------------------------------------------
+
+void GDBStub::Serve(VirtualProcessor& vp) noexcept {
+    std::string packet;
+    while (m_client != invalidSocket && m_state == State::Stopped) {
+        if (!ReceivePacket(packet)) {
+            Detach(vp);
+            return;
+        }
+        m_numPackets++;
+        m_reply.clear();
+        HandlePacket(vp, packet);
+    }
+}
+
+bool GDBStub::ReceivePacket(std::string& packet) noexcept {
+    for (;;) {
+        // Skip acknowledgements and interrupts received while stopped
+        size_t start = m_input.find('$');
+        if (start != std::string::npos) {
+            const size_t end = m_input.find('#', start);
+            if (end != std::string::npos && end + 2 < m_input.size()) {
+                packet.assign(m_input, start + 1, end - start - 1);
+                uint8_t sum = 0;
+                for (char c : packet) {
+                    sum += (uint8_t)c;
+                }
+                uint64_t expected;
+                const bool valid = parseHexLE(&m_input[end + 1], 1, expected) != nullptr && expected == sum;
+                m_input.erase(0, end + 3);
+                if (!m_noAck && !socketSendAll(m_client, valid ? "+" : "-", 1)) {
+                    return false;
+                }
+                if (valid) {
+                    return true;
+                }
+                continue;
+            }
+        }
+        else {
+            m_input.clear();
+        }
+
+        char buf[4096];
+        const auto len = socketRecv(m_client, buf, sizeof(buf));
+        if (len <= 0) {
+            return false;
+        }
+        m_input.append(buf, len);
+    }
+}
+
+bool GDBStub::SendPacket(const std::string& data) noexcept {
+    std::string frame;
+    frame.reserve(data.size() + 4);
+    frame.push_back('$');
+    uint8_t sum = 0;
+    for (char c : data) {
+        sum += (uint8_t)c;
+    }
+    frame += data;
+    frame.push_back('#');
+    appendHexLE(frame, sum, 1);
+    return socketSendAll(m_client, frame.data(), frame.size());
+}
+
+void GDBStub::HandlePacket(VirtualProcessor& vp, const std::string& packet) noexcept {
+    const char *args = packet.c_str() + 1;
+    switch (packet.empty() ? '\0' : packet[0]) {
+    case '?': m_reply = "S05"; break;
+    case 'g': ReadRegisters(vp); break;
+    case 'G': WriteRegisters(vp, args); break;
+    case 'p': ReadRegister(vp, args); break;
+    case 'P': WriteRegister(vp, args); break;
+    case 'm': ReadMemory(vp, args); break;
+    case 'M': WriteMemory(vp, args); break;
+    case 'c': Resume(vp, args, State::Continue); return;
+    case 's': Resume(vp, args, State::Step); return;
+    case 'H': m_reply = "OK"; break;
+    case 'T': m_reply = "OK"; break;
+    case 'D':
+        SendPacket("OK");
+        Detach(vp);
+        return;
+    case 'k':
+        Detach(vp);
+        return;
+    case 'Z':
+    case 'z':
+    {
+        // Z<type>,<address>,<kind>
+        char *end;
+        const char type = *args;
+        const uint64_t address = (args[0] != '\0' && args[1] == ',') ? strtoull(args + 2, &end, 16) : 0;
+        if (type != '0' && type != '1') {
+            break;  // Watchpoints are not supported
+        }
+        const bool ok = (packet[0] == 'Z') ? InsertBreakpoint(vp, type, address) : RemoveBreakpoint(vp, type, address);
+        m_reply = ok ? "OK" : "E0e";
+        break;
+    }
+    case 'q':
+    case 'Q':
+        Query(packet);
+        break;
+    }
+    SendPacket(m_reply);
+}
+
+void GDBStub::Query(const std::string& packet) noexcept {
+    static const char targetXML[] =
+        "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+        "<target><architecture>i386:x86-64</architecture></target>";
+
+    if (packet.compare(0, 10, "qSupported") == 0) {
+        char reply[128];
+        snprintf(reply, sizeof(reply), "PacketSize=%zx;swbreak+;hwbreak+;qXfer:features:read+;QStartNoAckMode+", maxPacketSize);
+        m_reply = reply;
+    }
+    else if (packet == "QStartNoAckMode") {
+        // The packet itself has been acknowledged already
+        m_reply = "OK";
+        m_noAck = true;
+    }
+    else if (packet.compare(0, 30, "qXfer:features:read:target.xml") == 0) {
+        // qXfer:features:read:target.xml:<offset>,<length>
+        char *end;
+        const size_t offset = strtoull(packet.c_str() + 31, &end, 16);
+        const size_t length = (*end == ',') ? strtoull(end + 1, nullptr, 16) : 0;
+        const size_t total = sizeof(targetXML) - 1;
+        if (offset >= total) {
+            m_reply = "l";
+        }
+        else {
+            const size_t len = (length < total - offset) ? length : total - offset;
+            m_reply = (offset + len < total) ? "m" : "l";
+            m_reply.append(targetXML + offset, len);
+        }
+    }
+    else if (packet == "qAttached") {
+        m_reply = "1";
+    }
+    else if (packet == "qC") {
+        m_reply = "QC1";
+    }
+    else if (packet == "qfThreadInfo") {
+        m_reply = "m1";
+    }
+    else if (packet == "qsThreadInfo") {
+        m_reply = "l";
+    }
+}
+
+void GDBStub::Resume(VirtualProcessor& vp, const char *args, State state) noexcept {
+    if (*args != '\0') {
+        RegValue rip;
+        rip.u64 = strtoull(args, nullptr, 16);
+        vp.RegWrite(Reg::RIP, rip);
+    }
+    m_state = state;
+}
+
+// ----- Registers --------------------------------------------------------------------------------------------------------
+
+void GDBStub::ReadRegisters(VirtualProcessor& vp) noexcept {
+    RegValue values[numGDBRegs];
+    if (vp.RegRead(gdbRegs, values, numGDBRegs) != VPOperationStatus::OK) {
+        m_reply = "E01";
+        return;
+    }
+    m_reply.reserve(numGDBRegs * 16);
+    for (size_t i = 0; i < numGDBRegs; i++) {
+        appendHexLE(m_reply, gdbRegValue(i, values[i]), gdbRegSize(i));
+    }
+}
+
+void GDBStub::WriteRegisters(VirtualProcessor& vp, const char *hex) noexcept {
+    // Only the general purpose registers, RIP and RFLAGS are written
+    RegValue values[gdbRegCS];
+    for (size_t i = 0; i < gdbRegCS; i++) {
+        uint64_t value;
+        hex = parseHexLE(hex, gdbRegSize(i), value);
+        if (hex == nullptr) {
+            m_reply = "E01";
+            return;
+        }
+        values[i].u64 = value;
+    }
+    m_reply = (vp.RegWrite(gdbRegs, values, gdbRegCS) == VPOperationStatus::OK) ? "OK" : "E01";
+}
+
+void GDBStub::ReadRegister(VirtualProcessor& vp, const char *args) noexcept {
+    const size_t reg = strtoul(args, nullptr, 16);
+    RegValue value;
+    if (reg >= numGDBRegs || vp.RegRead(gdbRegs[reg], value) != VPOperationStatus::OK) {
+        m_reply = "E01";
+        return;
+    }
+    appendHexLE(m_reply, gdbRegValue(reg, value), gdbRegSize(reg));
+}
+
+void GDBStub::WriteRegister(VirtualProcessor& vp, const char *args) noexcept {
+    // P<reg>=<value>
+    char *end;
+    const size_t reg = strtoul(args, &end, 16);
+    uint64_t value;
+    if (reg >= gdbRegCS || *end != '=' || parseHexLE(end + 1, gdbRegSize(reg), value) == nullptr) {
+        m_reply = "E01";
+        return;
+    }
+    RegValue regValue;
+    regValue.u64 = value;
+    m_reply = (vp.RegWrite(gdbRegs[reg], regValue) == VPOperationStatus::OK) ? "OK" : "E01";
+}
+
+// ----- Memory -----------------------------------------------------------------------------------------------------------
+
+size_t GDBStub::AccessMemory(VirtualProcessor& vp, uint64_t address, uint8_t *buffer, size_t size, bool write) noexcept {
+    size_t done = 0;
+    while (done < size) {
+        const size_t chunk = (size_t)std::min<uint64_t>(size - done, pageSize - (address & (pageSize - 1)));
+        uint64_t physical;
+        uint8_t *host = vp.LinearToPhysical(address, &physical) ? m_memory.Translate(physical, chunk) : nullptr;
+        if (host != nullptr) {
+            if (write) {
+                memcpy(host, buffer + done, chunk);
+            }
+            else {
+                memcpy(buffer + done, host, chunk);
+            }
+        }
+        else if (!(write ? vp.LMemWrite(address, chunk, buffer + done) : vp.LMemRead(address, chunk, buffer + done))) {
+            break;
+        }
+        address += chunk;
+        done += chunk;
+    }
+    return done;
+}
+
+void GDBStub::ReadMemory(VirtualProcessor& vp, const char *args) noexcept {
+    // m<address>,<length>
+    char *end;
+    const uint64_t address = strtoull(args, &end, 16);
+    size_t length = (*end == ',') ? strtoull(end + 1, nullptr, 16) : 0;
+    if (length > (maxPacketSize - 4) / 2) {
+        length = (maxPacketSize - 4) / 2;
+    }
+    m_data.resize(length);
+    const size_t read = AccessMemory(vp, address, m_data.data(), length, false);
+    if (read == 0 && length > 0) {
+        m_reply = "E14";
+        return;
+    }
+
+    // Show the original bytes under the breakpoints
+    for (auto& bp : m_swBreakpoints) {
+        if (bp.address - address < read) {
+            m_data[bp.address - address] = bp.original;
+        }
+    }
+    m_reply.reserve(read * 2);
+    for (size_t i = 0; i < read; i++) {
+        m_reply.push_back(hexDigits[m_data[i] >> 4]);
+        m_reply.push_back(hexDigits[m_data[i] & 15]);
+    }
+}
+
+void GDBStub::WriteMemory(VirtualProcessor& vp, const char *args) noexcept {
+    // M<address>,<length>:<data>
+    char *end;
+    const uint64_t address = strtoull(args, &end, 16);
+    const size_t length = (*end == ',') ? strtoull(end + 1, &end, 16) : 0;
+    if (*end != ':' || strlen(end + 1) != length * 2) {
+        m_reply = "E01";
+        return;
+    }
+    const char *hex = end + 1;
+    m_data.resize(length);
+    for (size_t i = 0; i < length; i++) {
+        uint64_t byte;
+        hex = parseHexLE(hex, 1, byte);
+        if (hex == nullptr) {
+            m_reply = "E01";
+            return;
+        }
+        m_data[i] = (uint8_t)byte;
+    }
+    m_reply = (AccessMemory(vp, address, m_data.data(), length, true) == length) ? "OK" : "E14";
+}
+
+// ----- Breakpoints ------------------------------------------------------------------------------------------------------
+
+bool GDBStub::InsertBreakpoint(VirtualProcessor& vp, char type, uint64_t address) noexcept {
+    if (type == '1') {
+        for (size_t i = 0; i < array_size(m_hwUsed); i++) {
+            if (!m_hwUsed[i]) {
+                m_hwUsed[i] = true;
+                m_hwBreakpoints[i] = address;
+                if (UpdateHardwareBreakpoints(vp)) {
+                    return true;
+                }
+                m_hwUsed[i] = false;
+                return false;
+            }
+        }
+        return false;
+    }
+
+    for (auto& bp : m_swBreakpoints) {
+        if (bp.address == address) {
+            return true;
+        }
+    }
+    SoftwareBreakpoint bp;
+    bp.address = address;
+    uint8_t patch = int3;
+    if (vp.EnableSoftwareBreakpoints(true) != VPOperationStatus::OK
+        || AccessMemory(vp, address, &bp.original, 1, false) != 1
+        || AccessMemory(vp, address, &patch, 1, true) != 1) {
+        return false;
+    }
+    m_swBreakpoints.push_back(bp);
+    return true;
+}
+
+bool GDBStub::RemoveBreakpoint(VirtualProcessor& vp, char type, uint64_t address) noexcept {
+    if (type == '1') {
+        for (size_t i = 0; i < array_size(m_hwUsed); i++) {
+            if (m_hwUsed[i] && m_hwBreakpoints[i] == address) {
+                m_hwUsed[i] = false;
+                return UpdateHardwareBreakpoints(vp);
+            }
+        }
+        return false;
+    }
+
+    for (size_t i = 0; i < m_swBreakpoints.size(); i++) {
+        if (m_swBreakpoints[i].address == address) {
+            const bool ok = AccessMemory(vp, address, &m_swBreakpoints[i].original, 1, true) == 1;
+            m_swBreakpoints[i] = m_swBreakpoints.back();
+            m_swBreakpoints.pop_back();
+            return ok;
+        }
+    }
+    return false;
+}
+
+bool GDBStub::UpdateHardwareBreakpoints(VirtualProcessor& vp) noexcept {
+    HardwareBreakpoints bps = {};
+    bool inUse = false;
+    for (size_t i = 0; i < array_size(m_hwUsed); i++) {
+        if (m_hwUsed[i]) {
+            bps.bp[i].address = m_hwBreakpoints[i];
+            bps.bp[i].localEnable = true;
+            bps.bp[i].trigger = HardwareBreakpointTrigger::Execution;
+            bps.bp[i].length = HardwareBreakpointLength::Byte;
+            inUse = true;
+        }
+    }
+    auto status = inUse ? vp.SetHardwareBreakpoints(bps) : vp.ClearHardwareBreakpoints();
+    return status == VPOperationStatus::OK;
+}
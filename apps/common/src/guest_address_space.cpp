@@ -0,0 +1,313 @@
+/*
+Defines a manager for the guest physical address space of a virtual machine.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "guest_address_space.hpp"
+
+#include "align_alloc.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace virt86;
+
+GuestAddressSpace::GuestAddressSpace(VirtualMachine& vm, const PlatformFeatures& features, GuestMemory *guestMemory) noexcept
+    : m_vm(vm)
+    , m_features(features)
+    , m_guestMemory(guestMemory)
+{
+}
+
+GuestAddressSpace::~GuestAddressSpace() noexcept {
+    UnmapAll();
+}
+
+MemoryMappingStatus GuestAddressSpace::Map(const char *name, uint64_t baseAddress, uint64_t size, MemoryFlags flags, uint8_t *memory) noexcept {
+    Region region;
+    region.name = name;
+    region.baseAddress = baseAddress;
+    region.size = size;
+    region.maxSize = size;
+    region.memory = memory;
+    region.flags = flags;
+    region.owned = false;
+    return Insert(std::move(region));
+}
+
+MemoryMappingStatus GuestAddressSpace::AddRAM(const char *name, uint64_t baseAddress, uint64_t size, uint64_t maxSize, MemoryFlags flags) noexcept {
+    if (maxSize < size) {
+        return MemoryMappingStatus::OutOfBounds;
+    }
+    if ((maxSize & (PAGE_SIZE - 1)) != 0) {
+        return MemoryMappingStatus::MisalignedSize;
+    }
+
+    uint8_t *memory = alignedAlloc(maxSize, m_mergeable);
+    if (memory == nullptr) {
+        return MemoryMappingStatus::Failed;
+    }
+    memset(memory, 0, size);
+
+    Region region;
+    region.name = name;
+    region.baseAddress = baseAddress;
+    region.size = size;
+    region.maxSize = maxSize;
+    region.memory = memory;
+    region.flags = flags;
+    region.owned = true;
+    auto status = Insert(std::move(region));
+    if (status != MemoryMappingStatus::OK) {
+        alignedFree(memory);
+    }
+    return status;
+}
+
+MemoryMappingStatus GuestAddressSpace::Insert(Region&& region) noexcept {
+    if (region.size == 0) {
+        return MemoryMappingStatus::EmptyRange;
+    }
+    if ((region.baseAddress & (PAGE_SIZE - 1)) != 0) {
+        return MemoryMappingStatus::MisalignedAddress;
+    }
+    if ((region.size & (PAGE_SIZE - 1)) != 0) {
+        return MemoryMappingStatus::MisalignedSize;
+    }
+    if ((reinterpret_cast<uintptr_t>(region.memory) & (PAGE_SIZE - 1)) != 0) {
+        return MemoryMappingStatus::MisalignedHostMemory;
+    }
+    const uint64_t lastAddress = region.baseAddress + region.maxSize - 1;
+    if (lastAddress < region.baseAddress || lastAddress > m_features.guestPhysicalAddress.maxAddress) {
+        return MemoryMappingStatus::OutOfBounds;
+    }
+    if (Overlaps(region.baseAddress, region.maxSize)) {
+        return MemoryMappingStatus::AlreadyAllocated;
+    }
+
+    auto status = m_vm.MapGuestMemory(region.baseAddress, region.size, region.flags, region.memory);
+    if (status != MemoryMappingStatus::OK) {
+        return status;
+    }
+    region.mappings.emplace_back(0, region.size);
+
+    auto it = std::upper_bound(m_regions.begin(), m_regions.end(), region.baseAddress,
+        [](uint64_t a, const Region& r) { return a < r.baseAddress; });
+    it = m_regions.insert(it, std::move(region));
+    SyncGuestMemory(*it);
+    return MemoryMappingStatus::OK;
+}
+
+MemoryMappingStatus GuestAddressSpace::Resize(uint64_t baseAddress, uint64_t newSize) noexcept {
+    Region *region = FindByBase(baseAddress);
+    if (region == nullptr) {
+        return MemoryMappingStatus::Failed;
+    }
+    if (newSize == 0) {
+        return MemoryMappingStatus::EmptyRange;
+    }
+    if ((newSize & (PAGE_SIZE - 1)) != 0) {
+        return MemoryMappingStatus::MisalignedSize;
+    }
+    if (newSize > region->maxSize) {
+        return MemoryMappingStatus::OutOfBounds;
+    }
+    if (newSize < region->size) {
+        return Shrink(*region, newSize);
+    }
+    if (newSize == region->size) {
+        return MemoryMappingStatus::OK;
+    }
+
+    // Map the newly added range; discarded pages may hold stale data
+    const uint64_t offset = region->size;
+    const uint64_t delta = newSize - region->size;
+    memset(region->memory + offset, 0, delta);
+    auto status = m_vm.MapGuestMemory(baseAddress + offset, delta, region->flags, region->memory + offset);
+    if (status != MemoryMappingStatus::OK) {
+        return status;
+    }
+    region->mappings.emplace_back(offset, delta);
+    region->size = newSize;
+    SyncGuestMemory(*region);
+    return MemoryMappingStatus::OK;
+}
+
+MemoryMappingStatus GuestAddressSpace::Shrink(Region& region, uint64_t newSize) noexcept {
+    if (!m_features.memoryUnmapping) {
+        return MemoryMappingStatus::Unsupported;
+    }
+
+    // Popping mappings lowers region.size, so the range to release is taken
+    // from the size before any of them are removed
+    const uint64_t oldSize = region.size;
+
+    // Remove whole mappings above the new end, then cut the one containing it
+    while (!region.mappings.empty()) {
+        auto& mapping = region.mappings.back();
+        const uint64_t offset = mapping.first;
+        const uint64_t length = mapping.second;
+        if (offset >= newSize) {
+            auto status = m_vm.UnmapGuestMemory(region.baseAddress + offset, length);
+            if (status != MemoryMappingStatus::OK) {
+                return status;
+            }
+            region.size = offset;
+            region.mappings.pop_back();
+            continue;
+        }
+
+        if (offset + length > newSize) {
+            MemoryMappingStatus status;
+            if (m_features.partialUnmapping) {
+                status = m_vm.UnmapGuestMemory(region.baseAddress + newSize, offset + length - newSize);
+            }
+            else {
+                status = m_vm.UnmapGuestMemory(region.baseAddress + offset, length);
+                if (status == MemoryMappingStatus::OK) {
+                    status = m_vm.MapGuestMemory(region.baseAddress + offset, newSize - offset, region.flags, region.memory + offset);
+                }
+            }
+            if (status != MemoryMappingStatus::OK) {
+                return status;
+            }
+            mapping.second = newSize - offset;
+        }
+        break;
+    }
+
+    if (region.owned && oldSize > newSize) {
+        const uint64_t released = oldSize - newSize;
+        if (alignedDiscard(region.memory + newSize, released)) {
+            m_discarded += released;
+        }
+    }
+    region.size = newSize;
+    SyncGuestMemory(region);
+    return MemoryMappingStatus::OK;
+}
+
+MemoryMappingStatus GuestAddressSpace::Unmap(uint64_t baseAddress) noexcept {
+    Region *region = FindByBase(baseAddress);
+    if (region == nullptr) {
+        return MemoryMappingStatus::Failed;
+    }
+    if (!m_features.memoryUnmapping) {
+        return MemoryMappingStatus::Unsupported;
+    }
+
+    while (!region->mappings.empty()) {
+        auto& mapping = region->mappings.back();
+        auto status = m_vm.UnmapGuestMemory(baseAddress + mapping.first, mapping.second);
+        if (status != MemoryMappingStatus::OK) {
+            return status;
+        }
+        region->mappings.pop_back();
+    }
+
+    if (m_guestMemory != nullptr) {
+        m_guestMemory->RemoveRegion(baseAddress);
+    }
+    if (region->owned) {
+        alignedFree(region->memory);
+    }
+    m_regions.erase(m_regions.begin() + (region - m_regions.data()));
+    return MemoryMappingStatus::OK;
+}
+
+MemoryMappingStatus GuestAddressSpace::UnmapAll() noexcept {
+    // Memory that cannot be unmapped is still in use by the VM and is leaked
+    if (!m_features.memoryUnmapping) {
+        return MemoryMappingStatus::Unsupported;
+    }
+    while (!m_regions.empty()) {
+        auto status = Unmap(m_regions.back().baseAddress);
+        if (status != MemoryMappingStatus::OK) {
+            return status;
+        }
+    }
+    return MemoryMappingStatus::OK;
+}
+
+const GuestAddressSpace::Region *GuestAddressSpace::Find(uint64_t address) const noexcept {
+    auto it = std::upper_bound(m_regions.begin(), m_regions.end(), address,
+        [](uint64_t a, const Region& r) { return a < r.baseAddress; });
+    if (it == m_regions.begin()) {
+        return nullptr;
+    }
+    --it;
+    if (address - it->baseAddress >= it->maxSize) {
+        return nullptr;
+    }
+    return &*it;
+}
+
+uint64_t GuestAddressSpace::TotalMapped() const noexcept {
+    uint64_t total = 0;
+    for (auto& region : m_regions) {
+        total += region.size;
+    }
+    return total;
+}
+
+void GuestAddressSpace::Print(FILE *out) const noexcept {
+    for (auto& region : m_regions) {
+        const uint32_t flags = static_cast<uint32_t>(region.flags);
+        fprintf(out, "  0x%016" PRIx64 "-0x%016" PRIx64 "  %c%c%c  %8" PRIu64 " KiB  %s",
+            region.baseAddress, region.baseAddress + region.size - 1,
+            (flags & static_cast<uint32_t>(MemoryFlags::Read)) ? 'R' : '-',
+            (flags & static_cast<uint32_t>(MemoryFlags::Write)) ? 'W' : '-',
+            (flags & static_cast<uint32_t>(MemoryFlags::Execute)) ? 'X' : '-',
+            region.size / 1024, region.name.c_str());
+        if (region.maxSize != region.size) {
+            fprintf(out, " (%" PRIu64 " KiB reserved)", region.maxSize / 1024);
+        }
+        fprintf(out, "\n");
+    }
+}
+
+GuestAddressSpace::Region *GuestAddressSpace::FindByBase(uint64_t baseAddress) noexcept {
+    for (auto& region : m_regions) {
+        if (region.baseAddress == baseAddress) {
+            return &region;
+        }
+    }
+    return nullptr;
+}
+
+bool GuestAddressSpace::Overlaps(uint64_t baseAddress, uint64_t size) const noexcept {
+    for (auto& region : m_regions) {
+        if (baseAddress < region.baseAddress + region.maxSize && region.baseAddress < baseAddress + size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void GuestAddressSpace::SyncGuestMemory(const Region& region) noexcept {
+    if (m_guestMemory == nullptr) {
+        return;
+    }
+    m_guestMemory->RemoveRegion(region.baseAddress);
+    m_guestMemory->AddRegion(region.baseAddress, region.size, region.memory);
+}
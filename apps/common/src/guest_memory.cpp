@@ -0,0 +1,78 @@
+/*
+Defines a registry of host memory blocks mapped into the guest physical
+address space, used to access guest memory directly from device code.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "guest_memory.hpp"
+
+#include <algorithm>
+
+bool GuestMemory::AddRegion(uint64_t baseAddress, uint64_t size, uint8_t *memory) noexcept {
+    if (size == 0 || memory == nullptr || baseAddress + size < baseAddress) {
+        return false;
+    }
+
+    auto it = std::lower_bound(m_regions.begin(), m_regions.end(), baseAddress,
+        [](const Region& region, uint64_t address) { return region.baseAddress < address; });
+
+    // Reject overlaps with the neighboring regions
+    if (it != m_regions.end() && it->baseAddress < baseAddress + size) {
+        return false;
+    }
+    if (it != m_regions.begin()) {
+        auto prev = it - 1;
+        if (prev->baseAddress + prev->size > baseAddress) {
+            return false;
+        }
+    }
+
+    m_regions.insert(it, Region{ baseAddress, size, memory });
+    return true;
+}
+
+bool GuestMemory::RemoveRegion(uint64_t baseAddress) noexcept {
+    for (auto it = m_regions.begin(); it != m_regions.end(); ++it) {
+        if (it->baseAddress == baseAddress) {
+            m_regions.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+uint8_t *GuestMemory::Translate(uint64_t address, uint64_t size) const noexcept {
+    // Find the last region starting at or below the address
+    auto it = std::upper_bound(m_regions.begin(), m_regions.end(), address,
+        [](uint64_t address, const Region& region) { return address < region.baseAddress; });
+    if (it == m_regions.begin()) {
+        return nullptr;
+    }
+    --it;
+
+    uint64_t offset = address - it->baseAddress;
+    if (offset >= it->size || size > it->size - offset) {
+        return nullptr;
+    }
+    return it->memory + offset;
+}
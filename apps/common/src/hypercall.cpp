@@ -0,0 +1,118 @@
+/*
+Defines the host-side dispatcher of the paravirtual hypercall ABI.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "hypercall.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+static int64_t hcNop(void *, const GuestMemory&, const uint64_t args[3]) {
+    return 0;
+}
+
+static int64_t hcConsoleWrite(void *, const GuestMemory& memory, const uint64_t args[3]) {
+    const uint8_t *buf = memory.Translate(args[0], args[1]);
+    if (buf == nullptr) {
+        return HC_EFAULT;
+    }
+    return (int64_t)fwrite(buf, 1, (size_t)args[1], stdout);
+}
+
+static int64_t hcChecksum(void *, const GuestMemory& memory, const uint64_t args[3]) {
+    const uint8_t *buf = memory.Translate(args[0], args[1]);
+    if (buf == nullptr) {
+        return HC_EFAULT;
+    }
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < args[1]; i++) {
+        sum += buf[i];
+    }
+    return (int64_t)(sum & INT64_MAX);
+}
+
+HypercallDispatcher::HypercallDispatcher(const GuestMemory& memory) noexcept
+    : m_memory(memory)
+{
+    memset(m_handlers, 0, sizeof(m_handlers));
+    Register(HC_NOP, hcNop, nullptr);
+    Register(HC_CONSOLE_WRITE, hcConsoleWrite, nullptr);
+    Register(HC_CHECKSUM, hcChecksum, nullptr);
+}
+
+bool HypercallDispatcher::Register(uint32_t number, HypercallHandler handler, void *context) noexcept {
+    if (number >= maxHandlers) {
+        return false;
+    }
+    m_handlers[number] = { handler, context };
+    return true;
+}
+
+bool HypercallDispatcher::Attach(IOBus& bus, uint16_t port) noexcept {
+    return bus.RegisterPIO(port, 4, nullptr, DoorbellWrite, this);
+}
+
+uint32_t HypercallDispatcher::ProcessBatch(uint64_t address) noexcept {
+    // The whole batch page must be backed by guest memory
+    uint8_t *page = m_memory.Translate(address, 0x1000);
+    if (page == nullptr) {
+        return 0;
+    }
+    auto batch = reinterpret_cast<HypercallBatch *>(page);
+
+    uint32_t count = batch->count;
+    if (count > hypercallMaxRequests) {
+        count = (uint32_t)hypercallMaxRequests;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        auto& request = batch->requests[i];
+        uint64_t args[3];
+        memcpy(args, request.args, sizeof(args));
+
+        uint32_t number = request.number;
+        if (request.flags != 0) {
+            request.result = HC_EINVAL;
+        }
+        else if (number >= maxHandlers || m_handlers[number].fn == nullptr) {
+            request.result = HC_ENOSYS;
+        }
+        else {
+            request.result = m_handlers[number].fn(m_handlers[number].context, m_memory, args);
+        }
+    }
+
+    batch->processed = count;
+    m_numBatches++;
+    m_numRequests += count;
+    return count;
+}
+
+void HypercallDispatcher::DoorbellWrite(void *context, uint16_t port, size_t size, uint32_t value) noexcept {
+    if (size != 4) {
+        return;
+    }
+    auto& dispatcher = *reinterpret_cast<HypercallDispatcher *>(context);
+    dispatcher.ProcessBatch((uint64_t)value << 12);
+}
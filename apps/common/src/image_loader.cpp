@@ -0,0 +1,164 @@
+/*
+Defines a loader that reads guest images into memory on a background thread.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "image_loader.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#if defined(_WIN32)
+#  include <Windows.h>
+#elif defined(__linux__)
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#elif defined(__APPLE__)
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#else
+#  error Unsupported platform
+#endif
+
+// Large enough to keep the device busy, small enough that progress can be
+// followed with BytesLoaded
+static const uint64_t chunkSize = 4 * 1024 * 1024;
+
+ImageLoader::~ImageLoader() noexcept {
+    Wait();
+}
+
+bool ImageLoader::Start(const char *path, uint8_t *memory, uint64_t size, uint64_t offset, bool exactSize) {
+    const auto start = std::chrono::steady_clock::now();
+    Wait();
+    m_error.clear();
+    m_ok = false;
+    m_bytesLoaded = 0;
+
+#if defined(_WIN32)
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        m_error = std::string("could not open ") + path;
+        return false;
+    }
+    m_handle = handle;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(handle, &fileSize)) {
+        m_error = std::string("could not get the size of ") + path;
+        Close();
+        return false;
+    }
+    m_fileSize = (uint64_t)fileSize.QuadPart;
+#else
+    m_fd = open(path, O_RDONLY);
+    if (m_fd < 0) {
+        m_error = std::string("could not open ") + path + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(m_fd, &st) != 0) {
+        m_error = std::string("could not get the size of ") + path + ": " + strerror(errno);
+        Close();
+        return false;
+    }
+    m_fileSize = (uint64_t)st.st_size;
+#endif
+
+    if (offset > size || m_fileSize > size - offset || (exactSize && m_fileSize != size - offset)) {
+        m_error = std::string(path) + " must be " + (exactSize ? "exactly " : "no larger than ") + std::to_string(size - offset) + " bytes";
+        Close();
+        return false;
+    }
+
+    // Let the kernel start reading the whole file before the thread even runs
+#if defined(__linux__)
+    posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(m_fd, 0, 0, POSIX_FADV_WILLNEED);
+#elif defined(__APPLE__)
+    fcntl(m_fd, F_RDAHEAD, 1);
+#endif
+
+    m_memory = memory;
+    m_size = size;
+    m_offset = offset;
+    m_thread = std::thread([this, start] { Load(start); });
+    return true;
+}
+
+bool ImageLoader::Wait() noexcept {
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    return m_ok;
+}
+
+void ImageLoader::Load(std::chrono::steady_clock::time_point start) noexcept {
+    uint8_t *dest = m_memory + m_offset;
+    uint64_t loaded = 0;
+    while (loaded < m_fileSize) {
+        const uint64_t len = std::min(chunkSize, m_fileSize - loaded);
+#if defined(_WIN32)
+        DWORD readLen;
+        if (!ReadFile(m_handle, dest + loaded, (DWORD)len, &readLen, NULL) || readLen == 0) {
+            m_error = "read failed with error " + std::to_string(GetLastError());
+            break;
+        }
+#else
+        const ssize_t readLen = pread(m_fd, dest + loaded, (size_t)len, (off_t)loaded);
+        if (readLen < 0 && errno == EINTR) {
+            continue;
+        }
+        if (readLen <= 0) {
+            m_error = (readLen < 0) ? std::string("read failed: ") + strerror(errno) : std::string("file truncated while reading");
+            break;
+        }
+#endif
+        loaded += (uint64_t)readLen;
+        m_bytesLoaded = loaded;
+    }
+    Close();
+
+    // Clear what the image does not cover while the device is idle
+    memset(m_memory, 0, (size_t)m_offset);
+    memset(dest + loaded, 0, (size_t)(m_size - m_offset - loaded));
+
+    m_ok = (loaded == m_fileSize);
+    m_elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void ImageLoader::Close() noexcept {
+#if defined(_WIN32)
+    if (m_handle != nullptr) {
+        CloseHandle((HANDLE)m_handle);
+        m_handle = nullptr;
+    }
+#else
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+#endif
+}
@@ -0,0 +1,309 @@
+/*
+Defines a host-side interrupt controller that injects device and timer
+interrupts into a virtual processor.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "interrupt_controller.hpp"
+
+#if defined(_WIN32)
+#  include <intrin.h>
+#elif defined(__linux__)
+#  include <cerrno>
+#  include <poll.h>
+#  include <sys/eventfd.h>
+#  include <sys/timerfd.h>
+#  include <unistd.h>
+#endif
+
+using namespace virt86;
+
+static inline size_t lowestBit(uint64_t value) noexcept {
+#if defined(_WIN32)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return index;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+InterruptController::InterruptController(uint64_t timerResolution) noexcept
+    : m_epoch(std::chrono::steady_clock::now())
+    , m_wheel(timerResolution)
+{
+    for (size_t i = 0; i < 256; i++) {
+        m_timerContexts[i] = TimerContext{ this, static_cast<uint8_t>(i) };
+        m_raiseTime[i].store(0, std::memory_order_relaxed);
+    }
+#if defined(__linux__)
+    // Falls back to the condition variable if either descriptor is unavailable
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    m_wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_timerFd < 0 || m_wakeFd < 0) {
+        if (m_timerFd >= 0) close(m_timerFd);
+        if (m_wakeFd >= 0) close(m_wakeFd);
+        m_timerFd = m_wakeFd = -1;
+    }
+#endif
+}
+
+InterruptController::~InterruptController() noexcept {
+    Stop();
+#if defined(__linux__)
+    if (m_timerFd >= 0) {
+        close(m_timerFd);
+        close(m_wakeFd);
+    }
+#endif
+}
+
+void InterruptController::Start() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running) {
+        return;
+    }
+    m_running = true;
+    m_thread = std::thread([this] { TimerThread(); });
+}
+
+void InterruptController::Stop() noexcept {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return;
+        }
+        m_running = false;
+    }
+    WakeTimerThread();
+    m_thread.join();
+}
+
+bool InterruptController::RaiseLocked(uint8_t vector, uint64_t time) noexcept {
+    m_numRaised.fetch_add(1, std::memory_order_relaxed);
+
+    // A coalesced request keeps the time of the first one, which is the one
+    // the guest is kept waiting for
+    const uint64_t bit = 1ull << (vector & 63);
+    if (m_pending[vector >> 6] & bit) {
+        m_numCoalesced.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    m_pending[vector >> 6] |= bit;
+    m_raiseTime[vector].store(time, std::memory_order_relaxed);
+    return true;
+}
+
+void InterruptController::Raise(uint8_t vector) noexcept {
+    KickHandler kick;
+    void *kickContext;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!RaiseLocked(vector, Now())) {
+            return;
+        }
+        kick = m_kickHandler;
+        kickContext = m_kickContext;
+    }
+    m_pendingCond.notify_all();
+    if (kick != nullptr) {
+        kick(kickContext);
+    }
+}
+
+uint64_t InterruptController::ScheduleInterrupt(uint64_t deadline, uint8_t vector, uint64_t period) {
+    uint64_t timerID;
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        timerID = m_wheel.Schedule(deadline, TimerExpired, &m_timerContexts[vector], period);
+        // Timers that expire after the one the timer thread is sleeping for
+        // are picked up when it wakes, so guests that rearm a one-shot timer
+        // on every tick don't cost a thread switch each time
+        wake = deadline < m_sleepDeadline;
+        if (wake) {
+            m_sleepDeadline = deadline;
+        }
+    }
+    if (wake) {
+        WakeTimerThread();
+    }
+    return timerID;
+}
+
+bool InterruptController::CancelTimer(uint64_t timerID) noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_wheel.Cancel(timerID);
+}
+
+void InterruptController::SetKickHandler(KickHandler handler, void *context) noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_kickHandler = handler;
+    m_kickContext = context;
+}
+
+void InterruptController::SetDeliverHandler(DeliverHandler handler, void *context) noexcept {
+    m_deliverHandler = handler;
+    m_deliverContext = context;
+}
+
+size_t InterruptController::Deliver(VirtualProcessor& vp) noexcept {
+    uint64_t pending[4];
+    uint64_t raiseTime[256];
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t i = 0; i < 4; i++) {
+            pending[i] = m_pending[i];
+            m_pending[i] = 0;
+            for (uint64_t bits = pending[i]; bits != 0; bits &= bits - 1) {
+                const size_t vector = i * 64 + lowestBit(bits);
+                raiseTime[vector] = m_raiseTime[vector].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t count = 0;
+    uint64_t rejected[4] = {};
+    for (size_t i = 0; i < 4; i++) {
+        uint64_t bits = pending[i];
+        while (bits != 0) {
+            const uint8_t vector = static_cast<uint8_t>(i * 64 + lowestBit(bits));
+            bits &= bits - 1;
+            if (vp.EnqueueInterrupt(vector)) {
+                count++;
+                if (m_deliverHandler != nullptr) {
+                    m_deliverHandler(m_deliverContext, vector);
+                }
+            }
+            else {
+                rejected[i] |= 1ull << (vector & 63);
+            }
+        }
+    }
+
+    // Vectors the processor did not accept stay pending for the next call,
+    // as if they had never been taken. A request raised for one of them in
+    // the meantime is coalesced into the original.
+    if ((rejected[0] | rejected[1] | rejected[2] | rejected[3]) != 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t i = 0; i < 4; i++) {
+            for (uint64_t bits = rejected[i]; bits != 0; bits &= bits - 1) {
+                const size_t vector = i * 64 + lowestBit(bits);
+                if (m_pending[i] & (1ull << (vector & 63))) {
+                    m_numCoalesced.fetch_add(1, std::memory_order_relaxed);
+                }
+                m_raiseTime[vector].store(raiseTime[vector], std::memory_order_relaxed);
+            }
+            m_pending[i] |= rejected[i];
+        }
+    }
+    m_numDelivered.fetch_add(count, std::memory_order_relaxed);
+    return count;
+}
+
+bool InterruptController::WaitForInterrupt(uint64_t timeout) noexcept {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto anyPending = [this] { return (m_pending[0] | m_pending[1] | m_pending[2] | m_pending[3]) != 0; };
+    return m_pendingCond.wait_for(lock, std::chrono::nanoseconds(timeout), anyPending);
+}
+
+void InterruptController::TimerExpired(void *context, uint64_t timerID, uint64_t deadline) {
+    // Invoked from Advance on the timer thread, with the lock held
+    auto& timer = *reinterpret_cast<TimerContext *>(context);
+    InterruptController& controller = *timer.controller;
+    if (controller.RaiseLocked(timer.vector, deadline)) {
+        controller.m_newlyPending = true;
+    }
+}
+
+void InterruptController::WakeTimerThread() noexcept {
+#if defined(__linux__)
+    if (m_wakeFd >= 0) {
+        const uint64_t one = 1;
+        (void)!write(m_wakeFd, &one, sizeof(one));
+        return;
+    }
+#endif
+    m_timerCond.notify_all();
+}
+
+void InterruptController::WaitForTimers(std::unique_lock<std::mutex>& lock, uint64_t deadline) noexcept {
+    // Called and returns with the lock held
+    m_sleepDeadline = deadline;
+#if defined(__linux__)
+    if (m_timerFd >= 0) {
+        // An all-zero expiration disarms the timer
+        itimerspec spec = {};
+        if (deadline != TimerWheel::never) {
+            const uint64_t expiration = std::chrono::duration_cast<std::chrono::nanoseconds>(m_epoch.time_since_epoch()).count() + deadline;
+            spec.it_value.tv_sec = static_cast<time_t>(expiration / 1000000000ull);
+            spec.it_value.tv_nsec = static_cast<long>(expiration % 1000000000ull);
+            if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+                spec.it_value.tv_nsec = 1;
+            }
+        }
+        timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+
+        lock.unlock();
+        // A wakeup posted after the deadline was read stays in the eventfd,
+        // so it can't be lost between the unlock and the poll
+        pollfd fds[2] = { { m_timerFd, POLLIN, 0 }, { m_wakeFd, POLLIN, 0 } };
+        while (poll(fds, 2, -1) < 0 && errno == EINTR) {
+        }
+        uint64_t count;
+        if (fds[0].revents & POLLIN) (void)!read(m_timerFd, &count, sizeof(count));
+        if (fds[1].revents & POLLIN) (void)!read(m_wakeFd, &count, sizeof(count));
+        lock.lock();
+        return;
+    }
+#endif
+    if (deadline == TimerWheel::never) {
+        m_timerCond.wait(lock);
+    }
+    else {
+        m_timerCond.wait_until(lock, m_epoch + std::chrono::nanoseconds(deadline));
+    }
+}
+
+void InterruptController::TimerThread() noexcept {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+        WaitForTimers(lock, m_wheel.NextEvent());
+        m_numTimerWakeups.fetch_add(1, std::memory_order_relaxed);
+
+        m_newlyPending = false;
+        m_wheel.Advance(Now());
+        if (!m_newlyPending) {
+            continue;
+        }
+
+        KickHandler kick = m_kickHandler;
+        void *kickContext = m_kickContext;
+        lock.unlock();
+        m_pendingCond.notify_all();
+        if (kick != nullptr) {
+            kick(kickContext);
+        }
+        lock.lock();
+    }
+}
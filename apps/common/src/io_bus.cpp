@@ -0,0 +1,149 @@
+/*
+Defines an I/O bus that routes port and memory-mapped I/O to device models.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "io_bus.hpp"
+
+#include "exit_stats.hpp"
+
+#include <algorithm>
+
+using namespace virt86;
+
+IOBus::IOBus() noexcept
+    : m_portMap(0x10000, 0)
+{
+    // Index 0 is reserved for unclaimed ports
+    m_pioRanges.push_back(PIORange{ nullptr, nullptr, nullptr });
+}
+
+bool IOBus::RegisterPIO(uint16_t basePort, uint32_t count, PIOReadHandler read, PIOWriteHandler write, void *context) noexcept {
+    if (count == 0 || basePort + count > 0x10000 || m_pioRanges.size() > 0xFF) {
+        return false;
+    }
+    for (uint32_t port = basePort; port < basePort + count; port++) {
+        if (m_portMap[port] != 0) {
+            return false;
+        }
+    }
+
+    uint8_t index = (uint8_t)m_pioRanges.size();
+    m_pioRanges.push_back(PIORange{ read, write, context });
+    for (uint32_t port = basePort; port < basePort + count; port++) {
+        m_portMap[port] = index;
+    }
+    return true;
+}
+
+bool IOBus::RegisterMMIO(uint64_t baseAddress, uint64_t size, MMIOReadHandler read, MMIOWriteHandler write, void *context) noexcept {
+    if (size == 0 || baseAddress + size < baseAddress) {
+        return false;
+    }
+
+    auto it = std::lower_bound(m_mmioRanges.begin(), m_mmioRanges.end(), baseAddress,
+        [](const MMIORange& range, uint64_t address) { return range.baseAddress < address; });
+    if (it != m_mmioRanges.end() && it->baseAddress < baseAddress + size) {
+        return false;
+    }
+    if (it != m_mmioRanges.begin()) {
+        auto prev = it - 1;
+        if (prev->baseAddress + prev->size > baseAddress) {
+            return false;
+        }
+    }
+
+    m_mmioRanges.insert(it, MMIORange{ baseAddress, size, read, write, context });
+    return true;
+}
+
+void IOBus::Attach(VirtualMachine& vm) noexcept {
+    vm.RegisterIOReadCallback(IOReadCallback);
+    vm.RegisterIOWriteCallback(IOWriteCallback);
+    vm.RegisterMMIOReadCallback(MMIOReadCallback);
+    vm.RegisterMMIOWriteCallback(MMIOWriteCallback);
+    vm.RegisterIOContext(this);
+}
+
+const IOBus::MMIORange *IOBus::FindMMIO(uint64_t address) const noexcept {
+    auto it = std::upper_bound(m_mmioRanges.begin(), m_mmioRanges.end(), address,
+        [](uint64_t address, const MMIORange& range) { return address < range.baseAddress; });
+    if (it == m_mmioRanges.begin()) {
+        return nullptr;
+    }
+    --it;
+    if (address - it->baseAddress >= it->size) {
+        return nullptr;
+    }
+    return &*it;
+}
+
+uint32_t IOBus::ReadPIO(uint16_t port, size_t size) const noexcept {
+    auto& range = m_pioRanges[m_portMap[port]];
+    if (range.read == nullptr) {
+        return 0xFFFFFFFF >> (32 - size * 8);
+    }
+    return range.read(range.context, port, size);
+}
+
+void IOBus::WritePIO(uint16_t port, size_t size, uint32_t value) const noexcept {
+    auto& range = m_pioRanges[m_portMap[port]];
+    if (range.write != nullptr) {
+        range.write(range.context, port, size, value);
+    }
+}
+
+uint64_t IOBus::ReadMMIO(uint64_t address, size_t size) const noexcept {
+    auto range = FindMMIO(address);
+    if (range == nullptr || range->read == nullptr) {
+        return ~0ull >> (64 - size * 8);
+    }
+    return range->read(range->context, address, size);
+}
+
+void IOBus::WriteMMIO(uint64_t address, size_t size, uint64_t value) const noexcept {
+    auto range = FindMMIO(address);
+    if (range != nullptr && range->write != nullptr) {
+        range->write(range->context, address, size, value);
+    }
+}
+
+uint32_t IOBus::IOReadCallback(void *context, uint16_t port, size_t size) noexcept {
+    IOCallbackTimer timer(IOCallbackKind::PIORead);
+    return reinterpret_cast<IOBus *>(context)->ReadPIO(port, size);
+}
+
+void IOBus::IOWriteCallback(void *context, uint16_t port, size_t size, uint32_t value) noexcept {
+    IOCallbackTimer timer(IOCallbackKind::PIOWrite);
+    reinterpret_cast<IOBus *>(context)->WritePIO(port, size, value);
+}
+
+uint64_t IOBus::MMIOReadCallback(void *context, uint64_t address, size_t size) noexcept {
+    IOCallbackTimer timer(IOCallbackKind::MMIORead);
+    return reinterpret_cast<IOBus *>(context)->ReadMMIO(address, size);
+}
+
+void IOBus::MMIOWriteCallback(void *context, uint64_t address, size_t size, uint64_t value) noexcept {
+    IOCallbackTimer timer(IOCallbackKind::MMIOWrite);
+    reinterpret_cast<IOBus *>(context)->WriteMMIO(address, size, value);
+}
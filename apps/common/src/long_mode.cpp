@@ -0,0 +1,82 @@
+/*
+Defines a helper that boots a virtual processor directly into 64-bit long mode.
+-------------------------------------------------------------------------------
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "long_mode.hpp"
+
+#include "utils.hpp"
+
+using namespace virt86;
+
+bool bootLongMode(VirtualProcessor& vp, const PageTableBuilder& pageTables, uint8_t *ram, uint64_t gdtAddress,
+    uint64_t entryPoint, uint64_t stackTop) noexcept {
+    // Same descriptors as the ROM's GDT
+    auto gdt = reinterpret_cast<uint64_t *>(&ram[gdtAddress]);
+    gdt[0] = 0x0000000000000000;
+    gdt[1] = 0x00209B0000000000;  // 64-bit code
+    gdt[2] = 0x0000930000000000;  // 64-bit data
+
+    RegValue cr0;
+    if (vp.RegRead(Reg::CR0, cr0) != VPOperationStatus::OK) {
+        return false;
+    }
+    cr0.u64 |= CR0_PE | CR0_PG;
+
+    RegValue gdtr, idtr, code, data, tr;
+    gdtr.table.base = gdtAddress;
+    gdtr.table.limit = 3 * sizeof(uint64_t) - 1;
+    idtr.table.base = 0;
+    idtr.table.limit = 0;
+
+    code.segment.selector = 0x0008;
+    code.segment.base = 0;
+    code.segment.limit = 0;
+    code.segment.attributes.u16 = 0x209B;  // Present, DPL 0, execute/read, accessed, 64-bit
+
+    data.segment.selector = 0x0010;
+    data.segment.base = 0;
+    data.segment.limit = 0;
+    data.segment.attributes.u16 = 0x0093;  // Present, DPL 0, read/write, accessed
+
+    // Hardware-assisted virtualization requires a busy 64-bit TSS in long mode
+    tr.segment.selector = 0;
+    tr.segment.base = 0;
+    tr.segment.limit = 0xFFFF;
+    tr.segment.attributes.u16 = 0x008B;
+
+    const Reg regs[] = {
+        Reg::GDTR, Reg::IDTR,
+        Reg::CR3, Reg::CR4, Reg::EFER, Reg::CR0,
+        Reg::CS, Reg::DS, Reg::ES, Reg::FS, Reg::GS, Reg::SS, Reg::TR,
+        Reg::RIP, Reg::RSP, Reg::RBP, Reg::RFLAGS,
+    };
+    const RegValue values[] = {
+        gdtr, idtr,
+        pageTables.Root(), CR4_PAE | CR4_PGE, EFER_LME | EFER_LMA, cr0,
+        code, data, data, data, data, data, tr,
+        entryPoint, stackTop, stackTop, 0x2,
+    };
+    return vp.RegWrite(regs, values, array_size(regs)) == VPOperationStatus::OK;
+}
@@ -0,0 +1,121 @@
+/*
+Defines a minimal HTTP server that exposes exit statistics to Prometheus.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "metrics_server.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// How long a client may take to send its request, and how long any single
+// send of the response may block, before the connection is dropped
+static constexpr int requestTimeoutMs = 2000;
+static constexpr int ioTimeoutMs = 1000;
+
+MetricsServer::MetricsServer(const ExitStats& stats) noexcept
+    : m_stats(stats)
+{
+}
+
+MetricsServer::~MetricsServer() noexcept {
+    Stop();
+}
+
+bool MetricsServer::Start(const char *endpoint) noexcept {
+    if (m_running) {
+        return false;
+    }
+    m_listener = socketListen(endpoint);
+    if (m_listener == invalidSocket) {
+        return false;
+    }
+    m_running = true;
+    m_thread = std::thread([this] { Serve(); });
+    return true;
+}
+
+void MetricsServer::Stop() noexcept {
+    if (!m_running) {
+        return;
+    }
+    m_running = false;
+    m_thread.join();
+    socketCloseListener(m_listener);
+    m_listener = invalidSocket;
+}
+
+void MetricsServer::Serve() noexcept {
+    // Poll the listener so that Stop() is noticed promptly
+    while (m_running) {
+        socket_t client = socketAccept(m_listener, 250);
+        if (client != invalidSocket) {
+            HandleClient(client);
+            socketClose(client);
+        }
+    }
+}
+
+void MetricsServer::HandleClient(socket_t client) noexcept {
+    // A client that stops sending or reading must not hold up the thread,
+    // since requests are served one at a time and Stop() waits for it
+    if (!socketSetTimeout(client, ioTimeoutMs)) {
+        return;
+    }
+
+    // Read until the end of the request headers; the request itself is ignored
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(requestTimeoutMs);
+    char buf[1024];
+    size_t total = 0;
+    while (total < sizeof(buf) - 1) {
+        if (!m_running || std::chrono::steady_clock::now() >= deadline) {
+            return;
+        }
+        auto len = socketRecv(client, buf + total, sizeof(buf) - 1 - total);
+        if (len <= 0) {
+            return;
+        }
+        total += len;
+        buf[total] = '\0';
+        if (strstr(buf, "\r\n\r\n") != nullptr || strstr(buf, "\n\n") != nullptr) {
+            break;
+        }
+    }
+
+    std::string body;
+    body.reserve(16384);
+    m_stats.WritePrometheus(body);
+
+    char header[160];
+    int headerLen = snprintf(header, sizeof(header),
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: close\r\n"
+        "\r\n", body.size());
+    if (socketSendAll(client, header, headerLen)) {
+        socketSendAll(client, body.data(), body.size());
+    }
+}
@@ -0,0 +1,156 @@
+/*
+Defines a registry of model-specific registers emulated by the host.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "msr_table.hpp"
+
+#include <algorithm>
+
+using namespace virt86;
+
+bool MSRTable::Insert(uint32_t msr, const Entry& entry) {
+    auto it = std::lower_bound(m_msrs.begin(), m_msrs.end(), msr);
+    if (it != m_msrs.end() && *it == msr) {
+        return false;
+    }
+    size_t index = it - m_msrs.begin();
+    m_msrs.insert(it, msr);
+    m_entries.insert(m_entries.begin() + index, entry);
+
+    // Plain registers point to their own entry, which may have moved
+    for (auto& e : m_entries) {
+        if (e.read == ValueRead) {
+            e.context = &e;
+        }
+    }
+    return true;
+}
+
+bool MSRTable::Register(uint32_t msr, ReadHandler read, WriteHandler write, void *context) {
+    return Insert(msr, Entry{ read, write, context, 0, 0 });
+}
+
+bool MSRTable::RegisterValue(uint32_t msr, uint64_t initialValue, uint64_t writableMask) {
+    return Insert(msr, Entry{ ValueRead, ValueWrite, nullptr, initialValue, writableMask });
+}
+
+bool MSRTable::ValueRead(void *context, uint32_t msr, uint64_t& value) {
+    value = reinterpret_cast<Entry *>(context)->value;
+    return true;
+}
+
+bool MSRTable::ValueWrite(void *context, uint32_t msr, uint64_t value) {
+    auto& entry = *reinterpret_cast<Entry *>(context);
+    entry.value = (entry.value & ~entry.writableMask) | (value & entry.writableMask);
+    return true;
+}
+
+MSRTable::Entry *MSRTable::Find(uint32_t msr) noexcept {
+    // Branchless binary search over the MSR numbers
+    const uint32_t *base = m_msrs.data();
+    size_t count = m_msrs.size();
+    if (count == 0) {
+        return nullptr;
+    }
+    while (count > 1) {
+        size_t half = count / 2;
+        base = (base[half] <= msr) ? base + half : base;
+        count -= half;
+    }
+    if (*base != msr) {
+        return nullptr;
+    }
+    return &m_entries[base - m_msrs.data()];
+}
+
+bool MSRTable::Read(uint32_t msr, uint64_t& value) noexcept {
+    m_numReads++;
+    Entry *entry = Find(msr);
+    value = 0;
+    if (entry == nullptr) {
+        m_numUnknown++;
+        return false;
+    }
+    if (entry->read == nullptr) {
+        return true;
+    }
+    return entry->read(entry->context, msr, value);
+}
+
+bool MSRTable::Write(uint32_t msr, uint64_t value) noexcept {
+    m_numWrites++;
+    Entry *entry = Find(msr);
+    if (entry == nullptr) {
+        m_numUnknown++;
+        return false;
+    }
+    if (entry->write == nullptr) {
+        return true;
+    }
+    return entry->write(entry->context, msr, value);
+}
+
+bool MSRTable::HandleExit(VirtualProcessor& vp) noexcept {
+    static const Reg inputRegs[] = { Reg::RIP, Reg::RCX, Reg::RAX, Reg::RDX, Reg::CS };
+    RegValue inputs[5];
+    if (vp.RegRead(inputRegs, inputs, 5) != VPOperationStatus::OK) {
+        return false;
+    }
+    const uint64_t rip = inputs[0].u64;
+    const uint64_t linearRIP = inputs[4].segment.base + rip;
+
+    // RDMSR is 0F 32 and WRMSR is 0F 30
+    const uint64_t opcodeAddress = m_ripAdvanced ? linearRIP - 2 : linearRIP;
+    uint8_t opcode[2];
+    if (!vp.LMemRead(opcodeAddress, 2, opcode) || opcode[0] != 0x0f || (opcode[1] != 0x30 && opcode[1] != 0x32)) {
+        return false;
+    }
+
+    // Registers written back: EAX and EDX after a successful read, then RIP
+    // if the platform left it on the instruction
+    static const Reg outputRegs[] = { Reg::RAX, Reg::RDX, Reg::RIP };
+    RegValue outputs[3];
+    outputs[2].u64 = rip + 2;
+    size_t first = 2;
+    const size_t last = m_ripAdvanced ? 2 : 3;
+
+    const uint32_t msr = inputs[1].u32;
+    if (opcode[1] == 0x32) {
+        // Unknown MSRs and failed reads leave EDX:EAX alone
+        uint64_t value;
+        if (Read(msr, value)) {
+            outputs[0].u64 = (uint32_t)value;
+            outputs[1].u64 = value >> 32;
+            first = 0;
+        }
+    }
+    else {
+        Write(msr, ((uint64_t)inputs[3].u32 << 32) | inputs[2].u32);
+    }
+
+    if (first == last) {
+        return true;
+    }
+    return vp.RegWrite(&outputRegs[first], &outputs[first], last - first) == VPOperationStatus::OK;
+}
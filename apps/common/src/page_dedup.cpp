@@ -0,0 +1,113 @@
+/*
+Defines a scanner that finds zero and duplicate pages in guest RAM.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "page_dedup.hpp"
+
+#include "align_alloc.hpp"
+
+#include <chrono>
+#include <cstring>
+
+static bool isZeroPage(const uint8_t *page) noexcept {
+    const uint64_t *words = reinterpret_cast<const uint64_t *>(page);
+    uint64_t bits = 0;
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        bits |= words[i];
+    }
+    return bits == 0;
+}
+
+static uint64_t hashPage(const uint8_t *page) noexcept {
+    const uint64_t *words = reinterpret_cast<const uint64_t *>(page);
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        hash = (hash ^ words[i]) * 0x100000001b3ull;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+PageDedupScanner::Stats PageDedupScanner::Scan(const GuestAddressSpace& addressSpace, bool reclaimZeroPages) noexcept {
+    Stats stats;
+    auto start = std::chrono::steady_clock::now();
+
+    m_pages.clear();
+    for (auto& region : addressSpace.Regions()) {
+        // Discard runs of zero pages with a single call
+        uint8_t *zeroRun = nullptr;
+        size_t zeroRunSize = 0;
+        auto flushZeroRun = [&]() {
+            if (zeroRunSize != 0 && alignedDiscard(zeroRun, zeroRunSize)) {
+                stats.pagesReclaimed += zeroRunSize / PAGE_SIZE;
+            }
+            zeroRun = nullptr;
+            zeroRunSize = 0;
+        };
+
+        for (uint64_t offset = 0; offset < region.size; offset += PAGE_SIZE) {
+            uint8_t *page = region.memory + offset;
+            stats.pagesScanned++;
+
+            if (isZeroPage(page)) {
+                stats.zeroPages++;
+                if (reclaimZeroPages) {
+                    if (zeroRun == nullptr) {
+                        zeroRun = page;
+                    }
+                    zeroRunSize += PAGE_SIZE;
+                }
+                continue;
+            }
+            flushZeroRun();
+
+            auto result = m_pages.emplace(hashPage(page), page);
+            if (!result.second) {
+                if (memcmp(result.first->second, page, PAGE_SIZE) == 0) {
+                    stats.duplicatePages++;
+                }
+                else {
+                    stats.hashCollisions++;
+                }
+            }
+        }
+        flushZeroRun();
+    }
+    m_pages.clear();
+
+    stats.scanTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+void PageDedupScanner::PrintStats(FILE *out, const Stats& stats) const noexcept {
+    fprintf(out, "Pages scanned:    %" PRIu64 " (%.2f ms)\n", stats.pagesScanned, stats.scanTimeNs / 1000000.0);
+    fprintf(out, "Zero pages:       %" PRIu64 "\n", stats.zeroPages);
+    fprintf(out, "Duplicate pages:  %" PRIu64 "\n", stats.duplicatePages);
+    if (stats.hashCollisions != 0) {
+        fprintf(out, "Hash collisions:  %" PRIu64 "\n", stats.hashCollisions);
+    }
+    fprintf(out, "Pages reclaimed:  %" PRIu64 "\n", stats.pagesReclaimed);
+    fprintf(out, "Bytes saved:      %" PRIu64 " KiB mergeable, %" PRIu64 " KiB reclaimed\n",
+        stats.BytesSaved() / 1024, stats.pagesReclaimed * PAGE_SIZE / 1024);
+}
@@ -0,0 +1,173 @@
+/*
+Defines a host-side builder for x86-64 guest page tables.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "page_table_builder.hpp"
+
+#include <cstring>
+
+static const uint64_t pageSize = 0x1000;
+static const size_t entriesPerTable = 512;
+static const uint64_t addressMask = 0x000FFFFFFFFFF000ull;
+static const uint64_t noTable = UINT64_MAX;
+static const uint64_t PTE_PAT_LARGE = (1ull << 12);  // PAT bit of 2 MiB and 1 GiB pages
+static const uint64_t PTE_PAT = (1ull << 7);         // PAT bit of 4 KiB pages
+
+// Size of the memory mapped by an entry at the given level (0 = PTE)
+static inline uint64_t entrySpan(size_t level) noexcept {
+    return pageSize << (9 * level);
+}
+
+static inline size_t entryIndex(uint64_t linear, size_t level) noexcept {
+    return (linear >> (12 + 9 * level)) & (entriesPerTable - 1);
+}
+
+PageTableBuilder::PageTableBuilder(GuestMemory& memory, uint64_t tableBase, uint64_t tableSize) noexcept
+    : m_memory(memory)
+    , m_tableBase(tableBase)
+    , m_tableEnd(tableBase + tableSize)
+    , m_nextTable(tableBase)
+{
+}
+
+bool PageTableBuilder::Create() noexcept {
+    const uint64_t root = AllocTable();
+    if (root == noTable) {
+        return false;
+    }
+    m_root = root;
+    return true;
+}
+
+uint64_t PageTableBuilder::AllocTable() noexcept {
+    if (m_nextTable + pageSize > m_tableEnd) {
+        return noTable;
+    }
+    uint64_t *table = Table(m_nextTable);
+    if (table == nullptr) {
+        return noTable;
+    }
+    memset(table, 0, pageSize);
+    const uint64_t address = m_nextTable;
+    m_nextTable += pageSize;
+    m_numTables++;
+    return address;
+}
+
+uint64_t *PageTableBuilder::Table(uint64_t address) const noexcept {
+    return reinterpret_cast<uint64_t *>(m_memory.Translate(address, pageSize));
+}
+
+uint64_t *PageTableBuilder::WalkCreate(uint64_t linear, size_t level) noexcept {
+    uint64_t *table = Table(m_root);
+    for (size_t current = 3; current > level && table != nullptr; current--) {
+        uint64_t& entry = table[entryIndex(linear, current)];
+        if (!(entry & PTE_PRESENT)) {
+            const uint64_t address = AllocTable();
+            if (address == noTable) {
+                return nullptr;
+            }
+            entry = address | PTE_PRESENT | PTE_WRITE | PTE_USER;
+        }
+        else if (entry & PTE_LARGE) {
+            // Split the large page into a table of smaller pages with the same
+            // attributes
+            const uint64_t address = AllocTable();
+            if (address == noTable) {
+                return nullptr;
+            }
+            const uint64_t span = entrySpan(current - 1);
+            const uint64_t base = entry & addressMask & ~(entrySpan(current) - 1);
+            uint64_t attributes = entry & ~addressMask;
+            if (current - 1 == 0) {
+                attributes &= ~PTE_LARGE;
+                if (entry & PTE_PAT_LARGE) {
+                    attributes |= PTE_PAT;
+                }
+            }
+            else {
+                attributes |= entry & PTE_PAT_LARGE;
+            }
+            uint64_t *split = Table(address);
+            for (size_t i = 0; i < entriesPerTable; i++) {
+                split[i] = (base + i * span) | attributes;
+            }
+
+            // The leaves keep the original restrictions
+            entry = address | PTE_PRESENT | PTE_WRITE | PTE_USER;
+        }
+        table = Table(entry & addressMask);
+    }
+    return table;
+}
+
+bool PageTableBuilder::Map(uint64_t linear, uint64_t physical, uint64_t size, uint64_t flags) noexcept {
+    if ((linear | physical | size) & (pageSize - 1)) {
+        return false;
+    }
+    flags = (flags & ~addressMask & ~PTE_LARGE) | PTE_PRESENT;
+
+    while (size > 0) {
+        // Pick the largest page allowed by the alignment of both addresses
+        // and the remaining size
+        size_t level = 0;
+        const size_t maxLevel = !m_largePages ? 0 : m_hugePages ? 2 : 1;
+        for (size_t candidate = maxLevel; candidate > 0; candidate--) {
+            const uint64_t span = entrySpan(candidate);
+            if (((linear | physical) & (span - 1)) == 0 && size >= span) {
+                level = candidate;
+                break;
+            }
+        }
+
+        uint64_t *table = WalkCreate(linear, level);
+        if (table == nullptr) {
+            return false;
+        }
+        table[entryIndex(linear, level)] = physical | flags | ((level > 0) ? PTE_LARGE : 0);
+        m_numPages[level]++;
+
+        const uint64_t span = entrySpan(level);
+        linear += span;
+        physical += span;
+        size -= span;
+    }
+    return true;
+}
+
+uint64_t PageTableBuilder::EntryAddress(uint64_t linear) const noexcept {
+    uint64_t address = m_root;
+    for (size_t level = 3; level > 0; level--) {
+        const uint64_t *table = Table(address);
+        if (table == nullptr) {
+            return 0;
+        }
+        const uint64_t entry = table[entryIndex(linear, level)];
+        if (!(entry & PTE_PRESENT) || (entry & PTE_LARGE)) {
+            return 0;
+        }
+        address = entry & addressMask;
+    }
+    return address + entryIndex(linear, 0) * sizeof(uint64_t);
+}
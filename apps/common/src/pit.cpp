@@ -0,0 +1,191 @@
+/*
+Defines an 8254 programmable interval timer.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "pit.hpp"
+
+// Converts between nanoseconds and PIT ticks without overflowing for
+// centuries of uptime
+static inline uint64_t nsToTicks(uint64_t ns) noexcept {
+    return (ns / 1000000000ull) * pitFrequency + (ns % 1000000000ull) * pitFrequency / 1000000000ull;
+}
+
+static inline uint64_t ticksToNs(uint64_t ticks) noexcept {
+    return (ticks / pitFrequency) * 1000000000ull + (ticks % pitFrequency) * 1000000000ull / pitFrequency;
+}
+
+PIT8254::PIT8254(InterruptController& controller, uint8_t vector) noexcept
+    : m_controller(controller)
+    , m_vector(vector)
+{
+}
+
+PIT8254::~PIT8254() noexcept {
+    StopTimer();
+}
+
+bool PIT8254::Attach(IOBus& bus, uint16_t port) noexcept {
+    m_port = port;
+    return bus.RegisterPIO(port, 4, PortRead, PortWrite, this);
+}
+
+void PIT8254::StopTimer() noexcept {
+    if (m_timerID != TimerWheel::invalidTimer) {
+        m_controller.CancelTimer(m_timerID);
+        m_timerID = TimerWheel::invalidTimer;
+    }
+}
+
+uint16_t PIT8254::Count(size_t index) const noexcept {
+    const Channel& channel = m_channels[index];
+    if (!channel.counting) {
+        return static_cast<uint16_t>(channel.reload);
+    }
+
+    const uint64_t ticks = nsToTicks(m_controller.Now() - channel.start);
+    switch (channel.mode) {
+    case 2:
+        // Counts from reload down to 1, then reloads
+        return static_cast<uint16_t>(channel.reload - ticks % channel.reload);
+    case 3:
+        // Counts down by two twice per period
+        return static_cast<uint16_t>((channel.reload - (ticks * 2) % channel.reload) & ~1u);
+    default:
+        // Counts down once and keeps wrapping around after reaching zero
+        return static_cast<uint16_t>(channel.reload - ticks);
+    }
+}
+
+void PIT8254::Command(uint8_t value) noexcept {
+    const size_t index = value >> 6;
+    if (index == 3) {
+        // Read-back command
+        return;
+    }
+
+    Channel& channel = m_channels[index];
+    const uint8_t accessMode = (value >> 4) & 3;
+    if (accessMode == 0) {
+        if (!channel.latched) {
+            channel.latch = Count(index);
+            channel.latched = true;
+            channel.readHigh = false;
+        }
+        return;
+    }
+
+    // Programming a mode stops the counter until a new count is written
+    channel.accessMode = accessMode;
+    channel.mode = (value >> 1) & 7;
+    if (channel.mode >= 6) {
+        channel.mode -= 4;
+    }
+    channel.writeHigh = false;
+    channel.readHigh = false;
+    channel.latched = false;
+    channel.counting = false;
+    if (index == 0) {
+        StopTimer();
+    }
+}
+
+void PIT8254::Load(size_t index, uint16_t count) noexcept {
+    Channel& channel = m_channels[index];
+    channel.reload = (count == 0) ? 0x10000 : count;
+    // Modes 1 and 5 never see a gate trigger
+    channel.counting = channel.mode != 1 && channel.mode != 5;
+    channel.start = m_controller.Now();
+    if (index != 0 || !channel.counting) {
+        return;
+    }
+
+    StopTimer();
+    const uint64_t period = ticksToNs(channel.reload);
+    if (channel.mode == 2 || channel.mode == 3) {
+        m_timerID = m_controller.ScheduleInterrupt(channel.start + period, m_vector, period);
+    }
+    else {
+        m_timerID = m_controller.ScheduleInterrupt(channel.start + period, m_vector);
+    }
+    m_numStarts++;
+}
+
+uint8_t PIT8254::ReadCounter(size_t index) noexcept {
+    Channel& channel = m_channels[index];
+    const uint16_t count = channel.latched ? channel.latch : Count(index);
+
+    uint8_t value;
+    switch (channel.accessMode) {
+    case 1: value = static_cast<uint8_t>(count); break;
+    case 2: value = static_cast<uint8_t>(count >> 8); break;
+    default:
+        value = channel.readHigh ? static_cast<uint8_t>(count >> 8) : static_cast<uint8_t>(count);
+        channel.readHigh = !channel.readHigh;
+        if (channel.readHigh) {
+            // Keep the latch until both bytes are read
+            return value;
+        }
+        break;
+    }
+    channel.latched = false;
+    return value;
+}
+
+void PIT8254::WriteCounter(size_t index, uint8_t value) noexcept {
+    Channel& channel = m_channels[index];
+    switch (channel.accessMode) {
+    case 1: Load(index, value); break;
+    case 2: Load(index, static_cast<uint16_t>(value << 8)); break;
+    default:
+        if (!channel.writeHigh) {
+            channel.writeLow = value;
+            channel.writeHigh = true;
+        }
+        else {
+            channel.writeHigh = false;
+            Load(index, static_cast<uint16_t>(channel.writeLow | (value << 8)));
+        }
+        break;
+    }
+}
+
+uint32_t PIT8254::PortRead(void *context, uint16_t port, size_t size) noexcept {
+    auto& pit = *reinterpret_cast<PIT8254 *>(context);
+    const size_t index = port - pit.m_port;
+    if (index >= 3) {
+        return 0xFF;
+    }
+    return pit.ReadCounter(index);
+}
+
+void PIT8254::PortWrite(void *context, uint16_t port, size_t size, uint32_t value) noexcept {
+    auto& pit = *reinterpret_cast<PIT8254 *>(context);
+    const size_t index = port - pit.m_port;
+    if (index == 3) {
+        pit.Command(static_cast<uint8_t>(value));
+    }
+    else {
+        pit.WriteCounter(index, static_cast<uint8_t>(value));
+    }
+}
@@ -0,0 +1,100 @@
+/*
+Defines a paravirtual clock that lets the guest read time without exiting.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "pvclock.hpp"
+
+#include <atomic>
+
+PVClock::PVClock(const GuestMemory& memory, const InterruptController& controller, const TSCClock& clock) noexcept
+    : m_memory(memory)
+    , m_controller(controller)
+    , m_clock(clock)
+{
+}
+
+bool PVClock::Attach(IOBus& bus, uint16_t port) noexcept {
+    m_port = port;
+    return bus.RegisterPIO(port, 8, PortRead, PortWrite, this);
+}
+
+void PVClock::Update() noexcept {
+    if (m_info == nullptr) {
+        return;
+    }
+
+    // Seqlock write side. The guest may be reading the page on another
+    // thread, so the fields are only written between the two version bumps.
+    volatile PVClockInfo& info = *m_info;
+    const uint32_t version = info.version;
+    info.version = version + 1;
+    std::atomic_thread_fence(std::memory_order_release);
+
+    info.tscTimestamp = m_clock.BaseTSC();
+    info.systemTime = m_clock.BaseTime();
+    info.tscToSystemMul = m_clock.Mul();
+    info.tscShift = m_clock.Shift();
+    info.flags = PVCLOCK_TSC_STABLE_BIT;
+
+    std::atomic_thread_fence(std::memory_order_release);
+    info.version = version + 2;
+    m_numUpdates++;
+}
+
+uint32_t PVClock::PortRead(void *context, uint16_t port, size_t size) noexcept {
+    auto& clock = *reinterpret_cast<PVClock *>(context);
+    switch (port - clock.m_port) {
+    case 0:
+        clock.m_numTimeReads++;
+        return static_cast<uint32_t>(clock.m_controller.Now());
+    case 4: return PVCLOCK_MAGIC;
+    default: return 0xFFFFFFFF;
+    }
+}
+
+void PVClock::PortWrite(void *context, uint16_t port, size_t size, uint32_t value) noexcept {
+    if (size != 4) {
+        return;
+    }
+    auto& clock = *reinterpret_cast<PVClock *>(context);
+    switch (port - clock.m_port) {
+    case 0: {
+        clock.m_info = nullptr;
+        clock.m_address = (static_cast<uint64_t>(clock.m_addressHigh) << 32) | (value & ~1u);
+        if ((value & 1) == 0 || (clock.m_address & (sizeof(PVClockInfo) - 1)) != 0) {
+            break;
+        }
+        clock.m_info = clock.m_memory.Get<PVClockInfo>(clock.m_address);
+        if (clock.m_info != nullptr) {
+            // Start from an even version the guest hasn't seen
+            clock.m_info->version = 0;
+            clock.Update();
+        }
+        break;
+    }
+    case 4:
+        clock.m_addressHigh = value;
+        break;
+    }
+}
@@ -0,0 +1,412 @@
+/*
+Defines a log of the non-deterministic inputs the host gives a guest,
+recorded during one run and fed back to replay it.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "replay_log.hpp"
+
+#include "utils.hpp"
+
+#include <cstring>
+
+using namespace virt86;
+
+// Recordings are written out in blocks of this size
+static const size_t flushSize = 64 * 1024;
+
+static const uint64_t msrTSC = 0x10;  // IA32_TIME_STAMP_COUNTER
+
+static inline uint64_t zigzag(int64_t value) noexcept {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value) noexcept {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+ReplayLog::~ReplayLog() noexcept {
+    if (m_file != nullptr) {
+        Finish();
+    }
+}
+
+bool ReplayLog::StartRecording(const char *path, bool syncTSC) {
+    m_file = fopen(path, "wb");
+    if (m_file == nullptr) {
+        m_error = std::string("could not create ") + path;
+        return false;
+    }
+    m_mode = Mode::Record;
+    m_syncTSC = syncTSC;
+    m_buffer.clear();
+    m_buffer.reserve(flushSize + 256);
+    m_buffer.insert(m_buffer.end(), { 'V', '8', '6', 'R' });
+    PutVarint(version);
+    PutVarint(syncTSC ? flagSyncTSC : 0);
+    return true;
+}
+
+bool ReplayLog::StartReplay(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == nullptr) {
+        m_error = std::string("could not open ") + path;
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    m_buffer.resize((len > 0) ? (size_t)len : 0);
+    const bool read = fread(m_buffer.data(), 1, m_buffer.size(), fp) == m_buffer.size();
+    fclose(fp);
+    if (!read) {
+        m_error = std::string("could not read ") + path;
+        return false;
+    }
+
+    uint64_t logVersion, flags;
+    m_pos = 4;
+    if (m_buffer.size() < 4 || memcmp(m_buffer.data(), "V86R", 4) != 0
+        || !GetVarint(logVersion) || logVersion != version || !GetVarint(flags)) {
+        m_error = std::string(path) + " is not a replay log";
+        return false;
+    }
+    m_mode = Mode::Replay;
+    m_syncTSC = (flags & flagSyncTSC) != 0;
+    m_bytes = m_buffer.size();
+    return true;
+}
+
+bool ReplayLog::Finish() noexcept {
+    bool ok = !m_diverged;
+    if (m_mode == Mode::Record && m_file != nullptr) {
+        ok &= fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) == m_buffer.size();
+        m_bytes += m_buffer.size();
+        m_buffer.clear();
+        ok &= fclose(m_file) == 0;
+        m_file = nullptr;
+        if (!ok) {
+            m_error = "failed to write the log";
+        }
+    }
+    else if (m_mode == Mode::Replay && !m_diverged && m_pos != m_buffer.size()) {
+        char message[96];
+        snprintf(message, sizeof(message), "replay ended with %zu bytes of the log left", m_buffer.size() - m_pos);
+        m_error = message;
+        ok = false;
+    }
+    return ok;
+}
+
+void ReplayLog::Attach(VirtualMachine& vm, IOBus& bus) noexcept {
+    m_bus = &bus;
+    vm.RegisterIOReadCallback(IOReadCallback);
+    vm.RegisterIOWriteCallback(IOWriteCallback);
+    vm.RegisterMMIOReadCallback(MMIOReadCallback);
+    vm.RegisterMMIOWriteCallback(MMIOWriteCallback);
+    vm.RegisterIOContext(this);
+}
+
+void ReplayLog::Attach(InterruptController& interrupts) noexcept {
+    if (m_mode == Mode::Record) {
+        interrupts.SetDeliverHandler(InterruptDelivered, this);
+    }
+}
+
+// ----- Run loop hooks ---------------------------------------------------------------------------------------------------
+
+size_t ReplayLog::BeforeRun(VirtualProcessor& vp, InterruptController *interrupts) noexcept {
+    size_t count = 0;
+    if (m_mode == Mode::Replay && !m_diverged) {
+        uint64_t delta;
+        if (m_syncTSC && Expect((uint8_t)Event::TSC, "TSC") && GetVarint(delta)) {
+            m_lastTSC += (uint64_t)unzigzag(delta);
+            vp.SetMSR(msrTSC, m_lastTSC);
+        }
+
+        // Inject the interrupts recorded before this run
+        uint8_t tag;
+        while (!m_diverged && PeekTag(tag) && tag == (uint8_t)Event::Interrupt) {
+            const size_t start = m_pos++;
+            if (!GetVarint(delta) || m_pos >= m_buffer.size()) {
+                Diverge("interrupt");
+                break;
+            }
+            const uint64_t run = m_lastInterruptRun + delta;
+            if (run > m_runs) {
+                m_pos = start;
+                break;
+            }
+            if (run < m_runs) {
+                Diverge("interrupt position");
+                break;
+            }
+            vp.EnqueueInterrupt(m_buffer[m_pos++]);
+            m_lastInterruptRun = run;
+            m_numEvents++;
+            count++;
+        }
+    }
+    else {
+        if (m_mode == Mode::Record && m_syncTSC) {
+            uint64_t tsc = 0;
+            vp.GetMSR(msrTSC, tsc);
+            Put((uint8_t)Event::TSC);
+            PutVarint(zigzag((int64_t)(tsc - m_lastTSC)));
+            m_lastTSC = tsc;
+            EndEvent();
+        }
+        if (interrupts != nullptr) {
+            count = interrupts->Deliver(vp);
+        }
+    }
+    m_runs++;
+    return count;
+}
+
+bool ReplayLog::HandleCPUID(VirtualProcessor& vp, CPUIDPolicy *policy) noexcept {
+    static const Reg inputRegs[] = { Reg::EAX, Reg::ECX };
+    static const Reg outputRegs[] = { Reg::EAX, Reg::EBX, Reg::ECX, Reg::EDX };
+    RegValue inputs[2], outputs[4];
+
+    if (m_mode == Mode::Off) {
+        return (policy != nullptr) ? policy->HandleExit(vp) : true;
+    }
+    if (vp.RegRead(inputRegs, inputs, 2) != VPOperationStatus::OK) {
+        return false;
+    }
+
+    if (m_mode == Mode::Replay && !m_diverged) {
+        uint64_t leaf, subleaf, values[4];
+        if (Expect((uint8_t)Event::CPUID, "CPUID") && GetVarint(leaf) && GetVarint(subleaf)
+            && leaf == inputs[0].u32 && subleaf == inputs[1].u32
+            && GetVarint(values[0]) && GetVarint(values[1]) && GetVarint(values[2]) && GetVarint(values[3])) {
+            for (size_t i = 0; i < 4; i++) {
+                outputs[i].u64 = values[i];
+            }
+            return vp.RegWrite(outputRegs, outputs, 4) == VPOperationStatus::OK;
+        }
+        Diverge("CPUID");
+    }
+
+    bool ok = (policy != nullptr) ? policy->HandleExit(vp) : true;
+    if (m_mode == Mode::Record) {
+        ok &= vp.RegRead(outputRegs, outputs, 4) == VPOperationStatus::OK;
+        Put((uint8_t)Event::CPUID);
+        PutVarint(inputs[0].u32);
+        PutVarint(inputs[1].u32);
+        for (auto& output : outputs) {
+            PutVarint(output.u32);
+        }
+        EndEvent();
+    }
+    return ok;
+}
+
+bool ReplayLog::Checkpoint(VirtualProcessor& vp) noexcept {
+    if (m_mode == Mode::Off || m_diverged) {
+        return !m_diverged;
+    }
+
+    static const Reg regs[] = {
+        Reg::RAX, Reg::RCX, Reg::RDX, Reg::RBX, Reg::RSP, Reg::RBP, Reg::RSI, Reg::RDI,
+        Reg::R8, Reg::R9, Reg::R10, Reg::R11, Reg::R12, Reg::R13, Reg::R14, Reg::R15,
+        Reg::RIP,
+    };
+    RegValue values[array_size(regs)];
+    if (vp.RegRead(regs, values, array_size(regs)) != VPOperationStatus::OK) {
+        return false;
+    }
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (auto& value : values) {
+        hash = (hash ^ value.u64) * 0x100000001b3ull;
+    }
+
+    if (m_mode == Mode::Record) {
+        Put((uint8_t)Event::Checkpoint);
+        PutVarint(hash);
+        EndEvent();
+        return true;
+    }
+    uint64_t recorded;
+    if (!Expect((uint8_t)Event::Checkpoint, "checkpoint") || !GetVarint(recorded) || recorded != hash) {
+        Diverge("register checkpoint");
+        return false;
+    }
+    return true;
+}
+
+// ----- I/O callbacks ----------------------------------------------------------------------------------------------------
+
+uint32_t ReplayLog::IOReadCallback(void *context, uint16_t port, size_t size) noexcept {
+    auto& log = *reinterpret_cast<ReplayLog *>(context);
+    const uint8_t tag = (uint8_t)Event::PIORead | (uint8_t)(size << 4);
+    if (log.m_mode == Mode::Replay && !log.m_diverged) {
+        uint64_t loggedPort, value;
+        if (log.Expect(tag, "port read") && log.GetVarint(loggedPort) && loggedPort == port && log.GetVarint(value)) {
+            return (uint32_t)value;
+        }
+        log.Diverge("port read");
+    }
+
+    const uint32_t value = log.m_bus->ReadPIO(port, size);
+    if (log.m_mode == Mode::Record) {
+        log.Put(tag);
+        log.PutVarint(port);
+        log.PutVarint(value);
+        log.EndEvent();
+    }
+    return value;
+}
+
+void ReplayLog::IOWriteCallback(void *context, uint16_t port, size_t size, uint32_t value) noexcept {
+    auto& log = *reinterpret_cast<ReplayLog *>(context);
+    const uint8_t tag = (uint8_t)Event::PIOWrite | (uint8_t)(size << 4);
+    if (log.m_mode == Mode::Replay && !log.m_diverged) {
+        uint64_t loggedPort, loggedValue;
+        if (!log.Expect(tag, "port write") || !log.GetVarint(loggedPort) || loggedPort != port
+            || !log.GetVarint(loggedValue) || loggedValue != value) {
+            log.Diverge("port write");
+        }
+    }
+    else if (log.m_mode == Mode::Record) {
+        log.Put(tag);
+        log.PutVarint(port);
+        log.PutVarint(value);
+        log.EndEvent();
+    }
+    log.m_bus->WritePIO(port, size, value);
+}
+
+uint64_t ReplayLog::MMIOReadCallback(void *context, uint64_t address, size_t size) noexcept {
+    auto& log = *reinterpret_cast<ReplayLog *>(context);
+    const uint8_t tag = (uint8_t)Event::MMIORead | (uint8_t)(size << 4);
+    if (log.m_mode == Mode::Replay && !log.m_diverged) {
+        uint64_t loggedAddress, value;
+        if (log.Expect(tag, "MMIO read") && log.GetVarint(loggedAddress) && loggedAddress == address && log.GetVarint(value)) {
+            return value;
+        }
+        log.Diverge("MMIO read");
+    }
+
+    const uint64_t value = log.m_bus->ReadMMIO(address, size);
+    if (log.m_mode == Mode::Record) {
+        log.Put(tag);
+        log.PutVarint(address);
+        log.PutVarint(value);
+        log.EndEvent();
+    }
+    return value;
+}
+
+void ReplayLog::MMIOWriteCallback(void *context, uint64_t address, size_t size, uint64_t value) noexcept {
+    auto& log = *reinterpret_cast<ReplayLog *>(context);
+    const uint8_t tag = (uint8_t)Event::MMIOWrite | (uint8_t)(size << 4);
+    if (log.m_mode == Mode::Replay && !log.m_diverged) {
+        uint64_t loggedAddress, loggedValue;
+        if (!log.Expect(tag, "MMIO write") || !log.GetVarint(loggedAddress) || loggedAddress != address
+            || !log.GetVarint(loggedValue) || loggedValue != value) {
+            log.Diverge("MMIO write");
+        }
+    }
+    else if (log.m_mode == Mode::Record) {
+        log.Put(tag);
+        log.PutVarint(address);
+        log.PutVarint(value);
+        log.EndEvent();
+    }
+    log.m_bus->WriteMMIO(address, size, value);
+}
+
+void ReplayLog::InterruptDelivered(void *context, uint8_t vector) noexcept {
+    auto& log = *reinterpret_cast<ReplayLog *>(context);
+
+    // BeforeRun counts the run after delivering
+    log.Put((uint8_t)Event::Interrupt);
+    log.PutVarint(log.m_runs - log.m_lastInterruptRun);
+    log.Put(vector);
+    log.m_lastInterruptRun = log.m_runs;
+    log.EndEvent();
+}
+
+// ----- Encoding ---------------------------------------------------------------------------------------------------------
+
+void ReplayLog::PutVarint(uint64_t value) {
+    while (value >= 0x80) {
+        m_buffer.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    m_buffer.push_back((uint8_t)value);
+}
+
+void ReplayLog::EndEvent() noexcept {
+    m_numEvents++;
+    if (m_buffer.size() >= flushSize && m_file != nullptr) {
+        if (fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) != m_buffer.size()) {
+            m_error = "failed to write the log";
+        }
+        m_bytes += m_buffer.size();
+        m_buffer.clear();
+    }
+}
+
+bool ReplayLog::PeekTag(uint8_t& tag) const noexcept {
+    if (m_pos >= m_buffer.size()) {
+        return false;
+    }
+    tag = m_buffer[m_pos];
+    return true;
+}
+
+bool ReplayLog::Expect(uint8_t tag, const char *what) noexcept {
+    uint8_t next;
+    if (!PeekTag(next) || next != tag) {
+        Diverge(what);
+        return false;
+    }
+    m_pos++;
+    m_numEvents++;
+    return true;
+}
+
+bool ReplayLog::GetVarint(uint64_t& value) noexcept {
+    value = 0;
+    for (size_t shift = 0; shift < 64 && m_pos < m_buffer.size(); shift += 7) {
+        const uint8_t byte = m_buffer[m_pos++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ReplayLog::Diverge(const char *what) noexcept {
+    if (m_diverged) {
+        return;
+    }
+    m_diverged = true;
+    char message[128];
+    snprintf(message, sizeof(message), "replay diverged at %s (event %" PRIu64 ", run %" PRIu64 ", log offset %zu)", what, m_numEvents, m_runs, m_pos);
+    m_error = message;
+}
@@ -0,0 +1,91 @@
+/*
+Defines a machine-readable report of test results and timings.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "result_report.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+void ResultReport::Add(const char *name, TestStatus status, uint64_t exits, uint64_t ns) {
+    const uint64_t runs = (status == TestStatus::Skipped) ? 0 : 1;
+    m_results.push_back({ name, status, runs, exits, ns, ns, ns });
+}
+
+bool ResultReport::Save(const char *path) const noexcept {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        return false;
+    }
+    fprintf(fp, "# test\tstatus\truns\texits\ttotal_ns\tmin_ns\tmax_ns\n");
+    for (auto& result : m_results) {
+        fprintf(fp, "%s\t%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n",
+            result.name.c_str(), StatusName(result.status), result.runs, result.exits,
+            result.totalNs, result.minNs, result.maxNs);
+    }
+    return fclose(fp) == 0;
+}
+
+bool ResultReport::Load(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return false;
+    }
+    m_results.clear();
+    char line[512];
+    bool ok = true;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        char name[256], status[16];
+        TestResult result;
+        if (sscanf(line, "%255s %15s %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64,
+            name, status, &result.runs, &result.exits, &result.totalNs, &result.minNs, &result.maxNs) != 7) {
+            ok = false;
+            break;
+        }
+        if (strcmp(status, "passed") == 0) result.status = TestStatus::Passed;
+        else if (strcmp(status, "failed") == 0) result.status = TestStatus::Failed;
+        else if (strcmp(status, "skipped") == 0) result.status = TestStatus::Skipped;
+        else {
+            ok = false;
+            break;
+        }
+        result.name = name;
+        m_results.push_back(result);
+    }
+    fclose(fp);
+    return ok;
+}
+
+const char *ResultReport::StatusName(TestStatus status) noexcept {
+    switch (status) {
+    case TestStatus::Passed: return "passed";
+    case TestStatus::Failed: return "failed";
+    case TestStatus::Skipped: return "skipped";
+    default: return "unknown";
+    }
+}
@@ -0,0 +1,249 @@
+/*
+Defines minimal cross-platform helpers for local stream sockets.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "socket.hpp"
+
+#if defined(_WIN32)
+#  include <winsock2.h>
+#  include <ws2tcpip.h>
+#elif defined(__linux__) || defined(__APPLE__)
+#  include <sys/types.h>
+#  include <sys/socket.h>
+#  include <sys/select.h>
+#  include <sys/stat.h>
+#  include <sys/un.h>
+#  include <netinet/in.h>
+#  include <arpa/inet.h>
+#  include <unistd.h>
+#else
+#  error Unsupported platform
+#endif
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_WIN32)
+static bool socketStartup() noexcept {
+    static bool initialized = false;
+    if (!initialized) {
+        WSADATA wsaData;
+        initialized = (WSAStartup(MAKEWORD(2, 2), &wsaData) == 0);
+    }
+    return initialized;
+}
+#endif
+
+// Returns true if the last socket call failed because a signal interrupted it
+static bool interrupted() noexcept {
+#if defined(_WIN32)
+    return false;
+#else
+    return errno == EINTR;
+#endif
+}
+
+#if !defined(_WIN32)
+// Removes the file at the path only if it is a socket, so that a mistyped
+// endpoint cannot delete a regular file
+static bool unlinkSocket(const char *path) noexcept {
+    struct stat st;
+    if (lstat(path, &st) != 0) {
+        return errno == ENOENT;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        return false;
+    }
+    return unlink(path) == 0;
+}
+#endif
+
+static socket_t listenOn(int family, const sockaddr *addr, socklen_t addrLen) noexcept {
+#if defined(_WIN32)
+    if (!socketStartup()) {
+        return invalidSocket;
+    }
+#endif
+    socket_t sock = (socket_t)socket(family, SOCK_STREAM, 0);
+    if (sock == invalidSocket) {
+        return invalidSocket;
+    }
+
+    if (family == AF_INET) {
+        int reuse = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+    }
+
+    if (bind(sock, addr, addrLen) != 0 || listen(sock, 8) != 0) {
+        socketClose(sock);
+        return invalidSocket;
+    }
+    return sock;
+}
+
+socket_t socketListenTCP(const char *address, uint16_t port) noexcept {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+        return invalidSocket;
+    }
+    return listenOn(AF_INET, (const sockaddr *)&addr, sizeof(addr));
+}
+
+socket_t socketListenUnix(const char *path) noexcept {
+#if defined(_WIN32)
+    return invalidSocket;
+#else
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return invalidSocket;
+    }
+    strcpy(addr.sun_path, path);
+    if (!unlinkSocket(path)) {
+        return invalidSocket;
+    }
+    return listenOn(AF_UNIX, (const sockaddr *)&addr, sizeof(addr));
+#endif
+}
+
+socket_t socketListen(const char *endpoint) noexcept {
+    if (strncmp(endpoint, "unix:", 5) == 0) {
+        return socketListenUnix(endpoint + 5);
+    }
+
+    // Split <address>:<port>, defaulting to the loopback address
+    char address[64] = "127.0.0.1";
+    const char *portStr = endpoint;
+    const char *colon = strrchr(endpoint, ':');
+    if (colon != nullptr) {
+        size_t len = colon - endpoint;
+        if (len >= sizeof(address)) {
+            return invalidSocket;
+        }
+        memcpy(address, endpoint, len);
+        address[len] = '\0';
+        portStr = colon + 1;
+    }
+
+    char *end;
+    unsigned long port = strtoul(portStr, &end, 10);
+    if (*portStr == '\0' || *end != '\0' || port > 0xFFFF) {
+        return invalidSocket;
+    }
+    return socketListenTCP(address, (uint16_t)port);
+}
+
+socket_t socketAccept(socket_t listener, int timeoutMs) noexcept {
+    if (!socketWaitReadable(listener, timeoutMs)) {
+        return invalidSocket;
+    }
+    socket_t sock;
+    do {
+        sock = (socket_t)accept(listener, nullptr, nullptr);
+    } while (sock == invalidSocket && interrupted());
+#if defined(__APPLE__)
+    // There is no MSG_NOSIGNAL; keep a closed peer from raising SIGPIPE
+    if (sock != invalidSocket) {
+        int noSigPipe = 1;
+        setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+    }
+#endif
+    return sock;
+}
+
+bool socketWaitReadable(socket_t sock, int timeoutMs) noexcept {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+    timeval tv;
+    tv.tv_sec = timeoutMs / 1000;
+    tv.tv_usec = (timeoutMs % 1000) * 1000;
+    return select((int)sock + 1, &fds, nullptr, nullptr, &tv) > 0;
+}
+
+bool socketSetTimeout(socket_t sock, int timeoutMs) noexcept {
+#if defined(_WIN32)
+    DWORD timeout = (DWORD)timeoutMs;
+#else
+    timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+#endif
+    return setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout)) == 0
+        && setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout, sizeof(timeout)) == 0;
+}
+
+ptrdiff_t socketRecv(socket_t sock, void *buffer, size_t len) noexcept {
+    ptrdiff_t received;
+    do {
+        received = recv(sock, (char *)buffer, (int)len, 0);
+    } while (received < 0 && interrupted());
+    return received;
+}
+
+bool socketSendAll(socket_t sock, const void *data, size_t len) noexcept {
+    const char *ptr = (const char *)data;
+    while (len > 0) {
+#if defined(__linux__)
+        auto sent = send(sock, ptr, len, MSG_NOSIGNAL);
+#else
+        auto sent = send(sock, ptr, (int)len, 0);
+#endif
+        if (sent < 0 && interrupted()) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        ptr += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+void socketClose(socket_t sock) noexcept {
+#if defined(_WIN32)
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+}
+
+void socketCloseListener(socket_t listener) noexcept {
+#if !defined(_WIN32)
+    sockaddr_un addr;
+    socklen_t addrLen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    if (getsockname(listener, (sockaddr *)&addr, &addrLen) == 0 && addr.sun_family == AF_UNIX && addr.sun_path[0] != '\0') {
+        unlinkSocket(addr.sun_path);
+    }
+#endif
+    socketClose(listener);
+}
@@ -0,0 +1,417 @@
+/*
+Defines an instruction tracer that single-steps a virtual processor and
+records register changes and memory writes in a compact trace file, and a
+reader for those files.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "step_tracer.hpp"
+
+#include "utils.hpp"
+
+#include <cstring>
+
+#if defined(_WIN32)
+#  include <intrin.h>
+#endif
+
+using namespace virt86;
+
+static const Reg tracedRegs[] = {
+    Reg::RAX, Reg::RCX, Reg::RDX, Reg::RBX, Reg::RSP, Reg::RBP, Reg::RSI, Reg::RDI,
+    Reg::R8, Reg::R9, Reg::R10, Reg::R11, Reg::R12, Reg::R13, Reg::R14, Reg::R15,
+    Reg::RIP, Reg::RFLAGS,
+    Reg::CS, Reg::SS, Reg::DS, Reg::ES, Reg::FS, Reg::GS,
+    Reg::CR0, Reg::CR2, Reg::CR3, Reg::CR4, Reg::EFER,
+};
+static const char *const tracedRegNames[] = {
+    "RAX", "RCX", "RDX", "RBX", "RSP", "RBP", "RSI", "RDI",
+    "R8", "R9", "R10", "R11", "R12", "R13", "R14", "R15",
+    "RIP", "RFLAGS",
+    "CS", "SS", "DS", "ES", "FS", "GS",
+    "CR0", "CR2", "CR3", "CR4", "EFER",
+};
+static const size_t numTracedRegs = array_size(tracedRegs);
+static_assert(array_size(tracedRegNames) == numTracedRegs, "Every traced register needs a name");
+
+// Segment registers are traced by selector
+static const size_t firstSegmentReg = 18;
+static const size_t numSegmentRegs = 6;
+
+static inline uint64_t tracedValue(size_t index, const RegValue& value) noexcept {
+    return (index - firstSegmentReg < numSegmentRegs) ? value.segment.selector : value.u64;
+}
+
+// Bytes of unchanged memory allowed inside a single recorded write
+static const size_t maxWriteGap = 8;
+
+// Trace output is flushed in blocks of this size
+static const size_t flushSize = 64 * 1024;
+
+static inline size_t lowestBit(uint64_t value) noexcept {
+#if defined(_WIN32)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return index;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+static inline void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+static inline uint64_t zigzag(int64_t value) noexcept {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value) noexcept {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// ----- StepTracer -------------------------------------------------------------------------------------------------------
+
+StepTracer::~StepTracer() noexcept {
+    Finish();
+}
+
+bool StepTracer::Start(VirtualProcessor& vp, const char *path) {
+    Finish();
+    m_values.resize(numTracedRegs);
+    if (vp.RegRead(tracedRegs, m_values.data(), numTracedRegs) != VPOperationStatus::OK) {
+        m_error = "failed to read registers";
+        return false;
+    }
+
+    m_file = fopen(path, "wb");
+    if (m_file == nullptr) {
+        m_error = std::string("could not create ") + path;
+        return false;
+    }
+    m_buffer.clear();
+    m_buffer.reserve(flushSize + 4096);
+    m_steps = 0;
+    m_memoryWrites = 0;
+    m_bytesWritten = 0;
+    m_failed = false;
+
+    m_buffer.insert(m_buffer.end(), { 'V', '8', '6', 'T' });
+    putVarint(m_buffer, version);
+    putVarint(m_buffer, numTracedRegs);
+    for (auto name : tracedRegNames) {
+        const size_t length = strlen(name);
+        putVarint(m_buffer, length);
+        m_buffer.insert(m_buffer.end(), name, name + length);
+    }
+    m_previous.resize(numTracedRegs);
+    for (size_t i = 0; i < numTracedRegs; i++) {
+        m_previous[i] = tracedValue(i, m_values[i]);
+        putVarint(m_buffer, m_previous[i]);
+    }
+    return true;
+}
+
+bool StepTracer::EnableMemoryWrites(VirtualMachine& vm, uint64_t ramBase, uint8_t *ram, uint64_t ramSize) {
+    if (!vm.GetPlatform().GetFeatures().dirtyPageTracking
+        || vm.ClearDirtyPages(ramBase, ramSize) != DirtyPageTrackingStatus::OK) {
+        m_error = "dirty page tracking not available";
+        return false;
+    }
+    m_vm = &vm;
+    m_ramBase = ramBase;
+    m_ram = ram;
+    m_ramSize = ramSize;
+    m_shadow.assign(ram, ram + ramSize);
+    m_dirtyBitmap.assign((ramSize / PAGE_SIZE + 63) / 64, 0);
+    return true;
+}
+
+VPExecutionStatus StepTracer::Step(VirtualProcessor& vp) noexcept {
+    const auto status = vp.Step();
+    if (status != VPExecutionStatus::OK || m_file == nullptr) {
+        return status;
+    }
+
+    if (vp.RegRead(tracedRegs, m_values.data(), numTracedRegs) != VPOperationStatus::OK) {
+        m_failed = true;
+        return status;
+    }
+
+    // Diff against the previous step
+    uint64_t changed = 0;
+    for (size_t i = 0; i < numTracedRegs; i++) {
+        const uint64_t value = tracedValue(i, m_values[i]);
+        if (value != m_previous[i]) {
+            changed |= 1ull << i;
+        }
+    }
+
+    if (m_vm != nullptr) {
+        RecordMemoryWrites();
+    }
+
+    const auto reason = vp.GetVMExitInfo().reason;
+    uint64_t flags = changed << flagBits;
+    if (reason != VMExitReason::Step) flags |= flagExit;
+    if (m_numWrites > 0) flags |= flagWrites;
+    putVarint(m_buffer, flags);
+
+    for (uint64_t bits = changed; bits != 0; bits &= bits - 1) {
+        const size_t i = lowestBit(bits);
+        const uint64_t value = tracedValue(i, m_values[i]);
+        putVarint(m_buffer, zigzag((int64_t)(value - m_previous[i])));
+        m_previous[i] = value;
+    }
+    if (flags & flagExit) {
+        putVarint(m_buffer, (uint64_t)reason);
+    }
+    if (flags & flagWrites) {
+        putVarint(m_buffer, m_numWrites);
+        m_buffer.insert(m_buffer.end(), m_writes.begin(), m_writes.end());
+    }
+
+    m_steps++;
+    if (m_buffer.size() >= flushSize) {
+        Flush();
+    }
+    return status;
+}
+
+void StepTracer::RecordMemoryWrites() noexcept {
+    m_writes.clear();
+    m_numWrites = 0;
+
+    const size_t bitmapSize = m_dirtyBitmap.size() * sizeof(uint64_t);
+    if (m_vm->QueryDirtyPages(m_ramBase, m_ramSize, m_dirtyBitmap.data(), bitmapSize) != DirtyPageTrackingStatus::OK
+        || m_vm->ClearDirtyPages(m_ramBase, m_ramSize) != DirtyPageTrackingStatus::OK) {
+        m_failed = true;
+        return;
+    }
+
+    for (size_t word = 0; word < m_dirtyBitmap.size(); word++) {
+        for (uint64_t bits = m_dirtyBitmap[word]; bits != 0; bits &= bits - 1) {
+            const uint64_t offset = (word * 64 + lowestBit(bits)) * PAGE_SIZE;
+            if (offset >= m_ramSize) {
+                break;
+            }
+            const uint8_t *page = &m_ram[offset];
+            uint8_t *shadow = &m_shadow[offset];
+            if (memcmp(page, shadow, PAGE_SIZE) == 0) {
+                continue;
+            }
+
+            // Emit ranges of changed bytes, merging ranges separated by small gaps
+            size_t pos = 0;
+            while (pos < PAGE_SIZE) {
+                if (page[pos] == shadow[pos]) {
+                    pos++;
+                    continue;
+                }
+                const size_t start = pos;
+                size_t end = pos + 1;
+                for (size_t gap = 0; end < PAGE_SIZE && gap <= maxWriteGap; end++) {
+                    gap = (page[end] == shadow[end]) ? gap + 1 : 0;
+                    if (gap > maxWriteGap) {
+                        end -= maxWriteGap;
+                        break;
+                    }
+                }
+                while (end > start && page[end - 1] == shadow[end - 1]) {
+                    end--;
+                }
+                putVarint(m_writes, m_ramBase + offset + start);
+                putVarint(m_writes, end - start);
+                m_writes.insert(m_writes.end(), &page[start], &page[end]);
+                memcpy(&shadow[start], &page[start], end - start);
+                m_numWrites++;
+                pos = end;
+            }
+        }
+    }
+    m_memoryWrites += m_numWrites;
+}
+
+void StepTracer::Flush() noexcept {
+    if (m_file == nullptr || m_buffer.empty()) {
+        return;
+    }
+    if (fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) != m_buffer.size()) {
+        m_failed = true;
+    }
+    m_bytesWritten += m_buffer.size();
+    m_buffer.clear();
+}
+
+bool StepTracer::Finish() noexcept {
+    if (m_file == nullptr) {
+        return !m_failed;
+    }
+    Flush();
+    if (fclose(m_file) != 0) {
+        m_failed = true;
+    }
+    m_file = nullptr;
+    if (m_failed && m_error.empty()) {
+        m_error = "failed to record the trace";
+    }
+    return !m_failed;
+}
+
+// ----- StepTraceReader --------------------------------------------------------------------------------------------------
+
+StepTraceReader::~StepTraceReader() noexcept {
+    if (m_file != nullptr) {
+        fclose(m_file);
+    }
+}
+
+bool StepTraceReader::Open(const char *path) {
+    if (m_file != nullptr) {
+        fclose(m_file);
+    }
+    m_file = fopen(path, "rb");
+    if (m_file == nullptr) {
+        m_error = std::string("could not open ") + path;
+        return false;
+    }
+
+    char magic[4];
+    uint64_t version, numRegs;
+    if (!ReadBytes(magic, sizeof(magic)) || memcmp(magic, "V86T", sizeof(magic)) != 0) {
+        m_error = "not a step trace";
+        return false;
+    }
+    if (!ReadVarint(version) || version != StepTracer::version) {
+        m_error = "unsupported trace version";
+        return false;
+    }
+    if (!ReadVarint(numRegs) || numRegs > 64 - StepTracer::flagBits) {
+        m_error = "invalid register count";
+        return false;
+    }
+
+    m_names.resize((size_t)numRegs);
+    m_values.resize((size_t)numRegs);
+    for (auto& name : m_names) {
+        uint64_t length;
+        if (!ReadVarint(length) || length > 32) {
+            m_error = "invalid register name";
+            return false;
+        }
+        name.resize((size_t)length);
+        if (!ReadBytes(&name[0], (size_t)length)) {
+            m_error = "truncated header";
+            return false;
+        }
+    }
+    for (auto& value : m_values) {
+        if (!ReadVarint(value)) {
+            m_error = "truncated header";
+            return false;
+        }
+    }
+    m_steps = 0;
+    return true;
+}
+
+bool StepTraceReader::Next(Step& step) {
+    uint64_t flags;
+    if (m_file == nullptr || !ReadVarint(flags)) {
+        return false;
+    }
+
+    step.index = m_steps;
+    step.changed = flags >> StepTracer::flagBits;
+    step.exited = (flags & StepTracer::flagExit) != 0;
+    step.reason = VMExitReason::Step;
+    step.writes.clear();
+
+    for (uint64_t bits = step.changed; bits != 0; bits &= bits - 1) {
+        const size_t reg = lowestBit(bits);
+        uint64_t delta;
+        if (reg >= m_values.size() || !ReadVarint(delta)) {
+            m_error = "corrupt step record";
+            return false;
+        }
+        m_values[reg] += (uint64_t)unzigzag(delta);
+    }
+    if (step.exited) {
+        uint64_t reason;
+        if (!ReadVarint(reason)) {
+            m_error = "corrupt step record";
+            return false;
+        }
+        step.reason = (VMExitReason)reason;
+    }
+    if (flags & StepTracer::flagWrites) {
+        uint64_t count;
+        if (!ReadVarint(count)) {
+            m_error = "corrupt step record";
+            return false;
+        }
+        // The count is not trusted for allocation: writes are added as they
+        // are read, so a corrupt count runs into the end of the file instead
+        // of exhausting memory
+        for (uint64_t i = 0; i < count; i++) {
+            step.writes.emplace_back();
+            auto& write = step.writes.back();
+            uint64_t length;
+            if (!ReadVarint(write.address) || !ReadVarint(length) || length > PAGE_SIZE) {
+                m_error = "corrupt memory write";
+                return false;
+            }
+            write.data.resize((size_t)length);
+            if (!ReadBytes(write.data.data(), (size_t)length)) {
+                m_error = "truncated memory write";
+                return false;
+            }
+        }
+    }
+
+    m_steps++;
+    return true;
+}
+
+bool StepTraceReader::ReadVarint(uint64_t& value) noexcept {
+    value = 0;
+    for (size_t shift = 0; shift < 64; shift += 7) {
+        const int c = fgetc(m_file);
+        if (c == EOF) {
+            return false;
+        }
+        value |= (uint64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool StepTraceReader::ReadBytes(void *data, size_t size) noexcept {
+    return fread(data, 1, size, m_file) == size;
+}
@@ -0,0 +1,274 @@
+/*
+Defines a hierarchical timer wheel for scheduling device events.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "timer_wheel.hpp"
+
+#if defined(_WIN32)
+#  include <intrin.h>
+#endif
+
+static inline size_t lowestBit(uint64_t value) noexcept {
+#if defined(_WIN32)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return index;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+static inline uint64_t rotateRight(uint64_t value, size_t count) noexcept {
+    count &= 63;
+    return (count == 0) ? value : (value >> count) | (value << (64 - count));
+}
+
+TimerWheel::TimerWheel(uint64_t resolution) noexcept
+    : m_resolution((resolution == 0) ? 1 : resolution)
+{
+    for (size_t level = 0; level < numLevels; level++) {
+        for (size_t slot = 0; slot < slotsPerLevel; slot++) {
+            m_slots[level][slot] = nil;
+        }
+    }
+}
+
+uint64_t TimerWheel::Schedule(uint64_t deadline, Callback callback, void *context, uint64_t period) {
+    if (callback == nullptr) {
+        return invalidTimer;
+    }
+
+    uint32_t index;
+    if (m_freeList != nil) {
+        index = m_freeList;
+        m_freeList = m_timers[index].next;
+    }
+    else {
+        if (m_timers.size() >= nil) {
+            return invalidTimer;
+        }
+        index = (uint32_t)m_timers.size();
+        m_timers.push_back(Timer{});
+        m_timers[index].generation = 0;
+    }
+
+    Timer& timer = m_timers[index];
+    timer.deadline = deadline;
+    timer.expires = (deadline / m_resolution) + ((deadline % m_resolution) != 0 ? 1 : 0);
+    timer.period = period;
+    timer.callback = callback;
+    timer.context = context;
+    timer.generation++;
+    if (timer.generation == 0) {
+        timer.generation = 1;
+    }
+    Insert(index);
+    m_count++;
+
+    return ((uint64_t)timer.generation << 32) | index;
+}
+
+bool TimerWheel::Cancel(uint64_t timerID) noexcept {
+    uint32_t index = (uint32_t)timerID;
+    uint32_t generation = (uint32_t)(timerID >> 32);
+    if (index >= m_timers.size()) {
+        return false;
+    }
+    Timer& timer = m_timers[index];
+    if (timer.generation != generation || timer.list == nullptr) {
+        return false;
+    }
+    Unlink(index);
+    Free(index);
+    m_count--;
+    return true;
+}
+
+void TimerWheel::Insert(uint32_t index) noexcept {
+    Timer& timer = m_timers[index];
+
+    // Expired timers fire on the next tick
+    if (timer.expires < m_currentTick) {
+        timer.expires = m_currentTick;
+    }
+
+    // Place the timer in the lowest level where it shares all higher-order
+    // bits with the current tick; it cascades down when those bits change.
+    for (size_t level = 0; level < numLevels; level++) {
+        size_t shift = levelBits * (level + 1);
+        if ((timer.expires >> shift) == (m_currentTick >> shift)) {
+            size_t slot = (timer.expires >> (levelBits * level)) & (slotsPerLevel - 1);
+            Link(&m_slots[level][slot], index);
+            m_occupied[level] |= 1ull << slot;
+            return;
+        }
+    }
+    Link(&m_overflow, index);
+}
+
+void TimerWheel::Link(uint32_t *list, uint32_t index) noexcept {
+    Timer& timer = m_timers[index];
+    timer.list = list;
+    timer.prev = nil;
+    timer.next = *list;
+    if (*list != nil) {
+        m_timers[*list].prev = index;
+    }
+    *list = index;
+}
+
+void TimerWheel::Unlink(uint32_t index) noexcept {
+    Timer& timer = m_timers[index];
+    if (timer.prev != nil) {
+        m_timers[timer.prev].next = timer.next;
+    }
+    else {
+        *timer.list = timer.next;
+    }
+    if (timer.next != nil) {
+        m_timers[timer.next].prev = timer.prev;
+    }
+
+    // Keep the occupancy bitmaps in sync
+    if (*timer.list == nil && timer.list != &m_overflow) {
+        size_t offset = timer.list - &m_slots[0][0];
+        m_occupied[offset / slotsPerLevel] &= ~(1ull << (offset % slotsPerLevel));
+    }
+    timer.list = nullptr;
+}
+
+void TimerWheel::Free(uint32_t index) noexcept {
+    Timer& timer = m_timers[index];
+    timer.list = nullptr;
+    timer.next = m_freeList;
+    m_freeList = index;
+}
+
+uint64_t TimerWheel::NextEventTick() const noexcept {
+    uint64_t next = never;
+    for (size_t level = 0; level < numLevels; level++) {
+        if (m_occupied[level] == 0) {
+            continue;
+        }
+        // First boundary of this level at or after the current tick
+        size_t shift = levelBits * level;
+        uint64_t base = (m_currentTick + (1ull << shift) - 1) >> shift;
+        uint64_t rotated = rotateRight(m_occupied[level], base & (slotsPerLevel - 1));
+        uint64_t tick = (base + lowestBit(rotated)) << shift;
+        if (tick < next) {
+            next = tick;
+        }
+    }
+    if (m_overflow != nil) {
+        size_t shift = levelBits * numLevels;
+        // First wheel span boundary at or after the current tick, which may
+        // not have been processed yet
+        uint64_t tick = ((m_currentTick + (1ull << shift) - 1) >> shift) << shift;
+        if (tick < next) {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+uint64_t TimerWheel::NextEvent() const noexcept {
+    uint64_t tick = NextEventTick();
+    if (tick == never || tick > never / m_resolution) {
+        return never;
+    }
+    return tick * m_resolution;
+}
+
+void TimerWheel::ProcessTick(uint64_t tick, size_t& expired) {
+    // Cascade higher levels whose slot boundary is at this tick
+    if ((tick & ((1ull << (levelBits * numLevels)) - 1)) == 0) {
+        uint32_t list = m_overflow;
+        m_overflow = nil;
+        while (list != nil) {
+            uint32_t next = m_timers[list].next;
+            Insert(list);
+            list = next;
+        }
+    }
+    for (size_t level = numLevels - 1; level >= 1; level--) {
+        size_t shift = levelBits * level;
+        if ((tick & ((1ull << shift) - 1)) != 0) {
+            continue;
+        }
+        size_t slot = (tick >> shift) & (slotsPerLevel - 1);
+        uint32_t list = m_slots[level][slot];
+        m_slots[level][slot] = nil;
+        m_occupied[level] &= ~(1ull << slot);
+        while (list != nil) {
+            uint32_t next = m_timers[list].next;
+            Insert(list);
+            list = next;
+        }
+    }
+
+    // Expire every timer in the current level 0 slot
+    size_t slot = tick & (slotsPerLevel - 1);
+    while (m_slots[0][slot] != nil) {
+        uint32_t index = m_slots[0][slot];
+        Unlink(index);
+
+        Timer& timer = m_timers[index];
+        uint64_t timerID = ((uint64_t)timer.generation << 32) | index;
+        uint64_t deadline = timer.deadline;
+        Callback callback = timer.callback;
+        void *context = timer.context;
+
+        if (timer.period != 0) {
+            // Reschedule relative to the previous deadline to avoid drift
+            timer.deadline += timer.period;
+            timer.expires = (timer.deadline / m_resolution) + ((timer.deadline % m_resolution) != 0 ? 1 : 0);
+            m_currentTick = tick + 1;
+            Insert(index);
+            m_currentTick = tick;
+        }
+        else {
+            Free(index);
+            m_count--;
+        }
+
+        expired++;
+        callback(context, timerID, deadline);
+    }
+}
+
+size_t TimerWheel::Advance(uint64_t now) {
+    uint64_t nowTick = now / m_resolution;
+    size_t expired = 0;
+    while (m_currentTick <= nowTick) {
+        uint64_t tick = NextEventTick();
+        if (tick > nowTick) {
+            m_currentTick = nowTick + 1;
+            break;
+        }
+        m_currentTick = tick;
+        ProcessTick(tick, expired);
+        m_currentTick = tick + 1;
+    }
+    return expired;
+}
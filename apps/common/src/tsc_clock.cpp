@@ -0,0 +1,150 @@
+/*
+Defines a clock that relates the guest TSC to host time.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "tsc_clock.hpp"
+
+#include <thread>
+
+#if defined(_WIN32)
+#  include <intrin.h>
+#else
+#  include <x86intrin.h>
+#endif
+
+using namespace virt86;
+
+static const uint32_t IA32_TSC = 0x10;
+
+uint64_t hostTSC() noexcept {
+    return __rdtsc();
+}
+
+// Returns (a * b) >> 32 without overflowing
+static inline uint64_t mulFrac(uint64_t a, uint32_t b) noexcept {
+#if defined(_WIN32)
+    uint64_t high;
+    const uint64_t low = _umul128(a, b, &high);
+    return (high << 32) | (low >> 32);
+#else
+    return static_cast<uint64_t>((static_cast<unsigned __int128>(a) * b) >> 32);
+#endif
+}
+
+// Returns a * b / c without overflowing, as long as the result fits
+static inline uint64_t mulDiv(uint64_t a, uint64_t b, uint64_t c) noexcept {
+#if defined(_WIN32)
+    uint64_t high;
+    const uint64_t low = _umul128(a, b, &high);
+    uint64_t remainder;
+    return _udiv128(high, low, c, &remainder);
+#else
+    return static_cast<uint64_t>(static_cast<unsigned __int128>(a) * b / c);
+#endif
+}
+
+bool TSCClock::Calibrate(const InterruptController& controller, VirtualProcessor& vp, uint64_t interval) noexcept {
+    // Each sample reads the steady clock between two TSC reads, so that a
+    // preemption in the middle shows up as a wide bracket and is retried
+    auto sample = [&](uint64_t& tsc, uint64_t& time) {
+        uint64_t best = ~0ull;
+        for (int i = 0; i < 16; i++) {
+            const uint64_t before = hostTSC();
+            const uint64_t now = controller.Now();
+            const uint64_t after = hostTSC();
+            if (after - before < best) {
+                best = after - before;
+                tsc = before + (after - before) / 2;
+                time = now;
+            }
+        }
+    };
+
+    uint64_t tsc0, time0, tsc1, time1;
+    sample(tsc0, time0);
+    std::this_thread::sleep_for(std::chrono::nanoseconds(interval));
+    sample(tsc1, time1);
+    if (time1 <= time0 || tsc1 <= tsc0) {
+        return false;
+    }
+    m_frequency = mulDiv(tsc1 - tsc0, 1000000000ull, time1 - time0);
+
+    // The guest TSC is read with a system call on most platforms; the
+    // midpoint of the host TSC reads around it is close enough
+    const uint64_t before = hostTSC();
+    uint64_t guestTSC = 0;
+    if (vp.GetMSR(IA32_TSC, guestTSC) != VPOperationStatus::OK) {
+        return false;
+    }
+    const uint64_t after = hostTSC();
+    const uint64_t offset = guestTSC - (before + (after - before) / 2);
+
+    m_baseTSC = tsc1 + offset;
+    m_baseTime = time1;
+
+    // Find the largest shift and multiplier such that
+    // ((delta << shift) * mul) >> 32 converts TSC ticks to nanoseconds, with
+    // the multiplier normalized to use all 32 bits. This is the same
+    // representation KVM uses for its paravirtual clock.
+    uint64_t ticks = m_frequency;
+    uint64_t scaled = 1000000000ull;
+    int shift = 0;
+    while (ticks > scaled * 2 || (ticks >> 32) != 0) {
+        ticks >>= 1;
+        shift--;
+    }
+    while (ticks <= scaled || (scaled >> 32) != 0) {
+        if ((scaled >> 32) != 0 || (ticks & 0x80000000ull) != 0) {
+            scaled >>= 1;
+        }
+        else {
+            ticks <<= 1;
+        }
+        shift++;
+    }
+    m_shift = static_cast<int8_t>(shift);
+    m_mul = static_cast<uint32_t>((scaled << 32) / ticks);
+    return true;
+}
+
+uint64_t TSCClock::ToTime(uint64_t tsc) const noexcept {
+    if (tsc <= m_baseTSC) {
+        return m_baseTime;
+    }
+    uint64_t delta = tsc - m_baseTSC;
+    if (m_shift < 0) {
+        delta >>= -m_shift;
+    }
+    else {
+        delta <<= m_shift;
+    }
+    return m_baseTime + mulFrac(delta, m_mul);
+}
+
+uint64_t TSCClock::ToTSC(uint64_t time) const noexcept {
+    if (time <= m_baseTime || m_frequency == 0) {
+        return m_baseTSC;
+    }
+    return m_baseTSC + mulDiv(time - m_baseTime, m_frequency, 1000000000ull);
+}
@@ -0,0 +1,197 @@
+/*
+Defines a 16550-style UART that gives the guest a console.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "uart.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+// Register offsets
+static const uint16_t UART_THR = 0;  // RBR on reads, DLL with DLAB
+static const uint16_t UART_IER = 1;  // DLM with DLAB
+static const uint16_t UART_IIR = 2;  // FCR on writes
+static const uint16_t UART_LCR = 3;
+static const uint16_t UART_MCR = 4;
+static const uint16_t UART_LSR = 5;
+static const uint16_t UART_MSR = 6;
+static const uint16_t UART_SCR = 7;
+
+static const uint8_t LCR_DLAB = 0x80;
+static const uint8_t LSR_THRE = 0x20;
+static const uint8_t LSR_TEMT = 0x40;
+static const uint8_t IIR_NO_INTERRUPT = 0x01;
+static const uint8_t IIR_FIFO_ENABLED = 0xC0;
+static const uint8_t FCR_FIFO_ENABLE = 0x01;
+static const uint8_t MSR_CTS = 0x10;
+static const uint8_t MSR_DSR = 0x20;
+static const uint8_t MSR_DCD = 0x80;
+
+// Output that stays below the drain threshold is written after this long,
+// so that a guest printing a line at a time is still seen promptly
+static const auto drainInterval = std::chrono::milliseconds(20);
+
+UART16550::UART16550(size_t bufferSize) noexcept {
+    size_t capacity = 256;
+    while (capacity < bufferSize) {
+        capacity <<= 1;
+    }
+    m_ring.resize(capacity);
+    m_mask = capacity - 1;
+}
+
+UART16550::~UART16550() noexcept {
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+    }
+}
+
+void UART16550::Start(FILE *output) noexcept {
+    if (m_thread.joinable()) {
+        return;
+    }
+    m_output = output;
+    m_thread = std::thread([this] { DrainLoop(); });
+}
+
+bool UART16550::Attach(IOBus& bus, uint16_t port) noexcept {
+    m_port = port;
+    return bus.RegisterPIO(port, 8, PortRead, PortWrite, this);
+}
+
+void UART16550::Flush() noexcept {
+    if (!m_thread.joinable()) {
+        return;
+    }
+    const uint64_t target = m_head.load(std::memory_order_acquire);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_tail.load(std::memory_order_acquire) < target) {
+        m_wake.notify_one();
+        m_drained.wait_for(lock, drainInterval);
+    }
+}
+
+uint32_t UART16550::PortRead(void *context, uint16_t port, size_t size) noexcept {
+    auto& uart = *reinterpret_cast<UART16550 *>(context);
+    const bool dlab = (uart.m_lcr & LCR_DLAB) != 0;
+    switch (port - uart.m_port) {
+    case UART_THR: return dlab ? (uart.m_divisor & 0xFF) : 0;
+    case UART_IER: return dlab ? (uart.m_divisor >> 8) : uart.m_ier;
+    case UART_IIR: return IIR_NO_INTERRUPT | ((uart.m_fcr & FCR_FIFO_ENABLE) ? IIR_FIFO_ENABLED : 0);
+    case UART_LCR: return uart.m_lcr;
+    case UART_MCR: return uart.m_mcr;
+    case UART_LSR: return uart.Full() ? 0 : (LSR_THRE | LSR_TEMT);
+    case UART_MSR: return MSR_CTS | MSR_DSR | MSR_DCD;
+    case UART_SCR: return uart.m_scr;
+    default: return 0xFF;
+    }
+}
+
+void UART16550::PortWrite(void *context, uint16_t port, size_t size, uint32_t value) noexcept {
+    auto& uart = *reinterpret_cast<UART16550 *>(context);
+    const bool dlab = (uart.m_lcr & LCR_DLAB) != 0;
+    const uint8_t byte = (uint8_t)value;
+    switch (port - uart.m_port) {
+    case UART_THR:
+        if (dlab) uart.m_divisor = (uart.m_divisor & 0xFF00) | byte;
+        else uart.Transmit(byte);
+        break;
+    case UART_IER:
+        if (dlab) uart.m_divisor = (uart.m_divisor & 0x00FF) | (byte << 8);
+        else uart.m_ier = byte & 0x0F;
+        break;
+    case UART_IIR: uart.m_fcr = byte; break;
+    case UART_LCR: uart.m_lcr = byte; break;
+    case UART_MCR: uart.m_mcr = byte & 0x1F; break;
+    case UART_SCR: uart.m_scr = byte; break;
+    default: break;
+    }
+}
+
+bool UART16550::Full() const noexcept {
+    return m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_acquire) > m_mask;
+}
+
+void UART16550::Transmit(uint8_t byte) noexcept {
+    const uint64_t head = m_head.load(std::memory_order_relaxed);
+    if (Full()) {
+        // Without a drain thread, keep the most recent output
+        if (!m_thread.joinable()) {
+            m_tail.fetch_add(1, std::memory_order_release);
+        }
+        else {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (Full()) {
+                m_wake.notify_one();
+                m_drained.wait_for(lock, drainInterval);
+            }
+        }
+    }
+    m_ring[head & m_mask] = byte;
+    m_head.store(head + 1, std::memory_order_release);
+
+    // Wake the drain thread once the ring is half full rather than on every byte
+    if (((head + 1) & (m_mask >> 1)) == 0) {
+        m_wake.notify_one();
+    }
+}
+
+void UART16550::DrainLoop() noexcept {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stop) {
+        m_wake.wait_for(lock, drainInterval);
+        lock.unlock();
+        Drain();
+        lock.lock();
+        m_drained.notify_all();
+    }
+    lock.unlock();
+    Drain();
+}
+
+// Writes everything in the ring with at most two writes, one on each side of
+// the wrap point. Returns false if there was nothing to write.
+bool UART16550::Drain() noexcept {
+    const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    const uint64_t head = m_head.load(std::memory_order_acquire);
+    if (head == tail) {
+        return false;
+    }
+    const size_t start = (size_t)(tail & m_mask);
+    const size_t len = (size_t)(head - tail);
+    const size_t first = std::min(len, m_ring.size() - start);
+    fwrite(&m_ring[start], 1, first, m_output);
+    if (first < len) {
+        fwrite(&m_ring[0], 1, len - first, m_output);
+    }
+    fflush(m_output);
+    m_numHostWrites.fetch_add(1, std::memory_order_relaxed);
+    m_tail.store(head, std::memory_order_release);
+    return true;
+}
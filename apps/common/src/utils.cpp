@@ -25,6 +25,20 @@ SOFTWARE.
 */
 #include "utils.hpp"
 
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#if defined(_WIN32)
+#  include <Windows.h>
+#  include <psapi.h>
+#elif defined(__linux__)
+#  include <unistd.h>
+#elif defined(__APPLE__)
+#  include <mach/mach.h>
+#endif
+
 const char *reason_str(virt86::VMExitReason reason) noexcept {
     switch (reason) {
     case virt86::VMExitReason::Normal: return "Normal";
@@ -45,3 +59,70 @@ const char *reason_str(virt86::VMExitReason reason) noexcept {
     default: return "Unknown/unexpected reason";
     }
 }
+
+size_t selectPlatform(const char *selector) noexcept {
+    for (size_t i = 0; i < array_size(virt86::PlatformFactories); i++) {
+        const virt86::Platform& platform = virt86::PlatformFactories[i]();
+        if (platform.GetInitStatus() != virt86::PlatformInitStatus::OK) {
+            continue;
+        }
+        if (selector == nullptr) {
+            return i;
+        }
+        std::string name = platform.GetName();
+        std::string wanted = selector;
+        for (auto& c : name) c = (char)tolower((unsigned char)c);
+        for (auto& c : wanted) c = (char)tolower((unsigned char)c);
+        if (name.find(wanted) != std::string::npos) {
+            return i;
+        }
+    }
+    return SIZE_MAX;
+}
+
+uint64_t residentSetSize() noexcept {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.WorkingSetSize;
+#elif defined(__linux__)
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    unsigned long long size, resident;
+    const int fields = fscanf(fp, "%llu %llu", &size, &resident);
+    fclose(fp);
+    if (fields != 2) {
+        return 0;
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+#elif defined(__APPLE__)
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return info.resident_size;
+#endif
+}
+
+bool loadFile(const char *path, std::vector<uint8_t>& data, uint64_t maxSize) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (len < 0 || (uint64_t)len > maxSize) {
+        fclose(fp);
+        return false;
+    }
+    data.resize(len);
+    size_t readLen = fread(data.data(), 1, len, fp);
+    fclose(fp);
+    return readLen == (size_t)len;
+}
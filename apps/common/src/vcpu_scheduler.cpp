@@ -0,0 +1,294 @@
+/*
+Defines a scheduler that multiplexes virtual processors over a pool of host
+threads in fixed time slices with fair-share accounting.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "vcpu_scheduler.hpp"
+
+#if defined(__linux__)
+#  include <pthread.h>
+#  include <signal.h>
+#endif
+
+using namespace virt86;
+
+VCPUScheduler::VCPUScheduler(size_t numThreads, uint64_t quantumNs) noexcept
+    : m_numThreads((numThreads == 0) ? 1 : numThreads)
+    , m_quantum((quantumNs == 0) ? 1 : quantumNs)
+    , m_epoch(std::chrono::steady_clock::now())
+{
+}
+
+VCPUScheduler::~VCPUScheduler() noexcept {
+}
+
+size_t VCPUScheduler::AddGuest(const char *name, VirtualProcessor& vp, uint32_t weight, ExitHandler handler, void *context) {
+    auto guest = std::make_unique<Guest>();
+    guest->vp = &vp;
+    guest->handler = handler;
+    guest->context = context;
+    guest->stats.name = name;
+    guest->stats.weight = (weight == 0) ? 1 : weight;
+    m_guests.push_back(std::move(guest));
+    return m_guests.size() - 1;
+}
+
+void VCPUScheduler::SetPreemptHandler(PreemptHandler handler, void *context) noexcept {
+    m_preemptHandler = handler;
+    m_preemptContext = context;
+}
+
+#if defined(__linux__)
+static void preemptSignalHandler(int) {
+    // Only needed to interrupt KVM_RUN
+}
+
+static void signalPreempt(void *, std::thread::native_handle_type thread) {
+    pthread_kill(thread, SIGRTMIN);
+}
+#endif
+
+bool VCPUScheduler::EnableSignalPreemption() noexcept {
+#if defined(__linux__)
+    // Installed without SA_RESTART so that the signal interrupts the ioctl
+    struct sigaction action = {};
+    action.sa_handler = preemptSignalHandler;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGRTMIN, &action, nullptr) != 0) {
+        return false;
+    }
+    SetPreemptHandler(signalPreempt, nullptr);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void VCPUScheduler::Run(uint64_t durationNs) {
+    const uint64_t start = Now();
+    m_stopping = false;
+    m_workersDone = false;
+    m_numActive = 0;
+    for (auto& guest : m_guests) {
+        guest->readyTime = start;
+        if (!guest->stats.stopped) {
+            m_numActive++;
+        }
+    }
+
+    m_workers.clear();
+    for (size_t i = 0; i < m_numThreads; i++) {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+    for (auto& worker : m_workers) {
+        Worker *w = worker.get();
+        worker->thread = std::thread([this, w]() { WorkerThread(*w); });
+    }
+    std::thread watchdog([this]() { WatchdogThread(); });
+
+    // Wait until every guest stops or the time is up
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto deadline = m_epoch + std::chrono::nanoseconds(start + durationNs);
+        m_cond.wait_until(lock, deadline, [this]() { return m_numActive == 0; });
+        m_stopping = true;
+    }
+    m_cond.notify_all();
+
+    // The watchdog keeps kicking busy workers until they finish their slices
+    for (auto& worker : m_workers) {
+        worker->thread.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_workersDone = true;
+    }
+    m_watchdogCond.notify_all();
+    watchdog.join();
+    m_elapsed = Now() - start;
+}
+
+VCPUScheduler::Guest *VCPUScheduler::Pick(uint64_t now) noexcept {
+    // Guests are few, so a linear scan for the least weighted run time is
+    // cheaper than maintaining an ordered queue
+    Guest *best = nullptr;
+    for (auto& guest : m_guests) {
+        if (guest->running || guest->stats.stopped) {
+            continue;
+        }
+        if (best == nullptr || guest->vruntime < best->vruntime) {
+            best = guest.get();
+        }
+    }
+    if (best != nullptr) {
+        best->running = true;
+        best->stats.waitLatency.Record(now - best->readyTime);
+    }
+    return best;
+}
+
+void VCPUScheduler::WorkerThread(Worker& worker) {
+    for (;;) {
+        Guest *guest;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            for (;;) {
+                if (m_stopping || m_numActive == 0) {
+                    return;
+                }
+                guest = Pick(Now());
+                if (guest != nullptr) {
+                    break;
+                }
+                m_cond.wait(lock);
+            }
+        }
+
+        RunSlice(worker, *guest);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            guest->running = false;
+            guest->readyTime = Now();
+            if (guest->stats.stopped) {
+                m_numActive--;
+            }
+        }
+        // Wakes up an idle worker, or the main thread once all guests stop
+        m_cond.notify_all();
+    }
+}
+
+void VCPUScheduler::RunSlice(Worker& worker, Guest& guest) noexcept {
+    VirtualProcessor& vp = *guest.vp;
+    auto& stats = guest.stats;
+
+    const uint64_t sliceStart = Now();
+    const uint64_t deadline = sliceStart + m_quantum;
+    worker.guest = &guest;
+    worker.deadline = deadline;
+
+    uint64_t now = sliceStart;
+    for (;;) {
+        auto status = vp.Run();
+        now = Now();
+        if (status != VPExecutionStatus::OK) {
+            if (worker.deadline == preemptedDeadline) {
+                stats.preemptions++;
+            }
+            else {
+                stats.failed = true;
+                stats.stopped = true;
+            }
+            break;
+        }
+        stats.exits++;
+
+        auto& exitInfo = vp.GetVMExitInfo();
+        if (exitInfo.reason == VMExitReason::Cancelled && worker.deadline == preemptedDeadline) {
+            stats.preemptions++;
+            break;
+        }
+        ExitAction action = guest.handler(guest.context, vp, exitInfo);
+        if (action == ExitAction::Stop) {
+            stats.stopped = true;
+            break;
+        }
+        if (action == ExitAction::Yield || m_stopping) {
+            break;
+        }
+        if (now >= deadline) {
+            stats.preemptions++;
+            break;
+        }
+    }
+
+    worker.deadline = 0;
+    worker.guest = nullptr;
+
+    const uint64_t elapsed = now - sliceStart;
+    stats.runTimeNs += elapsed;
+    stats.slices++;
+    guest.vruntime += elapsed * defaultWeight / stats.weight;
+}
+
+void VCPUScheduler::WatchdogThread() {
+    // Check slices a few times per quantum, but not more often than every 50 us
+    uint64_t interval = m_quantum / 4;
+    if (interval < 50000) {
+        interval = 50000;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_workersDone) {
+        m_watchdogCond.wait_for(lock, std::chrono::nanoseconds(interval));
+        if (m_workersDone) {
+            break;
+        }
+
+        // When stopping, every slice in progress is ended
+        const uint64_t now = Now();
+        for (auto& worker : m_workers) {
+            // Only the slice that overran is preempted: every slice starts
+            // with a later deadline, so the swap fails if the worker moved on
+            uint64_t deadline = worker->deadline;
+            if (deadline != preemptedDeadline) {
+                if (deadline == 0 || (now < deadline && !m_stopping)
+                    || !worker->deadline.compare_exchange_strong(deadline, preemptedDeadline)) {
+                    continue;
+                }
+            }
+
+            // Keep kicking until the slice ends, in case a kick arrived
+            // between two runs and was lost
+            if (m_preemptHandler != nullptr) {
+                Guest *guest = worker->guest;
+                if (guest != nullptr) {
+                    guest->stats.kicks++;
+                }
+                m_preemptHandler(m_preemptContext, worker->thread.native_handle());
+            }
+        }
+    }
+}
+
+void VCPUScheduler::PrintStats(FILE *out) const noexcept {
+    uint64_t totalWeight = 0;
+    uint64_t totalRunTime = 0;
+    for (auto& guest : m_guests) {
+        totalWeight += guest->stats.weight;
+        totalRunTime += guest->stats.runTimeNs;
+    }
+
+    fprintf(out, "Guest            Weight   Share  Target   Slices  Preempt    Kicks    Exits  Wait p50 us  p99 us  max us\n");
+    for (auto& guest : m_guests) {
+        auto& s = guest->stats;
+        const double share = (totalRunTime == 0) ? 0.0 : 100.0 * s.runTimeNs / totalRunTime;
+        const double target = 100.0 * s.weight / totalWeight;
+        fprintf(out, "%-16s %6u %6.1f%% %6.1f%% %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %11.1f %7.1f %7.1f%s\n",
+            s.name.c_str(), s.weight, share, target, s.slices, s.preemptions, s.kicks, s.exits,
+            s.waitLatency.Percentile(50) / 1000.0, s.waitLatency.Percentile(99) / 1000.0, s.waitLatency.Max() / 1000.0,
+            s.failed ? "  (failed)" : "");
+    }
+}
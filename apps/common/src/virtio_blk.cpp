@@ -0,0 +1,251 @@
+/*
+Defines a virtio block device backed by a host file.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "virtio_blk.hpp"
+
+#if defined(_WIN32)
+#  include <Windows.h>
+#elif defined(__linux__) || defined(__APPLE__)
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#else
+#  error Unsupported platform
+#endif
+
+#include <cstring>
+
+VirtioBlk::VirtioBlk(const GuestMemory& memory) noexcept
+    : VirtioMMIODevice(memory, VIRTIO_ID_BLOCK, 1, queueSize)
+{
+}
+
+VirtioBlk::~VirtioBlk() noexcept {
+    Close();
+}
+
+bool VirtioBlk::Open(const char *path, bool readOnly) noexcept {
+    Close();
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ | (readOnly ? 0 : GENERIC_WRITE), FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false;
+    }
+    m_file = file;
+    m_capacity = (uint64_t)size.QuadPart / VIRTIO_BLK_SECTOR_SIZE;
+#else
+    int fd = open(path, readOnly ? O_RDONLY : O_RDWR);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    m_file = fd;
+    m_capacity = (uint64_t)st.st_size / VIRTIO_BLK_SECTOR_SIZE;
+#endif
+    m_readOnly = readOnly;
+    return true;
+}
+
+void VirtioBlk::Close() noexcept {
+#if defined(_WIN32)
+    if (m_file != nullptr) {
+        CloseHandle(m_file);
+        m_file = nullptr;
+    }
+#else
+    if (m_file >= 0) {
+        close(m_file);
+        m_file = -1;
+    }
+#endif
+    m_capacity = 0;
+}
+
+uint64_t VirtioBlk::DeviceFeatures() const noexcept {
+    return VIRTIO_BLK_F_FLUSH | (m_readOnly ? VIRTIO_BLK_F_RO : 0);
+}
+
+uint32_t VirtioBlk::ReadConfig(uint32_t offset, size_t size) noexcept {
+    // Only the capacity field (offset 0, 64 bits) is implemented
+    if (offset == 0 && size == 4) {
+        return (uint32_t)m_capacity;
+    }
+    if (offset == 4 && size == 4) {
+        return (uint32_t)(m_capacity >> 32);
+    }
+    return 0;
+}
+
+void VirtioBlk::ProcessQueue(uint32_t index, Virtqueue& queue) noexcept {
+    VirtqBuffer buffers[32];
+    size_t numBuffers;
+    uint16_t head;
+    bool completed = false;
+
+    // Drain every available chain; one notification can carry many requests
+    while (queue.PopChain(head, buffers, 32, numBuffers)) {
+        uint32_t written = 0;
+        uint8_t status = HandleRequest(buffers, numBuffers, written);
+        if (numBuffers > 0 && buffers[numBuffers - 1].writable) {
+            buffers[numBuffers - 1].data[0] = status;
+            written++;
+        }
+        queue.PushUsed(head, written);
+        m_numRequests++;
+        completed = true;
+    }
+
+    if (completed) {
+        NotifyUsed();
+    }
+}
+
+uint8_t VirtioBlk::HandleRequest(const VirtqBuffer *buffers, size_t numBuffers, uint32_t& written) noexcept {
+    // A request is a device-readable header, data buffers and a one-byte
+    // device-writable status
+    if (numBuffers < 2 || buffers[0].writable || buffers[0].len < sizeof(VirtioBlkRequestHeader)
+        || !buffers[numBuffers - 1].writable || buffers[numBuffers - 1].len < 1) {
+        return VIRTIO_BLK_S_IOERR;
+    }
+
+    VirtioBlkRequestHeader header;
+    memcpy(&header, buffers[0].data, sizeof(header));
+    const VirtqBuffer *data = &buffers[1];
+    const size_t numData = numBuffers - 2;
+
+    switch (header.type) {
+    case VIRTIO_BLK_T_IN:
+    case VIRTIO_BLK_T_OUT: {
+        const bool isRead = header.type == VIRTIO_BLK_T_IN;
+        if (!isRead && m_readOnly) {
+            return VIRTIO_BLK_S_IOERR;
+        }
+        // Bounds are checked in sectors before anything is multiplied, so a
+        // huge sector number cannot wrap around into the disk
+        if (header.sector >= m_capacity) {
+            return VIRTIO_BLK_S_IOERR;
+        }
+        uint64_t sector = header.sector;
+        for (size_t i = 0; i < numData; i++) {
+            // Reads fill device-writable buffers; writes consume device-readable ones
+            if (data[i].writable != isRead || (data[i].len % VIRTIO_BLK_SECTOR_SIZE) != 0) {
+                return VIRTIO_BLK_S_IOERR;
+            }
+            if (data[i].len / VIRTIO_BLK_SECTOR_SIZE > m_capacity - sector) {
+                return VIRTIO_BLK_S_IOERR;
+            }
+            const uint64_t offset = sector * VIRTIO_BLK_SECTOR_SIZE;
+            if (isRead) {
+                if (!ReadAt(offset, data[i].data, data[i].len)) {
+                    return VIRTIO_BLK_S_IOERR;
+                }
+                written += data[i].len;
+                m_bytesRead += data[i].len;
+            }
+            else {
+                if (!WriteAt(offset, data[i].data, data[i].len)) {
+                    return VIRTIO_BLK_S_IOERR;
+                }
+                m_bytesWritten += data[i].len;
+            }
+            sector += data[i].len / VIRTIO_BLK_SECTOR_SIZE;
+        }
+        return VIRTIO_BLK_S_OK;
+    }
+    case VIRTIO_BLK_T_FLUSH:
+        return Flush() ? VIRTIO_BLK_S_OK : VIRTIO_BLK_S_IOERR;
+    case VIRTIO_BLK_T_GET_ID: {
+        static const char id[] = "virt86-blk";
+        if (numData < 1 || !data[0].writable) {
+            return VIRTIO_BLK_S_IOERR;
+        }
+        uint32_t len = (data[0].len < sizeof(id)) ? data[0].len : sizeof(id);
+        memcpy(data[0].data, id, len);
+        written += len;
+        return VIRTIO_BLK_S_OK;
+    }
+    default:
+        return VIRTIO_BLK_S_UNSUPP;
+    }
+}
+
+bool VirtioBlk::ReadAt(uint64_t offset, uint8_t *data, uint32_t len) noexcept {
+#if defined(_WIN32)
+    OVERLAPPED ov = { 0 };
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD read;
+    return ReadFile(m_file, data, len, &read, &ov) && read == len;
+#else
+    while (len > 0) {
+        ssize_t result = pread(m_file, data, len, (off_t)offset);
+        if (result <= 0) {
+            return false;
+        }
+        data += result;
+        offset += result;
+        len -= (uint32_t)result;
+    }
+    return true;
+#endif
+}
+
+bool VirtioBlk::WriteAt(uint64_t offset, const uint8_t *data, uint32_t len) noexcept {
+#if defined(_WIN32)
+    OVERLAPPED ov = { 0 };
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD written;
+    return WriteFile(m_file, data, len, &written, &ov) && written == len;
+#else
+    while (len > 0) {
+        ssize_t result = pwrite(m_file, data, len, (off_t)offset);
+        if (result <= 0) {
+            return false;
+        }
+        data += result;
+        offset += result;
+        len -= (uint32_t)result;
+    }
+    return true;
+#endif
+}
+
+bool VirtioBlk::Flush() noexcept {
+#if defined(_WIN32)
+    return FlushFileBuffers(m_file) != FALSE;
+#else
+    return fsync(m_file) == 0;
+#endif
+}
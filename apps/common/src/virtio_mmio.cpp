@@ -0,0 +1,160 @@
+/*
+Defines the virtio MMIO transport shared by the virtio device models.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "virtio_mmio.hpp"
+
+VirtioMMIODevice::VirtioMMIODevice(const GuestMemory& memory, uint32_t deviceID, uint32_t numQueues, uint16_t queueSizeMax) noexcept
+    : m_memory(memory)
+    , m_deviceID(deviceID)
+    , m_numQueues((numQueues < maxQueues) ? numQueues : maxQueues)
+    , m_queueSizeMax((queueSizeMax < Virtqueue::maxSize) ? queueSizeMax : Virtqueue::maxSize)
+{
+}
+
+bool VirtioMMIODevice::Attach(IOBus& bus, uint64_t baseAddress) noexcept {
+    m_baseAddress = baseAddress;
+    return bus.RegisterMMIO(baseAddress, VIRTIO_MMIO_SIZE, MMIORead, MMIOWrite, this);
+}
+
+void VirtioMMIODevice::Reset() noexcept {
+    m_status = 0;
+    m_deviceFeaturesSel = 0;
+    m_driverFeaturesSel = 0;
+    m_driverFeatures = 0;
+    m_queueSel = 0;
+    m_interruptStatus = 0;
+    for (uint32_t i = 0; i < m_numQueues; i++) {
+        m_queues[i].Reset();
+    }
+}
+
+uint32_t VirtioMMIODevice::ReadRegister(uint32_t offset, size_t size) noexcept {
+    if (offset >= VIRTIO_MMIO_CONFIG) {
+        return ReadConfig(offset - VIRTIO_MMIO_CONFIG, size);
+    }
+
+    // Common registers are 32 bits wide
+    if (size != 4) {
+        return 0;
+    }
+
+    Virtqueue *queue = (m_queueSel < m_numQueues) ? &m_queues[m_queueSel] : nullptr;
+    switch (offset) {
+    case VIRTIO_MMIO_MAGIC_VALUE: return VIRTIO_MMIO_MAGIC;
+    case VIRTIO_MMIO_VERSION: return 2;
+    case VIRTIO_MMIO_DEVICE_ID: return m_deviceID;
+    case VIRTIO_MMIO_VENDOR_ID: return 0x36387476;  // "vt86"
+    case VIRTIO_MMIO_DEVICE_FEATURES: {
+        uint64_t features = DeviceFeatures() | VIRTIO_F_VERSION_1;
+        return (m_deviceFeaturesSel == 0) ? (uint32_t)features : (m_deviceFeaturesSel == 1) ? (uint32_t)(features >> 32) : 0;
+    }
+    case VIRTIO_MMIO_QUEUE_NUM_MAX: return (queue != nullptr) ? m_queueSizeMax : 0;
+    case VIRTIO_MMIO_QUEUE_READY: return (queue != nullptr && queue->IsReady()) ? 1 : 0;
+    case VIRTIO_MMIO_INTERRUPT_STATUS: return m_interruptStatus;
+    case VIRTIO_MMIO_STATUS: return m_status;
+    case VIRTIO_MMIO_CONFIG_GENERATION: return 0;
+    default: return 0;
+    }
+}
+
+void VirtioMMIODevice::WriteRegister(uint32_t offset, size_t size, uint32_t value) noexcept {
+    if (offset >= VIRTIO_MMIO_CONFIG) {
+        WriteConfig(offset - VIRTIO_MMIO_CONFIG, size, value);
+        return;
+    }
+    if (size != 4) {
+        return;
+    }
+
+    Virtqueue *queue = (m_queueSel < m_numQueues) ? &m_queues[m_queueSel] : nullptr;
+    switch (offset) {
+    case VIRTIO_MMIO_DEVICE_FEATURES_SEL: m_deviceFeaturesSel = value; break;
+    case VIRTIO_MMIO_DRIVER_FEATURES_SEL: m_driverFeaturesSel = value; break;
+    case VIRTIO_MMIO_DRIVER_FEATURES:
+        if (m_driverFeaturesSel == 0) {
+            m_driverFeatures = (m_driverFeatures & ~0xFFFFFFFFull) | value;
+        }
+        else if (m_driverFeaturesSel == 1) {
+            m_driverFeatures = (m_driverFeatures & 0xFFFFFFFFull) | ((uint64_t)value << 32);
+        }
+        break;
+    case VIRTIO_MMIO_QUEUE_SEL: m_queueSel = value; break;
+    case VIRTIO_MMIO_QUEUE_NUM:
+        if (queue != nullptr && value <= m_queueSizeMax) queue->size = (uint16_t)value;
+        break;
+    case VIRTIO_MMIO_QUEUE_READY:
+        if (queue != nullptr) {
+            if (value == 1) {
+                if (!queue->Enable(m_memory)) {
+                    m_status |= VIRTIO_STATUS_FAILED;
+                }
+            }
+            else {
+                queue->Reset();
+            }
+        }
+        break;
+    case VIRTIO_MMIO_QUEUE_NOTIFY:
+        if (value < m_numQueues && m_queues[value].IsReady() && (m_status & VIRTIO_STATUS_DRIVER_OK)) {
+            m_numNotifications++;
+            ProcessQueue(value, m_queues[value]);
+        }
+        break;
+    case VIRTIO_MMIO_INTERRUPT_ACK: m_interruptStatus &= ~value; break;
+    case VIRTIO_MMIO_STATUS:
+        if (value == 0) {
+            Reset();
+        }
+        else if ((value & VIRTIO_STATUS_FEATURES_OK) && !(m_status & VIRTIO_STATUS_FEATURES_OK)) {
+            // Only accept features that were offered, and require a modern driver
+            uint64_t offered = DeviceFeatures() | VIRTIO_F_VERSION_1;
+            if ((m_driverFeatures & ~offered) != 0 || !(m_driverFeatures & VIRTIO_F_VERSION_1)) {
+                value &= ~VIRTIO_STATUS_FEATURES_OK;
+            }
+            m_status = value;
+        }
+        else {
+            m_status = value;
+        }
+        break;
+    case VIRTIO_MMIO_QUEUE_DESC_LOW: if (queue != nullptr) queue->descAddr = (queue->descAddr & ~0xFFFFFFFFull) | value; break;
+    case VIRTIO_MMIO_QUEUE_DESC_HIGH: if (queue != nullptr) queue->descAddr = (queue->descAddr & 0xFFFFFFFFull) | ((uint64_t)value << 32); break;
+    case VIRTIO_MMIO_QUEUE_DRIVER_LOW: if (queue != nullptr) queue->availAddr = (queue->availAddr & ~0xFFFFFFFFull) | value; break;
+    case VIRTIO_MMIO_QUEUE_DRIVER_HIGH: if (queue != nullptr) queue->availAddr = (queue->availAddr & 0xFFFFFFFFull) | ((uint64_t)value << 32); break;
+    case VIRTIO_MMIO_QUEUE_DEVICE_LOW: if (queue != nullptr) queue->usedAddr = (queue->usedAddr & ~0xFFFFFFFFull) | value; break;
+    case VIRTIO_MMIO_QUEUE_DEVICE_HIGH: if (queue != nullptr) queue->usedAddr = (queue->usedAddr & 0xFFFFFFFFull) | ((uint64_t)value << 32); break;
+    default: break;
+    }
+}
+
+uint64_t VirtioMMIODevice::MMIORead(void *context, uint64_t address, size_t size) noexcept {
+    auto& device = *reinterpret_cast<VirtioMMIODevice *>(context);
+    return device.ReadRegister((uint32_t)(address - device.m_baseAddress), size);
+}
+
+void VirtioMMIODevice::MMIOWrite(void *context, uint64_t address, size_t size, uint64_t value) noexcept {
+    auto& device = *reinterpret_cast<VirtioMMIODevice *>(context);
+    device.WriteRegister((uint32_t)(address - device.m_baseAddress), size, (uint32_t)value);
+}
@@ -0,0 +1,122 @@
+/*
+Defines the host side of a virtio split virtqueue living in guest memory.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "virtqueue.hpp"
+
+#include <atomic>
+
+void Virtqueue::Reset() noexcept {
+    size = 0;
+    descAddr = 0;
+    availAddr = 0;
+    usedAddr = 0;
+    m_memory = nullptr;
+    m_desc = nullptr;
+    m_avail = nullptr;
+    m_used = nullptr;
+    m_lastAvailIdx = 0;
+    m_ready = false;
+}
+
+bool Virtqueue::Enable(const GuestMemory& memory) noexcept {
+    // Split rings must have a power of two size
+    if (size == 0 || size > maxSize || (size & (size - 1)) != 0) {
+        return false;
+    }
+    if ((descAddr & 15) != 0 || (availAddr & 1) != 0 || (usedAddr & 3) != 0) {
+        return false;
+    }
+
+    // Each ring must be contiguous in host memory
+    m_desc = reinterpret_cast<VirtqDesc *>(memory.Translate(descAddr, sizeof(VirtqDesc) * size));
+    m_avail = reinterpret_cast<VirtqAvail *>(memory.Translate(availAddr, 6 + sizeof(uint16_t) * size));
+    m_used = reinterpret_cast<VirtqUsed *>(memory.Translate(usedAddr, 6 + sizeof(VirtqUsedElem) * size));
+    if (m_desc == nullptr || m_avail == nullptr || m_used == nullptr) {
+        return false;
+    }
+
+    m_memory = &memory;
+    m_lastAvailIdx = m_used->idx;
+    m_ready = true;
+    return true;
+}
+
+bool Virtqueue::PopChain(uint16_t& head, VirtqBuffer *buffers, size_t maxBuffers, size_t& numBuffers) noexcept {
+    if (!m_ready) {
+        return false;
+    }
+
+    uint16_t availIdx = *(volatile uint16_t *)&m_avail->idx;
+    if (availIdx == m_lastAvailIdx) {
+        return false;
+    }
+    // Read the ring entry only after seeing the index that published it
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    head = m_avail->ring[m_lastAvailIdx % size];
+    m_lastAvailIdx++;
+
+    numBuffers = 0;
+    uint16_t index = head;
+    for (size_t i = 0; i < size; i++) {
+        if (index >= size || numBuffers >= maxBuffers) {
+            numBuffers = 0;
+            return true;
+        }
+        const VirtqDesc& desc = m_desc[index];
+        if (desc.flags & VIRTQ_DESC_F_INDIRECT) {
+            // Not negotiated
+            numBuffers = 0;
+            return true;
+        }
+
+        uint8_t *data = m_memory->Translate(desc.addr, desc.len);
+        if (data == nullptr) {
+            numBuffers = 0;
+            return true;
+        }
+        buffers[numBuffers++] = VirtqBuffer{ data, desc.len, (desc.flags & VIRTQ_DESC_F_WRITE) != 0 };
+
+        if ((desc.flags & VIRTQ_DESC_F_NEXT) == 0) {
+            return true;
+        }
+        index = desc.next;
+    }
+
+    // Loop in the descriptor chain
+    numBuffers = 0;
+    return true;
+}
+
+void Virtqueue::PushUsed(uint16_t head, uint32_t len) noexcept {
+    uint16_t usedIdx = m_used->idx;
+    VirtqUsedElem& elem = m_used->ring[usedIdx % size];
+    elem.id = head;
+    elem.len = len;
+
+    // Publish the element before the index
+    std::atomic_thread_fence(std::memory_order_release);
+    *(volatile uint16_t *)&m_used->idx = usedIdx + 1;
+}
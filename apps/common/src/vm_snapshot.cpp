@@ -0,0 +1,183 @@
+/*
+Defines a snapshot of a virtual machine's RAM and processor state that is
+restored by copying back only the dirty pages.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "vm_snapshot.hpp"
+
+#include "align_alloc.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_WIN32)
+#  include <intrin.h>
+#endif
+
+using namespace virt86;
+
+static inline size_t lowestBit(uint64_t value) noexcept {
+#if defined(_WIN32)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return index;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+const Reg VMSnapshot::regs[] = {
+    Reg::RAX, Reg::RCX, Reg::RDX, Reg::RBX, Reg::RSP, Reg::RBP, Reg::RSI, Reg::RDI,
+    Reg::R8, Reg::R9, Reg::R10, Reg::R11, Reg::R12, Reg::R13, Reg::R14, Reg::R15,
+    Reg::RIP, Reg::RFLAGS,
+    Reg::CS, Reg::SS, Reg::DS, Reg::ES, Reg::FS, Reg::GS, Reg::LDTR, Reg::TR,
+    Reg::GDTR, Reg::IDTR,
+    Reg::CR0, Reg::CR2, Reg::CR3, Reg::CR4, Reg::CR8, Reg::EFER,
+    Reg::DR0, Reg::DR1, Reg::DR2, Reg::DR3, Reg::DR6, Reg::DR7,
+};
+const size_t VMSnapshot::numRegs = array_size(VMSnapshot::regs);
+
+// The MMX registers alias the x87 registers and are restored with them
+const Reg VMSnapshot::fpRegs[] = {
+    Reg::ST0, Reg::ST1, Reg::ST2, Reg::ST3, Reg::ST4, Reg::ST5, Reg::ST6, Reg::ST7,
+    Reg::XMM0, Reg::XMM1, Reg::XMM2, Reg::XMM3, Reg::XMM4, Reg::XMM5, Reg::XMM6, Reg::XMM7,
+    Reg::XMM8, Reg::XMM9, Reg::XMM10, Reg::XMM11, Reg::XMM12, Reg::XMM13, Reg::XMM14, Reg::XMM15,
+};
+const size_t VMSnapshot::numFPRegs = array_size(VMSnapshot::fpRegs);
+
+VMSnapshot::~VMSnapshot() noexcept {
+    if (m_snapshot != nullptr) {
+        alignedFree(m_snapshot);
+    }
+}
+
+bool VMSnapshot::Take(VirtualMachine& vm, VirtualProcessor& vp, uint64_t ramBase, uint8_t *ram, uint64_t ramSize) noexcept {
+    if (m_snapshot != nullptr && m_ramSize != ramSize) {
+        alignedFree(m_snapshot);
+        m_snapshot = nullptr;
+    }
+    if (m_snapshot == nullptr) {
+        m_snapshot = alignedAlloc(ramSize);
+        if (m_snapshot == nullptr) {
+            return false;
+        }
+    }
+
+    m_regValues.resize(numRegs);
+    if (vp.RegRead(regs, m_regValues.data(), numRegs) != VPOperationStatus::OK) {
+        return false;
+    }
+
+    // Platforms that cannot read the floating point state leave it alone on
+    // restore rather than failing the snapshot
+    m_fpRegValues.resize(numFPRegs);
+    m_fpState = vp.RegRead(fpRegs, m_fpRegValues.data(), numFPRegs) == VPOperationStatus::OK
+        && vp.GetFPUControl(m_fpuControl) == VPOperationStatus::OK
+        && vp.GetMXCSR(m_mxcsr) == VPOperationStatus::OK;
+
+    m_vm = &vm;
+    m_ramBase = ramBase;
+    m_ram = ram;
+    m_ramSize = ramSize;
+    memcpy(m_snapshot, ram, ramSize);
+
+    const uint64_t numPages = (ramSize + PAGE_SIZE - 1) / PAGE_SIZE;
+    m_dirtyBitmap.assign((numPages + 63) / 64, 0);
+    m_hostDirty.assign((numPages + 63) / 64, 0);
+
+    // Start tracking from a clean bitmap
+    m_dirtyTracking = vm.GetPlatform().GetFeatures().dirtyPageTracking
+        && vm.ClearDirtyPages(ramBase, ramSize) == DirtyPageTrackingStatus::OK;
+    return true;
+}
+
+void VMSnapshot::MarkDirty(uint64_t address, uint64_t size) noexcept {
+    if (size == 0 || address >= m_ramBase + m_ramSize || address + size <= m_ramBase) {
+        return;
+    }
+    const uint64_t first = (std::max(address, m_ramBase) - m_ramBase) / PAGE_SIZE;
+    const uint64_t last = (std::min(address + size, m_ramBase + m_ramSize) - 1 - m_ramBase) / PAGE_SIZE;
+    for (uint64_t page = first; page <= last; page++) {
+        m_hostDirty[page / 64] |= 1ull << (page & 63);
+    }
+}
+
+void VMSnapshot::CopyPages(uint64_t firstPage, uint64_t endPage) noexcept {
+    const uint64_t offset = firstPage * PAGE_SIZE;
+    if (firstPage >= endPage || offset >= m_ramSize) {
+        return;
+    }
+    const uint64_t size = std::min((endPage - firstPage) * PAGE_SIZE, m_ramSize - offset);
+    memcpy(&m_ram[offset], &m_snapshot[offset], size);
+    m_stats.pagesRestored += endPage - firstPage;
+}
+
+bool VMSnapshot::Restore(VirtualProcessor& vp) noexcept {
+    if (m_snapshot == nullptr) {
+        return false;
+    }
+    m_stats.restores++;
+
+    bool full = !m_dirtyTracking;
+    if (!full) {
+        const size_t bitmapSize = m_dirtyBitmap.size() * sizeof(uint64_t);
+        full = m_vm->QueryDirtyPages(m_ramBase, m_ramSize, m_dirtyBitmap.data(), bitmapSize) != DirtyPageTrackingStatus::OK
+            || m_vm->ClearDirtyPages(m_ramBase, m_ramSize) != DirtyPageTrackingStatus::OK;
+    }
+
+    if (full) {
+        memcpy(m_ram, m_snapshot, m_ramSize);
+        m_stats.pagesRestored += (m_ramSize + PAGE_SIZE - 1) / PAGE_SIZE;
+        m_stats.fullRestores++;
+    }
+    else {
+        // Copy back runs of consecutive dirty pages with one copy each
+        uint64_t runStart = 0;
+        uint64_t runEnd = 0;
+        for (size_t word = 0; word < m_dirtyBitmap.size(); word++) {
+            uint64_t bits = m_dirtyBitmap[word] | m_hostDirty[word];
+            while (bits != 0) {
+                const uint64_t page = word * 64 + lowestBit(bits);
+                bits &= bits - 1;
+                if (page != runEnd) {
+                    CopyPages(runStart, runEnd);
+                    runStart = page;
+                }
+                runEnd = page + 1;
+            }
+        }
+        CopyPages(runStart, runEnd);
+    }
+    std::fill(m_hostDirty.begin(), m_hostDirty.end(), 0);
+
+    if (m_fpState) {
+        if (vp.SetFPUControl(m_fpuControl) != VPOperationStatus::OK
+            || vp.SetMXCSR(m_mxcsr) != VPOperationStatus::OK
+            || vp.RegWrite(fpRegs, m_fpRegValues.data(), numFPRegs) != VPOperationStatus::OK) {
+            return false;
+        }
+    }
+    return vp.RegWrite(regs, m_regValues.data(), numRegs) == VPOperationStatus::OK;
+}
@@ -0,0 +1,163 @@
+/*
+Defines the corpus shared by the fuzzing workers.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "corpus.hpp"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+static const size_t maxTimeoutFiles = 16;
+
+Corpus::Corpus(size_t maxInputLength) noexcept
+    : m_maxInputLength(maxInputLength)
+    , m_features(new std::atomic<uint8_t>[featureMapSize])
+{
+    for (size_t i = 0; i < featureMapSize; i++) {
+        m_features[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+bool Corpus::SetOutputDirectory(const char *path) {
+    std::error_code ec;
+    std::filesystem::create_directories(path, ec);
+    if (ec) {
+        return false;
+    }
+    m_outputDir = path;
+    return true;
+}
+
+int64_t Corpus::LoadDirectory(const char *path) {
+    std::error_code ec;
+    std::filesystem::directory_iterator it(path, ec);
+    if (ec) {
+        return -1;
+    }
+
+    int64_t count = 0;
+    for (auto& entry : it) {
+        if (!entry.is_regular_file(ec)) {
+            continue;
+        }
+        std::ifstream file(entry.path(), std::ios::binary);
+        std::vector<uint8_t> input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (input.size() > m_maxInputLength) {
+            input.resize(m_maxInputLength);
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries.push_back(std::move(input));
+        count++;
+    }
+    return count;
+}
+
+void Corpus::Add(const std::vector<uint8_t>& input) {
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        index = m_entries.size();
+        m_entries.push_back(input);
+    }
+    if (!m_outputDir.empty()) {
+        char name[32];
+        snprintf(name, sizeof(name), "corpus-%06zu.bin", index);
+        WriteFile(name, input);
+    }
+}
+
+void Corpus::Pick(Random& random, std::vector<uint8_t>& input, std::vector<uint8_t> *splice) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_entries.empty()) {
+        input.clear();
+        if (splice != nullptr) {
+            splice->clear();
+        }
+        return;
+    }
+    input = m_entries[random.Below(m_entries.size())];
+    if (splice != nullptr) {
+        *splice = m_entries[random.Below(m_entries.size())];
+    }
+}
+
+bool Corpus::AddCrash(const std::vector<uint8_t>& input, const CrashTriage::Record *record, const char *kind, uint64_t rip) {
+    m_numCrashes.fetch_add(1, std::memory_order_relaxed);
+
+    // FNV-1a over the crash kind and the instruction pointer
+    uint64_t signature = 0xcbf29ce484222325ull;
+    for (const char *c = kind; *c != '\0'; c++) {
+        signature = (signature ^ (uint8_t)*c) * 0x100000001b3ull;
+    }
+    signature = (signature ^ rip) * 0x100000001b3ull;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_crashSignatures.insert(signature).second) {
+            return false;
+        }
+    }
+
+    if (!m_outputDir.empty()) {
+        char name[64];
+        snprintf(name, sizeof(name), "crash-%s-%016" PRIx64 ".bin", kind, rip);
+        WriteFile(name, input);
+        if (record != nullptr) {
+            std::lock_guard<std::mutex> lock(m_crashLogMutex);
+            CrashTriage::Append((m_outputDir + "/crashes.txt").c_str(), *record);
+        }
+    }
+    return true;
+}
+
+void Corpus::AddTimeout(const std::vector<uint8_t>& input) {
+    const size_t index = m_numTimeouts.fetch_add(1, std::memory_order_relaxed);
+    if (!m_outputDir.empty() && index < maxTimeoutFiles) {
+        char name[32];
+        snprintf(name, sizeof(name), "timeout-%02zu.bin", index);
+        WriteFile(name, input);
+    }
+}
+
+size_t Corpus::Size() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+size_t Corpus::NumUniqueCrashes() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_crashSignatures.size();
+}
+
+bool Corpus::WriteFile(const std::string& name, const std::vector<uint8_t>& data) const {
+    const std::string path = m_outputDir + "/" + name;
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (fp == NULL) {
+        return false;
+    }
+    const bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+    fclose(fp);
+    return ok;
+}
@@ -0,0 +1,109 @@
+/*
+Declares the corpus shared by the fuzzing workers.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "crash_triage.hpp"
+#include "mutator.hpp"
+
+#include <atomic>
+#include <cinttypes>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// The inputs, coverage features and crashes found by all workers.
+//
+// A feature is anything the guest does that the host can observe cheaply;
+// the harness uses port I/O writes. Features live in a fixed-size map of
+// flags so that workers check them without taking a lock; a lock is only
+// taken when an input is added or picked.
+//
+// When an output directory is set, new corpus entries and unique crashes are
+// written to it as they are found.
+class Corpus {
+public:
+    static const size_t featureMapSize = 1 << 16;
+
+    Corpus(size_t maxInputLength) noexcept;
+
+    // Creates the output directory. Entries found earlier are not written.
+    bool SetOutputDirectory(const char *path);
+
+    // Adds every file in a directory as an input. Returns the number of
+    // inputs added, or -1 if the directory cannot be read.
+    int64_t LoadDirectory(const char *path);
+
+    // Adds an input without checking features.
+    void Add(const std::vector<uint8_t>& input);
+
+    // Copies a random entry, and optionally a second one for splicing.
+    void Pick(Random& random, std::vector<uint8_t>& input, std::vector<uint8_t> *splice);
+
+    // Marks a feature as seen. Returns true if no input had it before.
+    bool AddFeature(uint64_t feature) noexcept {
+        auto& flag = m_features[feature & (featureMapSize - 1)];
+        if (flag.load(std::memory_order_relaxed) != 0 || flag.exchange(1, std::memory_order_relaxed) != 0) {
+            return false;
+        }
+        m_numFeatures.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Records a crash. Crashes are considered duplicates if they hit the same
+    // exception at the same instruction. Returns true if the crash is new.
+    bool AddCrash(const std::vector<uint8_t>& input, const CrashTriage::Record *record, const char *kind, uint64_t rip);
+
+    // Records an input that exceeded the time or exit budget. Only the first
+    // few are written out.
+    void AddTimeout(const std::vector<uint8_t>& input);
+
+    size_t Size();
+    size_t NumFeatures() const noexcept { return m_numFeatures.load(std::memory_order_relaxed); }
+    size_t NumCrashes() const noexcept { return m_numCrashes.load(std::memory_order_relaxed); }
+    size_t NumUniqueCrashes();
+    size_t NumTimeouts() const noexcept { return m_numTimeouts.load(std::memory_order_relaxed); }
+    size_t MaxInputLength() const noexcept { return m_maxInputLength; }
+
+private:
+    bool WriteFile(const std::string& name, const std::vector<uint8_t>& data) const;
+
+    const size_t m_maxInputLength;
+    std::unique_ptr<std::atomic<uint8_t>[]> m_features;
+    std::atomic<size_t> m_numFeatures{ 0 };
+    std::atomic<size_t> m_numCrashes{ 0 };
+    std::atomic<size_t> m_numTimeouts{ 0 };
+
+    std::mutex m_mutex;
+    std::vector<std::vector<uint8_t>> m_entries;
+    std::unordered_set<uint64_t> m_crashSignatures;
+    std::string m_outputDir;
+
+    // Serializes appends to crashes.txt so that records do not interleave
+    std::mutex m_crashLogMutex;
+};
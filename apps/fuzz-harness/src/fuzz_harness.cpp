@@ -0,0 +1,746 @@
+/*
+Entry point of the fuzzing harness. Boots a ROM and RAM image pair to a
+marker HLT, snapshots the virtual machine and runs the guest on mutated
+inputs from several workers, restoring only the dirty pages between runs.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "virt86/virt86.hpp"
+
+#include "print_helpers.hpp"
+#include "align_alloc.hpp"
+#include "utils.hpp"
+#include "io_bus.hpp"
+#include "crash_triage.hpp"
+#include "vm_snapshot.hpp"
+
+#include "corpus.hpp"
+#include "mutator.hpp"
+
+#if defined(__linux__)
+#  include <pthread.h>
+#  include <signal.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cinttypes>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace virt86;
+
+// The guest tells the host where the input goes by halting with this value
+// in EAX, the guest physical address of the input buffer in RDI and its
+// capacity in RSI. The host snapshots the VM at that point; every run then
+// starts right after the HLT with the input in the buffer and its length in
+// RSI, and ends at the next HLT.
+const uint32_t fuzzMarker = 0x5A5A5546;  // "FUZZ"
+
+// Memory layout shared with x64-guest
+const uint32_t romSize = PAGE_SIZE * 16;  // 64 KiB
+const uint64_t romBase = 0xFFFF0000;
+const uint64_t ramBase = 0x0;
+const uint64_t ramProgramBase = 0x10000;
+
+// Limit on VM exits before the guest reaches the marker
+const uint64_t bootExitLimit = 1000000;
+
+struct Options {
+    uint64_t numWorkers = 1;
+    uint64_t durationSec = 10;
+    uint64_t maxLength = 4096;
+    uint64_t maxExits = 10000;
+    uint64_t timeoutMs = 100;
+    uint64_t ramSizeMiB = 2;
+    uint64_t seed = 0;
+    const char *inputDir = nullptr;
+    const char *outputDir = nullptr;
+    const char *reproPath = nullptr;
+    const char *romPath = nullptr;
+    const char *ramPath = nullptr;
+};
+
+enum class Outcome {
+    Finished,   // Reached the next HLT
+    Crashed,    // Exception or triple fault
+    TimedOut,   // Exceeded the time or exit budget
+    Failed,     // The virtual processor failed
+};
+
+struct Worker {
+    size_t index;
+    VirtualMachine *vm;
+    VirtualProcessor *vp;
+    uint8_t *ram;
+    uint64_t ramSize;
+    IOBus bus;
+    VMSnapshot snapshot;
+    std::unique_ptr<Mutator> mutator;
+    Corpus *corpus = nullptr;
+
+    uint64_t inputAddress = 0;
+    uint64_t inputCapacity = 0;
+    bool newFeature = false;
+
+    // Deadline of the current run, or 0 between runs. The watchdog replaces
+    // it with expiredDeadline when the run exceeds it.
+    std::atomic<uint64_t> deadline{ 0 };
+
+    // Held by the watchdog while it kicks the worker and by the worker while
+    // it starts a run, so that a kick meant for a run that already ended is
+    // delivered before the next run starts
+    std::mutex kickMutex;
+
+    std::atomic<uint64_t> execs{ 0 };
+    uint64_t crashes = 0;
+    uint64_t timeouts = 0;
+    bool failed = false;
+
+    std::thread thread;
+};
+
+static const auto epoch = std::chrono::steady_clock::now();
+
+// Marks a run that exceeded its deadline
+static const uint64_t expiredDeadline = UINT64_MAX;
+
+static uint64_t now() noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void printUsage(const char *program) {
+    printf("usage: %s [options] <rom> <ram>\n", program);
+    printf("\n");
+    printf("Boots the ROM and RAM images like x64-guest until the guest halts with EAX set to\n");
+    printf("0x%08x, RDI pointing to an input buffer and RSI holding its capacity. The\n", fuzzMarker);
+    printf("harness snapshots the VM there and runs the rest of the guest on mutated inputs.\n");
+    printf("\n");
+    printf("options:\n");
+    printf("  -w, --workers <count>   number of worker threads, each with its own VM (default: 1)\n");
+    printf("  -d, --duration <s>      how long to fuzz in seconds (default: 10)\n");
+    printf("  -i, --input <dir>       directory with seed inputs\n");
+    printf("  -o, --output <dir>      directory for new corpus entries, crashes and timeouts\n");
+    printf("  -l, --max-length <n>    maximum input length in bytes (default: 4096)\n");
+    printf("  -e, --max-exits <n>     VM exits allowed per run (default: 10000)\n");
+    printf("  -t, --timeout <ms>      time allowed per run in milliseconds (default: 100)\n");
+    printf("  -s, --seed <n>          random seed (default: taken from the clock)\n");
+    printf("      --ram-size <MiB>    guest RAM size (default: 2)\n");
+    printf("      --repro <file>      run a single input and report the outcome\n");
+    printf("  -h, --help              show this message\n");
+}
+
+// Returns 1 if the program should continue, 0 if it should exit successfully
+// and -1 on invalid arguments.
+int parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            printUsage(argv[0]);
+            return 0;
+        }
+
+        const char **path = nullptr;
+        if (strcmp(arg, "-i") == 0 || strcmp(arg, "--input") == 0) {
+            path = &options.inputDir;
+        }
+        else if (strcmp(arg, "-o") == 0 || strcmp(arg, "--output") == 0) {
+            path = &options.outputDir;
+        }
+        else if (strcmp(arg, "--repro") == 0) {
+            path = &options.reproPath;
+        }
+        if (path != nullptr) {
+            if (++i >= argc) {
+                printf("fatal: %s requires an argument\n", arg);
+                return -1;
+            }
+            *path = argv[i];
+            continue;
+        }
+
+        uint64_t *value;
+        bool allowZero = false;
+        if (strcmp(arg, "-w") == 0 || strcmp(arg, "--workers") == 0) {
+            value = &options.numWorkers;
+        }
+        else if (strcmp(arg, "-d") == 0 || strcmp(arg, "--duration") == 0) {
+            value = &options.durationSec;
+        }
+        else if (strcmp(arg, "-l") == 0 || strcmp(arg, "--max-length") == 0) {
+            value = &options.maxLength;
+        }
+        else if (strcmp(arg, "-e") == 0 || strcmp(arg, "--max-exits") == 0) {
+            value = &options.maxExits;
+        }
+        else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--timeout") == 0) {
+            value = &options.timeoutMs;
+        }
+        else if (strcmp(arg, "-s") == 0 || strcmp(arg, "--seed") == 0) {
+            value = &options.seed;
+            allowZero = true;
+        }
+        else if (strcmp(arg, "--ram-size") == 0) {
+            value = &options.ramSizeMiB;
+        }
+        else if (arg[0] == '-') {
+            printf("fatal: unknown option: %s\n", arg);
+            printUsage(argv[0]);
+            return -1;
+        }
+        else if (options.romPath == nullptr) {
+            options.romPath = arg;
+            continue;
+        }
+        else if (options.ramPath == nullptr) {
+            options.ramPath = arg;
+            continue;
+        }
+        else {
+            printf("fatal: unexpected argument: %s\n", arg);
+            return -1;
+        }
+        if (++i >= argc) {
+            printf("fatal: %s requires an argument\n", arg);
+            return -1;
+        }
+        char *end;
+        *value = strtoull(argv[i], &end, 0);
+        if (*end != '\0' || (*value == 0 && !allowZero)) {
+            printf("fatal: invalid value for %s: %s\n", arg, argv[i]);
+            return -1;
+        }
+    }
+    if (options.ramPath == nullptr) {
+        printf("fatal: no input files specified\n");
+        printUsage(argv[0]);
+        return -1;
+    }
+    return 1;
+}
+
+// Every port write is a feature: the guest reports progress by writing to
+// ports, and distinct port and value pairs tell inputs apart. Writes made
+// while booting to the marker are not features.
+static void feedbackWrite(void *context, uint16_t port, size_t size, uint32_t value) {
+    auto& worker = *reinterpret_cast<Worker *>(context);
+    if (worker.corpus == nullptr) {
+        return;
+    }
+    uint64_t feature = ((uint64_t)port << 40) ^ ((uint64_t)size << 32) ^ value;
+    feature *= 0x9E3779B97F4A7C15ull;
+    if (worker.corpus->AddFeature(feature >> 48)) {
+        worker.newFeature = true;
+    }
+}
+
+// ----- Timeouts ---------------------------------------------------------------------------------------------------------
+
+#if defined(__linux__)
+static void timeoutSignalHandler(int) {
+    // Only needed to interrupt KVM_RUN
+}
+#endif
+
+// Installs the signal used to interrupt runs that exceed their time budget.
+// Returns false on platforms where runs can only be stopped at VM exits.
+bool enableTimeoutSignal() {
+#if defined(__linux__)
+    // Installed without SA_RESTART so that the signal interrupts the ioctl
+    struct sigaction action = {};
+    action.sa_handler = timeoutSignalHandler;
+    sigemptyset(&action.sa_mask);
+    return sigaction(SIGRTMIN, &action, nullptr) == 0;
+#else
+    return false;
+#endif
+}
+
+// Marks runs past their deadline as timed out and kicks their threads until
+// the runs end, in case a kick arrives between two runs and is lost.
+void watchdog(std::vector<std::unique_ptr<Worker>>& workers, uint64_t timeoutNs, const std::atomic<bool>& stop, bool useSignal) {
+    uint64_t interval = timeoutNs / 4;
+    if (interval < 1000000) {
+        interval = 1000000;
+    }
+    while (!stop.load()) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(interval));
+        const uint64_t t = now();
+        for (auto& worker : workers) {
+            std::lock_guard<std::mutex> lock(worker->kickMutex);
+
+            // Expire the deadline only if it still belongs to the run that
+            // exceeded it; every run starts with a later deadline, so a run
+            // that starts meanwhile is left alone
+            uint64_t deadline = worker->deadline.load();
+            if (deadline != expiredDeadline) {
+                if (deadline == 0 || t < deadline || !worker->deadline.compare_exchange_strong(deadline, expiredDeadline)) {
+                    continue;
+                }
+            }
+#if defined(__linux__)
+            if (useSignal) {
+                pthread_kill(worker->thread.native_handle(), SIGRTMIN);
+            }
+#endif
+        }
+    }
+}
+
+// ----- Execution --------------------------------------------------------------------------------------------------------
+
+// Runs the guest from the snapshot on one input. For crashes, fills in the
+// crash record if one could be captured and the crash kind.
+Outcome runInput(Worker& worker, const std::vector<uint8_t>& input, const Options& options, const CrashTriage& crashTriage,
+    CrashTriage::Record& record, bool& recordValid, const char *&kind, uint64_t& rip) {
+    auto& vp = *worker.vp;
+    recordValid = false;
+    kind = nullptr;
+    rip = 0;
+
+    if (!worker.snapshot.Restore(vp)) {
+        return Outcome::Failed;
+    }
+    memcpy(&worker.ram[worker.inputAddress - ramBase], input.data(), input.size());
+    worker.snapshot.MarkDirty(worker.inputAddress, input.size());
+    RegValue rsi;
+    rsi.u64 = input.size();
+    vp.RegWrite(Reg::RSI, rsi);
+
+    worker.newFeature = false;
+    const uint64_t deadline = now() + options.timeoutMs * 1000000;
+    {
+        std::lock_guard<std::mutex> lock(worker.kickMutex);
+        worker.deadline = deadline;
+    }
+
+    auto& exitInfo = vp.GetVMExitInfo();
+    Outcome outcome = Outcome::TimedOut;
+    for (uint64_t exits = 0; exits < options.maxExits; exits++) {
+        auto status = vp.Run();
+        if (status != VPExecutionStatus::OK) {
+            outcome = (worker.deadline.load() == expiredDeadline) ? Outcome::TimedOut : Outcome::Failed;
+            break;
+        }
+
+        bool done = true;
+        switch (exitInfo.reason) {
+        case VMExitReason::HLT:
+            outcome = Outcome::Finished;
+            break;
+        case VMExitReason::Exception:
+            outcome = Outcome::Crashed;
+            recordValid = crashTriage.Capture(vp, record);
+            // Drop the '#' of mnemonics such as "#PF" so the kind can name files
+            kind = recordValid ? CrashTriage::ExceptionName(record.exception) : "exception";
+            if (kind[0] == '#') {
+                kind++;
+            }
+            break;
+        case VMExitReason::Shutdown:
+            outcome = Outcome::Crashed;
+            kind = "shutdown";
+            break;
+        case VMExitReason::Error:
+            outcome = Outcome::Failed;
+            break;
+        default:
+            // Port I/O and MMIO were handled by the callbacks. Without the
+            // timeout signal, the deadline is only checked here.
+            done = worker.deadline.load() == expiredDeadline || now() >= deadline;
+            break;
+        }
+        if (done) {
+            break;
+        }
+    }
+    worker.deadline = 0;
+
+    if (outcome == Outcome::Crashed) {
+        if (recordValid) {
+            rip = record.rip;
+        }
+        else {
+            RegValue value;
+            vp.RegRead(Reg::RIP, value);
+            rip = value.u64;
+        }
+    }
+    return outcome;
+}
+
+// Runs the guest until it halts with the marker in EAX and takes the snapshot
+bool bootToMarker(Worker& worker, const CrashTriage& crashTriage) {
+    auto& vp = *worker.vp;
+    auto& exitInfo = vp.GetVMExitInfo();
+    for (uint64_t exits = 0; exits < bootExitLimit; exits++) {
+        if (vp.Run() != VPExecutionStatus::OK) {
+            printf("VCPU failed to run\n");
+            return false;
+        }
+        switch (exitInfo.reason) {
+        case VMExitReason::HLT: {
+            const Reg regs[] = { Reg::RAX, Reg::RDI, Reg::RSI };
+            RegValue values[array_size(regs)];
+            vp.RegRead(regs, values, array_size(regs));
+            if (values[0].u32 != fuzzMarker) {
+                break;
+            }
+            worker.inputAddress = values[1].u64;
+            worker.inputCapacity = values[2].u64;
+            if (worker.inputAddress < ramBase || worker.inputCapacity > worker.ramSize
+                || worker.inputAddress - ramBase > worker.ramSize - worker.inputCapacity) {
+                printf("input buffer 0x%" PRIx64 " (%" PRIu64 " bytes) is outside of RAM\n", worker.inputAddress, worker.inputCapacity);
+                return false;
+            }
+            if (!worker.snapshot.Take(*worker.vm, vp, ramBase, worker.ram, worker.ramSize)) {
+                printf("failed to take snapshot\n");
+                return false;
+            }
+            return true;
+        }
+        case VMExitReason::Exception: {
+            CrashTriage::Record record;
+            printf("guest crashed during boot\n");
+            if (crashTriage.Capture(vp, record)) {
+                CrashTriage::Print(stdout, record);
+            }
+            return false;
+        }
+        case VMExitReason::Shutdown:
+            printf("guest shut down during boot\n");
+            return false;
+        case VMExitReason::Error:
+            printf("VCPU execution failed during boot\n");
+            return false;
+        default:
+            break;
+        }
+    }
+    printf("guest did not reach the marker after %" PRIu64 " VM exits\n", bootExitLimit);
+    return false;
+}
+
+void fuzzLoop(Worker& worker, const Options& options, const CrashTriage& crashTriage, const std::atomic<bool>& stop) {
+    auto& corpus = *worker.corpus;
+    auto& mutator = *worker.mutator;
+    std::vector<uint8_t> input, splice;
+    CrashTriage::Record record;
+
+    while (!stop.load(std::memory_order_relaxed)) {
+        corpus.Pick(mutator.GetRandom(), input, &splice);
+        mutator.Mutate(input, corpus.MaxInputLength(), &splice);
+
+        bool recordValid;
+        const char *kind;
+        uint64_t rip;
+        const Outcome outcome = runInput(worker, input, options, crashTriage, record, recordValid, kind, rip);
+        worker.execs.fetch_add(1, std::memory_order_relaxed);
+
+        switch (outcome) {
+        case Outcome::Finished:
+            if (worker.newFeature) {
+                corpus.Add(input);
+            }
+            break;
+        case Outcome::Crashed:
+            worker.crashes++;
+            corpus.AddCrash(input, recordValid ? &record : nullptr, kind, rip);
+            break;
+        case Outcome::TimedOut:
+            worker.timeouts++;
+            corpus.AddTimeout(input);
+            break;
+        case Outcome::Failed:
+            worker.failed = true;
+            return;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    {
+        int result = parseOptions(argc, argv, options);
+        if (result <= 0) {
+            return result;
+        }
+    }
+    if (options.reproPath != nullptr) {
+        options.numWorkers = 1;
+    }
+    if (options.seed == 0) {
+        options.seed = (uint64_t)std::chrono::system_clock::now().time_since_epoch().count();
+    }
+
+    const uint64_t ramSize = options.ramSizeMiB * 1024 * 1024;
+    const uint64_t maxRamSize = 0xC0000000;
+    if (ramSize < PAGE_SIZE * 512 || ramSize > maxRamSize) {
+        printf("fatal: RAM size must be between 2 and %" PRIu64 " MiB\n", maxRamSize / 1024 / 1024);
+        return -1;
+    }
+
+    // The ROM is read-only and shared by all VMs; each worker gets a copy of
+    // the RAM image
+    std::vector<uint8_t> romImage, ramImage;
+    if (!loadFile(options.romPath, romImage, romSize) || romImage.size() != romSize) {
+        printf("fatal: could not load ROM file %s; it must be exactly %u bytes\n", options.romPath, romSize);
+        return -1;
+    }
+    if (!loadFile(options.ramPath, ramImage, ramSize - ramProgramBase)) {
+        printf("fatal: could not load RAM file %s; it must be no larger than %" PRIu64 " bytes\n", options.ramPath, ramSize - ramProgramBase);
+        return -1;
+    }
+    uint8_t *rom = alignedAlloc(romSize);
+    if (rom == NULL) {
+        printf("fatal: failed to allocate memory for ROM\n");
+        return -1;
+    }
+    memcpy(rom, romImage.data(), romSize);
+
+    // ----- Hypervisor platform initialization -------------------------------------------------------------------------------
+
+    printf("Loading virtualization platforms... ");
+
+    bool foundPlatform = false;
+    size_t platformIndex = 0;
+    for (size_t i = 0; i < array_size(PlatformFactories); i++) {
+        const Platform& platform = PlatformFactories[i]();
+        if (platform.GetInitStatus() == PlatformInitStatus::OK) {
+            printf("%s loaded successfully\n", platform.GetName().c_str());
+            foundPlatform = true;
+            platformIndex = i;
+            break;
+        }
+    }
+
+    if (!foundPlatform) {
+        printf("none found\n");
+        return -1;
+    }
+
+    Platform& platform = PlatformFactories[platformIndex]();
+    auto& features = platform.GetFeatures();
+    if (!features.dirtyPageTracking) {
+        printf("warning: dirty page tracking not supported; every run will restore all of RAM\n");
+    }
+
+    // ----- Workers ----------------------------------------------------------------------------------------------------------
+
+    CrashTriage crashTriage;
+    std::vector<std::unique_ptr<Worker>> workers;
+    printf("Booting %" PRIu64 " virtual machines to the snapshot point... ", options.numWorkers);
+    for (uint64_t i = 0; i < options.numWorkers; i++) {
+        VMSpecifications vmSpecs = { 0 };
+        vmSpecs.numProcessors = 1;
+        crashTriage.Enable(vmSpecs, features);
+        auto opt_vm = platform.CreateVM(vmSpecs);
+        if (!opt_vm) {
+            printf("failed to create VM\n");
+            return -1;
+        }
+
+        auto worker = std::make_unique<Worker>();
+        worker->index = (size_t)i;
+        worker->vm = &opt_vm->get();
+        worker->mutator = std::make_unique<Mutator>(options.seed + i * 0x9E3779B97F4A7C15ull);
+        worker->ramSize = ramSize;
+        worker->ram = alignedAlloc(ramSize);
+        if (worker->ram == NULL) {
+            printf("failed to allocate memory for RAM\n");
+            return -1;
+        }
+        memset(worker->ram, 0, ramSize);
+        memcpy(&worker->ram[ramProgramBase], ramImage.data(), ramImage.size());
+
+        auto& vm = *worker->vm;
+        auto memMapStatus = vm.MapGuestMemory(romBase, romSize, MemoryFlags::Read | MemoryFlags::Execute, rom);
+        if (memMapStatus == MemoryMappingStatus::OK) {
+            memMapStatus = vm.MapGuestMemory(ramBase, ramSize, MemoryFlags::Read | MemoryFlags::Write | MemoryFlags::Execute | MemoryFlags::DirtyPageTracking, worker->ram);
+        }
+        if (memMapStatus != MemoryMappingStatus::OK) {
+            printf("failed to map memory: ");
+            printMemoryMappingStatus(memMapStatus);
+            return -1;
+        }
+
+        worker->bus.RegisterPIO(0, 0x10000, nullptr, feedbackWrite, worker.get());
+        worker->bus.Attach(vm);
+
+        // The ROM expects a page-aligned buffer for its page tables in es:edi
+        // and a small stack in ss:esp, as in x64-guest
+        worker->vp = &vm.GetVirtualProcessor(0)->get();
+        RegValue edi, esp;
+        edi.u32 = 0x0;
+        esp.u32 = 0x10000;
+        worker->vp->RegWrite(Reg::EDI, edi);
+        worker->vp->RegWrite(Reg::ESP, esp);
+
+        if (!bootToMarker(*worker, crashTriage)) {
+            return -1;
+        }
+        workers.push_back(std::move(worker));
+    }
+    printf("succeeded\n");
+
+    auto& first = *workers[0];
+    printf("Input buffer at 0x%" PRIx64 ", %" PRIu64 " bytes\n", first.inputAddress, first.inputCapacity);
+
+    Corpus corpus((size_t)std::min(options.maxLength, first.inputCapacity));
+    for (auto& worker : workers) {
+        worker->corpus = &corpus;
+    }
+    if (options.outputDir != nullptr && !corpus.SetOutputDirectory(options.outputDir)) {
+        printf("fatal: could not create output directory %s\n", options.outputDir);
+        return -1;
+    }
+
+    const bool timeoutSignal = enableTimeoutSignal();
+    if (!timeoutSignal) {
+        printf("warning: runs can only time out at VM exits on this platform\n");
+    }
+    std::atomic<bool> stop{ false };
+    int exitCode = 0;
+
+    // ----- Reproduce --------------------------------------------------------------------------------------------------------
+
+    if (options.reproPath != nullptr) {
+        std::vector<uint8_t> input;
+        if (!loadFile(options.reproPath, input, corpus.MaxInputLength())) {
+            printf("fatal: could not load input %s; it must be no larger than %zu bytes\n", options.reproPath, corpus.MaxInputLength());
+            return -1;
+        }
+
+        Outcome outcome = Outcome::Failed;
+        CrashTriage::Record record;
+        bool recordValid;
+        const char *kind;
+        uint64_t rip;
+        first.thread = std::thread([&]() {
+            outcome = runInput(first, input, options, crashTriage, record, recordValid, kind, rip);
+        });
+        std::thread watchdogThread([&]() { watchdog(workers, options.timeoutMs * 1000000, stop, timeoutSignal); });
+        first.thread.join();
+        stop = true;
+        watchdogThread.join();
+
+        printf("\n");
+        switch (outcome) {
+        case Outcome::Finished: printf("Input finished normally\n"); break;
+        case Outcome::TimedOut: printf("Input timed out\n"); exitCode = 2; break;
+        case Outcome::Failed: printf("VCPU failed\n"); exitCode = -1; break;
+        case Outcome::Crashed:
+            printf("Input crashed (%s) at 0x%016" PRIx64 "\n", kind, rip);
+            if (recordValid) {
+                CrashTriage::Print(stdout, record);
+            }
+            exitCode = 1;
+            break;
+        }
+    }
+
+    // ----- Fuzz -------------------------------------------------------------------------------------------------------------
+
+    else {
+        if (options.inputDir != nullptr) {
+            const int64_t count = corpus.LoadDirectory(options.inputDir);
+            if (count < 0) {
+                printf("fatal: could not read input directory %s\n", options.inputDir);
+                return -1;
+            }
+            printf("Loaded %" PRId64 " seed inputs from %s\n", count, options.inputDir);
+        }
+        if (corpus.Size() == 0) {
+            corpus.Add(std::vector<uint8_t>(std::min<size_t>(16, corpus.MaxInputLength()), 0));
+        }
+
+        printf("Fuzzing with %" PRIu64 " workers for %" PRIu64 " s, seed %" PRIu64 "\n\n", options.numWorkers, options.durationSec, options.seed);
+        const uint64_t start = now();
+        for (auto& worker : workers) {
+            Worker *w = worker.get();
+            w->thread = std::thread([&, w]() { fuzzLoop(*w, options, crashTriage, stop); });
+        }
+        std::thread watchdogThread([&]() { watchdog(workers, options.timeoutMs * 1000000, stop, timeoutSignal); });
+
+        uint64_t lastExecs = 0;
+        for (uint64_t second = 1; second <= options.durationSec; second++) {
+            std::this_thread::sleep_until(epoch + std::chrono::nanoseconds(start + second * 1000000000ull));
+            uint64_t execs = 0;
+            for (auto& worker : workers) {
+                execs += worker->execs.load(std::memory_order_relaxed);
+            }
+            printf("[%5" PRIu64 " s] execs %10" PRIu64 " (%7" PRIu64 "/s)  corpus %5zu  features %5zu  crashes %4zu (%zu unique)  timeouts %zu\n",
+                second, execs, execs - lastExecs, corpus.Size(), corpus.NumFeatures(), corpus.NumCrashes(), corpus.NumUniqueCrashes(), corpus.NumTimeouts());
+            lastExecs = execs;
+        }
+
+        stop = true;
+        for (auto& worker : workers) {
+            worker->thread.join();
+        }
+        watchdogThread.join();
+        const double elapsed = (now() - start) / 1000000000.0;
+
+        printf("\n");
+        printf("Worker      Execs    Execs/s  Crashes  Timeouts  Pages/exec  Full restores\n");
+        uint64_t totalExecs = 0;
+        for (auto& worker : workers) {
+            const uint64_t execs = worker->execs.load();
+            auto& stats = worker->snapshot.GetStats();
+            printf("%6zu %10" PRIu64 " %10.0f %8" PRIu64 " %9" PRIu64 " %11.2f %14" PRIu64 "%s\n",
+                worker->index, execs, execs / elapsed, worker->crashes, worker->timeouts,
+                (stats.restores == 0) ? 0.0 : (double)stats.pagesRestored / stats.restores, stats.fullRestores,
+                worker->failed ? "  (VCPU failed)" : "");
+            totalExecs += execs;
+            if (worker->failed) {
+                exitCode = -1;
+            }
+        }
+        printf("Total  %10" PRIu64 " %10.0f\n", totalExecs, totalExecs / elapsed);
+    }
+    printf("\n");
+
+    // ----- Cleanup ----------------------------------------------------------------------------------------------------------
+
+    printf("Releasing VMs... ");
+    bool freed = true;
+    for (auto& worker : workers) {
+        freed &= platform.FreeVM(*worker->vm);
+        freed &= alignedFree(worker->ram);
+    }
+    printf(freed ? "succeeded\n" : "failed\n");
+
+    if (alignedFree(rom)) {
+        printf("ROM freed\n");
+    }
+    else {
+        printf("Failed to free ROM\n");
+    }
+
+    return exitCode;
+}
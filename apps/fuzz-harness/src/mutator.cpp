@@ -0,0 +1,129 @@
+/*
+Defines the input mutator of the fuzzing harness.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "mutator.hpp"
+
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+static const uint8_t interesting8[] = { 0x00, 0x01, 0x7f, 0x80, 0xff, 0x10, 0x20, 0x40, 0x64 };
+static const uint16_t interesting16[] = { 0x0000, 0x00ff, 0x0100, 0x7fff, 0x8000, 0xffff, 0x0200, 0x0400, 0x1000 };
+static const uint32_t interesting32[] = { 0x00000000, 0x0000ffff, 0x00010000, 0x7fffffff, 0x80000000, 0xffffffff, 0xfffffffe, 0x00001000 };
+
+void Mutator::Mutate(std::vector<uint8_t>& data, size_t maxLength, const std::vector<uint8_t> *splice) noexcept {
+    // Stack 1 to 8 mutations, favoring small stacks
+    const size_t count = (size_t)1 << m_random.Below(4);
+    for (size_t i = 0; i < count; i++) {
+        MutateOnce(data, maxLength, splice);
+    }
+}
+
+void Mutator::MutateOnce(std::vector<uint8_t>& data, size_t maxLength, const std::vector<uint8_t> *splice) noexcept {
+    auto& rng = m_random;
+
+    // Inputs must have at least one byte for most mutations
+    if (data.empty()) {
+        if (maxLength == 0) {
+            return;
+        }
+        data.push_back((uint8_t)rng.Next());
+        return;
+    }
+
+    const size_t size = data.size();
+    switch (rng.Below(11)) {
+    case 0: {  // Flip a bit
+        const size_t bit = rng.Below(size * 8);
+        data[bit / 8] ^= 1 << (bit & 7);
+        break;
+    }
+    case 1:  // Set a random byte
+        data[rng.Below(size)] = (uint8_t)rng.Next();
+        break;
+    case 2:  // Set a boundary byte
+        data[rng.Below(size)] = interesting8[rng.Below(array_size(interesting8))];
+        break;
+    case 3: {  // Set a boundary word
+        if (size < 2) break;
+        const uint16_t value = interesting16[rng.Below(array_size(interesting16))];
+        memcpy(&data[rng.Below(size - 1)], &value, sizeof(value));
+        break;
+    }
+    case 4: {  // Set a boundary dword
+        if (size < 4) break;
+        const uint32_t value = interesting32[rng.Below(array_size(interesting32))];
+        memcpy(&data[rng.Below(size - 3)], &value, sizeof(value));
+        break;
+    }
+    case 5: {  // Add or subtract a small value
+        const uint8_t delta = (uint8_t)(1 + rng.Below(16));
+        uint8_t& byte = data[rng.Below(size)];
+        byte = (rng.Next() & 1) ? byte + delta : byte - delta;
+        break;
+    }
+    case 6: {  // Insert random bytes
+        if (size >= maxLength) break;
+        const size_t length = 1 + rng.Below(std::min<size_t>(16, maxLength - size));
+        const uint8_t value = (rng.Next() & 1) ? (uint8_t)rng.Next() : 0;
+        data.insert(data.begin() + rng.Below(size + 1), length, value);
+        break;
+    }
+    case 7: {  // Delete a block
+        if (size < 2) break;
+        const size_t length = 1 + rng.Below(std::min<size_t>(16, size - 1));
+        const size_t offset = rng.Below(size - length + 1);
+        data.erase(data.begin() + offset, data.begin() + offset + length);
+        break;
+    }
+    case 8: {  // Copy a block over another part of the input
+        const size_t length = 1 + rng.Below(std::min<size_t>(32, size));
+        const size_t from = rng.Below(size - length + 1);
+        const size_t to = rng.Below(size - length + 1);
+        memmove(&data[to], &data[from], length);
+        break;
+    }
+    case 9: {  // Duplicate a block
+        if (size >= maxLength) break;
+        const size_t length = 1 + rng.Below(std::min(std::min<size_t>(32, size), maxLength - size));
+        const size_t from = rng.Below(size - length + 1);
+        std::vector<uint8_t> block(data.begin() + from, data.begin() + from + length);
+        data.insert(data.begin() + rng.Below(size + 1), block.begin(), block.end());
+        break;
+    }
+    case 10: {  // Splice: keep a prefix of this input and a suffix of another
+        if (splice == nullptr || splice->empty()) break;
+        const size_t cut = rng.Below(size + 1);
+        const size_t spliceCut = rng.Below(splice->size());
+        data.resize(cut);
+        data.insert(data.end(), splice->begin() + spliceCut, splice->end());
+        if (data.size() > maxLength) {
+            data.resize(maxLength);
+        }
+        break;
+    }
+    }
+}
@@ -0,0 +1,68 @@
+/*
+Declares the input mutator of the fuzzing harness.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <cinttypes>
+#include <stddef.h>
+#include <vector>
+
+// A small xorshift generator. Each worker owns one, so no state is shared.
+class Random {
+public:
+    explicit Random(uint64_t seed) noexcept : m_state((seed == 0) ? 0x9E3779B97F4A7C15ull : seed) {}
+
+    uint64_t Next() noexcept {
+        m_state ^= m_state >> 12;
+        m_state ^= m_state << 25;
+        m_state ^= m_state >> 27;
+        return m_state * 0x2545F4914F6CDD1Dull;
+    }
+
+    // Returns a value in [0, bound). bound must not be zero.
+    uint64_t Below(uint64_t bound) noexcept { return Next() % bound; }
+
+private:
+    uint64_t m_state;
+};
+
+// Applies a random stack of byte-level mutations to an input: bit flips,
+// random and boundary values, small arithmetic, block insertion, deletion
+// and duplication, and splicing with another corpus entry.
+class Mutator {
+public:
+    explicit Mutator(uint64_t seed) noexcept : m_random(seed) {}
+
+    // Mutates the input in place, keeping it no longer than maxLength bytes.
+    // The splice input may be null.
+    void Mutate(std::vector<uint8_t>& data, size_t maxLength, const std::vector<uint8_t> *splice) noexcept;
+
+    Random& GetRandom() noexcept { return m_random; }
+
+private:
+    void MutateOnce(std::vector<uint8_t>& data, size_t maxLength, const std::vector<uint8_t> *splice) noexcept;
+
+    Random m_random;
+};
@@ -0,0 +1,85 @@
+; Compile with NASM:
+;   $ nasm target.asm -o target.bin
+
+; Sample fuzz target. Boot it with the x64-guest ROM:
+;   $ virt86-fuzz-harness rom.bin target.bin
+;
+; The guest hands the harness its input buffer and parses each input as a
+; one-byte command followed by its arguments. Every check it passes is
+; reported with a write to PROGRESS_PORT, which the harness uses as coverage
+; feedback. Two commands hide a bug:
+;   "bug!"                  executes UD2 (#UD)
+;   "P" <address:4> "OK"    reads from the address, which faults (#PF)
+;                           outside of the first 2 MiB
+[BITS 64]
+org 0x10000
+
+; Fuzzing interface, matching fuzzMarker in fuzz_harness.cpp
+%define FUZZ_MARKER     0x5A5A5546      ; "FUZZ"
+%define INPUT           0x100000
+%define INPUT_CAPACITY  0x1000
+
+%define PROGRESS_PORT   0x80
+
+Entry:
+    ; The harness snapshots the VM at this HLT. Every run resumes right after
+    ; it with the input in the buffer and its length in RSI.
+    mov eax, FUZZ_MARKER
+    mov rdi, INPUT
+    mov esi, INPUT_CAPACITY
+    hlt
+
+    call Parse
+    hlt                     ; End of the run
+    jmp Entry
+
+; Reports that the check numbered al passed
+%macro PROGRESS 1
+    mov al, %1
+    out PROGRESS_PORT, al
+%endmacro
+
+; Parses the input at rdi, rsi bytes long
+Parse:
+    test rsi, rsi
+    jz .done
+    mov al, [rdi]
+    cmp al, 'b'
+    je ParseBug
+    cmp al, 'P'
+    je ParsePeek
+.done:
+    ret
+
+ParseBug:
+    PROGRESS 1
+    cmp rsi, 4
+    jb .done
+    cmp byte [rdi + 1], 'u'
+    jne .done
+    PROGRESS 2
+    cmp byte [rdi + 2], 'g'
+    jne .done
+    PROGRESS 3
+    cmp byte [rdi + 3], '!'
+    jne .done
+    ud2
+.done:
+    ret
+
+ParsePeek:
+    PROGRESS 4
+    cmp rsi, 7
+    jb .done
+    PROGRESS 5
+    cmp byte [rdi + 5], 'O'
+    jne .done
+    PROGRESS 6
+    cmp byte [rdi + 6], 'K'
+    jne .done
+    PROGRESS 7
+    mov ebx, [rdi + 1]
+    mov al, [rbx]
+    out PROGRESS_PORT, al
+.done:
+    ret
@@ -0,0 +1,227 @@
+/*
+Defines the host memory backings for guest RAM used by the memory benchmark.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "host_memory.hpp"
+
+#include "virt86/vp/vp.hpp"
+
+#include "align_alloc.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_WIN32)
+#  include <Windows.h>
+#elif defined(__linux__)
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#elif defined(__APPLE__)
+#  include <sys/mman.h>
+#else
+#  error Unsupported platform
+#endif
+
+bool BackingSpec::Parse(const char *spec) noexcept {
+    if (strcmp(spec, "heap") == 0) {
+        type = Backing::Heap;
+        return true;
+    }
+    if (strcmp(spec, "huge") == 0) {
+        type = Backing::HugePages;
+        return true;
+    }
+    if (strncmp(spec, "numa:", 5) == 0 && spec[5] != '\0') {
+        char *end;
+        const unsigned long value = strtoul(&spec[5], &end, 10);
+        if (*end != '\0' || value >= 64) {
+            return false;
+        }
+        type = Backing::NUMANode;
+        node = (uint32_t)value;
+        return true;
+    }
+    return false;
+}
+
+std::string BackingSpec::Name() const {
+    switch (type) {
+    case Backing::Heap: return "heap";
+    case Backing::HugePages: return "huge";
+    case Backing::NUMANode: return "numa:" + std::to_string(node);
+    }
+    return "unknown";
+}
+
+#if defined(_WIN32)
+// Large pages require the "Lock pages in memory" privilege, which is granted
+// to the user by policy but must be enabled in the process token
+static bool enableLockMemoryPrivilege() noexcept {
+    HANDLE token;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+        return false;
+    }
+    TOKEN_PRIVILEGES privileges;
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    bool ok = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)
+        && AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL)
+        && GetLastError() == ERROR_SUCCESS;
+    CloseHandle(token);
+    return ok;
+}
+#endif
+
+HostMemory::~HostMemory() noexcept {
+    Free();
+}
+
+bool HostMemory::Allocate(const BackingSpec& spec, size_t size) noexcept {
+    Free();
+    size = (size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+
+    switch (spec.type) {
+    case Backing::Heap:
+        m_data = alignedAlloc(size);
+        if (m_data == nullptr) {
+            m_detail = "out of memory";
+            return false;
+        }
+        m_kind = Kind::Aligned;
+        m_detail = "default pages";
+        break;
+
+    case Backing::HugePages:
+    {
+#if defined(_WIN32)
+        const size_t largePageSize = GetLargePageMinimum();
+        if (largePageSize == 0) {
+            m_detail = "large pages not supported";
+            return false;
+        }
+        if (!enableLockMemoryPrivilege()) {
+            m_detail = "the Lock pages in memory privilege is required";
+            return false;
+        }
+        size = (size + largePageSize - 1) & ~(largePageSize - 1);
+        m_data = (uint8_t *)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (m_data == nullptr) {
+            m_detail = "VirtualAlloc failed with error " + std::to_string(GetLastError());
+            return false;
+        }
+        m_kind = Kind::Mapped;
+        m_detail = "large pages";
+#elif defined(__linux__)
+        // Prefer preallocated hugetlbfs pages; fall back to transparent huge
+        // pages, which the kernel may or may not provide
+        const size_t hugePageSize = 2 * 1024 * 1024;
+        size = (size + hugePageSize - 1) & ~(hugePageSize - 1);
+        void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            m_detail = "hugetlbfs pages";
+        }
+        else {
+            mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED) {
+                m_detail = std::string("mmap failed: ") + strerror(errno);
+                return false;
+            }
+            if (madvise(mem, size, MADV_HUGEPAGE) != 0) {
+                munmap(mem, size);
+                m_detail = "no hugetlbfs pages reserved and transparent huge pages disabled";
+                return false;
+            }
+            m_detail = "transparent huge pages";
+        }
+        m_data = (uint8_t *)mem;
+        m_kind = Kind::Mapped;
+#else
+        m_detail = "not supported on this host";
+        return false;
+#endif
+        break;
+    }
+
+    case Backing::NUMANode:
+    {
+#if defined(_WIN32)
+        m_data = (uint8_t *)VirtualAllocExNuma(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, spec.node);
+        if (m_data == nullptr) {
+            m_detail = "VirtualAllocExNuma failed with error " + std::to_string(GetLastError());
+            return false;
+        }
+        m_kind = Kind::Mapped;
+#elif defined(__linux__)
+        void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            m_detail = std::string("mmap failed: ") + strerror(errno);
+            return false;
+        }
+
+        // mbind is called directly to avoid depending on libnuma
+        const int MPOL_BIND = 2;
+        unsigned long nodeMask = 1ul << spec.node;
+        if (syscall(SYS_mbind, mem, size, MPOL_BIND, &nodeMask, sizeof(nodeMask) * 8, 0) != 0) {
+            m_detail = std::string("mbind failed: ") + strerror(errno);
+            munmap(mem, size);
+            return false;
+        }
+        m_data = (uint8_t *)mem;
+        m_kind = Kind::Mapped;
+#else
+        m_detail = "not supported on this host";
+        return false;
+#endif
+        m_detail = "bound to node " + std::to_string(spec.node);
+        break;
+    }
+    }
+
+    m_size = size;
+    memset(m_data, 0, m_size);
+    return true;
+}
+
+void HostMemory::Free() noexcept {
+    switch (m_kind) {
+    case Kind::None:
+        break;
+    case Kind::Aligned:
+        alignedFree(m_data);
+        break;
+    case Kind::Mapped:
+#if defined(_WIN32)
+        VirtualFree(m_data, 0, MEM_RELEASE);
+#else
+        munmap(m_data, m_size);
+#endif
+        break;
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_kind = Kind::None;
+}
@@ -0,0 +1,74 @@
+/*
+Declares the host memory backings for guest RAM used by the memory benchmark.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <cinttypes>
+#include <stddef.h>
+#include <string>
+
+// Where the host memory behind guest RAM comes from
+enum class Backing {
+    Heap,       // alignedAlloc, with the host's default page size
+    HugePages,  // Large host pages: hugetlbfs or transparent huge pages on Linux, large pages on Windows
+    NUMANode,   // Default page size, bound to one NUMA node
+};
+
+struct BackingSpec {
+    Backing type = Backing::Heap;
+    uint32_t node = 0;
+
+    // Parses "heap", "huge" or "numa:<node>". Returns false if invalid.
+    bool Parse(const char *spec) noexcept;
+    std::string Name() const;
+};
+
+// A zeroed, page-aligned block of host memory with the given backing. All
+// pages are touched on allocation, so the benchmark does not measure page
+// faults and NUMA pages are placed on their node.
+class HostMemory {
+public:
+    ~HostMemory() noexcept;
+
+    // Allocates size bytes, rounded up to the backing's page size. Returns
+    // false if the backing is not available on this host; Detail then
+    // describes why.
+    bool Allocate(const BackingSpec& spec, size_t size) noexcept;
+    void Free() noexcept;
+
+    uint8_t *Data() const noexcept { return m_data; }
+    size_t Size() const noexcept { return m_size; }
+
+    // How the memory was actually allocated, or why it could not be
+    const std::string& Detail() const noexcept { return m_detail; }
+
+private:
+    enum class Kind { None, Aligned, Mapped };
+
+    uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+    Kind m_kind = Kind::None;
+    std::string m_detail;
+};
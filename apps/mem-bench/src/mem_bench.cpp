@@ -0,0 +1,625 @@
+/*
+Guest memory benchmark of the virt86 library: runs STREAM, pointer chase and
+TLB stride kernels in a guest with different host RAM backings and guest page
+sizes, and compares them with the same kernels run natively on the host.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "virt86/virt86.hpp"
+
+#include "print_helpers.hpp"
+#include "utils.hpp"
+#include "guest_memory.hpp"
+#include "page_table_builder.hpp"
+#include "long_mode.hpp"
+
+#include "host_memory.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace virt86;
+
+// Guest RAM layout, matching membench.asm
+const uint64_t gdtAddress = 0x1000;
+const uint64_t paramsAddress = 0x2000;
+const uint64_t programBase = 0x10000;
+const uint64_t programMaxSize = 0x10000;
+const uint64_t stackTop = 0x100000;
+const uint64_t pageTableArea = 0x100000;
+const uint64_t pageTableAreaSize = 0xF00000;
+const uint64_t bufferBase = 0x1000000;
+
+// Parameter block written by the host before each run
+struct Params {
+    uint64_t command;
+    uint64_t a, b, c;
+    uint64_t count;
+    uint64_t passes;
+    uint64_t stride;
+    uint64_t size;
+    double scalar;
+    uint64_t result;
+};
+
+enum Command : uint64_t {
+    CMD_NOP = 0,
+    CMD_COPY = 1,
+    CMD_SCALE = 2,
+    CMD_ADD = 3,
+    CMD_TRIAD = 4,
+    CMD_CHASE = 5,
+    CMD_STRIDE = 6,
+};
+
+const double streamScalar = 3.0;
+
+// Bytes each STREAM kernel moves per element: Copy and Scale read one array
+// and write one, Add and Triad read two and write one
+const char *kernelNames[] = { "copy", "scale", "add", "triad" };
+const uint64_t kernelBytes[] = { 16, 16, 24, 24 };
+
+// Loads per chase or stride run; large enough that the VM exit at the end of
+// the run does not show in the per-load time
+const uint64_t loadsPerRun = 4 * 1024 * 1024;
+
+enum class PageLayout { Pages4K, Pages2M, Pages1G };
+
+struct Options {
+    std::vector<BackingSpec> backings;
+    std::vector<PageLayout> layouts;
+    const char *platformName = nullptr;
+    const char *programPath = nullptr;
+    uint64_t arraySizeMiB = 64;
+    uint64_t chaseSizeMiB = 128;
+    uint64_t strideSizeMiB = 256;
+    uint64_t stride = 4096;
+    uint64_t trials = 5;
+    bool native = true;
+};
+
+// Best times out of all trials of one configuration
+struct Results {
+    bool ran = false;
+    double kernelNs[4] = { 0, 0, 0, 0 };
+    double chaseNs = 0;
+    double strideNs = 0;
+    bool valid = true;
+};
+
+// The buffers every kernel works on, in guest physical addresses. Guest RAM
+// is identity-mapped, so these are also the guest's linear addresses.
+struct Buffers {
+    uint64_t a, b, c;
+    uint64_t count;
+    uint64_t chaseLines;
+    uint64_t strideSize;
+    uint64_t stride;
+    uint64_t stridePasses;
+};
+
+static const char *layoutName(PageLayout layout) noexcept {
+    switch (layout) {
+    case PageLayout::Pages4K: return "4k";
+    case PageLayout::Pages2M: return "2m";
+    case PageLayout::Pages1G: return "1g";
+    default: return "?";
+    }
+}
+
+void printUsage(const char *program) {
+    printf("usage: %s [options] <membench.bin>\n", program);
+    printf("\n");
+    printf("Runs the STREAM copy, scale, add and triad kernels, a random pointer chase and a\n");
+    printf("page-strided load loop in a 64-bit guest, once for every combination of host RAM\n");
+    printf("backing and guest page size, and on the host for every backing. Prints bandwidth\n");
+    printf("in GB/s and latency in ns per load.\n");
+    printf("\n");
+    printf("options:\n");
+    printf("  -b, --backing <list>    comma-separated host RAM backings: heap, huge, numa:<node>\n");
+    printf("                          (default: heap,huge)\n");
+    printf("  -p, --pages <list>      comma-separated guest page sizes: 4k, 2m, 1g (default: 4k,2m)\n");
+    printf("  -a, --array-size <MiB>  size of each STREAM array (default: 64)\n");
+    printf("  -c, --chase-size <MiB>  size of the pointer chase region (default: 128)\n");
+    printf("  -s, --stride-size <MiB> size of the stride region (default: 256)\n");
+    printf("      --stride <bytes>    distance between stride loads (default: 4096)\n");
+    printf("  -n, --trials <count>    runs of each kernel; the best is reported (default: 5)\n");
+    printf("      --platform <name>   use the first available platform whose name contains <name>\n");
+    printf("      --no-native         skip the host-native runs\n");
+    printf("  -h, --help              show this message\n");
+}
+
+// Calls parse on each element of a comma-separated list
+template<typename T, typename F>
+static bool parseList(const char *list, std::vector<T>& values, F parse) {
+    values.clear();
+    std::string item;
+    for (const char *p = list;; p++) {
+        if (*p == ',' || *p == '\0') {
+            T value;
+            if (!parse(item.c_str(), value)) {
+                return false;
+            }
+            values.push_back(value);
+            item.clear();
+            if (*p == '\0') {
+                return true;
+            }
+        }
+        else {
+            item += *p;
+        }
+    }
+}
+
+static bool parseLayout(const char *name, PageLayout& layout) {
+    if (strcmp(name, "4k") == 0) layout = PageLayout::Pages4K;
+    else if (strcmp(name, "2m") == 0) layout = PageLayout::Pages2M;
+    else if (strcmp(name, "1g") == 0) layout = PageLayout::Pages1G;
+    else return false;
+    return true;
+}
+
+// Returns 1 if the program should continue, 0 if it should exit successfully
+// and -1 on invalid arguments.
+int parseOptions(int argc, char* argv[], Options& options) {
+    parseList("heap,huge", options.backings, [](const char *spec, BackingSpec& backing) { return backing.Parse(spec); });
+    parseList("4k,2m", options.layouts, parseLayout);
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (strcmp(arg, "--no-native") == 0) {
+            options.native = false;
+            continue;
+        }
+        if (arg[0] != '-') {
+            if (options.programPath != nullptr) {
+                printf("fatal: unexpected argument: %s\n", arg);
+                return -1;
+            }
+            options.programPath = arg;
+            continue;
+        }
+        if (++i >= argc) {
+            printf("fatal: %s requires an argument\n", arg);
+            return -1;
+        }
+        const char *value = argv[i];
+
+        if (strcmp(arg, "-b") == 0 || strcmp(arg, "--backing") == 0) {
+            if (!parseList(value, options.backings, [](const char *spec, BackingSpec& backing) { return backing.Parse(spec); })) {
+                printf("fatal: invalid backing list: %s\n", value);
+                return -1;
+            }
+            continue;
+        }
+        if (strcmp(arg, "-p") == 0 || strcmp(arg, "--pages") == 0) {
+            if (!parseList(value, options.layouts, parseLayout)) {
+                printf("fatal: invalid page size list: %s\n", value);
+                return -1;
+            }
+            continue;
+        }
+        if (strcmp(arg, "--platform") == 0) {
+            options.platformName = value;
+            continue;
+        }
+
+        uint64_t *number;
+        if (strcmp(arg, "-a") == 0 || strcmp(arg, "--array-size") == 0) {
+            number = &options.arraySizeMiB;
+        }
+        else if (strcmp(arg, "-c") == 0 || strcmp(arg, "--chase-size") == 0) {
+            number = &options.chaseSizeMiB;
+        }
+        else if (strcmp(arg, "-s") == 0 || strcmp(arg, "--stride-size") == 0) {
+            number = &options.strideSizeMiB;
+        }
+        else if (strcmp(arg, "--stride") == 0) {
+            number = &options.stride;
+        }
+        else if (strcmp(arg, "-n") == 0 || strcmp(arg, "--trials") == 0) {
+            number = &options.trials;
+        }
+        else {
+            printf("fatal: unknown option: %s\n", arg);
+            printUsage(argv[0]);
+            return -1;
+        }
+        char *end;
+        *number = strtoull(value, &end, 0);
+        if (*end != '\0' || *number == 0) {
+            printf("fatal: invalid value for %s: %s\n", arg, value);
+            return -1;
+        }
+    }
+    if (options.programPath == nullptr) {
+        printf("fatal: no guest program specified\n");
+        printUsage(argv[0]);
+        return -1;
+    }
+    if (options.stride < 8 || (options.stride & 7) != 0 || options.stride > options.strideSizeMiB * 1024 * 1024) {
+        printf("fatal: the stride must be a multiple of 8 bytes and fit in the stride region\n");
+        return -1;
+    }
+    return 1;
+}
+
+// ----- Buffers ------------------------------------------------------------------------------------------------------------------
+
+// Fills the STREAM arrays with their initial values
+static void initArrays(uint8_t *ram, const Buffers& buffers) noexcept {
+    auto a = reinterpret_cast<double *>(&ram[buffers.a]);
+    auto b = reinterpret_cast<double *>(&ram[buffers.b]);
+    auto c = reinterpret_cast<double *>(&ram[buffers.c]);
+    for (uint64_t i = 0; i < buffers.count; i++) {
+        a[i] = 1.0;
+        b[i] = 2.0;
+        c[i] = 0.0;
+    }
+}
+
+// Checks the arrays against the values the kernels produce from the initial
+// ones after the given number of trials, as STREAM does
+static bool checkArrays(const uint8_t *ram, const Buffers& buffers, uint64_t trials) noexcept {
+    double aj = 1.0, bj = 2.0, cj = 0.0;
+    for (uint64_t k = 0; k < trials; k++) {
+        cj = aj;
+        bj = streamScalar * cj;
+        cj = aj + bj;
+        aj = bj + streamScalar * cj;
+    }
+    auto a = reinterpret_cast<const double *>(&ram[buffers.a]);
+    auto b = reinterpret_cast<const double *>(&ram[buffers.b]);
+    auto c = reinterpret_cast<const double *>(&ram[buffers.c]);
+    const double epsilon = 1e-13;
+    for (uint64_t i = 0; i < buffers.count; i++) {
+        if (std::fabs(a[i] - aj) > epsilon * aj || std::fabs(b[i] - bj) > epsilon * bj || std::fabs(c[i] - cj) > epsilon * cj) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Builds a single random cycle through every cache line of the chase region
+// with Sattolo's algorithm. Each line holds the offset of the next one, so the
+// same chain works for the guest and the host.
+static void initChase(uint8_t *ram, const Buffers& buffers) {
+    std::vector<uint64_t> next(buffers.chaseLines);
+    for (uint64_t i = 0; i < buffers.chaseLines; i++) {
+        next[i] = i;
+    }
+    std::mt19937_64 rng(0x5EED);
+    for (uint64_t i = buffers.chaseLines - 1; i > 0; i--) {
+        std::uniform_int_distribution<uint64_t> dist(0, i - 1);
+        std::swap(next[i], next[dist(rng)]);
+    }
+    for (uint64_t i = 0; i < buffers.chaseLines; i++) {
+        *reinterpret_cast<uint64_t *>(&ram[buffers.a + i * 64]) = next[i] * 64;
+    }
+}
+
+// ----- Native kernels -----------------------------------------------------------------------------------------------------------
+
+static volatile uint64_t nativeSink;
+
+static double timeNs(std::chrono::steady_clock::time_point start) noexcept {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double runNative(uint8_t *ram, const Buffers& buffers, Command command) noexcept {
+    auto a = reinterpret_cast<double *>(&ram[buffers.a]);
+    auto b = reinterpret_cast<double *>(&ram[buffers.b]);
+    auto c = reinterpret_cast<double *>(&ram[buffers.c]);
+    const uint64_t n = buffers.count;
+    const double s = streamScalar;
+
+    const auto start = std::chrono::steady_clock::now();
+    switch (command) {
+    case CMD_COPY: for (uint64_t i = 0; i < n; i++) c[i] = a[i]; break;
+    case CMD_SCALE: for (uint64_t i = 0; i < n; i++) b[i] = s * c[i]; break;
+    case CMD_ADD: for (uint64_t i = 0; i < n; i++) c[i] = a[i] + b[i]; break;
+    case CMD_TRIAD: for (uint64_t i = 0; i < n; i++) a[i] = b[i] + s * c[i]; break;
+    case CMD_CHASE:
+    {
+        const uint8_t *base = &ram[buffers.a];
+        uint64_t p = 0;
+        for (uint64_t i = 0; i < loadsPerRun; i++) {
+            p = *reinterpret_cast<const uint64_t *>(&base[p]);
+        }
+        nativeSink = p;
+        break;
+    }
+    case CMD_STRIDE:
+    {
+        const uint8_t *base = &ram[buffers.a];
+        uint64_t sum = 0;
+        for (uint64_t pass = 0; pass < buffers.stridePasses; pass++) {
+            for (uint64_t offset = 0; offset < buffers.strideSize; offset += buffers.stride) {
+                sum += *reinterpret_cast<const uint64_t *>(&base[offset]);
+            }
+        }
+        nativeSink = sum;
+        break;
+    }
+    default:
+        break;
+    }
+    return timeNs(start);
+}
+
+// ----- Guest --------------------------------------------------------------------------------------------------------------------
+
+// Runs one command in the guest and returns the time it took in ns, or a
+// negative value if the guest stopped for anything other than the HLT at the
+// end of the command
+static double runGuest(VirtualProcessor& vp, Params& params, const Buffers& buffers, Command command) noexcept {
+    params.command = command;
+    params.a = buffers.a;
+    params.b = buffers.b;
+    params.c = buffers.c;
+    params.count = (command == CMD_CHASE) ? loadsPerRun : buffers.count;
+    params.passes = buffers.stridePasses;
+    params.stride = buffers.stride;
+    params.size = buffers.strideSize;
+    params.scalar = streamScalar;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (;;) {
+        if (vp.Run() != VPExecutionStatus::OK) {
+            printf("failed to run the virtual processor\n");
+            return -1.0;
+        }
+        const auto reason = vp.GetVMExitInfo().reason;
+        if (reason == VMExitReason::HLT) {
+            break;
+        }
+        if (reason != VMExitReason::Cancelled && reason != VMExitReason::Interrupt) {
+            printf("unexpected VM exit: %s\n", reason_str(reason));
+            return -1.0;
+        }
+    }
+    return timeNs(start);
+}
+
+// Runs every kernel the given number of times and keeps the best time of
+// each. run executes one command on the buffers in ram and returns its time in
+// ns, or a negative value on failure.
+template<typename F>
+static Results measure(uint8_t *ram, const Buffers& buffers, uint64_t trials, F run) {
+    Results results;
+    const uint64_t strideLoads = buffers.stridePasses * (buffers.strideSize / buffers.stride);
+    initArrays(ram, buffers);
+    for (uint64_t k = 0; k < trials; k++) {
+        for (size_t kernel = 0; kernel < 4; kernel++) {
+            const double ns = run((Command)(CMD_COPY + kernel));
+            if (ns < 0.0) {
+                return results;
+            }
+            if (k == 0 || ns < results.kernelNs[kernel]) {
+                results.kernelNs[kernel] = ns;
+            }
+        }
+    }
+    results.valid = checkArrays(ram, buffers, trials);
+
+    initChase(ram, buffers);
+    for (uint64_t k = 0; k < trials; k++) {
+        const double ns = run(CMD_CHASE) / loadsPerRun;
+        if (ns < 0.0) {
+            return results;
+        }
+        results.chaseNs = (k == 0) ? ns : std::min(results.chaseNs, ns);
+    }
+    for (uint64_t k = 0; k < trials; k++) {
+        const double ns = run(CMD_STRIDE) / strideLoads;
+        if (ns < 0.0) {
+            return results;
+        }
+        results.strideNs = (k == 0) ? ns : std::min(results.strideNs, ns);
+    }
+    results.ran = true;
+    return results;
+}
+
+// Creates a VM with the given memory as RAM, boots it with the given page
+// layout and measures every kernel in it
+static Results measureGuest(Platform& platform, HostMemory& memory, const Buffers& buffers, PageLayout layout, uint64_t trials) {
+    Results results;
+    VMSpecifications vmSpecs = { 0 };
+    vmSpecs.numProcessors = 1;
+    auto opt_vm = platform.CreateVM(vmSpecs);
+    if (!opt_vm) {
+        printf("failed to create VM\n");
+        return results;
+    }
+    auto& vm = opt_vm->get();
+
+    uint8_t *ram = memory.Data();
+    const uint64_t ramSize = memory.Size();
+    auto memMapStatus = vm.MapGuestMemory(0, ramSize, MemoryFlags::Read | MemoryFlags::Write | MemoryFlags::Execute, ram);
+    if (memMapStatus != MemoryMappingStatus::OK) {
+        printf("failed to map RAM: ");
+        printMemoryMappingStatus(memMapStatus);
+        platform.FreeVM(vm);
+        return results;
+    }
+
+    GuestMemory guestMemory;
+    guestMemory.AddRegion(0, ramSize, ram);
+    PageTableBuilder pageTables(guestMemory, pageTableArea, pageTableAreaSize);
+    pageTables.UseLargePages(layout != PageLayout::Pages4K);
+    pageTables.UseHugePages(layout == PageLayout::Pages1G);
+
+    auto& vp = vm.GetVirtualProcessor(0)->get();
+    auto& params = *reinterpret_cast<Params *>(&ram[paramsAddress]);
+    // Boot directly into long mode with all of RAM identity-mapped with the
+    // pages the layout calls for
+    if (!pageTables.Create() || !pageTables.Map(0, 0, ramSize, PageTableBuilder::PTE_WRITE)) {
+        printf("failed to build page tables\n");
+    }
+    else if (!bootLongMode(vp, pageTables, ram, gdtAddress, programBase, stackTop)) {
+        printf("failed to set up the virtual processor for long mode\n");
+    }
+    else {
+        printf("%" PRIu64 " 4 KiB, %" PRIu64 " 2 MiB and %" PRIu64 " 1 GiB pages\n",
+            pageTables.NumPages4K(), pageTables.NumPages2M(), pageTables.NumPages1G());
+
+        // Get through the guest's setup code to the first HLT before timing anything
+        if (runGuest(vp, params, buffers, CMD_NOP) >= 0.0) {
+            results = measure(ram, buffers, trials, [&](Command command) { return runGuest(vp, params, buffers, command); });
+        }
+    }
+
+    platform.FreeVM(vm);
+    return results;
+}
+
+// ----- Report -------------------------------------------------------------------------------------------------------------------
+
+static void printHeader() {
+    printf("%-12s %-6s %9s %9s %9s %9s %10s %10s\n", "backing", "pages", "copy", "scale", "add", "triad", "chase", "stride");
+    printf("%-12s %-6s %9s %9s %9s %9s %10s %10s\n", "", "", "GB/s", "GB/s", "GB/s", "GB/s", "ns/load", "ns/load");
+}
+
+static void printResults(const char *backing, const char *pages, const Results& results, const Buffers& buffers) {
+    printf("%-12s %-6s", backing, pages);
+    if (!results.ran) {
+        printf(" failed\n");
+        return;
+    }
+    for (size_t kernel = 0; kernel < 4; kernel++) {
+        printf(" %9.2f", (double)(kernelBytes[kernel] * buffers.count) / results.kernelNs[kernel]);
+    }
+    printf(" %10.2f %10.2f%s\n", results.chaseNs, results.strideNs, results.valid ? "" : "  (invalid STREAM results)");
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    {
+        int result = parseOptions(argc, argv, options);
+        if (result <= 0) {
+            return result;
+        }
+    }
+
+    std::vector<uint8_t> program;
+    if (!loadFile(options.programPath, program, programMaxSize)) {
+        printf("fatal: could not read guest program from %s\n", options.programPath);
+        return -1;
+    }
+
+    // ----- Memory layout ----------------------------------------------------------------------------------------------------
+
+    const uint64_t MiB = 1024 * 1024;
+    Buffers buffers;
+    buffers.count = options.arraySizeMiB * MiB / sizeof(double);
+    buffers.a = bufferBase;
+    buffers.b = buffers.a + options.arraySizeMiB * MiB;
+    buffers.c = buffers.b + options.arraySizeMiB * MiB;
+    buffers.chaseLines = options.chaseSizeMiB * MiB / 64;
+    buffers.strideSize = options.strideSizeMiB * MiB;
+    buffers.stride = options.stride;
+    buffers.stridePasses = std::max<uint64_t>(1, loadsPerRun / (buffers.strideSize / buffers.stride));
+
+    // 1 GiB pages only map whole, aligned gigabytes
+    const uint64_t bufferSize = std::max({ 3 * options.arraySizeMiB, options.chaseSizeMiB, options.strideSizeMiB }) * MiB;
+    uint64_t ramSize = bufferBase + bufferSize;
+    const bool hugeGuestPages = std::find(options.layouts.begin(), options.layouts.end(), PageLayout::Pages1G) != options.layouts.end();
+    const uint64_t ramAlignment = hugeGuestPages ? 1024 * MiB : 2 * MiB;
+    ramSize = (ramSize + ramAlignment - 1) & ~(ramAlignment - 1);
+
+    // With 4 KiB pages, every 2 MiB of RAM takes one page table
+    if (ramSize / 512 + 16 * PAGE_SIZE > pageTableAreaSize) {
+        printf("fatal: %" PRIu64 " MiB of RAM is too large for the page table area\n", ramSize / MiB);
+        return -1;
+    }
+    printf("Guest RAM: %" PRIu64 " MiB; STREAM arrays: 3 x %" PRIu64 " MiB; chase region: %" PRIu64 " MiB; stride region: %" PRIu64 " MiB, %" PRIu64 "-byte stride\n\n",
+        ramSize / MiB, options.arraySizeMiB, options.chaseSizeMiB, options.strideSizeMiB, options.stride);
+
+    // ----- Hypervisor platform initialization -------------------------------------------------------------------------------
+
+    printf("Loading virtualization platforms... ");
+
+    const size_t platformIndex = selectPlatform(options.platformName);
+    if (platformIndex == SIZE_MAX) {
+        printf("none found\n");
+        return -1;
+    }
+    Platform& platform = PlatformFactories[platformIndex]();
+    printf("%s loaded successfully\n\n", platform.GetName().c_str());
+
+    // ----- Benchmarks -------------------------------------------------------------------------------------------------------
+
+    struct Row {
+        std::string backing;
+        const char *pages;
+        Results results;
+    };
+    std::vector<Row> rows;
+    bool failed = false;
+    for (auto& backing : options.backings) {
+        const std::string name = backing.Name();
+        HostMemory memory;
+        printf("%s: ", name.c_str());
+        if (!memory.Allocate(backing, (size_t)ramSize)) {
+            printf("skipped, %s\n", memory.Detail().c_str());
+            continue;
+        }
+        printf("%s\n", memory.Detail().c_str());
+        memcpy(&memory.Data()[programBase], program.data(), program.size());
+
+        if (options.native) {
+            printf("  native... ");
+            Results results = measure(memory.Data(), buffers, options.trials, [&](Command command) { return runNative(memory.Data(), buffers, command); });
+            printf("done\n");
+            rows.push_back({ name, "native", results });
+            failed |= !results.valid;
+        }
+        for (auto layout : options.layouts) {
+            printf("  guest with %s pages... ", layoutName(layout));
+            Results results = measureGuest(platform, memory, buffers, layout, options.trials);
+            rows.push_back({ name, layoutName(layout), results });
+            failed |= !results.ran || !results.valid;
+        }
+    }
+
+    printf("\n");
+    printHeader();
+    for (auto& row : rows) {
+        printResults(row.backing.c_str(), row.pages, row.results, buffers);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,176 @@
+; Compile with NASM:
+;   $ nasm membench.asm -o membench.bin
+
+; Guest side of the memory benchmark. The host boots the processor directly
+; into 64-bit mode at Entry with all of RAM identity-mapped, writes a command
+; and its arguments to the parameter block, and runs the guest until it halts.
+; Each command runs one kernel once; the host times the run.
+[BITS 64]
+org 0x10000
+
+; Parameter block, matching the Params struct in mem_bench.cpp
+%define PARAMS          0x2000
+%define P_COMMAND       PARAMS + 0x00
+%define P_A             PARAMS + 0x08   ; Address of array A, or of the chase or stride region
+%define P_B             PARAMS + 0x10
+%define P_C             PARAMS + 0x18
+%define P_COUNT         PARAMS + 0x20   ; Elements per array, or loads for the pointer chase
+%define P_PASSES        PARAMS + 0x28   ; Passes over the stride region
+%define P_STRIDE        PARAMS + 0x30   ; Bytes between stride loads
+%define P_SIZE          PARAMS + 0x38   ; Size of the stride region in bytes
+%define P_SCALAR        PARAMS + 0x40   ; Double precision scalar for Scale and Triad
+%define P_RESULT        PARAMS + 0x48   ; Written by the guest so the loads cannot be skipped
+
+; Commands
+%define CMD_NOP         0
+%define CMD_COPY        1               ; c[i] = a[i]
+%define CMD_SCALE       2               ; b[i] = s * c[i]
+%define CMD_ADD         3               ; c[i] = a[i] + b[i]
+%define CMD_TRIAD       4               ; a[i] = b[i] + s * c[i]
+%define CMD_CHASE       5               ; p = *(a + p), count times
+%define CMD_STRIDE      6               ; load a[0], a[stride], ... over size bytes, passes times
+%define CMD_COUNT       7
+
+; The STREAM kernels process four doubles per iteration, so the arrays must be
+; 16-byte aligned and hold a multiple of four elements.
+
+Entry:
+    ; Enable SSE: clear CR0.EM, set CR0.MP, set CR4.OSFXSR and CR4.OSXMMEXCPT
+    mov rax, cr0
+    and ax, ~(1 << 2)
+    or ax, (1 << 1)
+    mov cr0, rax
+    mov rax, cr4
+    or ax, (3 << 9)
+    mov cr4, rax
+
+Main:
+    mov rax, [P_COMMAND]
+    cmp rax, CMD_COUNT
+    jae Done
+    jmp [Commands + rax * 8]
+
+Done:
+    hlt                     ; Let the host stop the clock and set up the next command
+    jmp Main
+
+Commands:
+    dq Done
+    dq Copy
+    dq Scale
+    dq Add
+    dq Triad
+    dq Chase
+    dq Stride
+
+Copy:
+    mov rsi, [P_A]
+    mov rdi, [P_C]
+    mov rcx, [P_COUNT]
+    shl rcx, 3
+    xor rax, rax
+.loop:
+    movapd xmm0, [rsi + rax]
+    movapd xmm1, [rsi + rax + 16]
+    movapd [rdi + rax], xmm0
+    movapd [rdi + rax + 16], xmm1
+    add rax, 32
+    cmp rax, rcx
+    jb .loop
+    jmp Done
+
+Scale:
+    movsd xmm7, [P_SCALAR]
+    unpcklpd xmm7, xmm7
+    mov rsi, [P_C]
+    mov rdi, [P_B]
+    mov rcx, [P_COUNT]
+    shl rcx, 3
+    xor rax, rax
+.loop:
+    movapd xmm0, [rsi + rax]
+    movapd xmm1, [rsi + rax + 16]
+    mulpd xmm0, xmm7
+    mulpd xmm1, xmm7
+    movapd [rdi + rax], xmm0
+    movapd [rdi + rax + 16], xmm1
+    add rax, 32
+    cmp rax, rcx
+    jb .loop
+    jmp Done
+
+Add:
+    mov rsi, [P_A]
+    mov rdx, [P_B]
+    mov rdi, [P_C]
+    mov rcx, [P_COUNT]
+    shl rcx, 3
+    xor rax, rax
+.loop:
+    movapd xmm0, [rsi + rax]
+    movapd xmm1, [rsi + rax + 16]
+    addpd xmm0, [rdx + rax]
+    addpd xmm1, [rdx + rax + 16]
+    movapd [rdi + rax], xmm0
+    movapd [rdi + rax + 16], xmm1
+    add rax, 32
+    cmp rax, rcx
+    jb .loop
+    jmp Done
+
+Triad:
+    movsd xmm7, [P_SCALAR]
+    unpcklpd xmm7, xmm7
+    mov rsi, [P_B]
+    mov rdx, [P_C]
+    mov rdi, [P_A]
+    mov rcx, [P_COUNT]
+    shl rcx, 3
+    xor rax, rax
+.loop:
+    movapd xmm0, [rdx + rax]
+    movapd xmm1, [rdx + rax + 16]
+    mulpd xmm0, xmm7
+    mulpd xmm1, xmm7
+    addpd xmm0, [rsi + rax]
+    addpd xmm1, [rsi + rax + 16]
+    movapd [rdi + rax], xmm0
+    movapd [rdi + rax + 16], xmm1
+    add rax, 32
+    cmp rax, rcx
+    jb .loop
+    jmp Done
+
+    ; The region holds a random cycle of offsets built by the host, one per
+    ; cache line, so every load depends on the previous one and misses
+Chase:
+    mov rsi, [P_A]
+    mov rcx, [P_COUNT]
+    xor rax, rax
+.loop:
+    mov rax, [rsi + rax]
+    dec rcx
+    jnz .loop
+    mov [P_RESULT], rax
+    jmp Done
+
+    ; With a stride of a page or more, every load touches a different page,
+    ; so the region stops fitting in the TLB long before it stops fitting in
+    ; the caches
+Stride:
+    mov rsi, [P_A]
+    mov r8, [P_PASSES]
+    mov r9, [P_STRIDE]
+    mov r10, [P_SIZE]
+    xor rdx, rdx
+.pass:
+    xor rax, rax
+.loop:
+    add rdx, [rsi + rax]
+    add rax, r9
+    cmp rax, r10
+    jb .loop
+    dec r8
+    jnz .pass
+    mov [P_RESULT], rdx
+    jmp Done
@@ -0,0 +1,168 @@
+/*
+Defines a child process with its output redirected to a file.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "child_process.hpp"
+
+#if defined(_WIN32)
+#elif defined(__linux__) || defined(__APPLE__)
+#  include <fcntl.h>
+#  include <signal.h>
+#  include <spawn.h>
+#  include <sys/wait.h>
+#  include <unistd.h>
+extern char **environ;
+#else
+#  error Unsupported platform
+#endif
+
+#if defined(_WIN32)
+
+// Quotes an argument following the rules of CommandLineToArgvW
+static void appendQuoted(std::string& cmdLine, const std::string& arg) {
+    if (!cmdLine.empty()) {
+        cmdLine.push_back(' ');
+    }
+    if (!arg.empty() && arg.find_first_of(" \t\"") == std::string::npos) {
+        cmdLine += arg;
+        return;
+    }
+    cmdLine.push_back('"');
+    size_t backslashes = 0;
+    for (char c : arg) {
+        if (c == '\\') {
+            backslashes++;
+            continue;
+        }
+        cmdLine.append((c == '"') ? backslashes * 2 + 1 : backslashes, '\\');
+        backslashes = 0;
+        cmdLine.push_back(c);
+    }
+    cmdLine.append(backslashes * 2, '\\');
+    cmdLine.push_back('"');
+}
+
+ChildProcess::~ChildProcess() noexcept {
+    if (m_process != NULL) {
+        CloseHandle(m_process);
+    }
+}
+
+bool ChildProcess::Start(const std::vector<std::string>& args, const char *logPath) noexcept {
+    std::string cmdLine;
+    for (auto& arg : args) {
+        appendQuoted(cmdLine, arg);
+    }
+
+    SECURITY_ATTRIBUTES sa = { sizeof(sa), NULL, TRUE };
+    HANDLE log = CreateFileA(logPath, GENERIC_WRITE, FILE_SHARE_READ, &sa, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (log == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    STARTUPINFOA si = { sizeof(si) };
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    si.hStdOutput = log;
+    si.hStdError = log;
+    PROCESS_INFORMATION pi;
+    const BOOL created = CreateProcessA(NULL, &cmdLine[0], NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi);
+    CloseHandle(log);
+    if (!created) {
+        return false;
+    }
+    CloseHandle(pi.hThread);
+    m_process = pi.hProcess;
+    return true;
+}
+
+bool ChildProcess::Poll(int& exitCode) noexcept {
+    if (WaitForSingleObject(m_process, 0) != WAIT_OBJECT_0) {
+        return false;
+    }
+    DWORD code;
+    exitCode = GetExitCodeProcess(m_process, &code) ? (int)code : -1;
+    return true;
+}
+
+void ChildProcess::Kill() noexcept {
+    TerminateProcess(m_process, 1);
+}
+
+#else
+
+ChildProcess::~ChildProcess() noexcept {
+    // Reap the process so that it does not linger as a zombie
+    if (m_pid > 0) {
+        Kill();
+        waitpid(m_pid, nullptr, 0);
+    }
+}
+
+bool ChildProcess::Start(const std::vector<std::string>& args, const char *logPath) noexcept {
+    std::vector<char *> argv;
+    for (auto& arg : args) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, logPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+    const int result = posix_spawn(&m_pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (result != 0) {
+        m_pid = -1;
+        return false;
+    }
+    return true;
+}
+
+bool ChildProcess::Poll(int& exitCode) noexcept {
+    int status;
+    const pid_t pid = waitpid(m_pid, &status, WNOHANG);
+    if (pid == 0) {
+        return false;
+    }
+    if (pid < 0) {
+        exitCode = -1;
+    }
+    else if (WIFEXITED(status)) {
+        exitCode = WEXITSTATUS(status);
+    }
+    else {
+        exitCode = 128 + WTERMSIG(status);
+    }
+    m_pid = -1;
+    return true;
+}
+
+void ChildProcess::Kill() noexcept {
+    if (m_pid > 0) {
+        kill(m_pid, SIGKILL);
+    }
+}
+
+#endif
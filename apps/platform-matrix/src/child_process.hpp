@@ -0,0 +1,58 @@
+/*
+Declares a child process with its output redirected to a file.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#if defined(_WIN32)
+#  include <Windows.h>
+#else
+#  include <sys/types.h>
+#endif
+
+#include <string>
+#include <vector>
+
+// A child process whose standard output and error are written to a file.
+class ChildProcess {
+public:
+    ~ChildProcess() noexcept;
+
+    // Starts the program in args[0] with the given arguments.
+    bool Start(const std::vector<std::string>& args, const char *logPath) noexcept;
+
+    // Checks whether the process has exited without waiting. Once it has,
+    // returns true and sets exitCode. A process killed by a signal reports
+    // 128 plus the signal number, like a shell.
+    bool Poll(int& exitCode) noexcept;
+
+    void Kill() noexcept;
+
+private:
+#if defined(_WIN32)
+    HANDLE m_process = NULL;
+#else
+    pid_t m_pid = -1;
+#endif
+};
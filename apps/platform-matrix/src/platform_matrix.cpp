@@ -0,0 +1,433 @@
+/*
+Entry point of the platform matrix, which runs the demos on every available
+hypervisor platform in parallel and compares the results.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "virt86/virt86.hpp"
+
+#include "utils.hpp"
+#include "result_report.hpp"
+
+#include "child_process.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cinttypes>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef BASIC_DEMO_PATH
+#  define BASIC_DEMO_PATH "virt86-basic-demo"
+#endif
+#ifndef X64_GUEST_PATH
+#  define X64_GUEST_PATH "virt86-x64-guest"
+#endif
+
+using namespace virt86;
+
+struct Options {
+    const char *basicDemoPath = BASIC_DEMO_PATH;
+    const char *x64GuestPath = X64_GUEST_PATH;
+    const char *outputDir = "platform-matrix";
+    const char *csvPath = nullptr;
+    const char *romPath = nullptr;
+    const char *ramPath = nullptr;
+    uint64_t repeat = 1;
+    uint64_t maxJobs = 0;
+    uint64_t timeoutSec = 300;
+    bool list = false;
+};
+
+// One workload on one platform
+struct Job {
+    const char *workload;
+    size_t platform;
+    std::vector<std::string> args;
+    std::string logPath;
+    std::string reportPath;
+
+    std::unique_ptr<ChildProcess> process;
+    std::chrono::steady_clock::time_point start;
+    double seconds = 0.0;
+    bool started = false;
+    bool finished = false;
+    bool timedOut = false;
+    int exitCode = -1;
+    ResultReport report;
+    bool hasReport = false;
+};
+
+static const char *initStatusName(PlatformInitStatus status) noexcept {
+    switch (status) {
+    case PlatformInitStatus::OK: return "available";
+    case PlatformInitStatus::Unavailable: return "unavailable";
+    case PlatformInitStatus::Unsupported: return "unsupported";
+    case PlatformInitStatus::Failed: return "failed to initialize";
+    default: return "unknown status";
+    }
+}
+
+// Turns a platform name into something usable in file names
+static std::string fileSafe(const std::string& name) {
+    std::string result = name;
+    for (auto& c : result) {
+        if (!isalnum((unsigned char)c)) {
+            c = '_';
+        }
+    }
+    return result;
+}
+
+void printUsage(const char *program) {
+    printf("usage: %s [options] [<rom> <ram>]\n", program);
+    printf("\n");
+    printf("Runs the basic-demo scenarios and, given ROM and RAM images, the x64-guest tests\n");
+    printf("on every available hypervisor platform, each in its own process, all in parallel.\n");
+    printf("Prints the results, VM exit counts and run times of every test side by side.\n");
+    printf("\n");
+    printf("options:\n");
+    printf("  -o, --output <dir>      directory for the logs and reports of each run\n");
+    printf("                          (default: platform-matrix)\n");
+    printf("      --csv <path>        also write the comparison as CSV\n");
+    printf("  -n, --repeat <count>    run each basic-demo scenario <count> times (default: 1)\n");
+    printf("  -j, --jobs <count>      maximum number of processes run at once (default: all)\n");
+    printf("  -t, --timeout <s>       kill runs that take longer than this (default: 300)\n");
+    printf("      --basic-demo <path> basic-demo executable (default: the one built with this program)\n");
+    printf("      --x64-guest <path>  x64-guest executable (default: the one built with this program)\n");
+    printf("  -l, --list              list the platforms and their status and exit\n");
+    printf("  -h, --help              show this message\n");
+}
+
+// Returns 1 if the program should continue, 0 if it should exit successfully
+// and -1 on invalid arguments.
+int parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (strcmp(arg, "-l") == 0 || strcmp(arg, "--list") == 0) {
+            options.list = true;
+            continue;
+        }
+
+        const char **path = nullptr;
+        if (strcmp(arg, "-o") == 0 || strcmp(arg, "--output") == 0) {
+            path = &options.outputDir;
+        }
+        else if (strcmp(arg, "--csv") == 0) {
+            path = &options.csvPath;
+        }
+        else if (strcmp(arg, "--basic-demo") == 0) {
+            path = &options.basicDemoPath;
+        }
+        else if (strcmp(arg, "--x64-guest") == 0) {
+            path = &options.x64GuestPath;
+        }
+        if (path != nullptr) {
+            if (++i >= argc) {
+                printf("fatal: %s requires an argument\n", arg);
+                return -1;
+            }
+            *path = argv[i];
+            continue;
+        }
+
+        uint64_t *value;
+        if (strcmp(arg, "-n") == 0 || strcmp(arg, "--repeat") == 0) {
+            value = &options.repeat;
+        }
+        else if (strcmp(arg, "-j") == 0 || strcmp(arg, "--jobs") == 0) {
+            value = &options.maxJobs;
+        }
+        else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--timeout") == 0) {
+            value = &options.timeoutSec;
+        }
+        else if (arg[0] == '-') {
+            printf("fatal: unknown option: %s\n", arg);
+            printUsage(argv[0]);
+            return -1;
+        }
+        else if (options.romPath == nullptr) {
+            options.romPath = arg;
+            continue;
+        }
+        else if (options.ramPath == nullptr) {
+            options.ramPath = arg;
+            continue;
+        }
+        else {
+            printf("fatal: unexpected argument: %s\n", arg);
+            return -1;
+        }
+        if (++i >= argc) {
+            printf("fatal: %s requires an argument\n", arg);
+            return -1;
+        }
+        char *end;
+        *value = strtoull(argv[i], &end, 0);
+        if (*end != '\0' || *value == 0) {
+            printf("fatal: invalid value for %s: %s\n", arg, argv[i]);
+            return -1;
+        }
+    }
+    if (options.romPath != nullptr && options.ramPath == nullptr) {
+        printf("fatal: the x64-guest tests need both a ROM and a RAM image\n");
+        return -1;
+    }
+    return 1;
+}
+
+// Starts pending jobs and reaps finished ones until all are done
+void runJobs(std::vector<Job>& jobs, const Options& options) {
+    const size_t maxRunning = (options.maxJobs != 0) ? (size_t)options.maxJobs : jobs.size();
+    const auto timeout = std::chrono::seconds(options.timeoutSec);
+    size_t next = 0;
+    size_t running = 0;
+    size_t finished = 0;
+    while (finished < jobs.size()) {
+        while (next < jobs.size() && running < maxRunning) {
+            Job& job = jobs[next++];
+            job.process.reset(new ChildProcess());
+            job.start = std::chrono::steady_clock::now();
+            if (job.process->Start(job.args, job.logPath.c_str())) {
+                job.started = true;
+                running++;
+            }
+            else {
+                printf("Failed to start %s\n", job.args[0].c_str());
+                job.finished = true;
+                finished++;
+            }
+        }
+
+        for (auto& job : jobs) {
+            if (!job.started || job.finished) {
+                continue;
+            }
+            const auto elapsed = std::chrono::steady_clock::now() - job.start;
+            if (!job.timedOut && elapsed > timeout) {
+                job.process->Kill();
+                job.timedOut = true;
+            }
+            if (job.process->Poll(job.exitCode)) {
+                job.seconds = std::chrono::duration<double>(elapsed).count();
+                job.finished = true;
+                job.hasReport = job.report.Load(job.reportPath.c_str());
+                running--;
+                finished++;
+                printf("  %-12s %-40s %s in %.1f s\n", job.workload, PlatformFactories[job.platform]().GetName().c_str(),
+                    job.timedOut ? "timed out" : (job.exitCode == 0) ? "done" : "failed", job.seconds);
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+}
+
+// Describes how a run ended
+static std::string jobStatus(const Job& job) {
+    char status[64];
+    if (!job.started) snprintf(status, sizeof(status), "not started");
+    else if (job.timedOut) snprintf(status, sizeof(status), "timed out");
+    else if (!job.hasReport) snprintf(status, sizeof(status), "no report (exit code %d)", job.exitCode);
+    else snprintf(status, sizeof(status), "exit code %d", job.exitCode);
+    return status;
+}
+
+// Prints one row per test with the status, average run time and exits on
+// each platform. Returns false if any run or test failed.
+bool printComparison(const std::vector<Job>& jobs, const std::vector<size_t>& platforms, const char *workload) {
+    std::vector<const Job *> columns;
+    for (size_t platform : platforms) {
+        for (auto& job : jobs) {
+            if (job.platform == platform && strcmp(job.workload, workload) == 0) {
+                columns.push_back(&job);
+            }
+        }
+    }
+    if (columns.empty()) {
+        return true;
+    }
+
+    // Tests in the order of the first report that has them
+    std::vector<std::string> tests;
+    for (auto job : columns) {
+        for (auto& result : job->report.Results()) {
+            bool known = false;
+            for (auto& test : tests) {
+                known |= (test == result.name);
+            }
+            if (!known) {
+                tests.push_back(result.name);
+            }
+        }
+    }
+
+    bool ok = true;
+    printf("%s\n", workload);
+    printf("%-12s", "test");
+    for (auto job : columns) {
+        printf(" | %-32.32s", PlatformFactories[job->platform]().GetName().c_str());
+    }
+    printf("\n%-12s", "");
+    for (size_t i = 0; i < columns.size(); i++) {
+        printf(" | %-8s %12s %10s", "status", "avg us", "exits");
+    }
+    printf("\n");
+    for (auto& test : tests) {
+        printf("%-12s", test.c_str());
+        for (auto job : columns) {
+            const TestResult *found = nullptr;
+            for (auto& result : job->report.Results()) {
+                if (result.name == test) {
+                    found = &result;
+                }
+            }
+            if (found == nullptr) {
+                printf(" | %-8s %12s %10s", "-", "-", "-");
+                continue;
+            }
+            ok &= (found->status != TestStatus::Failed);
+            if (found->runs == 0) {
+                printf(" | %-8s %12s %10s", ResultReport::StatusName(found->status), "-", "-");
+            }
+            else {
+                printf(" | %-8s %12.1f %10" PRIu64, ResultReport::StatusName(found->status),
+                    found->totalNs / 1000.0 / found->runs, found->exits / found->runs);
+            }
+        }
+        printf("\n");
+    }
+    printf("%-12s", "run");
+    for (auto job : columns) {
+        printf(" | %-32.32s", jobStatus(*job).c_str());
+        ok &= (job->hasReport && !job->timedOut);
+    }
+    printf("\n\n");
+    return ok;
+}
+
+bool writeCSV(const std::vector<Job>& jobs, const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        return false;
+    }
+    fprintf(fp, "workload,platform,test,status,runs,exits,total_ns,min_ns,max_ns\n");
+    for (auto& job : jobs) {
+        const std::string platform = PlatformFactories[job.platform]().GetName();
+        for (auto& result : job.report.Results()) {
+            fprintf(fp, "%s,\"%s\",%s,%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+                job.workload, platform.c_str(), result.name.c_str(), ResultReport::StatusName(result.status),
+                result.runs, result.exits, result.totalNs, result.minNs, result.maxNs);
+        }
+    }
+    return fclose(fp) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    {
+        int result = parseOptions(argc, argv, options);
+        if (result <= 0) {
+            return result;
+        }
+    }
+
+    // Each run picks its platform by name, so only the platforms available here are tried
+    printf("Platforms:\n");
+    std::vector<size_t> platforms;
+    for (size_t i = 0; i < array_size(PlatformFactories); i++) {
+        const Platform& platform = PlatformFactories[i]();
+        printf("  %-40s %s\n", platform.GetName().c_str(), initStatusName(platform.GetInitStatus()));
+        if (platform.GetInitStatus() == PlatformInitStatus::OK) {
+            platforms.push_back(i);
+        }
+    }
+    printf("\n");
+    if (options.list) {
+        return 0;
+    }
+    if (platforms.empty()) {
+        printf("fatal: no platforms available\n");
+        return -1;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(options.outputDir, ec);
+    if (ec) {
+        printf("fatal: could not create %s: %s\n", options.outputDir, ec.message().c_str());
+        return -1;
+    }
+
+    std::vector<Job> jobs;
+    for (size_t platform : platforms) {
+        const std::string name = PlatformFactories[platform]().GetName();
+        const std::string base = std::string(options.outputDir) + "/" + fileSafe(name);
+
+        jobs.emplace_back();
+        Job& demo = jobs.back();
+        demo.workload = "basic-demo";
+        demo.platform = platform;
+        demo.logPath = base + "-basic-demo.log";
+        demo.reportPath = base + "-basic-demo.tsv";
+        demo.args = { options.basicDemoPath, "-q", "--platform", name, "--report", demo.reportPath,
+            "--repeat", std::to_string(options.repeat) };
+
+        if (options.romPath != nullptr) {
+            jobs.emplace_back();
+            Job& guest = jobs.back();
+            guest.workload = "x64-guest";
+            guest.platform = platform;
+            guest.logPath = base + "-x64-guest.log";
+            guest.reportPath = base + "-x64-guest.tsv";
+            guest.args = { options.x64GuestPath, "--platform", name, "--report", guest.reportPath,
+                options.romPath, options.ramPath };
+        }
+    }
+
+    // Stale reports would be mistaken for results of this run
+    for (auto& job : jobs) {
+        std::filesystem::remove(job.reportPath, ec);
+    }
+
+    printf("Running %zu workloads on %zu platforms...\n", jobs.size(), platforms.size());
+    const auto start = std::chrono::steady_clock::now();
+    runJobs(jobs, options);
+    printf("Finished in %.1f s; logs and reports are in %s\n\n",
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), options.outputDir);
+
+    bool ok = printComparison(jobs, platforms, "basic-demo");
+    ok &= printComparison(jobs, platforms, "x64-guest");
+
+    if (options.csvPath != nullptr && !writeCSV(jobs, options.csvPath)) {
+        printf("Failed to write %s\n", options.csvPath);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,284 @@
+/*
+Entry point of the scheduling demo. Runs several guests that spin in loops
+of different lengths on a small pool of host threads and reports the CPU
+share and scheduling latency of each guest.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "virt86/virt86.hpp"
+
+#include "print_helpers.hpp"
+#include "align_alloc.hpp"
+#include "utils.hpp"
+#include "io_bus.hpp"
+#include "vcpu_scheduler.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cinttypes>
+#include <memory>
+#include <vector>
+
+using namespace virt86;
+
+// Each guest counts EBX down to zero with a LOOP instruction, then writes to
+// port 0x80 and starts over. Short loops exit frequently; long loops keep
+// the virtual processor running for tens of milliseconds between exits.
+const uint16_t progressPort = 0x80;
+const uint32_t shortLoop = 0x1000;
+const uint32_t longLoop = 0x2000000;
+
+struct Options {
+    uint64_t numGuests = 8;
+    uint64_t numThreads = 2;
+    uint64_t quantumUs = 1000;
+    uint64_t durationMs = 2000;
+    bool weighted = false;
+    bool signalPreempt = false;
+};
+
+struct GuestContext {
+    uint32_t loopCount;
+    uint64_t loops = 0;
+    bool unexpectedExit = false;
+};
+
+void printUsage(const char *program) {
+    printf("usage: %s [options]\n", program);
+    printf("\n");
+    printf("Runs several guests on a small pool of host threads and reports the CPU share\n");
+    printf("and scheduling latency of each guest. Odd guests run long loops that rarely exit.\n");
+    printf("\n");
+    printf("options:\n");
+    printf("  -g, --guests <count>    number of guests (default: 8)\n");
+    printf("  -t, --threads <count>   number of host threads running guests (default: 2)\n");
+    printf("  -q, --quantum <us>      time slice length in microseconds (default: 1000)\n");
+    printf("  -d, --duration <ms>     how long to run the guests in milliseconds (default: 2000)\n");
+    printf("  -w, --weighted          give odd guests twice the weight of even guests\n");
+    printf("      --signal-preempt    interrupt guests that overrun their slice with a signal\n");
+    printf("                          (Linux only)\n");
+    printf("  -h, --help              show this message\n");
+}
+
+// Returns 1 if the program should continue, 0 if it should exit successfully
+// and -1 on invalid arguments.
+int parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (strcmp(arg, "-w") == 0 || strcmp(arg, "--weighted") == 0) {
+            options.weighted = true;
+            continue;
+        }
+        if (strcmp(arg, "--signal-preempt") == 0) {
+            options.signalPreempt = true;
+            continue;
+        }
+
+        uint64_t *value;
+        if (strcmp(arg, "-g") == 0 || strcmp(arg, "--guests") == 0) {
+            value = &options.numGuests;
+        }
+        else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--threads") == 0) {
+            value = &options.numThreads;
+        }
+        else if (strcmp(arg, "-q") == 0 || strcmp(arg, "--quantum") == 0) {
+            value = &options.quantumUs;
+        }
+        else if (strcmp(arg, "-d") == 0 || strcmp(arg, "--duration") == 0) {
+            value = &options.durationMs;
+        }
+        else {
+            printf("fatal: unknown option: %s\n", arg);
+            printUsage(argv[0]);
+            return -1;
+        }
+        if (++i >= argc) {
+            printf("fatal: %s requires an argument\n", arg);
+            return -1;
+        }
+        char *end;
+        *value = strtoull(argv[i], &end, 0);
+        if (*end != '\0' || *value == 0) {
+            printf("fatal: invalid value for %s: %s\n", arg, argv[i]);
+            return -1;
+        }
+    }
+    return 1;
+}
+
+VCPUScheduler::ExitAction handleExit(void *context, VirtualProcessor& vp, const VMExitInfo& exitInfo) {
+    auto& guest = *reinterpret_cast<GuestContext *>(context);
+    switch (exitInfo.reason) {
+    case VMExitReason::PIO:
+        guest.loops++;
+        return VCPUScheduler::ExitAction::Continue;
+    case VMExitReason::Cancelled:
+    case VMExitReason::Interrupt:
+        return VCPUScheduler::ExitAction::Continue;
+    default:
+        guest.unexpectedExit = true;
+        return VCPUScheduler::ExitAction::Stop;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    {
+        int result = parseOptions(argc, argv, options);
+        if (result <= 0) {
+            return result;
+        }
+    }
+
+    // All guests run the same code from a single ROM page at the top of the
+    // 32-bit address range, starting at the reset vector in real mode
+    const uint64_t romBase = 0xFFFFF000;
+    uint8_t *rom = alignedAlloc(PAGE_SIZE);
+    if (rom == NULL) {
+        printf("fatal: failed to allocate memory for ROM\n");
+        return -1;
+    }
+    memset(rom, 0xf4, PAGE_SIZE);
+    {
+        uint32_t addr = 0xff0;
+#define emit(buf, code) {memcpy(&buf[addr], code, sizeof(code) - 1); addr += sizeof(code) - 1;}
+        emit(rom, "\x66\x89\xd9");  // [0xfff0] mov ecx, ebx
+        emit(rom, "\x67\xe2\xfd");  // [0xfff3] loop $ (using ECX)
+        emit(rom, "\xe6\x80");      // [0xfff6] out 0x80, al
+        emit(rom, "\xeb\xf6");      // [0xfff8] jmp 0xfff0
+#undef emit
+    }
+
+    // ----- Hypervisor platform initialization -------------------------------------------------------------------------------
+
+    printf("Loading virtualization platforms... ");
+
+    bool foundPlatform = false;
+    size_t platformIndex = 0;
+    for (size_t i = 0; i < array_size(PlatformFactories); i++) {
+        const Platform& platform = PlatformFactories[i]();
+        if (platform.GetInitStatus() == PlatformInitStatus::OK) {
+            printf("%s loaded successfully\n", platform.GetName().c_str());
+            foundPlatform = true;
+            platformIndex = i;
+            break;
+        }
+    }
+
+    if (!foundPlatform) {
+        printf("none found\n");
+        return -1;
+    }
+
+    Platform& platform = PlatformFactories[platformIndex]();
+
+    // Writes to the progress port are dropped; the exit handler counts them
+    IOBus bus;
+
+    VCPUScheduler scheduler((size_t)options.numThreads, options.quantumUs * 1000);
+    if (options.signalPreempt && !scheduler.EnableSignalPreemption()) {
+        printf("fatal: signal preemption is not supported on this platform\n");
+        return -1;
+    }
+
+    std::vector<VirtualMachine *> vms;
+    std::vector<std::unique_ptr<GuestContext>> guests;
+    printf("Creating %" PRIu64 " virtual machines... ", options.numGuests);
+    for (uint64_t i = 0; i < options.numGuests; i++) {
+        VMSpecifications vmSpecs = { 0 };
+        vmSpecs.numProcessors = 1;
+        auto opt_vm = platform.CreateVM(vmSpecs);
+        if (!opt_vm) {
+            printf("failed\n");
+            return -1;
+        }
+        VirtualMachine& vm = opt_vm->get();
+        vms.push_back(&vm);
+
+        auto memMapStatus = vm.MapGuestMemory(romBase, PAGE_SIZE, MemoryFlags::Read | MemoryFlags::Execute, rom);
+        if (memMapStatus != MemoryMappingStatus::OK) {
+            printf("failed to map ROM: ");
+            printMemoryMappingStatus(memMapStatus);
+            return -1;
+        }
+        bus.Attach(vm);
+
+        auto& vp = vm.GetVirtualProcessor(0)->get();
+        auto guest = std::make_unique<GuestContext>();
+        guest->loopCount = (i & 1) ? longLoop : shortLoop;
+        RegValue ebx;
+        ebx.u32 = guest->loopCount;
+        vp.RegWrite(Reg::EBX, ebx);
+
+        char name[32];
+        snprintf(name, sizeof(name), "guest-%" PRIu64 " (%s)", i, (i & 1) ? "long" : "short");
+        const uint32_t weight = (options.weighted && (i & 1)) ? VCPUScheduler::defaultWeight * 2 : VCPUScheduler::defaultWeight;
+        scheduler.AddGuest(name, vp, weight, handleExit, guest.get());
+        guests.push_back(std::move(guest));
+    }
+    printf("succeeded\n");
+
+    // ----- Run --------------------------------------------------------------------------------------------------------------
+
+    printf("Running %" PRIu64 " guests on %" PRIu64 " threads with %" PRIu64 " us slices for %" PRIu64 " ms%s\n\n",
+        options.numGuests, options.numThreads, options.quantumUs, options.durationMs,
+        options.signalPreempt ? ", preempting with signals" : "");
+    scheduler.Run(options.durationMs * 1000000);
+
+    scheduler.PrintStats(stdout);
+    printf("\n");
+
+    const double elapsed = scheduler.ElapsedNs() / 1000000000.0;
+    bool failed = false;
+    for (size_t i = 0; i < guests.size(); i++) {
+        auto& guest = *guests[i];
+        auto& stats = scheduler.Stats(i);
+        printf("%-16s %10.1f M iterations/s%s\n", stats.name.c_str(), (double)guest.loops * guest.loopCount / elapsed / 1000000.0,
+            guest.unexpectedExit ? "  (unexpected VM exit)" : "");
+        failed |= guest.unexpectedExit || stats.failed;
+    }
+    printf("\n");
+
+    // ----- Cleanup ----------------------------------------------------------------------------------------------------------
+
+    printf("Releasing VMs... ");
+    bool freed = true;
+    for (auto vm : vms) {
+        freed &= platform.FreeVM(*vm);
+    }
+    printf(freed ? "succeeded\n" : "failed\n");
+
+    if (alignedFree(rom)) {
+        printf("ROM freed\n");
+    }
+    else {
+        printf("Failed to free ROM\n");
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,496 @@
+/*
+Guest timekeeping benchmark of the virt86 library: measures the cost of reading
+the time through the paravirtual clock, the PIT and the local APIC, and the
+rate of timer interrupts each timer source can deliver.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "virt86/virt86.hpp"
+
+#include "print_helpers.hpp"
+#include "align_alloc.hpp"
+#include "utils.hpp"
+#include "guest_memory.hpp"
+#include "interrupt_controller.hpp"
+#include "io_bus.hpp"
+#include "msr_table.hpp"
+#include "page_table_builder.hpp"
+#include "long_mode.hpp"
+#include "apic_timer.hpp"
+#include "pit.hpp"
+#include "pvclock.hpp"
+#include "tsc_clock.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace virt86;
+
+// Guest RAM layout, matching timebench.asm
+const uint64_t gdtAddress = 0x1000;
+const uint64_t paramsAddress = 0x2000;
+const uint64_t programBase = 0x10000;
+const uint64_t programMaxSize = 0x10000;
+const uint64_t stackTop = 0x100000;
+const uint64_t pageTableArea = 0x100000;
+const uint64_t pageTableAreaSize = 0x100000;
+const uint64_t ramSize = 0x200000;
+
+// Interrupt vectors, matching timebench.asm
+const uint8_t pitVector = 0x20;
+
+// Parameter block written by the host before each run
+struct Params {
+    uint64_t command;
+    uint64_t count;
+    uint64_t arg;
+    uint64_t cycles;
+    uint64_t result;
+    uint64_t errors;
+    uint64_t ticks;
+    uint64_t done;
+};
+
+enum Command : uint64_t {
+    CMD_NOP = 0,
+    CMD_RDTSC = 1,
+    CMD_PVCLOCK = 2,
+    CMD_PORT = 3,
+    CMD_PIT_READ = 4,
+    CMD_APIC_READ = 5,
+    CMD_PIT_IRQ = 6,
+    CMD_APIC_IRQ = 7,
+    CMD_DEADLINE_IRQ = 8,
+};
+
+// Queries that don't exit are cheap enough to run this many times more often
+// than the ones that do, which keeps every run long enough to time
+const uint64_t nonExitingFactor = 100;
+
+// How long the host waits for a timer interrupt while the guest is halted
+// before giving up on a timer source
+const uint64_t haltTimeout = 100000000ull;  // 100 ms
+
+struct Options {
+    const char *platformName = nullptr;
+    const char *programPath = nullptr;
+    uint64_t queries = 100000;
+    uint64_t interrupts = 10000;
+    uint64_t period = 20000;
+    uint64_t trials = 3;
+};
+
+// State shared by all runs of the guest
+struct Guest {
+    VirtualProcessor& vp;
+    Params& params;
+    InterruptController& controller;
+    MSRTable& msrs;
+};
+
+// Outcome of one command
+struct Run {
+    bool ok = false;
+    bool timedOut = false;      // A timer source stopped delivering interrupts
+    uint64_t cycles = 0;
+    uint64_t exits = 0;
+    uint64_t result = 0;
+    uint64_t errors = 0;
+    uint64_t ticks = 0;
+    uint64_t hostTime = 0;      // Controller time when the command finished
+    uint64_t raised = 0;
+    uint64_t coalesced = 0;
+    uint64_t wakeups = 0;       // Of the controller's timer thread
+};
+
+void printUsage(const char *program) {
+    printf("usage: %s [options] <timebench.bin>\n", program);
+    printf("\n");
+    printf("Measures the cost of reading the time in a 64-bit guest through RDTSC, the\n");
+    printf("paravirtual clock page, the paravirtual clock port, the PIT and the local APIC\n");
+    printf("timer, and the rate at which the PIT, the periodic APIC timer and the\n");
+    printf("TSC-deadline timer deliver interrupts.\n");
+    printf("\n");
+    printf("options:\n");
+    printf("  -q, --queries <count>     time queries per run for sources that exit; the\n");
+    printf("                            others make %" PRIu64 " times as many (default: 100000)\n", nonExitingFactor);
+    printf("  -i, --interrupts <count>  timer interrupts per run (default: 10000)\n");
+    printf("      --period <ns>         timer period requested from every source (default: 20000)\n");
+    printf("  -n, --trials <count>      runs of each test; the best is reported (default: 3)\n");
+    printf("      --platform <name>     use the first available platform whose name contains <name>\n");
+    printf("  -h, --help                show this message\n");
+}
+
+// Returns 1 if the program should continue, 0 if it should exit successfully
+// and -1 on invalid arguments.
+int parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (arg[0] != '-') {
+            if (options.programPath != nullptr) {
+                printf("fatal: unexpected argument: %s\n", arg);
+                return -1;
+            }
+            options.programPath = arg;
+            continue;
+        }
+        if (++i >= argc) {
+            printf("fatal: %s requires an argument\n", arg);
+            return -1;
+        }
+        const char *value = argv[i];
+
+        if (strcmp(arg, "--platform") == 0) {
+            options.platformName = value;
+            continue;
+        }
+
+        uint64_t *number;
+        if (strcmp(arg, "-q") == 0 || strcmp(arg, "--queries") == 0) {
+            number = &options.queries;
+        }
+        else if (strcmp(arg, "-i") == 0 || strcmp(arg, "--interrupts") == 0) {
+            number = &options.interrupts;
+        }
+        else if (strcmp(arg, "--period") == 0) {
+            number = &options.period;
+        }
+        else if (strcmp(arg, "-n") == 0 || strcmp(arg, "--trials") == 0) {
+            number = &options.trials;
+        }
+        else {
+            printf("fatal: unknown option: %s\n", arg);
+            printUsage(argv[0]);
+            return -1;
+        }
+        char *end;
+        *number = strtoull(value, &end, 0);
+        if (*end != '\0' || *number == 0) {
+            printf("fatal: invalid value for %s: %s\n", arg, value);
+            return -1;
+        }
+    }
+    if (options.programPath == nullptr) {
+        printf("fatal: no guest program specified\n");
+        printUsage(argv[0]);
+        return -1;
+    }
+    if (options.period > UINT32_MAX) {
+        printf("fatal: the period must fit in the APIC timer's 32-bit count\n");
+        return -1;
+    }
+    return 1;
+}
+
+// ----- Guest --------------------------------------------------------------------------------------------------------------------
+
+// Runs one command in the guest until it reports completion. Pending
+// interrupts are injected before every run, and a halted guest waits for the
+// next one. If none arrives in time, the guest is told to stop waiting.
+static Run runGuest(Guest& guest, Command command, uint64_t count, uint64_t arg) noexcept {
+    auto& params = guest.params;
+    auto& controller = guest.controller;
+    params.command = command;
+    params.count = count;
+    params.arg = arg;
+    params.cycles = 0;
+    params.result = 0;
+    params.errors = 0;
+    params.ticks = 0;
+    params.done = 0;
+
+    Run run;
+    const uint64_t raised = controller.NumRaised();
+    const uint64_t coalesced = controller.NumCoalesced();
+    const uint64_t wakeups = controller.NumTimerWakeups();
+    for (;;) {
+        controller.Deliver(guest.vp);
+        if (guest.vp.Run() != VPExecutionStatus::OK) {
+            printf("failed to run the virtual processor\n");
+            return run;
+        }
+        run.exits++;
+
+        const auto reason = guest.vp.GetVMExitInfo().reason;
+        if (reason == VMExitReason::HLT) {
+            if (params.done) {
+                break;
+            }
+            if (!controller.WaitForInterrupt(haltTimeout)) {
+                run.timedOut = true;
+                params.count = 0;
+            }
+        }
+        else if (reason == VMExitReason::MSRAccess) {
+            if (!guest.msrs.HandleExit(guest.vp)) {
+                printf("failed to emulate MSR access\n");
+                return run;
+            }
+        }
+        else if (reason != VMExitReason::PIO && reason != VMExitReason::MMIO
+            && reason != VMExitReason::Cancelled && reason != VMExitReason::Interrupt) {
+            printf("unexpected VM exit: %s\n", reason_str(reason));
+            return run;
+        }
+    }
+
+    run.ok = true;
+    run.hostTime = controller.Now();
+    run.cycles = params.cycles;
+    run.result = params.result;
+    run.errors = params.errors;
+    run.ticks = params.ticks;
+    run.raised = controller.NumRaised() - raised;
+    run.coalesced = controller.NumCoalesced() - coalesced;
+    run.wakeups = controller.NumTimerWakeups() - wakeups;
+    return run;
+}
+
+// Runs a command the given number of times and keeps the fastest run
+static Run bestOf(Guest& guest, uint64_t trials, Command command, uint64_t count, uint64_t arg) noexcept {
+    Run best;
+    for (uint64_t k = 0; k < trials; k++) {
+        const Run run = runGuest(guest, command, count, arg);
+        if (!run.ok || run.timedOut) {
+            return run;
+        }
+        if (!best.ok || run.cycles < best.cycles) {
+            best = run;
+        }
+    }
+    return best;
+}
+
+// ----- Report -------------------------------------------------------------------------------------------------------------------
+
+static double cyclesToNs(const TSCClock& clock, double cycles) noexcept {
+    return cycles * 1000000000.0 / (double)clock.Frequency();
+}
+
+static void printQuery(const TSCClock& clock, const char *name, const Run& run, uint64_t count) {
+    printf("  %-20s", name);
+    if (!run.ok) {
+        printf(" failed\n");
+        return;
+    }
+    const double cycles = (double)run.cycles / count;
+    printf(" %12.1f %14.1f %13.2f\n", cyclesToNs(clock, cycles), cycles, (double)run.exits / count);
+}
+
+static void printInterrupts(const TSCClock& clock, const char *name, const Run& run, uint64_t periodNs, uint64_t count) {
+    printf("  %-20s", name);
+    if (!run.ok) {
+        printf(" failed\n");
+        return;
+    }
+    if (run.timedOut) {
+        printf(" no interrupts after %" PRIu64 " of %" PRIu64 "\n", run.ticks, count);
+        return;
+    }
+    const double seconds = cyclesToNs(clock, (double)run.cycles) / 1000000000.0;
+    printf(" %12.0f %13.0f %10" PRIu64 " %13.2f %12.2f\n",
+        1000000000.0 / (double)periodNs, (double)run.ticks / seconds, run.coalesced,
+        (double)run.exits / run.ticks, (double)run.wakeups / run.ticks);
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    {
+        int result = parseOptions(argc, argv, options);
+        if (result <= 0) {
+            return result;
+        }
+    }
+
+    std::vector<uint8_t> program;
+    if (!loadFile(options.programPath, program, programMaxSize)) {
+        printf("fatal: could not read guest program from %s\n", options.programPath);
+        return -1;
+    }
+
+    // ----- Hypervisor platform initialization -------------------------------------------------------------------------------
+
+    printf("Loading virtualization platforms... ");
+
+    const size_t platformIndex = selectPlatform(options.platformName);
+    if (platformIndex == SIZE_MAX) {
+        printf("none found\n");
+        return -1;
+    }
+    Platform& platform = PlatformFactories[platformIndex]();
+    printf("%s loaded successfully\n", platform.GetName().c_str());
+
+    // TSC-deadline mode is programmed through an MSR
+    auto& features = platform.GetFeatures();
+    const bool msrExits = BitmaskEnum(features.extendedVMExits).AnyOf(ExtendedVMExit::MSRAccess);
+
+    VMSpecifications vmSpecs = { 0 };
+    vmSpecs.numProcessors = 1;
+    if (msrExits) {
+        vmSpecs.extendedVMExits = ExtendedVMExit::MSRAccess;
+    }
+    auto opt_vm = platform.CreateVM(vmSpecs);
+    if (!opt_vm) {
+        printf("fatal: failed to create VM\n");
+        return -1;
+    }
+    auto& vm = opt_vm->get();
+
+    uint8_t *ram = alignedAlloc(ramSize);
+    if (ram == NULL) {
+        printf("fatal: failed to allocate memory for RAM\n");
+        return -1;
+    }
+    memcpy(&ram[programBase], program.data(), program.size());
+    auto memMapStatus = vm.MapGuestMemory(0, ramSize, MemoryFlags::Read | MemoryFlags::Write | MemoryFlags::Execute, ram);
+    if (memMapStatus != MemoryMappingStatus::OK) {
+        printf("fatal: failed to map RAM: ");
+        printMemoryMappingStatus(memMapStatus);
+        return -1;
+    }
+    auto& vp = vm.GetVirtualProcessor(0)->get();
+
+    // ----- Devices ----------------------------------------------------------------------------------------------------------
+
+    GuestMemory guestMemory;
+    guestMemory.AddRegion(0, ramSize, ram);
+
+    InterruptController controller;
+    controller.Start();
+
+    TSCClock clock;
+    if (!clock.Calibrate(controller, vp)) {
+        printf("fatal: failed to calibrate the TSC\n");
+        return -1;
+    }
+    printf("TSC frequency: %.3f MHz\n", (double)clock.Frequency() / 1000000.0);
+
+    IOBus bus;
+    MSRTable msrs;
+    PIT8254 pit(controller, pitVector);
+    LocalAPICTimer apic(controller, clock);
+    PVClock pvclock(guestMemory, controller, clock);
+    pit.Attach(bus);
+    apic.Attach(bus);
+    if (msrExits) {
+        apic.Attach(msrs);
+    }
+    pvclock.Attach(bus);
+    bus.Attach(vm);
+
+    // Boot directly into long mode with RAM identity-mapped, and the local
+    // APIC page too, uncached
+    PageTableBuilder pageTables(guestMemory, pageTableArea, pageTableAreaSize);
+    if (!pageTables.Create() || !pageTables.Map(0, 0, ramSize, PageTableBuilder::PTE_WRITE)
+        || !pageTables.Map(lapicBaseAddress, lapicBaseAddress, lapicSize, PageTableBuilder::PTE_WRITE | PageTableBuilder::PTE_PCD)) {
+        printf("failed to build page tables\n");
+        return -1;
+    }
+    if (!bootLongMode(vp, pageTables, ram, gdtAddress, programBase, stackTop)) {
+        printf("failed to set up the virtual processor for long mode\n");
+        return -1;
+    }
+
+    Guest guest{ vp, *reinterpret_cast<Params *>(&ram[paramsAddress]), controller, msrs };
+
+    // Get through the guest's setup code, which registers the clock page
+    if (!runGuest(guest, CMD_NOP, 0, 0).ok) {
+        return -1;
+    }
+    if (!pvclock.Enabled()) {
+        printf("fatal: the guest did not register the paravirtual clock page\n");
+        return -1;
+    }
+    printf("Paravirtual clock at 0x%" PRIx64 ", mul 0x%08x, shift %d\n\n", pvclock.Address(), clock.Mul(), clock.Shift());
+
+    // ----- Time queries -----------------------------------------------------------------------------------------------------
+
+    const uint64_t fastQueries = options.queries * nonExitingFactor;
+    printf("Time queries (best of %" PRIu64 ")\n", options.trials);
+    printf("  %-20s %12s %14s %13s\n", "source", "ns/query", "cycles/query", "exits/query");
+
+    bool failed = false;
+    const Run rdtsc = bestOf(guest, options.trials, CMD_RDTSC, fastQueries, 0);
+    printQuery(clock, "rdtsc", rdtsc, fastQueries);
+    const Run pvclockRun = bestOf(guest, options.trials, CMD_PVCLOCK, fastQueries, 0);
+    printQuery(clock, "pvclock page", pvclockRun, fastQueries);
+    const Run port = bestOf(guest, options.trials, CMD_PORT, options.queries, 0);
+    printQuery(clock, "pvclock port", port, options.queries);
+    const Run pitRead = bestOf(guest, options.trials, CMD_PIT_READ, options.queries, 0);
+    printQuery(clock, "PIT latch and read", pitRead, options.queries);
+    const Run apicRead = bestOf(guest, options.trials, CMD_APIC_READ, options.queries, 0);
+    printQuery(clock, "APIC current count", apicRead, options.queries);
+    failed |= !rdtsc.ok || !pvclockRun.ok || !port.ok || !pitRead.ok || !apicRead.ok;
+
+    // The last time read from the clock page should trail the host by little
+    // more than the exit at the end of the run. Calibration error shows up as
+    // a drift that grows with the time since the TSC was calibrated.
+    if (pvclockRun.ok) {
+        const int64_t lag = (int64_t)(pvclockRun.hostTime - pvclockRun.result);
+        printf("\n  pvclock: %" PRIu64 " reads went backwards; last read %.1f us %s the host\n",
+            pvclockRun.errors, std::abs((double)lag) / 1000.0, (lag < 0) ? "ahead of" : "behind");
+        failed |= pvclockRun.errors != 0;
+    }
+
+    // ----- Timer interrupts -------------------------------------------------------------------------------------------------
+
+    // Every source is programmed for the requested period as closely as it
+    // allows; the PIT only counts whole ticks of its 1.19 MHz clock
+    const uint64_t pitDivisor = std::min<uint64_t>(std::max<uint64_t>((options.period * pitFrequency + 500000000ull) / 1000000000ull, 2), 0xFFFF);
+    const uint64_t pitPeriod = pitDivisor * 1000000000ull / pitFrequency;
+    const uint64_t deadlineCycles = std::max<uint64_t>(options.period * clock.Frequency() / 1000000000ull, 1);
+
+    printf("\nTimer interrupts (best of %" PRIu64 ", %" PRIu64 " per run)\n", options.trials, options.interrupts);
+    printf("  %-20s %12s %13s %10s %13s %12s\n", "source", "requested/s", "delivered/s", "coalesced", "exits/irq", "wakeups/irq");
+
+    const Run pitIRQ = bestOf(guest, options.trials, CMD_PIT_IRQ, options.interrupts, pitDivisor);
+    printInterrupts(clock, "PIT", pitIRQ, pitPeriod, options.interrupts);
+    const Run apicIRQ = bestOf(guest, options.trials, CMD_APIC_IRQ, options.interrupts, options.period);
+    printInterrupts(clock, "APIC periodic", apicIRQ, options.period, options.interrupts);
+    failed |= !pitIRQ.ok || pitIRQ.timedOut || !apicIRQ.ok || apicIRQ.timedOut;
+    if (msrExits) {
+        const Run deadlineIRQ = bestOf(guest, options.trials, CMD_DEADLINE_IRQ, options.interrupts, deadlineCycles);
+        printInterrupts(clock, "TSC deadline", deadlineIRQ, options.period, options.interrupts);
+        failed |= !deadlineIRQ.ok || deadlineIRQ.timedOut;
+    }
+    else {
+        printf("  %-20s skipped, the platform has no MSR access exits\n", "TSC deadline");
+    }
+
+    printf("\nAPIC timer: %" PRIu64 " arms, %" PRIu64 " EOIs; PIT: %" PRIu64 " starts; %" PRIu64 " MSR writes\n",
+        apic.NumArmed(), apic.NumEOIs(), pit.NumStarts(), msrs.NumWrites());
+
+    controller.Stop();
+    platform.FreeVM(vm);
+    alignedFree(ram);
+    return failed ? 1 : 0;
+}
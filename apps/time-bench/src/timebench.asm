@@ -0,0 +1,364 @@
+; Compile with NASM:
+;   $ nasm timebench.asm -o timebench.bin
+
+; Guest side of the timekeeping benchmark. The host boots the processor
+; directly into 64-bit mode at Entry with RAM and the local APIC page
+; identity-mapped, writes a command and its arguments to the parameter block,
+; and runs the guest until it sets P_DONE and halts. Each command measures its
+; own duration in TSC cycles.
+[BITS 64]
+org 0x10000
+
+; Parameter block, matching the Params struct in time_bench.cpp
+%define PARAMS          0x2000
+%define P_COMMAND       PARAMS + 0x00
+%define P_COUNT         PARAMS + 0x08   ; Queries to make, or interrupts to wait for
+%define P_ARG           PARAMS + 0x10   ; PIT divisor, APIC initial count or TSC cycles between deadlines
+%define P_CYCLES        PARAMS + 0x18   ; TSC cycles the command took
+%define P_RESULT        PARAMS + 0x20   ; Last value read by a query
+%define P_ERRORS        PARAMS + 0x28   ; Paravirtual clock reads that went backwards
+%define P_TICKS         PARAMS + 0x30   ; Timer interrupts taken
+%define P_DONE          PARAMS + 0x38   ; Set before the HLT that ends a command
+
+; Paravirtual clock structure, matching PVClockInfo in pvclock.hpp
+%define PVCLOCK         0x3000
+%define PV_VERSION      PVCLOCK + 0x00
+%define PV_TSC          PVCLOCK + 0x08
+%define PV_TIME         PVCLOCK + 0x10
+%define PV_MUL          PVCLOCK + 0x18
+%define PV_SHIFT        PVCLOCK + 0x1C
+
+%define IDT             0x4000
+
+; Devices, matching pvclock.hpp, pit.hpp and apic_timer.hpp
+%define PVCLOCK_PORT    0x0620
+%define PIT_CHANNEL0    0x40
+%define PIT_CHANNEL2    0x42
+%define PIT_COMMAND     0x43
+%define LAPIC           0xFEE00000
+%define LAPIC_EOI       0x0B0
+%define LAPIC_SVR       0x0F0
+%define LAPIC_LVT_TIMER 0x320
+%define LAPIC_INITIAL   0x380
+%define LAPIC_CURRENT   0x390
+%define LAPIC_DIVIDE    0x3E0
+%define LVT_MASKED      (1 << 16)
+%define LVT_PERIODIC    (1 << 17)
+%define LVT_TSC_DEADLINE (2 << 17)
+%define IA32_TSC_DEADLINE 0x6E0
+
+; Interrupt vectors, matching time_bench.cpp
+%define PIT_VECTOR      0x20
+%define APIC_VECTOR     0x30
+%define DEADLINE_VECTOR 0x31
+
+; Commands
+%define CMD_NOP         0
+%define CMD_RDTSC       1               ; RDTSC alone
+%define CMD_PVCLOCK     2               ; Time from the paravirtual clock page
+%define CMD_PORT        3               ; Time from the paravirtual clock port
+%define CMD_PIT_READ    4               ; Latch and read PIT channel 2
+%define CMD_APIC_READ   5               ; Read the APIC timer current count
+%define CMD_PIT_IRQ     6               ; Wait for PIT channel 0 interrupts
+%define CMD_APIC_IRQ    7               ; Wait for periodic APIC timer interrupts
+%define CMD_DEADLINE_IRQ 8              ; Wait for TSC-deadline interrupts, rearming in the handler
+%define CMD_COUNT       9
+
+; The LAPIC page is above 2 GiB, where 32-bit displacements would be sign
+; extended, so it is always addressed through a register.
+
+Entry:
+    ; Point every vector at an empty handler, then install the timer handlers
+    xor ecx, ecx
+.idt:
+    mov rdi, rcx
+    shl rdi, 4
+    add rdi, IDT
+    mov rax, IgnoreInterrupt
+    call SetGate
+    inc ecx
+    cmp ecx, 256
+    jb .idt
+    mov rdi, IDT + PIT_VECTOR * 16
+    mov rax, PITInterrupt
+    call SetGate
+    mov rdi, IDT + APIC_VECTOR * 16
+    mov rax, APICInterrupt
+    call SetGate
+    mov rdi, IDT + DEADLINE_VECTOR * 16
+    mov rax, DeadlineInterrupt
+    call SetGate
+    lidt [IDTR]
+
+    ; Register the paravirtual clock page
+    mov dx, PVCLOCK_PORT + 4
+    xor eax, eax
+    out dx, eax
+    mov dx, PVCLOCK_PORT
+    mov eax, PVCLOCK | 1
+    out dx, eax
+
+    ; Enable the APIC with the timer masked and counting at full rate
+    mov rbx, LAPIC
+    mov dword [rbx + LAPIC_SVR], 0x1FF
+    mov dword [rbx + LAPIC_DIVIDE], 0xB
+    mov dword [rbx + LAPIC_LVT_TIMER], APIC_VECTOR | LVT_MASKED
+
+Main:
+    mov rax, [P_COMMAND]
+    cmp rax, CMD_COUNT
+    jae Done
+    jmp [Commands + rax * 8]
+
+Done:
+    mov qword [P_DONE], 1
+    hlt                     ; Let the host collect the results and set up the next command
+    jmp Main
+
+Commands:
+    dq Done
+    dq ReadTSCLoop
+    dq PVClockLoop
+    dq PortLoop
+    dq PITReadLoop
+    dq APICReadLoop
+    dq PITIRQ
+    dq APICIRQ
+    dq DeadlineIRQ
+
+; Writes a 64-bit interrupt gate for the handler in rax to the IDT entry at rdi
+SetGate:
+    mov [rdi], ax
+    mov word [rdi + 2], 0x0008      ; Code segment
+    mov word [rdi + 4], 0x8E00      ; Present, DPL 0, interrupt gate
+    shr rax, 16
+    mov [rdi + 6], ax
+    shr rax, 16
+    mov [rdi + 8], eax
+    mov dword [rdi + 12], 0
+    ret
+
+; Starts and stops the command's cycle count in r15
+StartClock:
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov r15, rax
+    ret
+
+StopClock:
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, r15
+    mov [P_CYCLES], rax
+    ret
+
+; Returns the paravirtual clock time in nanoseconds in rax. Clobbers rcx, rdx
+; and r8.
+ReadPVClock:
+.retry:
+    mov r8d, [PV_VERSION]
+    test r8d, 1
+    jnz .retry              ; The host is updating the page
+    lfence                  ; Keep RDTSC from running ahead of the version read
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, [PV_TSC]
+    movsx ecx, byte [PV_SHIFT]
+    test ecx, ecx
+    js .right
+    shl rax, cl
+    jmp .scale
+.right:
+    neg ecx
+    shr rax, cl
+.scale:
+    mov edx, [PV_MUL]
+    mul rdx                 ; rdx:rax = delta * mul
+    shrd rax, rdx, 32
+    add rax, [PV_TIME]
+    cmp r8d, [PV_VERSION]
+    jne .retry
+    ret
+
+ReadTSCLoop:
+    mov r12, [P_COUNT]
+    call StartClock
+.loop:
+    rdtsc
+    dec r12
+    jnz .loop
+    call StopClock
+    jmp Done
+
+PVClockLoop:
+    mov r12, [P_COUNT]
+    xor r9, r9              ; Previous time
+    xor r10, r10            ; Reads that went backwards
+    call StartClock
+.loop:
+    call ReadPVClock
+    cmp rax, r9
+    jae .forward
+    inc r10
+.forward:
+    mov r9, rax
+    dec r12
+    jnz .loop
+    call StopClock
+    mov [P_RESULT], r9
+    mov [P_ERRORS], r10
+    jmp Done
+
+PortLoop:
+    mov r12, [P_COUNT]
+    call StartClock
+    mov dx, PVCLOCK_PORT
+.loop:
+    in eax, dx
+    dec r12
+    jnz .loop
+    mov r9d, eax
+    call StopClock
+    mov [P_RESULT], r9
+    jmp Done
+
+    ; Channel 2 has no interrupt, so it can count while the others are tested
+PITReadLoop:
+    mov al, 0xB4            ; Channel 2, low then high byte, mode 2
+    out PIT_COMMAND, al
+    xor al, al              ; A count of 0 is 65536
+    out PIT_CHANNEL2, al
+    out PIT_CHANNEL2, al
+    mov r12, [P_COUNT]
+    call StartClock
+.loop:
+    mov al, 0x80            ; Latch channel 2
+    out PIT_COMMAND, al
+    in al, PIT_CHANNEL2
+    mov ah, al
+    in al, PIT_CHANNEL2
+    xchg al, ah
+    dec r12
+    jnz .loop
+    movzx r9d, ax
+    call StopClock
+    mov [P_RESULT], r9
+    jmp Done
+
+    ; The masked timer counts down without raising interrupts
+APICReadLoop:
+    mov rbx, LAPIC
+    mov dword [rbx + LAPIC_LVT_TIMER], APIC_VECTOR | LVT_MASKED
+    mov dword [rbx + LAPIC_INITIAL], 0xFFFFFFFF
+    mov r12, [P_COUNT]
+    call StartClock
+.loop:
+    mov eax, [rbx + LAPIC_CURRENT]
+    dec r12
+    jnz .loop
+    mov r9d, eax
+    call StopClock
+    mov [P_RESULT], r9
+    mov dword [rbx + LAPIC_INITIAL], 0
+    jmp Done
+
+; Halts until the handlers have counted P_COUNT interrupts. The host sets
+; P_COUNT to zero to stop the wait when no interrupts arrive.
+WaitTicks:
+.wait:
+    mov rax, [P_TICKS]
+    cmp rax, [P_COUNT]
+    jae .done
+    sti
+    hlt                     ; STI holds off interrupts until after the next instruction
+    cli
+    jmp .wait
+.done:
+    ret
+
+PITIRQ:
+    mov qword [P_TICKS], 0
+    call StartClock
+    mov al, 0x34            ; Channel 0, low then high byte, mode 2
+    out PIT_COMMAND, al
+    mov rax, [P_ARG]
+    out PIT_CHANNEL0, al
+    mov al, ah
+    out PIT_CHANNEL0, al
+    call WaitTicks
+    call StopClock
+    mov al, 0x30            ; Reprogramming the mode stops the counter
+    out PIT_COMMAND, al
+    jmp Done
+
+APICIRQ:
+    mov qword [P_TICKS], 0
+    mov rbx, LAPIC
+    call StartClock
+    mov dword [rbx + LAPIC_LVT_TIMER], APIC_VECTOR | LVT_PERIODIC
+    mov eax, [P_ARG]
+    mov [rbx + LAPIC_INITIAL], eax
+    call WaitTicks
+    call StopClock
+    mov dword [rbx + LAPIC_INITIAL], 0
+    mov dword [rbx + LAPIC_LVT_TIMER], APIC_VECTOR | LVT_MASKED
+    jmp Done
+
+DeadlineIRQ:
+    mov qword [P_TICKS], 0
+    mov rbx, LAPIC
+    call StartClock
+    mov dword [rbx + LAPIC_LVT_TIMER], DEADLINE_VECTOR | LVT_TSC_DEADLINE
+    call ArmDeadline
+    call WaitTicks
+    call StopClock
+    ; Leaving TSC-deadline mode disarms the timer
+    mov dword [rbx + LAPIC_LVT_TIMER], APIC_VECTOR | LVT_MASKED
+    jmp Done
+
+; Sets the TSC deadline P_ARG cycles from now. Clobbers rax, rcx and rdx.
+ArmDeadline:
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    add rax, [P_ARG]
+    mov rdx, rax
+    shr rdx, 32
+    mov ecx, IA32_TSC_DEADLINE
+    wrmsr
+    ret
+
+IgnoreInterrupt:
+    iretq
+
+PITInterrupt:
+    inc qword [P_TICKS]
+    iretq
+
+APICInterrupt:
+    push rax
+    inc qword [P_TICKS]
+    mov rax, LAPIC
+    mov dword [rax + LAPIC_EOI], 0
+    pop rax
+    iretq
+
+DeadlineInterrupt:
+    push rax
+    push rcx
+    push rdx
+    inc qword [P_TICKS]
+    call ArmDeadline
+    mov rax, LAPIC
+    mov dword [rax + LAPIC_EOI], 0
+    pop rdx
+    pop rcx
+    pop rax
+    iretq
+
+IDTR:
+    dw 256 * 16 - 1
+    dq IDT
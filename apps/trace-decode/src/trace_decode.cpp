@@ -0,0 +1,157 @@
+/*
+Entry point of the trace decoder. Prints the steps recorded by the step
+tracer, or a summary of the trace.
+-------------------------------------------------------------------------------
+MIT License
+
+Copyright (c) 2019 Ivan Roberto de Oliveira
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "step_tracer.hpp"
+#include "utils.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <map>
+#include <vector>
+
+using namespace virt86;
+
+void printUsage(const char *program) {
+    printf("usage: %s [--summary] <trace>\n", program);
+    printf("\n");
+    printf("Prints the registers that changed and the memory written by every step of a\n");
+    printf("trace recorded with the step tracer. With --summary, prints only the number of\n");
+    printf("steps, exits, memory writes and register changes.\n");
+}
+
+int main(int argc, char* argv[]) {
+    bool summary = false;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--summary") == 0) {
+            summary = true;
+        }
+        else if (path == nullptr) {
+            path = argv[i];
+        }
+        else {
+            printf("fatal: unexpected argument: %s\n", argv[i]);
+            return -1;
+        }
+    }
+    if (path == nullptr) {
+        printUsage(argv[0]);
+        return -1;
+    }
+
+    StepTraceReader reader;
+    if (!reader.Open(path)) {
+        printf("fatal: %s\n", reader.Error().c_str());
+        return -1;
+    }
+
+    const size_t numRegs = reader.NumRegs();
+    if (!summary) {
+        printf("Initial state:\n");
+        for (size_t i = 0; i < numRegs; i++) {
+            printf("  %-6s = %016" PRIx64 "%s", reader.RegName(i).c_str(), reader.Value(i), ((i & 3) == 3) ? "\n" : "");
+        }
+        printf("\n\n");
+    }
+
+    std::vector<uint64_t> changes(numRegs, 0);
+    std::map<VMExitReason, uint64_t> exits;
+    uint64_t numSteps = 0;
+    uint64_t numWrites = 0;
+    uint64_t bytesWritten = 0;
+
+    StepTraceReader::Step step;
+    while (reader.Next(step)) {
+        numSteps++;
+        for (size_t i = 0; i < numRegs; i++) {
+            if (step.changed & (1ull << i)) {
+                changes[i]++;
+            }
+        }
+        if (step.exited) {
+            exits[step.reason]++;
+        }
+        numWrites += step.writes.size();
+        for (auto& write : step.writes) {
+            bytesWritten += write.data.size();
+        }
+        if (summary) {
+            continue;
+        }
+
+        printf("#%-8" PRIu64, step.index);
+        for (size_t i = 0; i < numRegs; i++) {
+            if (step.changed & (1ull << i)) {
+                printf(" %s=%" PRIx64, reader.RegName(i).c_str(), reader.Value(i));
+            }
+        }
+        if (step.exited) {
+            printf("  [exit: %s]", reason_str(step.reason));
+        }
+        printf("\n");
+        for (auto& write : step.writes) {
+            printf("          write %016" PRIx64 ":", write.address);
+            for (size_t i = 0; i < write.data.size(); i++) {
+                if (i == 16) {
+                    printf(" ... (%zu bytes)", write.data.size());
+                    break;
+                }
+                printf(" %02x", write.data[i]);
+            }
+            printf("\n");
+        }
+    }
+    if (!reader.Error().empty()) {
+        printf("error: %s after %" PRIu64 " steps\n", reader.Error().c_str(), numSteps);
+    }
+
+    if (summary) {
+        printf("Steps: %" PRIu64 "\n", numSteps);
+        printf("Memory writes: %" PRIu64 " (%" PRIu64 " bytes)\n", numWrites, bytesWritten);
+        printf("Exits:\n");
+        for (auto& exit : exits) {
+            printf("  %-24s %" PRIu64 "\n", reason_str(exit.first), exit.second);
+        }
+        printf("Register changes:\n");
+        for (size_t i = 0; i < numRegs; i++) {
+            if (changes[i] != 0) {
+                printf("  %-6s %" PRIu64 "\n", reader.RegName(i).c_str(), changes[i]);
+            }
+        }
+    }
+    printf("\nFinal state:\n");
+    for (size_t i = 0; i < numRegs; i++) {
+        printf("  %-6s = %016" PRIx64 "%s", reader.RegName(i).c_str(), reader.Value(i), ((i & 3) == 3) ? "\n" : "");
+    }
+    printf("\n");
+
+    return reader.Error().empty() ? 0 : 1;
+}
@@ -17,7 +17,88 @@ org 0x10000
 %define FPTEST_FMA3   (1 << 8)
 %define FPTEST_AVX2   (1 << 9)
 
+; Page table entry bits
+%define PAGE_PRESENT    (1 << 0)
+%define PAGE_WRITE      (1 << 1)
+%define PAGE_PCD        (1 << 4)
+
+; Hypercall ABI, matching apps/common/include/hypercall.hpp
+%define HYPERCALL_PORT      0x0600
+%define HC_NOP              0
+%define HC_CONSOLE_WRITE    1
+%define HC_CHECKSUM         2
+%define HCBATCH_COUNT       0
+%define HCBATCH_PROCESSED   4
+%define HCBATCH_REQUESTS    16
+%define HCREQ_SIZE          40
+%define HCREQ_NUMBER        0
+%define HCREQ_FLAGS         4
+%define HCREQ_RESULT        8
+%define HCREQ_ARG0          16
+%define HCREQ_ARG1          24
+%define HCREQ_ARG2          32
+
+; Virtio MMIO block device, matching apps/common/include/virtio_mmio.hpp and virtio_blk.hpp
+%define VIRTIO_MMIO_BASE                0xFFE00000
+%define VIRTIO_MMIO_MAGIC_VALUE         0x000
+%define VIRTIO_MMIO_DEVICE_ID           0x008
+%define VIRTIO_MMIO_DRIVER_FEATURES     0x020
+%define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+%define VIRTIO_MMIO_QUEUE_SEL           0x030
+%define VIRTIO_MMIO_QUEUE_NUM           0x038
+%define VIRTIO_MMIO_QUEUE_READY         0x044
+%define VIRTIO_MMIO_QUEUE_NOTIFY        0x050
+%define VIRTIO_MMIO_STATUS              0x070
+%define VIRTIO_MMIO_QUEUE_DESC_LOW      0x080
+%define VIRTIO_MMIO_QUEUE_DESC_HIGH     0x084
+%define VIRTIO_MMIO_QUEUE_DRIVER_LOW    0x090
+%define VIRTIO_MMIO_QUEUE_DRIVER_HIGH   0x094
+%define VIRTIO_MMIO_QUEUE_DEVICE_LOW    0x0a0
+%define VIRTIO_MMIO_QUEUE_DEVICE_HIGH   0x0a4
+%define VIRTIO_MMIO_CONFIG              0x100
+%define VIRTIO_STATUS_ACKNOWLEDGE       1
+%define VIRTIO_STATUS_DRIVER            2
+%define VIRTIO_STATUS_DRIVER_OK         4
+%define VIRTIO_STATUS_FEATURES_OK       8
+%define VIRTIO_ID_BLOCK                 2
+%define VIRTIO_BLK_T_IN                 0
+%define VIRTQ_DESC_F_NEXT               1
+%define VIRTQ_DESC_F_WRITE              2
+
+; Memory balloon, matching apps/common/include/balloon.hpp
+%define BALLOON_PORT        0x0610
+%define BALLOON_INFLATE     1
+%define BALLOON_DEFLATE     2
+%define BALLOON_BASE        0x100000    ; Free RAM handed to the balloon, below the stack
+%define BALLOON_MAX_PAGES   192
+%define BALLOON_CHUNK       32          ; Pages reported with each range
+
+; 16550 UART console, matching apps/common/include/uart.hpp
+%define UART_PORT           0x03F8
+%define UART_FCR            2
+%define UART_LCR            3
+
+; Virtio block benchmark parameters
+%define VBLK_QUEUE_SIZE     128         ; Must be a power of two
+%define VBLK_INFLIGHT       32          ; Requests submitted with each notification
+%define VBLK_BATCHES        256         ; Number of notifications
+%define VBLK_REQUEST_SIZE   4096        ; Bytes read by each request
+
 Entry:
+    ; Set up the console for 8 data bits, no parity and one stop bit, with FIFOs
+    mov dx, UART_PORT + UART_LCR
+    mov al, 0x03
+    out dx, al
+    mov dx, UART_PORT + UART_FCR
+    mov al, 0x07
+    out dx, al
+
+    ; Print a banner with a single string instruction
+    mov rsi, bootmsg
+    mov rcx, BOOTMSG_SIZE
+    mov dx, UART_PORT
+    rep outsb
+
     ; Do a simple read
 	mov rax, [0x10000]
     
@@ -311,6 +392,261 @@ XSAVE.Test:
     hlt                     ; Let the host check the result
 
 FPTests.End:
+
+Hypercall.Test:
+    lea rdi, [hcbulk]       ; Fill the bulk buffer with a known pattern
+    mov rcx, HCBULK_SIZE / 8
+    mov rax, 0x0807060504030201
+    rep stosq
+
+    lea rdi, [hcbatch]      ; Build a batch of four requests in the shared page
+    mov dword [rdi + HCBATCH_COUNT], 4
+    mov dword [rdi + HCBATCH_PROCESSED], 0
+
+    lea rbx, [rdi + HCBATCH_REQUESTS + 0 * HCREQ_SIZE]  ; Print a message on the host console
+    mov dword [rbx + HCREQ_NUMBER], HC_CONSOLE_WRITE
+    mov dword [rbx + HCREQ_FLAGS], 0
+    lea rax, [hcmsg]
+    mov [rbx + HCREQ_ARG0], rax
+    mov qword [rbx + HCREQ_ARG1], HCMSG_SIZE
+
+    lea rbx, [rdi + HCBATCH_REQUESTS + 1 * HCREQ_SIZE]  ; Checksum the bulk buffer in place
+    mov dword [rbx + HCREQ_NUMBER], HC_CHECKSUM
+    mov dword [rbx + HCREQ_FLAGS], 0
+    lea rax, [hcbulk]
+    mov [rbx + HCREQ_ARG0], rax
+    mov qword [rbx + HCREQ_ARG1], HCBULK_SIZE
+
+    lea rbx, [rdi + HCBATCH_REQUESTS + 2 * HCREQ_SIZE]  ; Do nothing
+    mov dword [rbx + HCREQ_NUMBER], HC_NOP
+    mov dword [rbx + HCREQ_FLAGS], 0
+
+    lea rbx, [rdi + HCBATCH_REQUESTS + 3 * HCREQ_SIZE]  ; Call an unknown hypercall
+    mov dword [rbx + HCREQ_NUMBER], 0x1FF
+    mov dword [rbx + HCREQ_FLAGS], 0
+
+    mov eax, hcbatch        ; Submit the whole batch with a single OUT of its page frame number
+    shr eax, 12
+    mov dx, HYPERCALL_PORT
+    out dx, eax
+
+    mov eax, [rdi + HCBATCH_PROCESSED]  ; Put number of processed requests into RAX
+    mov rsi, rdi            ; Put address of the batch into RSI
+
+    hlt                     ; Let the host check the results
+
+VirtioBlk.Init:
+    ; RDI contains the address of the page table entry for VIRTIO_MMIO_BASE, provided by the host
+    xor r14, r14            ; R14 will be set to 1 if the block device is present and initialized
+
+    mov eax, VIRTIO_MMIO_BASE | PAGE_PRESENT | PAGE_WRITE | PAGE_PCD
+    mov [rdi], rax          ; Map the device registers as uncached memory
+    mov ebx, VIRTIO_MMIO_BASE   ; RBX will contain the base address of the device registers
+    invlpg [rbx]
+
+    mov eax, [rbx + VIRTIO_MMIO_MAGIC_VALUE]    ; Check for the "virt" magic value
+    cmp eax, 0x74726976
+    jne VirtioBlk.Init.End
+    mov eax, [rbx + VIRTIO_MMIO_DEVICE_ID]      ; Check that this is a block device
+    cmp eax, VIRTIO_ID_BLOCK
+    jne VirtioBlk.Init.End
+
+    mov dword [rbx + VIRTIO_MMIO_STATUS], 0     ; Reset the device
+    mov dword [rbx + VIRTIO_MMIO_STATUS], VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER
+    mov dword [rbx + VIRTIO_MMIO_DRIVER_FEATURES_SEL], 1
+    mov dword [rbx + VIRTIO_MMIO_DRIVER_FEATURES], 1    ; Accept VIRTIO_F_VERSION_1 only
+    mov dword [rbx + VIRTIO_MMIO_STATUS], VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_FEATURES_OK
+    mov eax, [rbx + VIRTIO_MMIO_STATUS]         ; Check that the device accepted the features
+    test eax, VIRTIO_STATUS_FEATURES_OK
+    jz VirtioBlk.Init.End
+
+    mov eax, [rbx + VIRTIO_MMIO_CONFIG]         ; Check that the disk is large enough (capacity in sectors)
+    cmp eax, VBLK_INFLIGHT * VBLK_REQUEST_SIZE / 512
+    jb VirtioBlk.Init.End
+
+    mov dword [rbx + VIRTIO_MMIO_QUEUE_SEL], 0  ; Set up the request queue
+    mov dword [rbx + VIRTIO_MMIO_QUEUE_NUM], VBLK_QUEUE_SIZE
+    lea rax, [vblk.desc]
+    mov [rbx + VIRTIO_MMIO_QUEUE_DESC_LOW], eax
+    mov dword [rbx + VIRTIO_MMIO_QUEUE_DESC_HIGH], 0
+    lea rax, [vblk.avail]
+    mov [rbx + VIRTIO_MMIO_QUEUE_DRIVER_LOW], eax
+    mov dword [rbx + VIRTIO_MMIO_QUEUE_DRIVER_HIGH], 0
+    lea rax, [vblk.used]
+    mov [rbx + VIRTIO_MMIO_QUEUE_DEVICE_LOW], eax
+    mov dword [rbx + VIRTIO_MMIO_QUEUE_DEVICE_HIGH], 0
+    mov dword [rbx + VIRTIO_MMIO_QUEUE_READY], 1
+    mov dword [rbx + VIRTIO_MMIO_STATUS], VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_FEATURES_OK | VIRTIO_STATUS_DRIVER_OK
+
+    lea rdi, [vblk.desc]    ; Build one descriptor chain per request: header, data buffer and status
+    xor ecx, ecx
+
+VirtioBlk.Init.Loop:
+    lea rax, [vblk.hdr + rcx * 16]  ; Request header: read sectors starting at i * 8
+    mov dword [rax], VIRTIO_BLK_T_IN
+    mov dword [rax + 4], 0
+    mov rdx, rcx
+    shl rdx, 3
+    mov [rax + 8], rdx
+
+    imul rsi, rcx, 48       ; RSI = offset of the first descriptor of the chain
+    mov [rdi + rsi], rax    ; Header descriptor
+    mov dword [rdi + rsi + 8], 16
+    mov word [rdi + rsi + 12], VIRTQ_DESC_F_NEXT
+    lea edx, [ecx * 2 + ecx + 1]
+    mov [rdi + rsi + 14], dx
+
+    mov rax, rcx            ; Data descriptor
+    shl rax, 12
+    lea rdx, [vblk.buffers]
+    add rax, rdx
+    mov [rdi + rsi + 16], rax
+    mov dword [rdi + rsi + 24], VBLK_REQUEST_SIZE
+    mov word [rdi + rsi + 28], VIRTQ_DESC_F_NEXT | VIRTQ_DESC_F_WRITE
+    lea edx, [ecx * 2 + ecx + 2]
+    mov [rdi + rsi + 30], dx
+
+    lea rax, [vblk.status + rcx]    ; Status descriptor
+    mov byte [rax], 0xFF
+    mov [rdi + rsi + 32], rax
+    mov dword [rdi + rsi + 40], 1
+    mov word [rdi + rsi + 44], VIRTQ_DESC_F_WRITE
+    mov word [rdi + rsi + 46], 0
+
+    inc ecx
+    cmp ecx, VBLK_INFLIGHT
+    jb VirtioBlk.Init.Loop
+
+    mov r14, 1              ; The device is ready
+
+VirtioBlk.Init.End:
+    mov rax, r14            ; Put device status into RAX
+    hlt                     ; Let the host start the benchmark timer
+
+VirtioBlk.Bench:
+    xor r12, r12            ; R12 will contain the number of completed requests
+    xor r13, r13            ; R13 will contain the number of failed requests
+    test r14, r14           ; Skip the benchmark if the device is not available
+    jz VirtioBlk.Bench.End
+
+    mov ebx, VIRTIO_MMIO_BASE
+    mov r8d, VBLK_BATCHES   ; R8 counts the remaining batches
+    xor r9d, r9d            ; R9 tracks the available ring index
+
+VirtioBlk.Bench.Batch:
+    xor ecx, ecx            ; Make every chain available
+
+VirtioBlk.Bench.Fill:
+    lea eax, [r9d + ecx]
+    and eax, VBLK_QUEUE_SIZE - 1
+    imul edx, ecx, 3
+    mov [vblk.avail + 4 + rax * 2], dx
+    inc ecx
+    cmp ecx, VBLK_INFLIGHT
+    jb VirtioBlk.Bench.Fill
+
+    add r9d, VBLK_INFLIGHT
+    mov [vblk.avail + 2], r9w   ; Publish the new available index...
+    mov dword [rbx + VIRTIO_MMIO_QUEUE_NOTIFY], 0   ; ... and notify the device with a single exit
+
+VirtioBlk.Bench.Wait:
+    movzx eax, word [vblk.used + 2] ; The device completes requests before the notification returns,
+    cmp ax, r9w                     ; but wait for the used index anyway
+    jne VirtioBlk.Bench.Wait
+
+    xor ecx, ecx            ; Check and reset the status of every request
+
+VirtioBlk.Bench.Check:
+    cmp byte [vblk.status + rcx], 0
+    je VirtioBlk.Bench.CheckOK
+    inc r13
+
+VirtioBlk.Bench.CheckOK:
+    mov byte [vblk.status + rcx], 0xFF
+    inc ecx
+    cmp ecx, VBLK_INFLIGHT
+    jb VirtioBlk.Bench.Check
+
+    add r12, VBLK_INFLIGHT
+    dec r8d
+    jnz VirtioBlk.Bench.Batch
+
+VirtioBlk.Bench.End:
+    mov rax, r12            ; Put number of completed requests into RAX
+    hlt                     ; Let the host compute the results
+
+Balloon.Inflate:
+    mov dx, BALLOON_PORT    ; Read the balloon size requested by the host
+    in eax, dx
+    mov ecx, BALLOON_MAX_PAGES
+    cmp eax, ecx
+    cmova eax, ecx
+    mov r12d, eax           ; R12 will contain the number of pages in the balloon
+
+    mov rdi, BALLOON_BASE   ; Dirty the free pages so that they are resident on the host
+    mov ecx, r12d
+    shl ecx, 9
+    mov rax, 0xA5A5A5A5A5A5A5A5
+    rep stosq
+
+    mov dx, BALLOON_PORT + 8
+    mov eax, BALLOON_INFLATE
+    out dx, eax
+    call Balloon.Report     ; Give the pages to the host
+
+    mov dx, BALLOON_PORT + 4
+    in eax, dx              ; Put the balloon size seen by the host into RAX
+    hlt                     ; Let the host measure its memory usage
+
+Balloon.Deflate:
+    mov dx, BALLOON_PORT + 8
+    mov eax, BALLOON_DEFLATE
+    out dx, eax
+    call Balloon.Report     ; Take the pages back
+
+    mov rdi, BALLOON_BASE   ; Use the pages again
+    mov ecx, r12d
+    shl ecx, 9
+    mov rax, 0x5A5A5A5A5A5A5A5A
+    rep stosq
+
+    mov rsi, donemsg        ; Report the end of the tests on the console
+    mov rcx, DONEMSG_SIZE
+    mov dx, UART_PORT
+    rep outsb
+
+    mov dx, BALLOON_PORT + 4
+    in eax, dx              ; Put the balloon size seen by the host into RAX
+    hlt                     ; Let the host measure its memory usage
+    jmp Balloon.End
+
+Balloon.Report:             ; Reports R12 pages starting at BALLOON_BASE in chunks of BALLOON_CHUNK pages
+    mov ebx, BALLOON_BASE >> 12
+    mov r13d, r12d          ; R13 counts the remaining pages
+
+Balloon.Report.Loop:
+    test r13d, r13d
+    jz Balloon.Report.End
+    mov ecx, BALLOON_CHUNK
+    cmp r13d, ecx
+    cmovb ecx, r13d
+
+    mov dx, BALLOON_PORT    ; Write the first page frame number...
+    mov eax, ebx
+    out dx, eax
+    mov dx, BALLOON_PORT + 4
+    mov eax, ecx            ; ... and the number of pages, which applies the command
+    out dx, eax
+
+    add ebx, ecx
+    sub r13d, ecx
+    jmp Balloon.Report.Loop
+
+Balloon.Report.End:
+    ret
+
+Balloon.End:
+
     ; We're done
 
 Die:
@@ -318,6 +654,12 @@ Die:
     hlt
     jmp Die
     
+    ; Console messages
+    bootmsg: db "x64-guest: running in 64-bit long mode", 10
+    BOOTMSG_SIZE equ $ - bootmsg
+    donemsg: db "x64-guest: all guest tests finished", 10
+    DONEMSG_SIZE equ $ - donemsg
+
     ; Data for MMX test
 ALIGN 16
     mmx.v1: dw 5, 10, 15, 20
@@ -379,4 +721,24 @@ ALIGN 4096
     xsavearea: resb 4096        ; XSAVE data area
     xsavebases: times 16 dd 0   ; Base offsets of each XSAVE component
     xsavesizes: times 16 dd 0   ; Sizes of each XSAVE component
-    xsavealign: dd 0            ; Alignment bits of each XSAVE component
\ No newline at end of file
+    xsavealign: dd 0            ; Alignment bits of each XSAVE component
+
+    ; Data for hypercall test
+    hcmsg: db "Hello from the guest via hypercall!", 10
+    HCMSG_SIZE equ $ - hcmsg
+ALIGN 4096
+    hcbatch: resb 4096          ; Shared hypercall batch page
+    hcbulk: resb 16384          ; Bulk payload buffer
+    HCBULK_SIZE equ $ - hcbulk
+
+    ; Data for virtio block benchmark
+ALIGN 4096
+    vblk.desc: resb 16 * VBLK_QUEUE_SIZE        ; Descriptor table
+    vblk.avail: resb 6 + 2 * VBLK_QUEUE_SIZE    ; Available ring
+ALIGN 4
+    vblk.used: resb 6 + 8 * VBLK_QUEUE_SIZE     ; Used ring
+ALIGN 16
+    vblk.hdr: resb 16 * VBLK_INFLIGHT           ; Request headers
+    vblk.status: resb VBLK_INFLIGHT             ; Request status bytes
+ALIGN 4096
+    vblk.buffers: resb VBLK_REQUEST_SIZE * VBLK_INFLIGHT
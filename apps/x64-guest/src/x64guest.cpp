@@ -31,6 +31,25 @@ SOFTWARE.
 #include "print_helpers.hpp"
 #include "align_alloc.hpp"
 #include "utils.hpp"
+#include "guest_memory.hpp"
+#include "io_bus.hpp"
+#include "hypercall.hpp"
+#include "virtio_blk.hpp"
+#include "page_table_builder.hpp"
+#include "long_mode.hpp"
+#include "guest_address_space.hpp"
+#include "balloon.hpp"
+#include "page_dedup.hpp"
+#include "cpuid_policy.hpp"
+#include "crash_triage.hpp"
+#include "coverage.hpp"
+#include "step_tracer.hpp"
+#include "replay_log.hpp"
+#include "gdb_stub.hpp"
+#include "result_report.hpp"
+#include "image_loader.hpp"
+#include "elf_loader.hpp"
+#include "uart.hpp"
 
 #include <cmath>
 
@@ -43,7 +62,10 @@ SOFTWARE.
 #endif
 
 #include <cstdio>
+#include <cstring>
 #include <cinttypes>
+#include <chrono>
+#include <memory>
 
 // Define constants matching those in the guest code to determine which tests
 // the host code will check
@@ -60,55 +82,290 @@ const uint32_t FPTEST_AVX2  = (1 << 9);
 
 using namespace virt86;
 
-void runToHLT(VirtualProcessor& vp) {
+// CPUID results presented to the guest when --cpuid is given
+static CPUIDPolicy cpuidPolicy;
+
+// Captures guest faults; records are appended to the file given with --triage
+static CrashTriage crashTriage;
+static const char *triagePath = nullptr;
+
+// Records which of the basic blocks given with --coverage the guest executes
+static CoverageTracker coverage;
+
+// Records the guest's inputs with --record, or feeds them back with --replay
+static ReplayLog replayLog;
+
+// Serves the debugger given with --gdb; null when not debugging
+static GDBStub *gdbStub = nullptr;
+
+// Results of the boot and the guest tests, saved with --report
+static ResultReport report;
+
+// VM exits and time spent in Run by runToHLT, for the report
+static uint64_t numExits = 0;
+static std::chrono::nanoseconds runTime{ 0 };
+
+// Time and VM exits of one block of guest code
+struct TestRun {
+    uint64_t exits;
+    uint64_t ns;
+};
+
+// Handles a VM exit. Returns false when the guest should stop running.
+static bool handleExit(VirtualProcessor& vp) {
+    numExits++;
+    auto& exitInfo = vp.GetVMExitInfo();
+    switch (exitInfo.reason) {
+    case VMExitReason::HLT:
+        printf("HLT reached\n");
+        if (!replayLog.Checkpoint(vp)) {
+            printf("Replay: %s\n", replayLog.Error().c_str());
+        }
+        return false;
+    case VMExitReason::Shutdown:
+        printf("VCPU shutting down\n");
+        return false;
+    case VMExitReason::Error:
+        printf("VCPU execution failed\n");
+        return false;
+    case VMExitReason::CPUID:
+        replayLog.HandleCPUID(vp, cpuidPolicy.Leaves().empty() ? nullptr : &cpuidPolicy);
+        break;
+    case VMExitReason::Exception:
+    {
+        CrashTriage::Record record;
+        if (crashTriage.Capture(vp, record)) {
+            CrashTriage::Print(stdout, record);
+            if (triagePath != nullptr && !CrashTriage::Append(triagePath, record)) {
+                printf("Failed to write crash record to %s\n", triagePath);
+            }
+        }
+        else {
+            printf("Guest exception; failed to capture the crash record\n");
+        }
+        return false;
+    }
+    case VMExitReason::SoftwareBreakpoint:
+    case VMExitReason::HardwareBreakpoint:
+        if (!coverage.HandleExit(vp)) {
+            printf("Unexpected breakpoint\n");
+            return false;
+        }
+        break;
+    }
+    return true;
+}
+
+void runToHLT(VirtualProcessor& vp, bool printState = true) {
+    // With --gdb, the stub runs the guest so that the debugger can stop it
+    if (gdbStub != nullptr) {
+        auto handler = [](void *, VirtualProcessor& vp) { return handleExit(vp); };
+        if (!gdbStub->Run(vp, handler, nullptr)) {
+            printf("Virtual CPU execution failed\n");
+        }
+        return;
+    }
+
     // Run until HLT is reached
     bool running = true;
     while (running) {
+        replayLog.BeforeRun(vp, nullptr);
+        auto runStart = std::chrono::steady_clock::now();
         auto execStatus = vp.Run();
+        runTime += std::chrono::steady_clock::now() - runStart;
         if (execStatus != VPExecutionStatus::OK) {
             printf("Virtual CPU execution failed\n");
             break;
         }
 
-        printRegs(vp);
-        printf("\n");
-
-        auto& exitInfo = vp.GetVMExitInfo();
-        switch (exitInfo.reason) {
-        case VMExitReason::HLT:
-            printf("HLT reached\n");
-            running = false;
-            break;
-        case VMExitReason::Shutdown:
-            printf("VCPU shutting down\n");
-            running = false;
-            break;
-        case VMExitReason::Error:
-            printf("VCPU execution failed\n");
-            running = false;
-            break;
+        if (printState) {
+            printRegs(vp);
+            printf("\n");
         }
+
+        running = handleExit(vp);
     }
 }
 
+// Runs the next block of a test, measuring the time spent in the guest
+TestRun runTest(VirtualProcessor& vp, bool printState = true) {
+    const uint64_t exitsBefore = numExits;
+    const auto timeBefore = runTime;
+    runToHLT(vp, printState);
+    return { numExits - exitsBefore, (uint64_t)(runTime - timeBefore).count() };
+}
+
+// Prints whether a test left the expected result in a register or in memory
+static bool checkResult(bool correct, const char *location) {
+    printf("%s contains %s result\n", location, correct ? "the correct" : "an incorrect");
+    return correct;
+}
+
+// Guest RAM layout. rom.asm's SwitchToLongMode builds its page tables in the
+// first 0x5000 bytes; the host allocates any other page tables from the rest
+// of the page table area. Direct boot builds all page tables in that area and
+// puts the GDT right after it.
+const uint64_t pageTableArea = 0x0000;
+const uint64_t romPageTablesSize = 0x5000;
+const uint64_t romPDPTAddress = 0x1000;
+const uint64_t pageTableAreaSize = 0xF000;
+const uint64_t gdtAddress = 0xF000;
+
+// Direct boot stack. ELF segments are loaded at or above ramProgramBase, clear
+// of the page tables and the GDT, but may reach into the stack; the stack is
+// then moved above the highest segment.
+const uint64_t defaultStackTop = 0x200000;
+const uint64_t stackSize = 0x10000;
+
 int main(int argc, char* argv[]) {
     // Require two arguments: the ROM code and the RAM code
-    if (argc < 3) {
+    // An optional third argument specifies a disk image for the virtio block device
+    bool directBoot = false;
+    bool hugePages = false;
+    bool merge = false;
+    const char *cpuidSource = nullptr;
+    const char *cpuidSavePath = nullptr;
+    bool crashTest = false;
+    const char *coveragePath = nullptr;
+    const char *coverageOutPath = nullptr;
+    const char *tracePath = nullptr;
+    const char *recordPath = nullptr;
+    const char *replayPath = nullptr;
+    bool syncTSC = false;
+    const char *gdbEndpoint = nullptr;
+    const char *platformName = nullptr;
+    const char *reportPath = nullptr;
+    const char *consolePath = nullptr;
+    uint64_t ramSizeMiB = 2;
+    const char *romPath = nullptr;
+    const char *ramPath = nullptr;
+    const char *diskPath = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--direct-boot") == 0) {
+            directBoot = true;
+        }
+        else if (strcmp(argv[i], "--huge-pages") == 0) {
+            hugePages = true;
+        }
+        else if (strcmp(argv[i], "--merge") == 0) {
+            merge = true;
+        }
+        else if (strcmp(argv[i], "--cpuid") == 0 && i + 1 < argc) {
+            cpuidSource = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cpuid-save") == 0 && i + 1 < argc) {
+            cpuidSavePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--triage") == 0 && i + 1 < argc) {
+            triagePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--crash-test") == 0) {
+            crashTest = true;
+        }
+        else if (strcmp(argv[i], "--coverage") == 0 && i + 1 < argc) {
+            coveragePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--coverage-out") == 0 && i + 1 < argc) {
+            coverageOutPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--sync-tsc") == 0) {
+            syncTSC = true;
+        }
+        else if (strcmp(argv[i], "--gdb") == 0 && i + 1 < argc) {
+            gdbEndpoint = argv[++i];
+        }
+        else if (strcmp(argv[i], "--platform") == 0 && i + 1 < argc) {
+            platformName = argv[++i];
+        }
+        else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            reportPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--console") == 0 && i + 1 < argc) {
+            consolePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--ram-size") == 0) {
+            if (++i >= argc) {
+                printf("fatal: --ram-size requires an argument\n");
+                return -1;
+            }
+            char *end;
+            ramSizeMiB = strtoull(argv[i], &end, 0);
+            if (*end != '\0' || ramSizeMiB == 0) {
+                printf("fatal: invalid value for --ram-size: %s\n", argv[i]);
+                return -1;
+            }
+        }
+        else if (romPath == nullptr) {
+            romPath = argv[i];
+        }
+        else if (ramPath == nullptr) {
+            ramPath = argv[i];
+        }
+        else if (diskPath == nullptr) {
+            diskPath = argv[i];
+        }
+    }
+    if (ramPath == nullptr) {
         printf("fatal: no input files specified\n");
-        printf("usage: %s <rom> <ram>\n", argv[0]);
+        printf("usage: %s [--direct-boot] [--huge-pages] [--merge] [--ram-size <MiB>] [--cpuid <file>|host] [--cpuid-save <file>] [--triage <file>] [--crash-test] [--coverage <file>] [--coverage-out <file>] [--trace <file>] [--record <file>|--replay <file>] [--sync-tsc] [--gdb <endpoint>] [--platform <name>] [--report <file>] [--console <file>] <rom> <ram> [disk image]\n", argv[0]);
+        return -1;
+    }
+
+    // RAM must fit below the 3 GiB mark so that it does not collide with the
+    // ROM and the devices at the top of the 32-bit address range. The size is
+    // checked in MiB so that huge values cannot wrap around.
+    const uint64_t maxRamSize = 0xC0000000;
+    if (ramSizeMiB < 2 || ramSizeMiB > maxRamSize / 1024 / 1024) {
+        printf("fatal: RAM size must be between 2 and %" PRIu64 " MiB\n", maxRamSize / 1024 / 1024);
+        return -1;
+    }
+    const uint64_t ramSize = ramSizeMiB * 1024 * 1024;
+
+    // The tracer single-steps the boot instead of running it, so its exits cannot be matched against a log
+    if (recordPath != nullptr || replayPath != nullptr) {
+        if (tracePath != nullptr || (recordPath != nullptr && replayPath != nullptr)) {
+            printf("fatal: --record and --replay cannot be combined with each other or with --trace\n");
+            return -1;
+        }
+        const bool started = (recordPath != nullptr) ? replayLog.StartRecording(recordPath, syncTSC) : replayLog.StartReplay(replayPath);
+        if (!started) {
+            printf("fatal: %s\n", replayLog.Error().c_str());
+            return -1;
+        }
+    }
+
+    // The stub runs the guest on its own, without the run loop hooks of these options
+    if (gdbEndpoint != nullptr && (tracePath != nullptr || recordPath != nullptr || replayPath != nullptr || coveragePath != nullptr)) {
+        printf("fatal: --gdb cannot be combined with --trace, --record, --replay or --coverage\n");
         return -1;
     }
 
     // ROM and RAM sizes
     const uint32_t romSize = PAGE_SIZE * 16;  // 64 KiB
-    const uint32_t ramSize = PAGE_SIZE * 512; // 2 MiB
     const uint64_t romBase = 0xFFFF0000;
     const uint64_t ramBase = 0x0;
     const uint64_t ramProgramBase = 0x10000;
+    const uint64_t virtioBlkBase = 0xFFE00000;
+
+    // ----- Guest images -----------------------------------------------------------------------------------------------------
 
-    // --- ROM ------------------
+    // The images are read and the rest of RAM is cleared on background
+    // threads while the platform is initialized, the VM is created and memory
+    // is mapped. Nothing touches ROM or RAM until the loaders are done.
+    const auto startupStart = std::chrono::steady_clock::now();
+    auto msSince = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
 
-    // Initialize ROM
     uint8_t *rom = alignedAlloc(romSize);
     if (rom == NULL) {
         printf("fatal: failed to allocate memory for ROM\n");
@@ -116,113 +373,142 @@ int main(int argc, char* argv[]) {
     }
     printf("ROM allocated: %u bytes\n", romSize);
 
-    // Open ROM file specified in the command line
-    FILE *fp = fopen(argv[1], "rb");
-    if (fp == NULL) {
-        printf("fatal: could not open ROM file: %s\n", argv[1]);
-        return -1;
-    }
-
-    // Check that the ROM file is exactly 64 KiB
-    fseek(fp, 0, SEEK_END);
-    long len = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    if (len != romSize) {
-        printf("fatal: ROM file size must be %ud bytes\n", romSize);
-        return -1;
-    }
-    
-    // Load ROM from the file
-    size_t readLen = fread(rom, 1, len, fp);
-    if (readLen != len) {
-        printf("fatal: could not fully read ROM file\n");
-        return -1;
-    }
-    fclose(fp);
-    printf("ROM loaded from %s\n", argv[1]);
-
-    // --- RAM ------------------
-
-    // Initialize and clear RAM
-    uint8_t *ram = alignedAlloc(ramSize);
+    uint8_t *ram = alignedAlloc(ramSize, merge);
     if (ram == NULL) {
         printf("fatal: failed to allocate memory for RAM\n");
         return -1;
     }
-    memset(ram, 0, ramSize);
-    printf("RAM allocated: %u bytes\n", ramSize);
-    
-    // Open RAM file specified in the command line
-    fp = fopen(argv[2], "rb");
-    if (fp == NULL) {
-        printf("fatal: could not open RAM file: %s\n", argv[2]);
-        return -1;
-    }
+    printf("RAM allocated: %" PRIu64 " bytes\n", ramSize);
 
-    // Check that the RAM file fits in our RAM
-    fseek(fp, 0, SEEK_END);
-    len = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    if (len > ramSize - ramProgramBase) {
-        printf("fatal: RAM file size must be no larger than %llu bytes\n", ramSize - ramProgramBase);
+    // The ROM must be exactly 64 KiB and the RAM program must fit above its load address
+    ImageLoader romLoader, ramLoader;
+    if (!romLoader.Start(romPath, rom, romSize, 0, true)) {
+        printf("fatal: %s\n", romLoader.Error().c_str());
         return -1;
     }
 
-    // Load RAM from the file
-    readLen = fread(&ram[0x10000], 1, len, fp);
-    if (readLen != len) {
-        printf("fatal: could not fully read RAM file\n");
+    // An ELF RAM image is loaded segment by segment and boots directly into
+    // its entry point; anything else is a flat image loaded at ramProgramBase.
+    // Segments are never mapped from the file, since the balloon and page
+    // deduplication discard guest pages, which must then read back as zeros.
+    ElfLoader elf;
+    uint64_t stackTop = defaultStackTop;
+    const bool elfImage = ElfLoader::IsELF(ramPath);
+    double elfLoadMs = 0.0;
+    if (elfImage) {
+        const auto elfStart = std::chrono::steady_clock::now();
+        if (!elf.Open(ramPath) || !alignedClear(ram, ramSize) || !elf.Load(&ram[ramProgramBase], ramBase + ramProgramBase, ramSize - ramProgramBase, false)) {
+            printf("fatal: could not load ELF image %s: %s\n", ramPath, elf.Error().c_str());
+            return -1;
+        }
+        elfLoadMs = msSince(elfStart);
+        printf("Loaded %zu segments from %s: %" PRIu64 " bytes mapped, %" PRIu64 " copied, %" PRIu64 " zero-filled; entry point at 0x%" PRIx64 "\n",
+            elf.Segments().size(), ramPath, elf.BytesMapped(), elf.BytesCopied(), elf.BytesZeroed(), elf.Entry());
+        directBoot = true;
+
+        uint64_t segmentsEnd = 0;
+        for (auto& segment : elf.Segments()) {
+            if (segment.physicalAddress + segment.memorySize > segmentsEnd) {
+                segmentsEnd = segment.physicalAddress + segment.memorySize;
+            }
+        }
+        if (segmentsEnd > stackTop - stackSize) {
+            stackTop = ((segmentsEnd + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1)) + stackSize;
+            if (stackTop > ramBase + ramSize) {
+                printf("fatal: no room for the stack above the ELF segments, which end at 0x%" PRIx64 "\n", segmentsEnd);
+                return -1;
+            }
+            printf("ELF segments reach into the stack; moved the stack top to 0x%" PRIx64 "\n", stackTop);
+        }
+    }
+    else if (!ramLoader.Start(ramPath, ram, ramSize, ramProgramBase)) {
+        printf("fatal: %s\n", ramLoader.Error().c_str());
         return -1;
     }
-    fclose(fp);
-    printf("RAM loaded from %s\n", argv[2]);
-    
+    printf("Loading ROM from %s%s%s in the background\n", romPath, elfImage ? "" : " and RAM from ", elfImage ? "" : ramPath);
+
     printf("\n");
 
     // ----- Hypervisor platform initialization -------------------------------------------------------------------------------
 
-    // Pick the first hypervisor platform that is available and properly initialized on this system.
+    // Pick the first hypervisor platform that is available and properly initialized on this system,
+    // or the one selected with --platform
     printf("Loading virtualization platforms... ");
 
-    bool foundPlatform = false;
-    size_t platformIndex = 0;
-    for (size_t i = 0; i < array_size(PlatformFactories); i++) {
-        const Platform& platform = PlatformFactories[i]();
-        if (platform.GetInitStatus() == PlatformInitStatus::OK) {
-            printf("%s loaded successfully\n", platform.GetName().c_str());
-            foundPlatform = true;
-            platformIndex = i;
-            break;
-        }
-    }
-
-    if (!foundPlatform) {
+    auto stageStart = std::chrono::steady_clock::now();
+    const size_t platformIndex = selectPlatform(platformName);
+    if (platformIndex == SIZE_MAX) {
         printf("none found\n");
         return -1;
     }
 
     Platform& platform = PlatformFactories[platformIndex]();
+    printf("%s loaded successfully\n", platform.GetName().c_str());
+    const double platformMs = msSince(stageStart);
     auto& features = platform.GetFeatures();
     
     // Create virtual machine
     VMSpecifications vmSpecs = { 0 };
     vmSpecs.numProcessors = 1;
-    vmSpecs.extendedVMExits = ExtendedVMExit::CPUID;
-    vmSpecs.vmExitCPUIDFunctions.push_back(0);
-    vmSpecs.CPUIDResults.emplace_back(0x80000002, 'vupc', ' tri', 'UPCV', '    ');
+    if (cpuidSource != nullptr) {
+        if (strcmp(cpuidSource, "host") == 0) {
+            cpuidPolicy.LoadHost();
+        }
+        else if (!cpuidPolicy.Load(cpuidSource)) {
+            printf("fatal: %s\n", cpuidPolicy.Error().c_str());
+            return -1;
+        }
+        cpuidPolicy.Set(0x80000002, CPUIDPolicy::anySubleaf, 'vupc', ' tri', 'UPCV', '    ');
+        if (cpuidSavePath != nullptr && !cpuidPolicy.Save(cpuidSavePath)) {
+            printf("fatal: could not write CPUID table to %s\n", cpuidSavePath);
+            return -1;
+        }
+
+        auto cpuidStats = cpuidPolicy.Install(vmSpecs, features);
+        printf("CPUID policy: %zu leaves, %zu functions installed, %zu handled on exit, %zu left to the hypervisor\n",
+            cpuidPolicy.Leaves().size(), cpuidStats.installed, cpuidStats.trapped, cpuidStats.unhandled);
+    }
+    else {
+        vmSpecs.extendedVMExits = ExtendedVMExit::CPUID;
+        vmSpecs.vmExitCPUIDFunctions.push_back(0);
+        vmSpecs.CPUIDResults.emplace_back(0x80000002, 'vupc', ' tri', 'UPCV', '    ');
+    }
+
+    // The guest runs with an empty IDT, so without exception exits any fault
+    // would end in a triple fault
+    {
+        const auto exceptions = BitmaskEnum(crashTriage.Enable(vmSpecs, features));
+        printf("Exception exits:");
+        if (!exceptions) printf(" unsupported");
+        if (exceptions.AnyOf(ExceptionCode::InvalidOpcodeFault)) printf(" #UD");
+        if (exceptions.AnyOf(ExceptionCode::DoubleFaultAbort)) printf(" #DF");
+        if (exceptions.AnyOf(ExceptionCode::GeneralProtectionFault)) printf(" #GP");
+        if (exceptions.AnyOf(ExceptionCode::PageFault)) printf(" #PF");
+        printf("\n");
+    }
     printf("Creating virtual machine... ");
+    stageStart = std::chrono::steady_clock::now();
     auto opt_vm = platform.CreateVM(vmSpecs);
     if (!opt_vm) {
         printf("failed\n");
         return -1;
     }
+    const double createVMMs = msSince(stageStart);
     printf("succeeded\n");
     VirtualMachine& vm = opt_vm->get();
     
-    // Map ROM to the top of the 32-bit address range
+    // Track every guest physical mapping. Devices access guest RAM directly
+    // through guestMemory, which the address space keeps up to date.
+    GuestMemory guestMemory;
+    GuestAddressSpace addressSpace(vm, features, &guestMemory);
+    addressSpace.SetMergeable(merge);
+
+    // Map ROM to the top of the 32-bit address range. Mapping does not read
+    // the memory, so the images may still be loading.
+    stageStart = std::chrono::steady_clock::now();
     printf("Mapping ROM... ");
     {
-        auto memMapStatus = vm.MapGuestMemory(romBase, romSize, MemoryFlags::Read | MemoryFlags::Execute, rom);
+        auto memMapStatus = addressSpace.Map("ROM", romBase, romSize, MemoryFlags::Read | MemoryFlags::Execute, rom);
         printMemoryMappingStatus(memMapStatus);
         if (memMapStatus != MemoryMappingStatus::OK) return -1;
     }
@@ -230,11 +516,57 @@ int main(int argc, char* argv[]) {
     // Map RAM to the bottom of the 32-bit address range
     printf("Mapping RAM... ");
     {
-        auto memMapStatus = vm.MapGuestMemory(ramBase, ramSize, MemoryFlags::Read | MemoryFlags::Write | MemoryFlags::Execute | MemoryFlags::DirtyPageTracking, ram);
+        auto memMapStatus = addressSpace.Map("RAM", ramBase, ramSize, MemoryFlags::Read | MemoryFlags::Write | MemoryFlags::Execute | MemoryFlags::DirtyPageTracking, ram);
         printMemoryMappingStatus(memMapStatus);
         if (memMapStatus != MemoryMappingStatus::OK) return -1;
     }
+    const double mapMs = msSince(stageStart);
+
+    // Route I/O to the hypercall dispatcher, which accesses guest RAM directly
+    IOBus ioBus;
+    HypercallDispatcher hypercalls(guestMemory);
+    hypercalls.Attach(ioBus);
+
+    VirtioBlk virtioBlk(guestMemory);
+    if (diskPath != nullptr) {
+        printf("Opening disk image %s... ", diskPath);
+        if (!virtioBlk.Open(diskPath, true)) {
+            printf("failed\n");
+            return -1;
+        }
+        virtioBlk.Attach(ioBus, virtioBlkBase);
+        printf("%" PRIu64 " sectors\n", virtioBlk.Capacity());
+    }
 
+    // Let the guest return free pages to the host
+    const uint32_t balloonTargetPages = 192;
+    BalloonDevice balloon(guestMemory, ramBase + ramSize);
+    balloon.Attach(ioBus);
+    balloon.SetTarget(balloonTargetPages);
+
+    // Give the guest a console on COM1, written to stdout unless redirected.
+    // A redirected file is declared before the UART so that it is closed
+    // only after the UART has drained into it and been destroyed.
+    std::unique_ptr<FILE, int (*)(FILE *)> consoleFileOwner(nullptr, fclose);
+    UART16550 console;
+    FILE *consoleFile = stdout;
+    if (consolePath != nullptr) {
+        consoleFile = fopen(consolePath, "wb");
+        if (consoleFile == NULL) {
+            printf("fatal: could not open console output file %s\n", consolePath);
+            return -1;
+        }
+        consoleFileOwner.reset(consoleFile);
+    }
+    console.Attach(ioBus);
+    console.Start(consoleFile);
+
+    if (replayLog.GetMode() != ReplayLog::Mode::Off) {
+        replayLog.Attach(vm, ioBus);
+    }
+    else {
+        ioBus.Attach(vm);
+    }
 
     // Get the virtual processor
     printf("Retrieving virtual processor... ");
@@ -250,11 +582,83 @@ int main(int argc, char* argv[]) {
     printRegs(vp);
     printf("\n");
 
-    // The ROM code expects the following:
-    //   es:edi    Should point to a valid page-aligned 16KiB buffer, for the PML4, PDPT, PD and a PT.
-    //   ss:esp    Should point to memory that can be used as a small (1 uint32_t) stack
-    // We'll set up our page table at 0x0 and use 0x10000 as the base of our stack, just below the user program.
-    {
+    // Everything from here on may access guest memory
+    stageStart = std::chrono::steady_clock::now();
+    if (!romLoader.Wait()) {
+        printf("fatal: could not fully read ROM file: %s\n", romLoader.Error().c_str());
+        return -1;
+    }
+    if (!elfImage && !ramLoader.Wait()) {
+        printf("fatal: could not fully read RAM file: %s\n", ramLoader.Error().c_str());
+        return -1;
+    }
+    const double waitMs = msSince(stageStart);
+    printf("Startup timings:\n");
+    printf("  ROM load            %8.2f ms (background)\n", romLoader.ElapsedMs());
+    if (elfImage) {
+        printf("  ELF load            %8.2f ms\n", elfLoadMs);
+    }
+    else {
+        printf("  RAM load and clear  %8.2f ms (background, %" PRIu64 " bytes read)\n", ramLoader.ElapsedMs(), ramLoader.FileSize());
+    }
+    printf("  Platform init       %8.2f ms\n", platformMs);
+    printf("  VM creation         %8.2f ms\n", createVMMs);
+    printf("  Memory mapping      %8.2f ms\n", mapMs);
+    printf("  Waiting for images  %8.2f ms\n", waitMs);
+    printf("  Total               %8.2f ms\n", msSince(startupStart));
+    printf("\n");
+
+    // Wait for the debugger before the first instruction runs
+    GDBStub debugger(guestMemory);
+    if (gdbEndpoint != nullptr) {
+        if (!debugger.Listen(gdbEndpoint)) {
+            printf("fatal: could not listen for GDB on %s\n", gdbEndpoint);
+            return -1;
+        }
+        printf("Waiting for GDB on %s...\n", gdbEndpoint);
+        fflush(stdout);
+        while (!debugger.Accept(1000)) {
+        }
+        printf("GDB attached\n\n");
+        gdbStub = &debugger;
+    }
+
+    // ----- Start ----------------------------------------------------------------------------------------------------
+
+    // With the ROM boot, the host allocates its page tables after the ones built by the ROM
+    const uint64_t hostTablesOffset = directBoot ? 0 : romPageTablesSize;
+    PageTableBuilder pageTables(guestMemory, pageTableArea + hostTablesOffset, pageTableAreaSize - hostTablesOffset);
+    pageTables.UseHugePages(hugePages);
+
+    auto bootStart = std::chrono::steady_clock::now();
+    if (directBoot) {
+        // Build the long mode environment on the host and start at the RAM entry point
+        const uint64_t entryPoint = elfImage ? elf.Entry() : ramProgramBase;
+        // All of RAM is identity-mapped with the largest pages possible, and
+        // the ROM with 4 KiB pages
+        if (!pageTables.Create()
+            || !pageTables.Map(0, 0, ramSize, PageTableBuilder::PTE_WRITE)
+            || !pageTables.Map(romBase, romBase, romSize, PageTableBuilder::PTE_WRITE)) {
+            printf("fatal: failed to build page tables\n");
+            return -1;
+        }
+        if (!bootLongMode(vp, pageTables, ram, gdtAddress, entryPoint, stackTop)) {
+            printf("fatal: failed to set up the virtual processor for long mode\n");
+            return -1;
+        }
+
+        // Segments linked at other virtual addresses, such as a higher half
+        // kernel, need mappings of their own on top of the identity map
+        if (elfImage && !elf.MapSegments(pageTables)) {
+            printf("fatal: could not map ELF segments: %s\n", elf.Error().c_str());
+            return -1;
+        }
+    }
+    else {
+        // The ROM code expects the following:
+        //   es:edi    Should point to a valid page-aligned 16KiB buffer, for the PML4, PDPT, PD and a PT.
+        //   ss:esp    Should point to memory that can be used as a small (1 uint32_t) stack
+        // We'll set up our page table at 0x0 and use 0x10000 as the base of our stack, just below the user program.
         RegValue edi, esp;
         edi.u32 = 0x0;
         esp.u32 = 0x10000;
@@ -262,10 +666,77 @@ int main(int argc, char* argv[]) {
         vp.RegWrite(Reg::ESP, esp);
     }
 
-    // ----- Start ----------------------------------------------------------------------------------------------------
+    // Breakpoints go in before the first instruction so that the boot code is covered too
+    if (coveragePath != nullptr) {
+        if (!coverage.Load(coveragePath)) {
+            printf("fatal: %s\n", coverage.Error().c_str());
+            return -1;
+        }
+        if (!coverage.Arm(vp)) {
+            printf("fatal: failed to arm coverage breakpoints: %s\n", coverage.Error().c_str());
+            return -1;
+        }
+        printf("Coverage: tracking %zu basic blocks\n", coverage.NumBlocks());
+    }
 
-    // Run next block
-    runToHLT(vp);
+    // Run next block, tracing every instruction if requested
+    if (tracePath != nullptr) {
+        StepTracer tracer;
+        if (!tracer.Start(vp, tracePath)) {
+            printf("fatal: %s\n", tracer.Error().c_str());
+            return -1;
+        }
+        if (!tracer.EnableMemoryWrites(vm, ramBase, ram, ramSize)) {
+            printf("Memory writes will not be traced: %s\n", tracer.Error().c_str());
+        }
+        const uint64_t maxTraceSteps = 10000000;
+        VPExecutionStatus status = VPExecutionStatus::OK;
+        while (tracer.NumSteps() < maxTraceSteps) {
+            status = tracer.Step(vp);
+            if (status != VPExecutionStatus::OK) {
+                break;
+            }
+            const auto reason = vp.GetVMExitInfo().reason;
+            if (reason == VMExitReason::CPUID && !cpuidPolicy.Leaves().empty()) {
+                cpuidPolicy.HandleExit(vp);
+            }
+            else if (reason == VMExitReason::HLT || reason == VMExitReason::Exception
+                || reason == VMExitReason::Shutdown || reason == VMExitReason::Error) {
+                break;
+            }
+        }
+        if (!tracer.Finish()) {
+            printf("Failed to write trace to %s: %s\n", tracePath, tracer.Error().c_str());
+        }
+        printf("Traced %" PRIu64 " instructions to %s: %" PRIu64 " bytes, %" PRIu64 " memory writes%s\n",
+            tracer.NumSteps(), tracePath, tracer.BytesWritten(), tracer.NumMemoryWrites(),
+            (status != VPExecutionStatus::OK) ? " (VCPU failed to step)" : "");
+    }
+    else {
+        runToHLT(vp, false);
+    }
+    auto bootTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - bootStart).count();
+    printRegs(vp);
+    printf("\n");
+    printf("%s boot to first HLT took %.1f us\n", (directBoot ? "Direct" : "ROM"), bootTime);
+    report.Add("boot", (vp.GetVMExitInfo().reason == VMExitReason::HLT) ? TestStatus::Passed : TestStatus::Failed, numExits, (uint64_t)(bootTime * 1000.0));
+
+    // The ROM only maps the first 2 MiB of RAM; map the rest with large pages.
+    // rom.asm points the fourth PDPTE at the same page directory as the first,
+    // so the ROM needs page tables of its own before more RAM can be mapped.
+    if (!directBoot) {
+        pageTables.Attach(pageTableArea);
+        if (ramSize > PAGE_SIZE * 512) {
+            *(uint64_t *)&ram[romPDPTAddress + 3 * sizeof(uint64_t)] = 0;
+            if (!pageTables.Map(romBase, romBase, romSize, PageTableBuilder::PTE_WRITE)
+                || !pageTables.Map(PAGE_SIZE * 512, PAGE_SIZE * 512, ramSize - PAGE_SIZE * 512, PageTableBuilder::PTE_WRITE)) {
+                printf("fatal: failed to map RAM above 2 MiB\n");
+                return -1;
+            }
+        }
+    }
+    printf("RAM mapped with %" PRIu64 " 4 KiB, %" PRIu64 " 2 MiB and %" PRIu64 " 1 GiB pages using %zu page tables\n",
+        pageTables.NumPages4K(), pageTables.NumPages2M(), pageTables.NumPages1G(), pageTables.NumTables());
     printf("\n");
 
     // ----- Page table manipulation ----------------------------------------------------------------------------------
@@ -276,33 +747,27 @@ int main(int argc, char* argv[]) {
     const static uint64_t checkValue1 = 0xfedcba9876543210;
     const static uint64_t checkValue2 = 0x0123456789abcdef;
 
-    // Allocate host memory for the new page and write the check value to its base address
+    // Allocate host memory for the new pages and write the check values to their base addresses
     // We allocate near the top of the maximum supported GPA, with one page of breathing room because HAXM doesn't let us use the last page
+    // Room for two more pages is reserved to demonstrate hot-add and hot-remove later
     const size_t moreRamSize = PAGE_SIZE * 2;
-    const uint64_t moreRamBase = features.guestPhysicalAddress.maxAddress - moreRamSize - 0x1000;
-    uint8_t* moreRam = alignedAlloc(moreRamSize);
-    if (moreRam == NULL) {
-        printf("fatal: failed to allocate memory for additional RAM\n");
-        return -1;
-    }
-    memset(moreRam, 0, moreRamSize);
-    printf("Additional RAM allocated: %u bytes\n", moreRamSize);
-    memcpy(moreRam, &checkValue1, sizeof(checkValue1));
-    memcpy(moreRam + PAGE_SIZE, &checkValue2, sizeof(checkValue2));
-
-    // Map the memory to the guest at the desired base address
-    printf("Mapping additional RAM to 0x%llx... ", moreRamBase);
+    const size_t moreRamMaxSize = PAGE_SIZE * 4;
+    const uint64_t moreRamBase = (features.guestPhysicalAddress.maxAddress - moreRamMaxSize - 0x1000) & ~0xFFFull;
+    printf("Mapping additional RAM to 0x%" PRIx64 "... ", moreRamBase);
     {
-        auto memMapStatus = vm.MapGuestMemory(moreRamBase, moreRamSize, MemoryFlags::Read | MemoryFlags::Write | MemoryFlags::Execute, moreRam);
+        auto memMapStatus = addressSpace.AddRAM("additional RAM", moreRamBase, moreRamSize, moreRamMaxSize, MemoryFlags::Read | MemoryFlags::Write | MemoryFlags::Execute);
         printMemoryMappingStatus(memMapStatus);
         if (memMapStatus != MemoryMappingStatus::OK) return -1;
     }
+    uint8_t *moreRam = addressSpace.Find(moreRamBase)->memory;
+    memcpy(moreRam, &checkValue1, sizeof(checkValue1));
+    memcpy(moreRam + PAGE_SIZE, &checkValue2, sizeof(checkValue2));
 
     // Map the newly added physical page to linear address 0x100000000
-    // PML4E for that virtual address already exists
-    *(uint64_t*)&ram[0x1020] = 0x5023;  // PDPTE -> PDE at 0x5000
-    *(uint64_t*)&ram[0x5000] = 0x6023;  // PDE -> PTE at 0x6000
-    *(uint64_t*)&ram[0x6000] = (moreRamBase & ~0xFFF) | 0x23;   // PTE -> physical address
+    if (!pageTables.Map(0x100000000, moreRamBase, PAGE_SIZE, PageTableBuilder::PTE_WRITE)) {
+        printf("fatal: failed to map additional RAM\n");
+        return -1;
+    }
 
     // Display linear-to-physical address translation of the new page
     printAddressTranslation(vp, 0x100000000);
@@ -313,7 +778,10 @@ int main(int argc, char* argv[]) {
     printf("\n");
 
     // Update page mapping to point to the second page of the newly allocated RAM
-    *(uint64_t*)&ram[0x6000] = ((moreRamBase & ~0xFFF) + 0x1000) | 0x23;   // PTE -> physical address
+    if (!pageTables.Map(0x100000000, moreRamBase + 0x1000, PAGE_SIZE, PageTableBuilder::PTE_WRITE)) {
+        printf("fatal: failed to remap additional RAM\n");
+        return -1;
+    }
 
     // Display new address translation
     printf("Page mapping updated:\n");
@@ -324,6 +792,21 @@ int main(int argc, char* argv[]) {
     runToHLT(vp);
     printf("\n");
 
+    // ----- Memory hot-add and hot-remove ----------------------------------------------------------------------------
+
+    // The guest is done with the additional RAM. Grow it into the reserved
+    // range, then shrink it to a single page, returning the rest to the host.
+    printf("Guest physical memory map:\n");
+    addressSpace.Print(stdout);
+    printf("Growing additional RAM to %zu KiB... ", moreRamMaxSize / 1024);
+    printMemoryMappingStatus(addressSpace.Resize(moreRamBase, moreRamMaxSize));
+    printf("Shrinking additional RAM to %zu KiB... ", (size_t)PAGE_SIZE / 1024);
+    printMemoryMappingStatus(addressSpace.Resize(moreRamBase, PAGE_SIZE));
+    printf("Guest physical memory map:\n");
+    addressSpace.Print(stdout);
+    printf("%" PRIu64 " KiB of host memory released\n", addressSpace.TotalDiscarded() / 1024);
+    printf("\n");
+
     // ----- Floating point extensions tests initialization -----------------------------------------------------------
 
     // Define some helper functions for tests
@@ -367,7 +850,7 @@ int main(int argc, char* argv[]) {
     
     if (testBits & FPTEST_MMX) {
         // Run next block
-        runToHLT(vp);
+        const TestRun run = runTest(vp);
         printf("\n");
         printMMRegs(vp, MMFormat::I16);
         printf("\n");
@@ -382,22 +865,25 @@ int main(int argc, char* argv[]) {
             uint64_t memValue;
             vp.LMemRead(rsi.u64, sizeof(memValue), &memValue);
 
-            if (rax.u64 == 0x002c00210016000b) printf("RAX contains the correct result\n");
-            if (memValue == 0x002c00210016000b) printf("Memory contains the correct result\n");
-            if (mm0.mm.i64[0] == 0x002c00210016000b) printf("MM0 contains the correct result\n");
+            bool passed = true;
+            passed &= checkResult(rax.u64 == 0x002c00210016000b, "RAX");
+            passed &= checkResult(memValue == 0x002c00210016000b, "Memory");
+            passed &= checkResult(mm0.mm.i64[0] == 0x002c00210016000b, "MM0");
             printf("MMX test complete\n");
+            report.Add("mmx", passed ? TestStatus::Passed : TestStatus::Failed, run.exits, run.ns);
         }
         printf("\n");
     }
     else {
         printf("MMX not supported by guest; skipping test\n\n");
+        report.Add("mmx", TestStatus::Skipped, 0, 0);
     }
 
     // ----- SSE ------------------------------------------------------------------------------------------------------
 
     if (testBits & FPTEST_SSE) {
         // Run next block
-        runToHLT(vp);
+        const TestRun run = runTest(vp);
         printf("\n");
         printXMMRegs(vp, XMMFormat::F32);
         printf("\n");
@@ -413,23 +899,26 @@ int main(int argc, char* argv[]) {
             vp.LMemRead(rsi.u64, sizeof(memValue), &memValue);
 
             // Reinterpret RAX as if it were the lowest 64 bits of XMM0
-            if (feq(rax.xmm.f32[0], 30.8) && feq(rax.xmm.f32[1], 51.48)) printf("RAX contains the correct result\n");
-            if (feq(memValue[0], 30.8) && feq(memValue[1], 51.48) && feq(memValue[2], 77.0) && feq(memValue[3], 107.36)) printf("Memory contains the correct result\n");
-            if (feq(xmm0.xmm.f32[0], 30.8) && feq(xmm0.xmm.f32[1], 51.48) && feq(xmm0.xmm.f32[2], 77.0) && feq(xmm0.xmm.f32[3], 107.36)) printf("XMM0 contains the correct result\n");
+            bool passed = true;
+            passed &= checkResult(feq(rax.xmm.f32[0], 30.8) && feq(rax.xmm.f32[1], 51.48), "RAX");
+            passed &= checkResult(feq(memValue[0], 30.8) && feq(memValue[1], 51.48) && feq(memValue[2], 77.0) && feq(memValue[3], 107.36), "Memory");
+            passed &= checkResult(feq(xmm0.xmm.f32[0], 30.8) && feq(xmm0.xmm.f32[1], 51.48) && feq(xmm0.xmm.f32[2], 77.0) && feq(xmm0.xmm.f32[3], 107.36), "XMM0");
             printf("SSE test complete\n");
+            report.Add("sse", passed ? TestStatus::Passed : TestStatus::Failed, run.exits, run.ns);
         }
 
         printf("\n");
     }
     else {
         printf("SSE not supported by guest; skipping test\n\n");
+        report.Add("sse", TestStatus::Skipped, 0, 0);
     }
 
     // ----- SSE2 -----------------------------------------------------------------------------------------------------
 
     if (testBits & FPTEST_SSE2) {
         // Run next block
-        runToHLT(vp);
+        const TestRun run = runTest(vp);
         printf("\n");
         printXMMRegs(vp, XMMFormat::F64);
         printf("\n");
@@ -445,23 +934,26 @@ int main(int argc, char* argv[]) {
             vp.LMemRead(rsi.u64, sizeof(memValue), &memValue);
 
             // Reinterpret RAX as if it were the lowest 64 bits of XMM0
-            if (deq(rax.xmm.f64[0], 11.22)) printf("RAX contains the correct result\n");
-            if (deq(memValue[0], 11.22) && deq(memValue[1], 24.64)) printf("Memory contains the correct result\n");
-            if (deq(xmm0.xmm.f64[0], 11.22) && deq(xmm0.xmm.f64[1], 24.64)) printf("XMM0 contains the correct result\n");
+            bool passed = true;
+            passed &= checkResult(deq(rax.xmm.f64[0], 11.22), "RAX");
+            passed &= checkResult(deq(memValue[0], 11.22) && deq(memValue[1], 24.64), "Memory");
+            passed &= checkResult(deq(xmm0.xmm.f64[0], 11.22) && deq(xmm0.xmm.f64[1], 24.64), "XMM0");
             printf("SSE2 test complete\n");
+            report.Add("sse2", passed ? TestStatus::Passed : TestStatus::Failed, run.exits, run.ns);
         }
 
         printf("\n");
     }
     else {
         printf("SSE2 not supported by guest; skipping test\n\n");
+        report.Add("sse2", TestStatus::Skipped, 0, 0);
     }
 
     // ----- SSE3 -----------------------------------------------------------------------------------------------------
 
     if (testBits & FPTEST_SSE3) {
         // Run next block
-        runToHLT(vp);
+        const TestRun run = runTest(vp);
         printf("\n");
         printXMMRegs(vp, XMMFormat::F64);
         printf("\n");
@@ -477,23 +969,26 @@ int main(int argc, char* argv[]) {
             vp.LMemRead(rsi.u64, sizeof(memValue), &memValue);
 
             // Reinterpret RAX as if it were the lowest 64 bits of XMM0
-            if (deq(rax.xmm.f64[0], 4.0)) printf("RAX contains the correct result\n");
-            if (deq(memValue[0], 4.0) && deq(memValue[1], 2.0)) printf("Memory contains the correct result\n");
-            if (deq(xmm0.xmm.f64[0], 4.0) && deq(xmm0.xmm.f64[1], 2.0)) printf("XMM0 contains the correct result\n");
+            bool passed = true;
+            passed &= checkResult(deq(rax.xmm.f64[0], 4.0), "RAX");
+            passed &= checkResult(deq(memValue[0], 4.0) && deq(memValue[1], 2.0), "Memory");
+            passed &= checkResult(deq(xmm0.xmm.f64[0], 4.0) && deq(xmm0.xmm.f64[1], 2.0), "XMM0");
             printf("SSE3 test complete\n");
+            report.Add("sse3", passed ? TestStatus::Passed : TestStatus::Failed, run.exits, run.ns);
         }
 
         printf("\n");
     }
     else {
         printf("SSE3 not supported by guest; skipping test\n\n");
+        report.Add("sse3", TestStatus::Skipped, 0, 0);
     }
 
     // ----- SSSE3 ----------------------------------------------------------------------------------------------------
 
     if (testBits & FPTEST_SSSE3) {
         // Run next block
-        runToHLT(vp);
+        const TestRun run = runTest(vp);
         printf("\n");
         printXMMRegs(vp, XMMFormat::I32);
         printf("\n");
@@ -509,23 +1004,26 @@ int main(int argc, char* argv[]) {
             vp.LMemRead(rsi.u64, sizeof(memValue), &memValue);
 
             // Reinterpret RAX as if it were the lowest 64 bits of XMM1
-            if (rax.xmm.i32[0] == -3087 && rax.xmm.i32[1] == 3087) printf("RAX contains the correct result\n");
-            if (memValue[0] == -3087 && memValue[1] == 3087 && memValue[2] == 5555 && memValue[3] == 5555) printf("Memory contains the correct result\n");
-            if (xmm1.xmm.i32[0] == -3087 && xmm1.xmm.i32[1] == 3087 && xmm1.xmm.i32[2] == 5555 && xmm1.xmm.i32[3] == 5555) printf("XMM1 contains the correct result\n");
+            bool passed = true;
+            passed &= checkResult(rax.xmm.i32[0] == -3087 && rax.xmm.i32[1] == 3087, "RAX");
+            passed &= checkResult(memValue[0] == -3087 && memValue[1] == 3087 && memValue[2] == 5555 && memValue[3] == 5555, "Memory");
+            passed &= checkResult(xmm1.xmm.i32[0] == -3087 && xmm1.xmm.i32[1] == 3087 && xmm1.xmm.i32[2] == 5555 && xmm1.xmm.i32[3] == 5555, "XMM1");
             printf("SSSE3 test complete\n");
+            report.Add("ssse3", passed ? TestStatus::Passed : TestStatus::Failed, run.exits, run.ns);
         }
 
         printf("\n");
     }
     else {
         printf("SSSE3 not supported by guest; skipping test\n\n");
+        report.Add("ssse3", TestStatus::Skipped, 0, 0);
     }
 
     // ----- SSE4 -----------------------------------------------------------------------------------------------------
 
     if (testBits & FPTEST_SSE4) {
         // Run next block
-        runToHLT(vp);
+        const TestRun run = runTest(vp);
         printf("\n");
         printXMMRegs(vp, XMMFormat::I64);
         printf("\n");
@@ -540,23 +1038,26 @@ int main(int argc, char* argv[]) {
             int64_t memValue[2];
             vp.LMemRead(rsi.u64, sizeof(memValue), &memValue);
 
-            if (rax.u64 == 0) printf("RAX contains the correct result\n");
-            if (memValue[0] == 0 && memValue[1] == -1) printf("Memory contains the correct result\n");
-            if (xmm2.xmm.i64[0] == 0 && xmm2.xmm.i64[1] == -1) printf("XMM2 contains the correct result\n");
+            bool passed = true;
+            passed &= checkResult(rax.u64 == 0, "RAX");
+            passed &= checkResult(memValue[0] == 0 && memValue[1] == -1, "Memory");
+            passed &= checkResult(xmm2.xmm.i64[0] == 0 && xmm2.xmm.i64[1] == -1, "XMM2");
             printf("SSE4 test complete\n");
+            report.Add("sse4", passed ? TestStatus::Passed : TestStatus::Failed, run.exits, run.ns);
         }
 
         printf("\n");
     }
     else {
         printf("SSE4 not supported by guest; skipping test\n\n");
+        report.Add("sse4", TestStatus::Skipped, 0, 0);
     }
 
     // ----- AVX ------------------------------------------------------------------------------------------------------
 
     if (testBits & FPTEST_AVX) {
         // Run next block
-        runToHLT(vp);
+        const TestRun run = runTest(vp);
         printf("\n");
         printXMMRegs(vp, XMMFormat::F32);
         printf("\n");
@@ -572,24 +1073,27 @@ int main(int argc, char* argv[]) {
             vp.LMemRead(rsi.u64, sizeof(memValue), &memValue);
 
             // Reinterpret RAX as if it were the lowest 64 bits of XMM3
-            if (feq(rax.xmm.f32[0], 10.0) && feq(rax.xmm.f32[1], 15.0)) printf("RAX contains the correct result\n");
-            if (feq(memValue[0], 10.0) && feq(memValue[1], 15.0) && feq(memValue[2], 20.0) && feq(memValue[3], 25.0)
-                && feq(memValue[4], 30.0) && feq(memValue[5], 35.0) && feq(memValue[6], 40.0) && feq(memValue[7], 45.0)) printf("Memory contains the correct result\n");
-            if (feq(xmm3.xmm.f32[0], 10.0) && feq(xmm3.xmm.f32[1], 15.0) && feq(xmm3.xmm.f32[2], 20.0) && feq(xmm3.xmm.f32[3], 25.0)) printf("XMM3 contains the correct result\n");
+            bool passed = true;
+            passed &= checkResult(feq(rax.xmm.f32[0], 10.0) && feq(rax.xmm.f32[1], 15.0), "RAX");
+            passed &= checkResult(feq(memValue[0], 10.0) && feq(memValue[1], 15.0) && feq(memValue[2], 20.0) && feq(memValue[3], 25.0)
+                && feq(memValue[4], 30.0) && feq(memValue[5], 35.0) && feq(memValue[6], 40.0) && feq(memValue[7], 45.0), "Memory");
+            passed &= checkResult(feq(xmm3.xmm.f32[0], 10.0) && feq(xmm3.xmm.f32[1], 15.0) && feq(xmm3.xmm.f32[2], 20.0) && feq(xmm3.xmm.f32[3], 25.0), "XMM3");
             printf("AVX test complete\n");
+            report.Add("avx", passed ? TestStatus::Passed : TestStatus::Failed, run.exits, run.ns);
         }
 
         printf("\n");
     }
     else {
         printf("AVX not supported by guest; skipping test\n\n");
+        report.Add("avx", TestStatus::Skipped, 0, 0);
     }
 
     // ----- FMA3 -----------------------------------------------------------------------------------------------------
 
     if (testBits & FPTEST_FMA3) {
         // Run next block
-        runToHLT(vp);
+        const TestRun run = runTest(vp);
         printf("\n");
         printXMMRegs(vp, XMMFormat::F64);
         printf("\n");
@@ -605,23 +1109,26 @@ int main(int argc, char* argv[]) {
             vp.LMemRead(rsi.u64, sizeof(memValue), &memValue);
 
             // Reinterpret RAX as if it were the lowest 64 bits of XMM0
-            if (deq(rax.xmm.f64[0], 4.0)) printf("RAX contains the correct result\n");
-            if (deq(memValue[0], 4.0) && deq(memValue[1], 5.5) && deq(memValue[2], 6.0) && deq(memValue[3], 5.5)) printf("Memory contains the correct result\n");
-            if (deq(xmm0.xmm.f64[0], 4.0) && deq(xmm0.xmm.f64[1], 5.5)) printf("XMM0 contains the correct result\n");
+            bool passed = true;
+            passed &= checkResult(deq(rax.xmm.f64[0], 4.0), "RAX");
+            passed &= checkResult(deq(memValue[0], 4.0) && deq(memValue[1], 5.5) && deq(memValue[2], 6.0) && deq(memValue[3], 5.5), "Memory");
+            passed &= checkResult(deq(xmm0.xmm.f64[0], 4.0) && deq(xmm0.xmm.f64[1], 5.5), "XMM0");
             printf("FMA3 test complete\n");
+            report.Add("fma3", passed ? TestStatus::Passed : TestStatus::Failed, run.exits, run.ns);
         }
 
         printf("\n");
     }
     else {
         printf("FMA3 not supported by guest; skipping test\n\n");
+        report.Add("fma3", TestStatus::Skipped, 0, 0);
     }
 
     // ----- AVX2 -----------------------------------------------------------------------------------------------------
 
     if (testBits & FPTEST_AVX2) {
         // Run next block
-        runToHLT(vp);
+        const TestRun run = runTest(vp);
         printf("\n");
         printXMMRegs(vp, XMMFormat::I64);
         printf("\n");
@@ -636,23 +1143,26 @@ int main(int argc, char* argv[]) {
             uint64_t memValue[4];
             vp.LMemRead(rsi.u64, sizeof(memValue), &memValue);
 
-            if (rax.u64 == 4) printf("RAX contains the correct result\n");
-            if (memValue[0] == 4 && memValue[1] == 3 && memValue[2] == 2 && memValue[3] == 1) printf("Memory contains the correct result\n");
-            if (xmm15.xmm.i64[0] == 4 && xmm15.xmm.i64[1] == 3) printf("XMM15 contains the correct result\n");
+            bool passed = true;
+            passed &= checkResult(rax.u64 == 4, "RAX");
+            passed &= checkResult(memValue[0] == 4 && memValue[1] == 3 && memValue[2] == 2 && memValue[3] == 1, "Memory");
+            passed &= checkResult(xmm15.xmm.i64[0] == 4 && xmm15.xmm.i64[1] == 3, "XMM15");
             printf("AVX2 test complete\n");
+            report.Add("avx2", passed ? TestStatus::Passed : TestStatus::Failed, run.exits, run.ns);
         }
 
         printf("\n");
     }
     else {
         printf("AVX2 not supported by guest; skipping test\n\n");
+        report.Add("avx2", TestStatus::Skipped, 0, 0);
     }
 
     // ----- XSAVE ----------------------------------------------------------------------------------------------------
 
     if (testBits & FPTEST_XSAVE) {
         // Run next block
-        runToHLT(vp);
+        const TestRun run = runTest(vp);
         printf("\n");
 
         // Check result
@@ -671,16 +1181,202 @@ int main(int argc, char* argv[]) {
             printXSAVE(vp, rsi.u64, bases, sizes, alignments, MMFormat::I16, XMMFormat::IF32);
             printf("\n");
             printf("XSAVE test complete\n");
+            report.Add("xsave", TestStatus::Passed, run.exits, run.ns);
         }
 
         printf("\n");
     }
     else {
         printf("XSAVE not supported by guest; skipping test\n\n");
+        report.Add("xsave", TestStatus::Skipped, 0, 0);
+    }
+
+    // ----- Hypercalls -----------------------------------------------------------------------------------------------
+
+    {
+        // Run next block
+        const TestRun run = runTest(vp);
+        printf("\n");
+
+        // Check result
+        RegValue rax, rsi;
+        vp.RegRead(Reg::RAX, rax);   // contains the number of processed requests
+        vp.RegRead(Reg::RSI, rsi);   // contains address of the batch in memory
+
+        bool passed = false;
+        auto batch = reinterpret_cast<const HypercallBatch *>(guestMemory.Translate(rsi.u64, PAGE_SIZE));
+        if (batch == nullptr) {
+            printf("Hypercall batch address is invalid: 0x%" PRIx64 "\n", rsi.u64);
+        }
+        else {
+            // The guest fills the bulk buffer with bytes 1 to 8 repeatedly
+            const uint64_t bulkSize = batch->requests[1].args[1];
+            const int64_t expectedChecksum = (int64_t)(bulkSize / 8 * (1 + 2 + 3 + 4 + 5 + 6 + 7 + 8));
+
+            const bool allProcessed = rax.u32 == 4 && batch->processed == 4;
+            const bool consoleOK = batch->requests[0].result == (int64_t)batch->requests[0].args[1];
+            const bool checksumOK = batch->requests[1].result == expectedChecksum;
+            const bool nopOK = batch->requests[2].result == 0;
+            const bool unknownRejected = batch->requests[3].result == HC_ENOSYS;
+            if (allProcessed) printf("All hypercalls were processed\n");
+            if (consoleOK) printf("Console write returned the correct result\n");
+            if (checksumOK) printf("Checksum returned the correct result\n");
+            if (nopOK) printf("NOP returned the correct result\n");
+            if (unknownRejected) printf("Unknown hypercall was rejected\n");
+            printf("Processed %" PRIu64 " hypercalls in %" PRIu64 " batches\n", hypercalls.NumRequests(), hypercalls.NumBatches());
+            passed = allProcessed && consoleOK && checksumOK && nopOK && unknownRejected;
+            printf(passed ? "Hypercall test complete\n" : "Hypercall test failed\n");
+        }
+        report.Add("hypercalls", passed ? TestStatus::Passed : TestStatus::Failed, run.exits, run.ns);
+    }
+    printf("\n");
+
+    // ----- Virtio block device --------------------------------------------------------------------------------------
+
+    // Run device initialization block. The guest maps the device registers
+    // through the page table entry whose address is passed in RDI.
+    vp.RegWrite(Reg::RDI, pageTables.EntryAddress(virtioBlkBase));
+    const TestRun virtioInitRun = runTest(vp, false);
+    printRegs(vp);
+    printf("\n");
+
+    {
+        RegValue rax;
+        vp.RegRead(Reg::RAX, rax);   // contains 1 if the guest initialized the device
+        const bool deviceReady = rax.u64 == 1;
+        if (deviceReady) printf("Guest initialized the virtio block device\n");
+        else printf("Virtio block device not available; skipping benchmark\n");
+
+        // Run the benchmark block
+        auto start = std::chrono::steady_clock::now();
+        const TestRun run = runTest(vp, false);
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // Without a disk image there is no device to benchmark
+        TestStatus status = (diskPath != nullptr) ? TestStatus::Failed : TestStatus::Skipped;
+        if (deviceReady) {
+            RegValue r12, r13;
+            vp.RegRead(Reg::R12, r12);   // contains the number of completed requests
+            vp.RegRead(Reg::R13, r13);   // contains the number of failed requests
+
+            const double bytes = (double)virtioBlk.BytesRead();
+            printf("Completed %" PRIu64 " requests (%" PRIu64 " failed) with %" PRIu64 " notifications in %.3f ms\n",
+                r12.u64, r13.u64, virtioBlk.NumNotifications(), elapsed * 1000.0);
+            printf("  %.0f IOPS, %.2f MB/s\n", (double)r12.u64 / elapsed, bytes / elapsed / 1000000.0);
+            if (r12.u64 == virtioBlk.NumRequests() && r13.u64 == 0) {
+                printf("All requests completed successfully\n");
+                status = TestStatus::Passed;
+            }
+            printf("Virtio block benchmark complete\n");
+        }
+        report.Add("virtio-blk", status, virtioInitRun.exits + run.exits, virtioInitRun.ns + run.ns);
+    }
+    printf("\n");
+
+    // ----- Memory balloon -------------------------------------------------------------------------------------------
+
+    {
+        const uint64_t rssStart = residentSetSize();
+
+        // Run the inflate block
+        const TestRun inflateRun = runTest(vp, false);
+        RegValue rax;
+        vp.RegRead(Reg::RAX, rax);   // contains the balloon size reported by the device
+        const uint64_t inflatedPages = rax.u32;
+        const uint64_t rssInflated = residentSetSize();
+
+        // Run the deflate block
+        const TestRun deflateRun = runTest(vp, false);
+        vp.RegRead(Reg::RAX, rax);
+        const uint64_t deflatedPages = rax.u32;
+        const uint64_t rssDeflated = residentSetSize();
+
+        printf("Balloon inflated to %" PRIu64 " pages (%" PRIu64 " KiB), then deflated to %" PRIu64 " pages\n",
+            inflatedPages, inflatedPages * PAGE_SIZE / 1024, deflatedPages);
+        printf("  Host RSS: %" PRIu64 " KiB -> %" PRIu64 " KiB inflated -> %" PRIu64 " KiB deflated\n",
+            rssStart / 1024, rssInflated / 1024, rssDeflated / 1024);
+        const bool passed = inflatedPages == balloonTargetPages && deflatedPages == 0
+            && balloon.NumInflated() == balloonTargetPages && balloon.NumDeflated() == balloonTargetPages;
+        printf(passed ? "Balloon test complete\n" : "Balloon test failed\n");
+        report.Add("balloon", passed ? TestStatus::Passed : TestStatus::Failed, inflateRun.exits + deflateRun.exits, inflateRun.ns + deflateRun.ns);
+    }
+    printf("\n");
+
+    // ----- Page deduplication ---------------------------------------------------------------------------------------
+
+    // Identical guests share most of their RAM. With --merge, RAM is offered
+    // to KSM and zero pages are returned to the host.
+    {
+        const uint64_t rssStart = residentSetSize();
+        PageDedupScanner scanner;
+        auto stats = scanner.Scan(addressSpace, merge);
+        const uint64_t rssEnd = residentSetSize();
+
+        printf("Page deduplication scan%s:\n", merge ? " (reclaiming zero pages)" : "");
+        scanner.PrintStats(stdout, stats);
+        printf("  Host RSS: %" PRIu64 " KiB -> %" PRIu64 " KiB\n", rssStart / 1024, rssEnd / 1024);
+
+        // The guest left the pages it took back from the balloon filled with
+        // the same pattern, so all but the first of them are duplicates. Every
+        // zero page is reclaimed with --merge, and none without it.
+        const bool duplicatesFound = stats.duplicatePages >= balloonTargetPages - 1;
+        const bool reclaimed = stats.pagesReclaimed == (merge ? stats.zeroPages : 0);
+        if (!duplicatesFound) printf("Expected at least %" PRIu32 " duplicate pages\n", balloonTargetPages - 1);
+        if (!reclaimed) printf("Expected %" PRIu64 " reclaimed pages\n", merge ? stats.zeroPages : 0);
+        report.Add("dedup", (duplicatesFound && reclaimed) ? TestStatus::Passed : TestStatus::Failed, 0, stats.scanTimeNs);
+    }
+    printf("\n");
+
+    // ----- Crash test -----------------------------------------------------------------------------------------------
+
+    // Jump to an unmapped address to produce a page fault on instruction fetch
+    if (crashTest) {
+        printf("Crash test: jumping to an unmapped address\n");
+        RegValue rip;
+        rip.u64 = 0x0000400000000000;
+        vp.RegWrite(Reg::RIP, rip);
+        runToHLT(vp, false);
+        printf("\n");
     }
 
     // ----- End ------------------------------------------------------------------------------------------------------
 
+    console.Flush();
+    printf("Console: %" PRIu64 " bytes from the guest in %" PRIu64 " host writes\n\n", console.BytesSent(), console.NumHostWrites());
+
+    if (gdbStub != nullptr) {
+        printf("GDB: %" PRIu64 " packets served\n\n", gdbStub->NumPackets());
+        gdbStub->Detach(vp);
+        gdbStub = nullptr;
+    }
+
+    if (coveragePath != nullptr) {
+        coverage.Disarm(vp);
+        printf("Coverage: %zu of %zu basic blocks hit\n", coverage.NumHit(), coverage.NumBlocks());
+        if (coverageOutPath != nullptr && !coverage.Save(coverageOutPath)) {
+            printf("Failed to write coverage to %s\n", coverageOutPath);
+        }
+        printf("\n");
+    }
+
+    if (replayLog.GetMode() != ReplayLog::Mode::Off) {
+        const bool ok = replayLog.Finish();
+        printf("%s %" PRIu64 " events, %" PRIu64 " bytes\n", replayLog.Recording() ? "Recorded" : "Replayed",
+            replayLog.NumEvents(), replayLog.NumBytes());
+        if (!ok) {
+            printf("Replay log: %s\n", replayLog.Error().c_str());
+        }
+        printf("\n");
+    }
+
+    if (reportPath != nullptr && !report.Save(reportPath)) {
+        printf("Failed to write report to %s\n\n", reportPath);
+    }
+
+    if (cpuidSource != nullptr) {
+        printf("CPUID exits handled by the policy: %" PRIu64 "\n\n", cpuidPolicy.NumExits());
+    }
+
     printf("Final VCPU state:\n");
     printRegs(vp);
     printSTRegs(vp);
@@ -701,7 +1397,7 @@ int main(int argc, char* argv[]) {
 
     {
         uint64_t stackVal;
-        if (vp.LMemRead(0x200000 - 8, sizeof(uint64_t), &stackVal)) {
+        if (vp.LMemRead(stackTop - 8, sizeof(uint64_t), &stackVal)) {
             printf("Value written to stack: 0x%016" PRIx64 "\n", stackVal);
         }
         
@@ -720,6 +1416,12 @@ int main(int argc, char* argv[]) {
 
     // ----- Cleanup ----------------------------------------------------------------------------------------------------------
    
+    // Unmap guest memory while the VM still exists; the address space would
+    // otherwise do it on destruction, after the VM is gone
+    if (addressSpace.UnmapAll() == MemoryMappingStatus::OK) {
+        printf("Guest memory unmapped\n");
+    }
+
     // Free VM
     printf("Releasing VM... ");
     if (platform.FreeVM(vm)) {